@@ -0,0 +1,367 @@
+/*
+ * Allocator replay: feeds a trace recorded with system.alloc_trace_start()
+ * (or by bench_alloc_trace) through several allocator backends and reports
+ * throughput, peak footprint and fragmentation for each.
+ *
+ *   alloc_replay <trace> [backend...]
+ *
+ * A backend is a realloc-style function plus a footprint probe; add one to
+ * s_backends[] to evaluate a new policy on the same allocation stream.
+ */
+#include "lua_alloc_trace.h"
+#include "lua_slab.h"
+#include "lua_tlsf.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLAY_POOL_BYTES (256u * 1024 * 1024)
+#define REPLAY_SLAB_BUDGET (32u * 1024)
+#define FOOTPRINT_SAMPLE_MASK 4095
+
+typedef struct {
+    const char* name;
+    const char* description;
+    bool (*init)(void);
+    void* (*realloc)(void* ptr, size_t osize, size_t nsize, uint32_t tag);
+    size_t (*footprint)(void);      // Backing memory currently spanned
+    int (*fragmentation)(void);     // 0..100, or -1 if the backend can't tell
+    void (*fini)(void);
+} replay_backend_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// --- libc malloc, the closest host analogue of heap_caps ---
+
+static size_t s_libc_base = 0;
+
+static size_t libc_heap_size(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+}
+
+// The trace and the block map are malloc'd too; only count growth from here.
+// glibc reuses free space it already had, so this can undercount.
+static bool libc_init(void) {
+    s_libc_base = libc_heap_size();
+    return true;
+}
+
+static void* libc_realloc(void* ptr, size_t osize, size_t nsize, uint32_t tag) {
+    (void)osize;
+    (void)tag;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+static size_t libc_footprint(void) {
+    size_t size = libc_heap_size();
+    return size > s_libc_base ? size - s_libc_base : 0;
+}
+
+static int libc_fragmentation(void) {
+    return -1;
+}
+
+static void libc_fini(void) {
+}
+
+// --- TLSF pool, as used by CONFIG_LUA_TLSF_POOL ---
+
+static uint8_t* s_region = NULL;
+static lua_tlsf_t* s_pool = NULL;
+static size_t s_pool_high = 0;
+
+static bool tlsf_init(void) {
+    s_region = malloc(REPLAY_POOL_BYTES);
+    s_pool = s_region ? lua_tlsf_create(s_region, REPLAY_POOL_BYTES) : NULL;
+    s_pool_high = 0;
+    return s_pool != NULL;
+}
+
+static void* tlsf_realloc(void* ptr, size_t osize, size_t nsize, uint32_t tag) {
+    (void)osize;
+    (void)tag;
+    void* p = lua_tlsf_realloc(s_pool, ptr, nsize);
+    if (p != NULL) {
+        size_t end = (size_t)((uint8_t*)p - s_region) + nsize;
+        if (end > s_pool_high) s_pool_high = end;
+    }
+    return p;
+}
+
+static size_t tlsf_footprint(void) {
+    return s_pool_high;
+}
+
+static int tlsf_fragmentation(void) {
+    lua_tlsf_stats_t st;
+    lua_tlsf_get_stats(s_pool, &st);
+    return (int)st.fragmentation;
+}
+
+static void tlsf_fini(void) {
+    free(s_region);
+    s_region = NULL;
+    s_pool = NULL;
+}
+
+// --- Size-class slabs in front of the TLSF pool (CONFIG_LUA_SLAB_ALLOC) ---
+
+static bool slab_tlsf_init(void) {
+    return lua_slab_init(REPLAY_SLAB_BUDGET) && tlsf_init();
+}
+
+static void* slab_tlsf_realloc(void* ptr, size_t osize, size_t nsize, uint32_t tag) {
+    if (ptr != NULL && lua_slab_owns(ptr)) {
+        if (nsize == 0) {
+            lua_slab_free(ptr);
+            return NULL;
+        }
+        if (nsize <= lua_slab_block_size(ptr)) {
+            return ptr;
+        }
+        void* p = tlsf_realloc(NULL, 0, nsize, tag);
+        if (p != NULL) {
+            memcpy(p, ptr, osize);
+            lua_slab_free(ptr);
+        }
+        return p;
+    }
+    if (ptr == NULL) {
+        void* p = lua_slab_alloc(nsize);
+        if (p != NULL) {
+            return p;
+        }
+    }
+    return tlsf_realloc(ptr, osize, nsize, tag);
+}
+
+static size_t slab_tlsf_footprint(void) {
+    lua_slab_stats_t st;
+    lua_slab_get_stats(&st);
+    return (size_t)st.pages_used * LUA_SLAB_PAGE_SIZE + s_pool_high;
+}
+
+static const replay_backend_t s_backends[] = {
+    {"libc", "glibc malloc/realloc/free", libc_init, libc_realloc, libc_footprint, libc_fragmentation, libc_fini},
+    {"tlsf", "private TLSF pool", tlsf_init, tlsf_realloc, tlsf_footprint, tlsf_fragmentation, tlsf_fini},
+    {"slab", "slabs for <= 64 B, TLSF pool for the rest", slab_tlsf_init, slab_tlsf_realloc,
+     slab_tlsf_footprint, tlsf_fragmentation, tlsf_fini},
+};
+#define NUM_BACKENDS (sizeof(s_backends) / sizeof(s_backends[0]))
+
+// --- Trace block id -> replayed block ---
+
+typedef struct {
+    uint32_t id;
+    void* ptr;
+} block_slot_t;
+
+static block_slot_t* s_map = NULL;
+static uint32_t s_map_mask = 0;
+
+static uint32_t map_hash(uint32_t id) {
+    return (id >> 3) * 2654435761u;
+}
+
+static block_slot_t* map_find(uint32_t id) {
+    for (uint32_t i = map_hash(id) & s_map_mask;; i = (i + 1) & s_map_mask) {
+        if (s_map[i].id == id || s_map[i].id == 0) {
+            return &s_map[i];
+        }
+    }
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void map_remove(block_slot_t* slot) {
+    uint32_t i = (uint32_t)(slot - s_map);
+    for (uint32_t j = (i + 1) & s_map_mask; s_map[j].id != 0; j = (j + 1) & s_map_mask) {
+        uint32_t home = map_hash(s_map[j].id) & s_map_mask;
+        if (((j - home) & s_map_mask) >= ((j - i) & s_map_mask)) {
+            s_map[i] = s_map[j];
+            i = j;
+        }
+    }
+    s_map[i].id = 0;
+    s_map[i].ptr = NULL;
+}
+
+typedef struct {
+    double seconds;
+    uint64_t ops;
+    uint64_t failed;
+    size_t peak_live;
+    size_t peak_footprint;
+    int fragmentation;
+} replay_result_t;
+
+static bool replay(const replay_backend_t* be, const lua_alloc_trace_rec_t* recs, size_t count,
+                   replay_result_t* res) {
+    memset(res, 0, sizeof(*res));
+    memset(s_map, 0, sizeof(*s_map) * (s_map_mask + 1));
+    if (!be->init()) {
+        return false;
+    }
+
+    size_t live = 0;
+    double t0 = now_sec();
+    for (size_t i = 0; i < count; i++) {
+        const lua_alloc_trace_rec_t* r = &recs[i];
+        if (r->ptr == 0) {
+            if (r->nsize == 0 || r->result == 0) {
+                continue; // free(NULL) or an allocation that failed on the device
+            }
+            block_slot_t* slot = map_find(r->result);
+            void* p = be->realloc(NULL, 0, r->nsize, r->osize);
+            if (p == NULL) {
+                res->failed++;
+                continue;
+            }
+            slot->id = r->result;
+            slot->ptr = p;
+            live += r->nsize;
+        } else {
+            block_slot_t* slot = map_find(r->ptr);
+            if (slot->id == 0) {
+                continue; // Block allocated before the trace started
+            }
+            if (r->nsize > 0 && r->result == 0) {
+                continue; // Failed on the device, block left untouched
+            }
+            void* p = be->realloc(slot->ptr, r->osize, r->nsize, 0);
+            live -= r->osize;
+            map_remove(slot);
+            if (r->nsize > 0) {
+                if (p == NULL) {
+                    res->failed++;
+                    continue;
+                }
+                slot = map_find(r->result);
+                slot->id = r->result;
+                slot->ptr = p;
+                live += r->nsize;
+            }
+        }
+        res->ops++;
+        if (live > res->peak_live) res->peak_live = live;
+        if ((res->ops & FOOTPRINT_SAMPLE_MASK) == 0) {
+            size_t fp = be->footprint();
+            if (fp > res->peak_footprint) res->peak_footprint = fp;
+        }
+    }
+    res->seconds = now_sec() - t0;
+
+    size_t fp = be->footprint();
+    if (fp > res->peak_footprint) res->peak_footprint = fp;
+    res->fragmentation = be->fragmentation();
+
+    // Release what the trace left live so the next backend starts clean
+    for (uint32_t i = 0; i <= s_map_mask; i++) {
+        if (s_map[i].id != 0) {
+            be->realloc(s_map[i].ptr, 0, 0, 0);
+        }
+    }
+    be->fini();
+    return true;
+}
+
+static lua_alloc_trace_rec_t* load_trace(const char* path, size_t* count) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    lua_alloc_trace_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, LUA_ALLOC_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != LUA_ALLOC_TRACE_VERSION || hdr.rec_size != sizeof(lua_alloc_trace_rec_t)) {
+        fprintf(stderr, "%s: not a version %d allocation trace\n", path, LUA_ALLOC_TRACE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f) - (long)sizeof(hdr);
+    fseek(f, sizeof(hdr), SEEK_SET);
+    *count = (size_t)bytes / sizeof(lua_alloc_trace_rec_t);
+
+    lua_alloc_trace_rec_t* recs = malloc(*count * sizeof(*recs) + 1);
+    if (recs == NULL || fread(recs, sizeof(*recs), *count, f) != *count) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(recs);
+        recs = NULL;
+    }
+    fclose(f);
+    return recs;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [backend...]\nbackends:", argv[0]);
+        for (size_t b = 0; b < NUM_BACKENDS; b++) {
+            fprintf(stderr, " %s", s_backends[b].name);
+        }
+        fprintf(stderr, "\n");
+        return 2;
+    }
+
+    size_t count;
+    lua_alloc_trace_rec_t* recs = load_trace(argv[1], &count);
+    if (recs == NULL) {
+        return 1;
+    }
+
+    // Sized for the worst case of every record creating a block, at most half full
+    uint32_t slots = 1024;
+    while (slots < count * 2) slots <<= 1;
+    s_map = calloc(slots, sizeof(*s_map));
+    s_map_mask = slots - 1;
+
+    uint32_t span_us = count > 0 ? recs[count - 1].time_us - recs[0].time_us : 0;
+    printf("%s: %zu records over %.1f s\n", argv[1], count, span_us / 1e6);
+    printf("%-6s %10s %9s %12s %14s %9s %6s\n", "alloc", "Mops/s", "ns/op", "peak live", "peak footprint",
+           "overhead", "frag");
+
+    for (size_t b = 0; b < NUM_BACKENDS; b++) {
+        const replay_backend_t* be = &s_backends[b];
+        bool selected = argc == 2;
+        for (int a = 2; a < argc; a++) {
+            selected |= strcmp(argv[a], be->name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+
+        replay_result_t res;
+        if (!replay(be, recs, count, &res)) {
+            fprintf(stderr, "%s: backend init failed\n", be->name);
+            continue;
+        }
+        printf("%-6s %10.2f %9.1f %12zu %14zu %8.1f%% ", be->name, res.ops / res.seconds / 1e6,
+               res.seconds * 1e9 / (res.ops ? res.ops : 1), res.peak_live, res.peak_footprint,
+               res.peak_live ? 100.0 * res.peak_footprint / res.peak_live - 100.0 : 0.0);
+        if (res.fragmentation >= 0) {
+            printf("%5d%%", res.fragmentation);
+        } else {
+            printf("%6s", "-");
+        }
+        if (res.failed) {
+            printf("  (%llu failed)", (unsigned long long)res.failed);
+        }
+        printf("  %s\n", be->description);
+    }
+
+    free(s_map);
+    free(recs);
+    return 0;
+}
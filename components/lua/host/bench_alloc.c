@@ -0,0 +1,143 @@
+/*
+ * Allocator benchmark: runs a UI-like churn workload (short strings, small
+ * tables, closures) on a state created by lua_newstate_psram() and reports
+ * the allocation rate, GC cycles and slab occupancy.
+ *
+ *   bench_alloc_<variant> [iterations] [trace file]
+ *
+ * The trace file argument needs a build with CONFIG_LUA_ALLOC_TRACE=1 and
+ * produces input for alloc_replay.
+ */
+#include "lua_psram_alloc.h"
+#include "lua_alloc_trace.h"
+#include "lua_slab.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static lua_Alloc s_inner_alloc;
+static void* s_inner_ud;
+static unsigned long s_alloc_calls;
+
+static void* counting_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    (void)ud;
+    s_alloc_calls++;
+    return s_inner_alloc(s_inner_ud, ptr, osize, nsize);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Starts with a burst of short strings, like a config file parsed at boot
+// and dropped; then each iteration mimics one UI refresh: label text, a
+// style table, a handler closure
+static const char* s_workload =
+    "local iterations = ...\n"
+    "local boot = {}\n"
+    "for i = 1, 2000 do boot[i] = 'cfg' .. i end\n"
+    "boot = nil\n"
+    "collectgarbage()\n"
+    "local cycles = 0\n"
+    "local function sentinel()\n"
+    "  setmetatable({}, {__gc = function() cycles = cycles + 1; sentinel() end})\n"
+    "end\n"
+    "sentinel()\n"
+    "local keep = {}\n"
+    "for i = 1, iterations do\n"
+    "  local text = 'RSSI ' .. (i % 97) .. ' dBm'\n"
+    "  local style = {x = i, y = i + 1, w = 40, h = 20}\n"
+    "  local handler = function(e) return text, style.x + e end\n"
+    "  local blob = string.rep('#', (i * 37) % 1500)\n"
+    "  keep[i % 64 + 1] = {text, style, handler, blob}\n"
+    "end\n"
+    "return cycles\n";
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500000;
+    const char* trace_path = argc > 2 ? argv[2] : NULL;
+
+    lua_State* L = lua_newstate_psram();
+    if (L == NULL) {
+        fprintf(stderr, "failed to create Lua state\n");
+        return 1;
+    }
+    s_inner_alloc = lua_getallocf(L, &s_inner_ud);
+    lua_setallocf(L, counting_alloc, NULL);
+    if (trace_path != NULL && !lua_alloc_trace_start(trace_path)) {
+        fprintf(stderr, "failed to start trace %s\n", trace_path);
+        return 1;
+    }
+    luaL_openlibs(L);
+
+    if (luaL_loadstring(L, s_workload) != LUA_OK) {
+        fprintf(stderr, "load failed: %s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    lua_pushinteger(L, iterations);
+
+    unsigned long calls_before = s_alloc_calls;
+    double t0 = now_sec();
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+        fprintf(stderr, "run failed: %s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    double elapsed = now_sec() - t0;
+    unsigned long calls = s_alloc_calls - calls_before;
+    long long cycles = lua_tointeger(L, -1);
+
+    printf("%-6s %d iterations in %.3f s\n", BENCH_VARIANT, iterations, elapsed);
+    printf("  allocator calls: %lu (%.2f M/s)\n", calls, calls / elapsed / 1e6);
+    printf("  GC cycles: %lld (%.1f /s)\n", cycles, cycles / elapsed);
+
+    lua_memory_stats_t mem;
+    lua_get_memory_snapshot(&mem);
+    printf("  peak Lua heap: %zu bytes\n", mem.peak_total);
+
+#if CONFIG_LUA_TLSF_POOL
+    lua_tlsf_stats_t pool;
+    if (lua_get_pool_stats(&pool)) {
+        printf("  pool: %zu used in %u blocks, %zu free in %u blocks\n", pool.used_bytes,
+               (unsigned)pool.used_blocks, pool.free_bytes, (unsigned)pool.free_blocks);
+        printf("  pool largest free: %zu, fragmentation %u%%\n", pool.largest_free, (unsigned)pool.fragmentation);
+    }
+#endif
+
+#if CONFIG_LUA_ALLOC_TAGGING
+    lua_alloc_tag_stats_t tags[LUA_ALLOC_TAG_COUNT];
+    lua_get_tag_stats(tags);
+    printf("  live heap by type:\n");
+    for (int i = 0; i < LUA_ALLOC_TAG_COUNT; i++) {
+        printf("    %-9s %8zu bytes in %u blocks\n", lua_alloc_tag_name(i),
+               tags[i].live_bytes, (unsigned)tags[i].live_count);
+    }
+#endif
+
+#if CONFIG_LUA_SLAB_ALLOC
+    lua_slab_stats_t slab;
+    lua_slab_get_stats(&slab);
+    printf("  slab pages: %u/%u, %u given back\n", (unsigned)slab.pages_used, (unsigned)slab.pages_total,
+           (unsigned)slab.pages_released);
+    for (int i = 0; i < LUA_SLAB_NUM_CLASSES; i++) {
+        const lua_slab_class_stats_t* c = &slab.classes[i];
+        unsigned long requests = (unsigned long)c->allocs + c->misses;
+        printf("    %2zu B: %2u pages, %u used, %u free, %u served, %u misses (%.1f%% served)\n", c->block_size,
+               (unsigned)c->pages, (unsigned)c->blocks_used, (unsigned)c->blocks_free, (unsigned)c->allocs,
+               (unsigned)c->misses, requests ? 100.0 * c->allocs / requests : 0.0);
+    }
+#endif
+
+    lua_close(L);
+    if (trace_path != NULL) {
+        uint32_t recorded, dropped;
+        lua_alloc_trace_stop();
+        lua_alloc_trace_get_stats(&recorded, &dropped);
+        printf("  trace: %u records, %u dropped -> %s\n", (unsigned)recorded, (unsigned)dropped, trace_path);
+    }
+    return 0;
+}
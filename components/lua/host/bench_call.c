@@ -0,0 +1,172 @@
+/*
+ * Call benchmark: calls a small Lua hook from C the ways the engine offers
+ * and reports calls per second.
+ *
+ *   by name     lua_engine_call_function(), a global lookup per call
+ *   handle      lua_engine_call_begin(), lua_pushinteger(), lua_engine_call_end()
+ *   callf       lua_engine_callf() with an argument format string
+ *   raw         lua_rawgeti() and lua_pcall() without a message handler,
+ *               the floor for any call from C
+ *
+ * Then times a handler that computes for a while, and with
+ * CONFIG_LUA_CALL_BUDGET_MS checks that a runaway handler is aborted and a
+ * long coroutine is spread over frames. bench_call_nobudget is the same
+ * without the budget.
+ */
+#include "lua_engine.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* s_app =
+    "frames, total = 0, 0\n"
+    "function on_frame(dt, n) frames = frames + 1 total = total + dt + n end\n"
+    "app = {on_frame = on_frame}\n";
+
+static void report(const char* name, int calls, double t) {
+    printf("  %-10s %10.0f calls/s  (%.0f ns/call)\n", name, calls / t, t * 1e9 / calls);
+}
+
+static void check_frames(lua_State* L, long long expected) {
+    lua_getglobal(L, "frames");
+    long long frames = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (frames != expected || lua_gettop(L) != 0) {
+        fprintf(stderr, "expected %lld calls and an empty stack, got %lld and %d slots\n", expected, frames,
+                lua_gettop(L));
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    int calls = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    if (luaL_dostring(L, s_app) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    lua_engine_fn_t fn = lua_engine_ref_function(L, "app.on_frame");
+    if (fn == LUA_ENGINE_NOFN || lua_engine_ref_function(L, "app.missing") != LUA_ENGINE_NOFN) {
+        fprintf(stderr, "resolving app.on_frame failed\n");
+        return 1;
+    }
+    long long expected = 0;
+
+    printf("%d calls of a Lua hook taking two arguments\n", calls);
+
+    double t0 = now_sec();
+    for (int i = 0; i < calls; i++) {
+        lua_pushinteger(L, 16);
+        lua_pushinteger(L, i);
+        lua_engine_call_function(L, "on_frame", 2, 0);
+    }
+    report("by name", calls, now_sec() - t0);
+    check_frames(L, expected += calls);
+
+    t0 = now_sec();
+    for (int i = 0; i < calls; i++) {
+        lua_engine_call_begin(L, fn);
+        lua_pushinteger(L, 16);
+        lua_pushinteger(L, i);
+        lua_engine_call_end(L, 2, 0);
+    }
+    report("handle", calls, now_sec() - t0);
+    check_frames(L, expected += calls);
+
+    t0 = now_sec();
+    for (int i = 0; i < calls; i++) {
+        lua_engine_callf(L, fn, "ii", 16, i);
+    }
+    report("callf", calls, now_sec() - t0);
+    check_frames(L, expected += calls);
+
+    t0 = now_sec();
+    for (int i = 0; i < calls; i++) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, fn);
+        lua_pushinteger(L, 16);
+        lua_pushinteger(L, i);
+        lua_pcall(L, 2, 0, 0);
+    }
+    report("raw", calls, now_sec() - t0);
+    check_frames(L, expected += calls);
+
+    // Errors come back with a traceback and leave the stack as it was
+    if (luaL_dostring(L, "function app.on_frame() error('boom') end") != LUA_OK) {
+        return 1;
+    }
+    lua_engine_fn_t failing = lua_engine_ref_function(L, "app.on_frame");
+    uint32_t total, errors;
+    if (lua_engine_callf(L, failing, "") == LUA_OK || lua_gettop(L) != 0) {
+        fprintf(stderr, "error call did not fail cleanly\n");
+        return 1;
+    }
+    lua_engine_get_call_stats(&total, &errors);
+    printf("  %u calls through the engine, %u failed\n", (unsigned)total, (unsigned)errors);
+
+    // A handler that computes: a debug hook would slow down every instruction
+    if (luaL_dostring(L, "function compute() local s = 0 for i = 1, 2000000 do s = s + i % 7 end return s end") !=
+        LUA_OK) {
+        return 1;
+    }
+    lua_engine_fn_t compute = lua_engine_ref_function(L, "compute");
+    t0 = now_sec();
+    for (int i = 0; i < 10; i++) {
+        lua_engine_callf(L, compute, "");
+    }
+    printf("  compute    %10.2f ms/call  (budget %d ms)\n", (now_sec() - t0) * 100, CONFIG_LUA_CALL_BUDGET_MS);
+
+#if CONFIG_LUA_CALL_BUDGET_MS
+    if (luaL_dostring(L, "function runaway() while true do end end\n"
+                         "function long(ms) local t = os.clock() while os.clock() - t < ms / 1000 do end end") !=
+        LUA_OK) {
+        return 1;
+    }
+    lua_engine_fn_t runaway = lua_engine_ref_function(L, "runaway");
+    t0 = now_sec();
+    if (lua_engine_callf(L, runaway, "") == LUA_OK || lua_gettop(L) != 0) {
+        fprintf(stderr, "runaway handler was not aborted cleanly\n");
+        return 1;
+    }
+    printf("  runaway handler aborted after %.0f ms\n", (now_sec() - t0) * 1e3);
+
+    // A coroutine working for 4 budgets is suspended 4 times
+    lua_State* co = lua_newthread(L);
+    lua_getglobal(co, "long");
+    lua_pushinteger(co, CONFIG_LUA_CALL_BUDGET_MS * 4);
+    t0 = now_sec();
+    if (lua_engine_resume(co, L, 1) != LUA_YIELD) {
+        fprintf(stderr, "long coroutine was not suspended\n");
+        return 1;
+    }
+    lua_pop(L, 1);
+    int frames = 0;
+    while (lua_engine_run_suspended(L) > 0) {
+        frames++;
+    }
+    lua_engine_budget_stats_t budget;
+    lua_engine_get_budget_stats(&budget);
+    printf("  long coroutine finished after %d more frames, %.0f ms\n", frames + 1, (now_sec() - t0) * 1e3);
+    printf("  %u overruns in %u handlers: %u aborted, %u suspensions\n", (unsigned)budget.overruns,
+           (unsigned)budget.handlers, (unsigned)budget.aborted, (unsigned)budget.suspended);
+    if (budget.handlers != 2 || budget.aborted != 1 || budget.pending != 0 || lua_gettop(L) != 0) {
+        fprintf(stderr, "unexpected budget stats\n");
+        return 1;
+    }
+    lua_engine_unref_function(L, runaway);
+#endif
+
+    lua_engine_unref_function(L, compute);
+    lua_engine_unref_function(L, fn);
+    lua_engine_unref_function(L, failing);
+    lua_close(L);
+    return 0;
+}
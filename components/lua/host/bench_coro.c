@@ -0,0 +1,138 @@
+/*
+ * Coroutine pool benchmark: TIMERS Lua timers at 100 Hz, each tick run the
+ * way system_bindings.c runs a timer callback, in a coroutine resumed with
+ * lua_engine_resume(). SECONDS of ticks are dispatched back to back, and
+ * reported per second of ticks:
+ *
+ *   new        lua_newthread() per callback, as before the pool
+ *   pool       borrowed from lua_coro_pool.c and given back
+ *   closethread  the same, but every thread reset with lua_closethread()
+ *              before going back, which shrinks its stack each time
+ *
+ * Allocations are the allocator calls that allocate or resize a block; GC
+ * cycles are counted by a finalizer that re-arms itself.
+ */
+#include "lua_engine.h"
+#include "lua_coro_pool.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TIMERS          20
+#define TICK_HZ         100
+#define SECONDS         10
+
+typedef enum {
+    MODE_NEW,
+    MODE_POOL,
+    MODE_CLOSETHREAD,
+} bench_mode_t;
+
+// Callbacks of the size a screen's timers have: a few calls deep, one with
+// enough arguments to grow a fresh coroutine's stack
+static const char* s_app =
+    "gc_cycles = 0\n"
+    "local function sentinel() setmetatable({}, {__gc = function() gc_cycles = gc_cycles + 1 sentinel() end}) end\n"
+    "sentinel()\n"
+    "local labels = {}\n"
+    "local function set_text(id, ...) labels[id] = select('#', ...) end\n"
+    "function make_timer(id)\n"
+    "  local ticks = 0\n"
+    "  return function()\n"
+    "    ticks = ticks + 1\n"
+    "    set_text(id, ticks, ticks * 2, ticks * 3, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,\n"
+    "             16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36)\n"
+    "  end\n"
+    "end\n";
+
+static int s_refs[TIMERS];
+
+static void run_timer(lua_State* L, int ref, bench_mode_t mode) {
+    lua_State* co = mode == MODE_NEW ? lua_newthread(L) : lua_coro_pool_take(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lua_xmove(L, co, 1);
+    int status = lua_engine_resume(co, L, 0);
+    if (mode == MODE_NEW) {
+        lua_pop(L, 1);
+        return;
+    }
+    if (mode == MODE_CLOSETHREAD && status == LUA_OK) {
+        lua_closethread(co, L);
+    }
+    lua_coro_pool_give(L, co, status);
+}
+
+static lua_State* new_app_state(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    lua_coro_pool_init(L);
+    if (luaL_dostring(L, s_app) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    for (int t = 0; t < TIMERS; t++) {
+        lua_getglobal(L, "make_timer");
+        lua_pushinteger(L, t);
+        lua_call(L, 1, 1);
+        s_refs[t] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return L;
+}
+
+static lua_Integer gc_cycles(lua_State* L) {
+    lua_getglobal(L, "gc_cycles");
+    lua_Integer n = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return n;
+}
+
+static int run(const char* name, bench_mode_t mode) {
+    lua_State* L = new_app_state();
+    lua_gc(L, LUA_GCCOLLECT);
+    lua_memory_stats_t before, after;
+    lua_get_memory_snapshot(&before);
+    lua_Integer cycles = gc_cycles(L);
+    uint32_t calls_before, errors_before, calls, errors;
+    lua_engine_get_call_stats(&calls_before, &errors_before);
+
+    int64_t start_us = esp_timer_get_time();
+    for (int tick = 0; tick < SECONDS * TICK_HZ; tick++) {
+        for (int t = 0; t < TIMERS; t++) {
+            run_timer(L, s_refs[t], mode);
+        }
+    }
+    int64_t us = esp_timer_get_time() - start_us;
+
+    lua_get_memory_snapshot(&after);
+    cycles = gc_cycles(L) - cycles;
+    lua_engine_get_call_stats(&calls, &errors);
+    uint32_t allocs = (after.alloc_count - before.alloc_count) + (after.realloc_count - before.realloc_count);
+    int callbacks = SECONDS * TICK_HZ * TIMERS;
+    printf("  %-11s %6.2f us/callback  %7.0f allocations/s  %5.1f GC cycles/s\n", name, (double)us / callbacks,
+           (double)allocs / SECONDS, (double)cycles / SECONDS);
+    lua_close(L);
+    return errors != errors_before || calls - calls_before != (uint32_t)callbacks;
+}
+
+int main(void) {
+    printf("%d timers at %d Hz, %d s of ticks; pool of %d coroutines\n", TIMERS, TICK_HZ, SECONDS,
+           CONFIG_LUA_CORO_POOL_SIZE);
+    int failed = 0;
+    failed |= run("new", MODE_NEW);
+    failed |= run("pool", MODE_POOL);
+    failed |= run("closethread", MODE_CLOSETHREAD);
+
+    lua_coro_pool_stats_t stats;
+    lua_coro_pool_get_stats(&stats);
+    printf("  pool runs: %u taken, %u created, %u idle of %u\n", (unsigned)stats.taken, (unsigned)stats.created,
+           (unsigned)stats.idle, (unsigned)stats.size);
+    failed |= stats.idle != stats.size;
+    if (failed) {
+        fprintf(stderr, "coroutine checks failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Event loop benchmark: three producer threads stand in for the esp_timer
+ * task, the WiFi task and an interrupt handler, each posting events at a
+ * steady rate plus, every 500 ms, a burst (a scan's worth of results). A
+ * 100 Hz GUI loop renders for 2 ms a frame, then drains the queue into a
+ * Lua handler that computes for about 200 us per event. Reports the frame
+ * time, the latency from posting to the handler starting and the queue
+ * depth with
+ *
+ *   budget   lua_event_loop_drain() with CONFIG_LUA_EVENT_BUDGET_US
+ *   all      the whole queue drained every frame
+ *
+ * The checks make sure every producer's events run in the order it posted
+ * them and none is lost but the ones counted as dropped.
+ */
+#include "lua_engine.h"
+#include "lua_event_loop.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdkconfig.h"
+#include "freertos/task.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAMES          300
+#define FRAME_WAIT_MS   10
+#define RENDER_US       2000
+#define PRODUCERS       3
+#define POST_EVERY_US   4000
+#define BURST_EVERY     125         // Posts between bursts
+#define BURST_SIZE      16
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} bench_event_t;
+
+static volatile bool s_stop = false;
+static uint32_t s_posted[PRODUCERS];
+static uint32_t s_next_seq[PRODUCERS];     // Next sequence number each producer's handler expects
+static uint32_t s_refused = 0;
+static int s_out_of_order = 0;
+static uint32_t s_handled = 0;
+static lua_engine_fn_t s_on_event = LUA_ENGINE_NOFN;
+static int64_t s_frames[FRAMES];
+
+static const char* s_app =
+    "local total = 0\n"
+    "function on_event(producer, seq)\n"
+    "  local t = {}\n"
+    "  for i = 1, 10000 do t[i % 16 + 1] = i * producer + seq end\n"
+    "  total = total + #t\n"
+    "end\n";
+
+static void handle_event(lua_State* L, void* payload) {
+    bench_event_t event;
+    memcpy(&event, payload, sizeof(event));
+    // A dropped event leaves a gap; one arriving early or twice is a bug
+    if (event.seq < s_next_seq[event.producer]) {
+        s_out_of_order++;
+    }
+    s_next_seq[event.producer] = event.seq + 1;
+    s_handled++;
+    lua_engine_callf(L, s_on_event, "ii", (int)event.producer, (int)event.seq);
+}
+
+static void* producer_thread(void* arg) {
+    uint32_t producer = (uint32_t)(uintptr_t)arg;
+    uint32_t seq = s_posted[producer];  // Carries on from the last run
+    while (!s_stop) {
+        int n = seq % BURST_EVERY == 0 ? BURST_SIZE : 1;
+        for (int i = 0; i < n; i++) {
+            bench_event_t event = {producer, seq++};
+            bool ok;
+            if (producer == PRODUCERS - 1) {
+                BaseType_t woken = pdFALSE;
+                ok = lua_event_loop_post_from_isr(handle_event, &event, sizeof(event), &woken);
+            } else {
+                ok = lua_event_loop_post(handle_event, &event, sizeof(event));
+            }
+            if (!ok) {
+                __atomic_add_fetch(&s_refused, 1, __ATOMIC_RELAXED);
+            }
+        }
+        s_posted[producer] = seq;
+        struct timespec ts = {0, POST_EVERY_US * 1000L};
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+static void spin_us(int64_t us) {
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+static int compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void run(lua_State* L, const char* name, uint32_t budget_us) {
+    lua_event_loop_stats_t before, after;
+    lua_event_loop_get_stats(&before);
+    s_stop = false;
+    pthread_t threads[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_create(&threads[p], NULL, producer_thread, (void*)(uintptr_t)p);
+    }
+
+    for (int f = 0; f < FRAMES; f++) {
+        vTaskDelay(pdMS_TO_TICKS(FRAME_WAIT_MS));
+        int64_t frame_start_us = esp_timer_get_time();
+        spin_us(RENDER_US); // lv_timer_handler()
+        lua_event_loop_drain(L, budget_us);
+        s_frames[f] = esp_timer_get_time() - frame_start_us;
+    }
+
+    s_stop = true;
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(threads[p], NULL);
+    }
+    lua_event_loop_get_stats(&after);
+    uint32_t left = after.depth;
+    while (lua_event_loop_drain(L, budget_us) > 0) {
+    }
+
+    qsort(s_frames, FRAMES, sizeof(s_frames[0]), compare_i64);
+    printf("  %-6s frame p50 %5.2f ms  p99 %5.2f ms  max %5.2f ms   latency avg %5.2f ms  max %5.2f ms\n"
+           "         %u events, queue high water %u, %u left at the end, %u dropped, %u drains over budget\n",
+           name, s_frames[FRAMES / 2] / 1e3, s_frames[FRAMES * 99 / 100] / 1e3, s_frames[FRAMES - 1] / 1e3,
+           after.latency_us_avg / 1e3, after.latency_us_max / 1e3, (unsigned)(after.handled - before.handled),
+           (unsigned)after.depth_high_water, (unsigned)left, (unsigned)(after.dropped - before.dropped),
+           (unsigned)(after.deferred - before.deferred));
+}
+
+int main(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    if (luaL_dostring(L, s_app) != LUA_OK || !lua_event_loop_init()) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    s_on_event = lua_engine_ref_function(L, "on_event");
+    printf("%d frames: %d ms wait + %d us render; %d producers posting every %d ms, bursts of %d\n", FRAMES,
+           FRAME_WAIT_MS, RENDER_US, PRODUCERS, POST_EVERY_US / 1000, BURST_SIZE);
+
+    run(L, "budget", CONFIG_LUA_EVENT_BUDGET_US);
+    run(L, "all", UINT32_MAX);
+
+    // A full queue refuses the rest and counts them
+    uint32_t capacity = 0;
+    bench_event_t event = {0, s_posted[0]};
+    while (lua_event_loop_post(handle_event, &event, sizeof(event))) {
+        event.seq++;
+        capacity++;
+    }
+    s_refused++;
+    s_posted[0] = event.seq + 1;
+    lua_event_loop_drain(L, UINT32_MAX);
+
+    lua_event_loop_stats_t stats;
+    lua_event_loop_get_stats(&stats);
+    uint32_t posted = 0;
+    for (int p = 0; p < PRODUCERS; p++) {
+        posted += s_posted[p];
+    }
+    printf("  queue of %u; %u posted, %u run, %u refused\n", (unsigned)capacity, (unsigned)stats.posted,
+           (unsigned)stats.handled, (unsigned)stats.dropped);
+    lua_close(L);
+
+    if (s_out_of_order != 0 || stats.handled != s_handled || stats.posted != s_handled ||
+        stats.posted + stats.dropped != posted || stats.dropped != s_refused || stats.depth != 0 ||
+        capacity != CONFIG_LUA_EVENT_QUEUE_LEN) {
+        fprintf(stderr, "event checks failed: %d out of order, %u of %u run\n", s_out_of_order,
+                (unsigned)s_handled, (unsigned)posted);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * State image benchmark: brings up the same app state three ways and
+ * compares the time and heap each takes.
+ *
+ *   cold      compile every module from source and run it
+ *   bytecode  load every module from precompiled chunks and run it
+ *   image     restore a state image saved after the cold start
+ *
+ * Each restored state is checked against the cold one by calling every
+ * module function, so a bad image fails the run instead of the timing.
+ */
+#include "lua_psram_alloc.h"
+#include "lua_state_image.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODULE_FUNCS 40
+#define ROUNDS 5
+#define SOURCES_HASH 0x5eed
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} bench_buf_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int buf_writer(lua_State* L, const void* p, size_t size, void* ud) {
+    (void)L;
+    bench_buf_t* buf = (bench_buf_t*)ud;
+    if (buf->size + size > buf->capacity) {
+        buf->capacity = (buf->size + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->size, p, size);
+    buf->size += size;
+    return 0;
+}
+
+// Same module shape as bench_load, plus state the image has to keep:
+// a counter shared by two closures and a table pointing back at the module
+static char* make_module(int id, size_t* len) {
+    size_t cap = 64 * 1024, n = 0;
+    char* src = malloc(cap);
+    n += snprintf(src + n, cap - n,
+                  "local M = {name = 'app%d', styles = {}}\n"
+                  "local count = 0\n"
+                  "function M.inc() count = count + 1 return count end\n"
+                  "function M.get() return count end\n"
+                  "M.styles.owner = M\n", id);
+    for (int f = 0; f < MODULE_FUNCS; f++) {
+        if (cap - n < 512) {
+            cap *= 2;
+            src = realloc(src, cap);
+        }
+        n += snprintf(src + n, cap - n,
+                      "M.styles[%d] = {x = %d, y = %d, text = ('label %d'):upper()}\n"
+                      "function M.f%d(a, b)\n"
+                      "  local style = M.styles[%d]\n"
+                      "  local total = 0\n"
+                      "  for i = 1, 3 do total = total + i * %d end\n"
+                      "  local cb = function(e) return style.x + e + total end\n"
+                      "  return cb(a) + b + #style.text + math.floor(count)\n"
+                      "end\n", f, f, f * 3, f, f, f, f);
+    }
+    n += snprintf(src + n, cap - n, "return M\n");
+    *len = n;
+    return src;
+}
+
+// A library opened after the baseline whose function is a C closure
+static int counter_next(lua_State* L) {
+    lua_Integer n = lua_tointeger(L, lua_upvalueindex(1)) + 1;
+    lua_pushinteger(L, n);
+    lua_replace(L, lua_upvalueindex(1));
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+static int open_counter(lua_State* L) {
+    lua_newtable(L);
+    lua_pushinteger(L, 0);
+    lua_pushcclosure(L, counter_next, 1);
+    lua_setfield(L, -2, "next");
+    lua_state_image_add_lib(L, "counter", -1);
+    return 1;
+}
+
+static lua_State* new_state(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushcfunction(L, open_counter);
+    lua_setfield(L, -2, "counter");
+    lua_pop(L, 1);
+    lua_state_image_mark_baseline(L);
+    return L;
+}
+
+static void run_modules(lua_State* L, char** chunks, size_t* sizes, int modules, const char* mode) {
+    for (int i = 0; i < modules; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "app.m%d", i);
+        if (luaL_loadbufferx(L, chunks[i], sizes[i], name, mode) != LUA_OK) {
+            fprintf(stderr, "module %d: %s\n", i, lua_tostring(L, -1));
+            exit(1);
+        }
+        lua_call(L, 0, 1);
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+        lua_pushvalue(L, -2);
+        lua_setfield(L, -2, name);
+        lua_pop(L, 2);
+    }
+    if (luaL_dostring(L, "app = {counter = require('counter'), started = os.time ~= nil}\n"
+                         "app.counter.next()\n"
+                         "function app.start() return app.counter.next() end") != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+static long long checksum(lua_State* L, int modules) {
+    long long sum = 0;
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    for (int i = 0; i < modules; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "app.m%d", i);
+        lua_getfield(L, -1, name);
+        lua_getfield(L, -1, "inc");
+        lua_call(L, 0, 0);
+        for (int f = 0; f < MODULE_FUNCS; f++) {
+            snprintf(name, sizeof(name), "f%d", f);
+            lua_getfield(L, -1, name);
+            lua_pushinteger(L, i);
+            lua_pushinteger(L, f);
+            lua_call(L, 2, 1);
+            sum += lua_tointeger(L, -1);
+            lua_pop(L, 1);
+        }
+        lua_getfield(L, -1, "get");
+        lua_call(L, 0, 1);
+        sum += lua_tointeger(L, -1) * 1000;
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+    if (luaL_dostring(L, "return app.counter.next() + #('x'):rep(3)") != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    sum += lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return sum;
+}
+
+static size_t heap_now(lua_State* L) {
+    lua_gc(L, LUA_GCCOLLECT);
+    lua_memory_stats_t mem;
+    lua_get_memory_snapshot(&mem);
+    return mem.total_allocated;
+}
+
+int main(int argc, char** argv) {
+    int modules = argc > 1 ? atoi(argv[1]) : 20;
+
+    char** sources = malloc(modules * sizeof(char*));
+    size_t* source_sizes = malloc(modules * sizeof(size_t));
+    char** chunks = malloc(modules * sizeof(char*));
+    size_t* chunk_sizes = malloc(modules * sizeof(size_t));
+    lua_State* L = new_state();
+    for (int i = 0; i < modules; i++) {
+        sources[i] = make_module(i, &source_sizes[i]);
+        bench_buf_t buf = {0};
+        luaL_loadbuffer(L, sources[i], source_sizes[i], "=app");
+        lua_dump(L, buf_writer, &buf, 0);
+        lua_pop(L, 1);
+        chunks[i] = buf.data;
+        chunk_sizes[i] = buf.size;
+    }
+    lua_close(L);
+
+    double cold = 1e9, bytecode = 1e9, image = 1e9;
+    size_t cold_heap = 0, image_heap = 0;
+    long long cold_sum = 0, image_sum = 0;
+    bench_buf_t img = {0};
+    for (int round = 0; round < ROUNDS; round++) {
+        double t0 = now_sec();
+        L = new_state();
+        run_modules(L, sources, source_sizes, modules, "t");
+        double t = now_sec() - t0;
+        cold = t < cold ? t : cold;
+        if (round == 0) {
+            img.size = 0;
+            lua_getglobal(L, "app");
+            lua_getfield(L, -1, "start");
+            if (lua_state_image_dump(L, -1, SOURCES_HASH, buf_writer, &img, false) != LUA_OK) {
+                fprintf(stderr, "save failed: %s\n", lua_tostring(L, -1));
+                return 1;
+            }
+            lua_pop(L, 2);
+
+            // Objects created after startup are refused rather than lost
+            (void)luaL_dostring(L, "app.co = coroutine.create(print)");
+            bench_buf_t bad = {0};
+            if (lua_state_image_dump(L, 0, 0, buf_writer, &bad, false) == LUA_OK) {
+                fprintf(stderr, "saving a coroutine did not fail\n");
+                return 1;
+            }
+            printf("saving a coroutine fails: %s\n", lua_tostring(L, -1));
+            lua_pop(L, 1);
+            free(bad.data);
+            (void)luaL_dostring(L, "app.co = nil");
+            cold_heap = heap_now(L);
+            (void)luaL_dostring(L, "app.start()"); // What the restore runs as the entry
+            cold_sum = checksum(L, modules);
+        }
+        lua_close(L);
+
+        t0 = now_sec();
+        L = new_state();
+        run_modules(L, chunks, chunk_sizes, modules, "b");
+        t = now_sec() - t0;
+        bytecode = t < bytecode ? t : bytecode;
+        lua_close(L);
+
+        t0 = now_sec();
+        L = new_state();
+        if (lua_state_image_undump(L, img.data, img.size, SOURCES_HASH) != LUA_OK) {
+            fprintf(stderr, "restore failed: %s\n", lua_tostring(L, -1));
+            return 1;
+        }
+        t = now_sec() - t0;
+        image = t < image ? t : image;
+        if (round == 0) {
+            // The entry is app.start, which advances the restored counter
+            lua_call(L, 0, 1);
+            if (lua_tointeger(L, -1) != 2) {
+                fprintf(stderr, "entry returned %lld, expected 2\n", (long long)lua_tointeger(L, -1));
+                return 1;
+            }
+            lua_pop(L, 1);
+            if (luaL_dostring(L, "assert(require('counter') == app.counter)") != LUA_OK) {
+                fprintf(stderr, "%s\n", lua_tostring(L, -1));
+                return 1;
+            }
+            image_heap = heap_now(L);
+            image_sum = checksum(L, modules);
+        } else {
+            lua_pop(L, 1);
+        }
+        lua_close(L);
+    }
+
+    // An image saved from other app files is refused before it touches the state
+    L = new_state();
+    if (lua_state_image_undump(L, img.data, img.size, SOURCES_HASH + 1) != LUA_ERRSYNTAX) {
+        fprintf(stderr, "image with other sources was restored\n");
+        return 1;
+    }
+    printf("restoring after the sources changed fails: %s\n", lua_tostring(L, -1));
+    lua_close(L);
+
+    if (image_sum != cold_sum) {
+        fprintf(stderr, "restored state differs: checksum %lld, cold %lld\n", image_sum, cold_sum);
+        return 1;
+    }
+    printf("%d modules, best of %d, checksum %lld\n", modules, ROUNDS, cold_sum);
+    printf("  cold (source):   %8.2f ms, heap %zu bytes\n", cold * 1000, cold_heap);
+    printf("  cold (bytecode): %8.2f ms\n", bytecode * 1000);
+    printf("  image restore:   %8.2f ms, heap %zu bytes, image %zu bytes\n", image * 1000, image_heap, img.size);
+    return 0;
+}
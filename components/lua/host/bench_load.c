@@ -0,0 +1,146 @@
+/*
+ * Load benchmark: compiles a set of generated app-sized chunks the way the
+ * engine loads apps from the SD card, keeping every loaded function alive
+ * while UI-like objects churn in between. Reports load time, peak Lua heap
+ * and what the private pool looks like afterwards.
+ */
+#include "lua_psram_alloc.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODULE_FUNCS 40
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One screen-sized module: many small functions with locals, constants and
+// nested closures, similar in shape to the apps on the SD card
+static char* make_module(int id, size_t* len) {
+    size_t cap = 64 * 1024, n = 0;
+    char* src = malloc(cap);
+    n += snprintf(src + n, cap - n, "local M = {name = 'app%d'}\n", id);
+    for (int f = 0; f < MODULE_FUNCS; f++) {
+        if (cap - n < 512) {
+            cap *= 2;
+            src = realloc(src, cap);
+        }
+        n += snprintf(src + n, cap - n,
+                      "function M.f%d(a, b)\n"
+                      "  local style = {x = a, y = b, w = %d, h = 20, text = 'label %d'}\n"
+                      "  local total = 0\n"
+                      "  for i = 1, 3 do total = total + i * %d end\n"
+                      "  local cb = function(e) return style.x + e + total end\n"
+                      "  return cb(1) + #style.text\n"
+                      "end\n", f, f * 3, f, f);
+    }
+    n += snprintf(src + n, cap - n, "return M\n");
+    *len = n;
+    return src;
+}
+
+static const char* s_churn =
+    "local keep = ...\n"
+    "for i = 1, 2000 do\n"
+    "  keep[i % 256 + 1] = {text = 'item ' .. i, data = string.rep('x', i % 300)}\n"
+    "end\n";
+
+int main(int argc, char** argv) {
+    int modules = argc > 1 ? atoi(argv[1]) : 50;
+
+    lua_State* L = lua_newstate_psram();
+    if (L == NULL) {
+        fprintf(stderr, "failed to create Lua state\n");
+        return 1;
+    }
+    luaL_openlibs(L);
+    // Collect aggressively so the collector runs while chunks are compiling
+    lua_gc(L, LUA_GCINC, 100, 100, 0);
+
+    lua_newtable(L); // Loaded modules, index 1
+    lua_newtable(L); // Churn set, index 2
+    if (luaL_loadstring(L, s_churn) != LUA_OK) {
+        fprintf(stderr, "load failed: %s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    int churn = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    double load_time = 0;
+    int failed_loads = 0;
+    for (int i = 0; i < modules; i++) {
+        size_t len;
+        char* src = make_module(i, &len);
+
+        double t0 = now_sec();
+        int status = luaL_loadbuffer(L, src, len, "=app");
+        load_time += now_sec() - t0;
+        free(src);
+        if (status != LUA_OK) {
+            fprintf(stderr, "module %d: %s\n", i, lua_tostring(L, -1));
+            return 1;
+        }
+        lua_call(L, 0, 1);
+        lua_rawseti(L, 1, i + 1);
+
+        // Every tenth round also exercises the error path
+        if (i % 10 == 0) {
+            if (luaL_loadstring(L, "local x = {1, 2, 3\nreturn x") != LUA_OK) {
+                failed_loads++;
+            }
+            lua_pop(L, 1);
+        }
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, churn);
+        lua_pushvalue(L, 2);
+        lua_call(L, 1, 0);
+    }
+
+    // Run every function of every module to check the bytecode survived the move
+    long long checksum = 0;
+    for (int i = 1; i <= modules; i++) {
+        lua_rawgeti(L, 1, i);
+        for (int f = 0; f < MODULE_FUNCS; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "f%d", f);
+            lua_getfield(L, -1, name);
+            lua_pushinteger(L, i);
+            lua_pushinteger(L, f);
+            lua_call(L, 2, 1);
+            checksum += lua_tointeger(L, -1);
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    lua_gc(L, LUA_GCCOLLECT);
+
+    lua_memory_stats_t mem;
+    lua_get_memory_snapshot(&mem);
+    printf("%-6s %d modules loaded in %.3f s (%.2f ms each), %d failed loads, checksum %lld\n",
+           BENCH_VARIANT, modules, load_time, load_time * 1000 / modules, failed_loads, checksum);
+    printf("  peak Lua heap: %zu bytes, live after GC: %zu bytes\n", mem.peak_total, mem.total_allocated);
+    printf("  allocations: %u, frees: %u, reallocs: %u\n", (unsigned)mem.alloc_count,
+           (unsigned)mem.free_count, (unsigned)mem.realloc_count);
+#if CONFIG_LUA_LOAD_ARENA
+    printf("  load arena: peak %zu of %d bytes, %u overflows\n", mem.arena_peak,
+           CONFIG_LUA_LOAD_ARENA_KB * 1024, (unsigned)mem.arena_overflows);
+#endif
+
+#if CONFIG_LUA_TLSF_POOL
+    lua_tlsf_stats_t pool;
+    if (lua_get_pool_stats(&pool)) {
+        printf("  pool: %zu used in %u blocks, %zu free in %u blocks\n", pool.used_bytes,
+               (unsigned)pool.used_blocks, pool.free_bytes, (unsigned)pool.free_blocks);
+        printf("  pool largest free: %zu, fragmentation %u%%\n", pool.largest_free, (unsigned)pool.fragmentation);
+    }
+#endif
+
+    lua_close(L);
+    return 0;
+}
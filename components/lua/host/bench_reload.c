@@ -0,0 +1,265 @@
+/*
+ * Hot reload benchmark: an app of SCREENS screen modules, all built from a
+ * shared styles module and put together by a gui module, is written to a
+ * temporary directory standing in for the SD card. Reports
+ *
+ *   restart   a new state loading the app and building every screen, the
+ *             Lua part of what a reboot redoes
+ *   scan      lua_hot_reload_scan() with nothing changed
+ *   screen    one screen module rewritten: it alone is compiled, and only
+ *             its screen rebuilt
+ *   styles    the module every screen requires rewritten: it is compiled,
+ *             every screen rebuilt from the new styles
+ *
+ * The checks make sure no object leaks and unchanged screens keep theirs.
+ */
+#include "lua_engine.h"
+#include "lua_hot_reload.h"
+#include "lua_app_bundle.h"
+#include "lua_bytecode_cache.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdcard_driver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCREENS         24
+#define WIDGETS         40
+#define SCREEN_FUNCS    30
+#define RESTARTS        10
+
+static char s_dir[64];
+static int s_live = 0;          // Objects created and not deleted
+static int s_created = 0;
+static lua_Integer s_last_color = 0;
+
+// The bench reads modules from files only
+const char* lua_app_bundle_file(void) {
+    return NULL;
+}
+
+bool lua_app_bundle_module_crc(const char* module_name, uint32_t* crc) {
+    (void)module_name;
+    (void)crc;
+    return false;
+}
+
+bool lua_app_bundle_open(const char* path) {
+    (void)path;
+    return false;
+}
+
+int lua_app_bundle_load(lua_State* L, const char* module_name) {
+    (void)L;
+    (void)module_name;
+    return LUA_ERRFILE;
+}
+
+// Stand in for lvgl.label_create() and lvgl.obj_del()
+static int l_obj_create(lua_State* L) {
+    s_last_color = luaL_checkinteger(L, 1);
+    luaL_checkstring(L, 2);
+    s_live++;
+    s_created++;
+    lua_pushinteger(L, s_created);
+    return 1;
+}
+
+static int l_obj_del(lua_State* L) {
+    luaL_checkinteger(L, 1);
+    s_live--;
+    return 0;
+}
+
+static int l_on_reload(lua_State* L) {
+    lua_settop(L, 1);
+    lua_hot_reload_set_handler(L, 1);
+    return 0;
+}
+
+// Each edit adds a line: the rewrite can land in the same mtime second
+static void write_file(const char* name, const char* src, int version) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s.lua", s_dir, name);
+    FILE* f = fopen(path, "w");
+    bool ok = f != NULL && fputs(src, f) >= 0;
+    for (int v = 1; ok && v < version; v++) {
+        ok = fputs("-- edited\n", f) >= 0;
+    }
+    if (f == NULL || fclose(f) != 0 || !ok) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static void write_styles(int version) {
+    char src[256];
+    snprintf(src, sizeof(src),
+             "-- version %d\n"
+             "local S = {}\n"
+             "S.bg = %d\n"
+             "S.fg = 0xffffff\n"
+             "return S\n", version, version * 0x100000);
+    write_file("styles", src, version);
+}
+
+// Screen-sized: the widgets it builds plus handlers, like a converted GUI Guider screen
+static void write_screen(int id, int version) {
+    size_t cap = 64 * 1024, n = 0;
+    char* src = malloc(cap);
+    n += snprintf(src + n, cap - n,
+                  "-- version %d\n"
+                  "local styles = require('styles')\n"
+                  "local M = {}\n"
+                  "function M.build()\n"
+                  "  M.objs = {}\n"
+                  "  for i = 1, %d do\n"
+                  "    M.objs[i] = obj_create(styles.bg + %d + i, 'screen %d widget ' .. i)\n"
+                  "  end\n"
+                  "end\n"
+                  "function M.destroy()\n"
+                  "  for _, o in ipairs(M.objs or {}) do obj_del(o) end\n"
+                  "  M.objs = nil\n"
+                  "end\n"
+                  "on_reload(function() M.destroy() M.build() end)\n",
+                  version, WIDGETS, version * 1000, id);
+    for (int f = 0; f < SCREEN_FUNCS; f++) {
+        n += snprintf(src + n, cap - n,
+                      "function M.on_event_%d(e, value)\n"
+                      "  local style = {x = value, y = %d, w = 120, h = 20, text = 'label %d'}\n"
+                      "  local total = 0\n"
+                      "  for i = 1, 3 do total = total + i * %d end\n"
+                      "  return style.x + e + total + #style.text\n"
+                      "end\n", f, f * 3, f, f);
+    }
+    n += snprintf(src + n, cap - n, "return M\n");
+    char name[32];
+    snprintf(name, sizeof(name), "screen_%d", id);
+    write_file(name, src, version);
+    free(src);
+}
+
+static void write_app(void) {
+    write_styles(1);
+    for (int id = 0; id < SCREENS; id++) {
+        write_screen(id, 1);
+    }
+    char src[256];
+    snprintf(src, sizeof(src),
+             "local G = {screens = {}}\n"
+             "for id = 0, %d do G.screens[#G.screens + 1] = require('screen_' .. id) end\n"
+             "function G.build_all() for _, s in ipairs(G.screens) do s.build() end end\n"
+             "return G\n", SCREENS - 1);
+    write_file("gui", src, 1);
+}
+
+// Like lua_engine.c's sdcard_searcher, on the bench's directory
+static int bench_searcher(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s.lua", s_dir, name);
+    if (lua_bytecode_cache_loadfile(L, path) != LUA_OK) {
+        lua_pop(L, 1);
+        lua_pushfstring(L, "\n\tno file '%s' (bench_searcher)", path);
+        return 1;
+    }
+    lua_pushstring(L, path);
+    return 2;
+}
+
+static lua_State* load_app(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    lua_register(L, "obj_create", l_obj_create);
+    lua_register(L, "obj_del", l_obj_del);
+    lua_register(L, "on_reload", l_on_reload);
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "searchers");
+    lua_pushcfunction(L, bench_searcher);
+    lua_rawseti(L, -2, 2);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, 3);
+    lua_pop(L, 2);
+    lua_hot_reload_install(L);
+    if (luaL_dostring(L, "require('gui').build_all()") != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    return L;
+}
+
+static void close_app(lua_State* L) {
+    lua_close(L);
+    s_live = 0;
+}
+
+// Timed scan; the files' new mtimes don't have to differ: their sizes do
+static int64_t timed_scan(lua_State* L, int* reloaded) {
+    sdcard_mark_changed();
+    int64_t start_us = esp_timer_get_time();
+    *reloaded = lua_hot_reload_scan(L);
+    return esp_timer_get_time() - start_us;
+}
+
+int main(void) {
+    snprintf(s_dir, sizeof(s_dir), "/tmp/bench_reload.XXXXXX");
+    if (mkdtemp(s_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    write_app();
+    printf("%d screens of %d widgets sharing one styles module, %d handlers each\n", SCREENS, WIDGETS,
+           SCREEN_FUNCS);
+
+    int64_t restart_us = 0;
+    for (int i = 0; i < RESTARTS; i++) {
+        int64_t start_us = esp_timer_get_time();
+        lua_State* L = load_app();
+        restart_us += esp_timer_get_time() - start_us;
+        close_app(L);
+    }
+    printf("  restart  %7.2f ms  (%d modules compiled, %d objects built)\n", restart_us / 1e3 / RESTARTS,
+           SCREENS + 2, SCREENS * WIDGETS);
+
+    lua_State* L = load_app();
+    int failed = 0;
+    int reloaded;
+
+    int64_t us = timed_scan(L, &reloaded);
+    printf("  scan     %7.2f ms  (%d reloaded)\n", us / 1e3, reloaded);
+    failed |= reloaded != 0;
+
+    write_screen(7, 2);
+    s_created = 0;
+    us = timed_scan(L, &reloaded);
+    printf("  screen   %7.2f ms  (%d reloaded, %d objects built)\n", us / 1e3, reloaded, s_created);
+    failed |= reloaded != 1 || s_created != WIDGETS || s_last_color != 1 * 0x100000 + 2000 + WIDGETS;
+
+    write_styles(2);
+    s_created = 0;
+    us = timed_scan(L, &reloaded);
+    printf("  styles   %7.2f ms  (%d reloaded, %d objects built)\n", us / 1e3, reloaded, s_created);
+    failed |= reloaded != 1 || s_created != SCREENS * WIDGETS || s_last_color != 2 * 0x100000 + 1000 + WIDGETS;
+
+    lua_hot_reload_stats_t stats;
+    lua_hot_reload_get_stats(&stats);
+    printf("  %u modules tracked, %u scans, %u reloads, %u failures, %u handlers called\n",
+           (unsigned)stats.modules, (unsigned)stats.scans, (unsigned)stats.reloads, (unsigned)stats.failures,
+           (unsigned)stats.hooks);
+    failed |= s_live != SCREENS * WIDGETS || stats.failures != 0;
+    close_app(L);
+
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", s_dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "failed to remove %s\n", s_dir);
+    }
+    if (failed) {
+        fprintf(stderr, "reload checks failed: %d objects live\n", s_live);
+        return 1;
+    }
+    return 0;
+}
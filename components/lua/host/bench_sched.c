@@ -0,0 +1,239 @@
+/*
+ * Scheduler benchmark. A 100 Hz GUI loop renders for 2 ms a frame, then
+ * runs Lua: the button handlers of a screen that shows a message, waits
+ * 300 ms, shows another and waits 500 ms, the way oobe_lua.lua's format
+ * button does, written with
+ *
+ *   delay    system.delay(), blocking the frame it runs in
+ *   sleep    system.spawn() and system.sleep(), resumed by
+ *            lua_scheduler_run() after the frame
+ *
+ * and reports the longest gap between frames and the time from the click
+ * to the last message. Then TASKS coroutines each sleep 5 to 50 ms in a
+ * loop for SECONDS, and 100 wait for an event that another wakes while 10
+ * wait for one that never comes; the checks make sure every waiter got
+ * what it was owed.
+ */
+#include "lua_engine.h"
+#include "lua_scheduler.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FRAME_WAIT_MS   10
+#define RENDER_US       2000
+#define CLICKS          3
+#define FRAMES_BETWEEN  120
+#define TASKS           500
+#define SECONDS         2
+#define RUN_BUDGET_US   4000
+
+static int64_t s_click_us;
+static int64_t s_done_us;
+
+static int l_spawn(lua_State* L) {
+    return lua_scheduler_spawn(L);
+}
+
+static int l_sleep(lua_State* L) {
+    return lua_scheduler_sleep(L, (uint32_t)luaL_checkinteger(L, 1));
+}
+
+static int l_wait(lua_State* L) {
+    lua_Integer timeout_ms = luaL_optinteger(L, 2, -1);
+    lua_settop(L, 2);
+    return lua_scheduler_wait(L, 1, (int32_t)timeout_ms);
+}
+
+static int l_wake(lua_State* L) {
+    lua_pushinteger(L, lua_scheduler_wake(L, 1, lua_gettop(L) - 1));
+    return 1;
+}
+
+static int l_delay(lua_State* L) {
+    vTaskDelay(pdMS_TO_TICKS(luaL_checkinteger(L, 1)));
+    return 0;
+}
+
+static int l_done(lua_State* L) {
+    (void)L;
+    s_done_us = esp_timer_get_time();
+    return 0;
+}
+
+static const char* s_app =
+    "labels = {}\n"
+    "local function steps(pause)\n"
+    "  labels.status = 'Formatting...'\n"
+    "  pause(300)\n"
+    "  labels.status = 'Done'\n"
+    "  pause(500)\n"
+    "  labels.status = ''\n"
+    "  done()\n"
+    "end\n"
+    "function click_delay() steps(delay) end\n"
+    "function click_sleep() spawn(steps, sleep) end\n"
+    "resumes = 0\n"
+    "function sleepers(n)\n"
+    "  for i = 1, n do\n"
+    "    spawn(function()\n"
+    "      while true do sleep(math.random(5, 50)); resumes = resumes + 1 end\n"
+    "    end)\n"
+    "  end\n"
+    "end\n"
+    "got, timed_out, wrong = 0, 0, 0\n"
+    "function waiters()\n"
+    "  for i = 1, 100 do\n"
+    "    spawn(function()\n"
+    "      local ok, a, b = wait('ready', 1000)\n"
+    "      if ok and a == 42 and b == 'x' then got = got + 1 else wrong = wrong + 1 end\n"
+    "    end)\n"
+    "  end\n"
+    "  for i = 1, 10 do\n"
+    "    spawn(function()\n"
+    "      if wait('never', 30) == false then timed_out = timed_out + 1 else wrong = wrong + 1 end\n"
+    "    end)\n"
+    "  end\n"
+    "  spawn(function() sleep(50); woken = wake('ready', 42, 'x') end)\n"
+    "end\n";
+
+static lua_State* new_app_state(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    lua_scheduler_init(L);
+    lua_register(L, "spawn", l_spawn);
+    lua_register(L, "sleep", l_sleep);
+    lua_register(L, "wait", l_wait);
+    lua_register(L, "wake", l_wake);
+    lua_register(L, "delay", l_delay);
+    lua_register(L, "done", l_done);
+    if (luaL_dostring(L, s_app) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    return L;
+}
+
+static void spin_us(int64_t us) {
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+static void call(lua_State* L, const char* name) {
+    lua_getglobal(L, name);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+// One frame of main.c's loop: wait, render, run Lua. Returns the next wait.
+static uint32_t frame(lua_State* L, uint32_t wait_ms, const char* handler, int64_t* run_us) {
+    vTaskDelay(pdMS_TO_TICKS(wait_ms));
+    spin_us(RENDER_US); // lv_timer_handler()
+    int64_t start_us = esp_timer_get_time();
+    if (handler != NULL) {
+        call(L, handler);
+    }
+    int32_t next_ms = lua_scheduler_run(L, RUN_BUDGET_US);
+    if (run_us != NULL) {
+        *run_us = esp_timer_get_time() - start_us;
+    }
+    if (next_ms >= 0 && next_ms < FRAME_WAIT_MS) {
+        return next_ms > 0 ? (uint32_t)next_ms : 1;
+    }
+    return FRAME_WAIT_MS;
+}
+
+static void run_clicks(const char* name, const char* handler) {
+    lua_State* L = new_app_state();
+    int64_t gap_max_us = 0;
+    int64_t response_max_us = 0;
+    int64_t last_us = esp_timer_get_time();
+    uint32_t wait_ms = FRAME_WAIT_MS;
+    for (int f = 0; f < CLICKS * FRAMES_BETWEEN; f++) {
+        bool click = f % FRAMES_BETWEEN == FRAMES_BETWEEN / 4;
+        if (click) {
+            s_click_us = esp_timer_get_time();
+        }
+        wait_ms = frame(L, wait_ms, click ? handler : NULL, NULL);
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_us > gap_max_us) {
+            gap_max_us = now_us - last_us;
+        }
+        last_us = now_us;
+        if (s_done_us > s_click_us && s_done_us - s_click_us > response_max_us) {
+            response_max_us = s_done_us - s_click_us;
+        }
+    }
+    printf("  %-6s longest frame gap %6.1f ms, click to last message %6.1f ms\n", name, gap_max_us / 1000.0,
+           response_max_us / 1000.0);
+    lua_close(L);
+}
+
+static lua_Integer global_int(lua_State* L, const char* name) {
+    lua_getglobal(L, name);
+    lua_Integer n = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return n;
+}
+
+static int run_sleepers(void) {
+    lua_State* L = new_app_state();
+    lua_getglobal(L, "sleepers");
+    lua_pushinteger(L, TASKS);
+    lua_call(L, 1, 0);
+    call(L, "waiters");
+
+    lua_scheduler_stats_t stats;
+    lua_scheduler_get_stats(&stats);
+    int64_t run_max_us = 0;
+    int frames = 0;
+    uint32_t wait_ms = FRAME_WAIT_MS;
+    int64_t end_us = esp_timer_get_time() + SECONDS * 1000000LL;
+    while (esp_timer_get_time() < end_us) {
+        int64_t run_us;
+        wait_ms = frame(L, wait_ms, NULL, &run_us);
+        if (run_us > run_max_us) {
+            run_max_us = run_us;
+        }
+        frames++;
+    }
+    lua_scheduler_get_stats(&stats);
+    printf("  %d tasks: %.0f resumes/s, late avg %u us, max %u us; run max %.2f ms over %d frames, "
+           "heap high water %u\n",
+           TASKS, (double)global_int(L, "resumes") / SECONDS, (unsigned)stats.late_us_avg,
+           (unsigned)stats.late_us_max, run_max_us / 1000.0, frames, (unsigned)stats.heap_high_water);
+
+    lua_Integer got = global_int(L, "got");
+    lua_Integer timed_out = global_int(L, "timed_out");
+    lua_Integer wrong = global_int(L, "wrong");
+    lua_Integer woken = global_int(L, "woken");
+    printf("  wait/wake: %d woken, %d got the values, %d timed out, %d wrong; %u blocked\n", (int)woken, (int)got,
+           (int)timed_out, (int)wrong, (unsigned)stats.blocked);
+
+    // The task stacks the placement rules send to internal RAM stay within its budget
+    lua_tlsf_stats_t internal;
+    uint32_t spills;
+    lua_get_internal_pool_stats(&internal, &spills);
+    printf("  internal placement: %zu of %d KB used, %u blocks spilled to PSRAM\n", internal.used_bytes,
+           CONFIG_LUA_PLACE_INTERNAL_KB, (unsigned)spills);
+    lua_close(L);
+    return got != 100 || woken != 100 || timed_out != 10 || wrong != 0 || stats.blocked != TASKS;
+}
+
+int main(void) {
+    printf("%d Hz frames, %d us of rendering; %d clicks\n", 1000 / FRAME_WAIT_MS, RENDER_US, CLICKS);
+    run_clicks("delay", "click_delay");
+    run_clicks("sleep", "click_sleep");
+    if (run_sleepers()) {
+        fprintf(stderr, "scheduler checks failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Timer wheel benchmark: a screen's TIMERS Lua timers, blinking cursors
+ * and refreshing labels at 100 ms to 2 s, for SECONDS. A 100 Hz GUI loop
+ * drains the event queue after each frame, the way main.c does. Reports
+ * per second the esp_timer task's wake-ups, the events it queued for the
+ * Lua task and the callbacks run, with
+ *
+ *   esp_timer  one periodic esp_timer per Lua timer, as before the wheel
+ *   wheel      every timer on lua_timer_wheel.c, one esp_timer set to the
+ *              next deadline, timers due in the same tick run as one batch
+ *
+ * Then checks start, stop, reset and period changes on the wheel: every
+ * timer must go off as often as its periods allow, never early.
+ */
+#include "lua_engine.h"
+#include "lua_event_loop.h"
+#include "lua_timer_wheel.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "sdkconfig.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TIMERS          40
+#define SECONDS         5
+#define FRAME_WAIT_MS   10
+
+static const uint32_t s_periods_ms[] = {100, 250, 500, 500, 500, 1000, 1000, 2000};
+
+typedef struct {
+    lua_timer_wheel_entry_t entry;
+    esp_timer_handle_t handle;      // esp_timer mode
+    uint32_t index;
+    bool pending;
+    int ref;
+    uint32_t fired;
+    int64_t started_us;
+    int64_t early_us;               // Most it went off before its periods since the start had passed
+} bench_timer_t;
+
+static bench_timer_t s_timers[TIMERS];
+
+static const char* s_app =
+    "local labels = {}\n"
+    "function make_timer(id)\n"
+    "  local on = false\n"
+    "  return function()\n"
+    "    on = not on\n"
+    "    labels[id] = on and 'blink' or ''\n"
+    "  end\n"
+    "end\n";
+
+static void call_timer(lua_State* L, bench_timer_t* timer) {
+    timer->fired++;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, timer->ref);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+// Before the wheel: every timer's esp_timer queues an event of its own
+static void run_timer_event(lua_State* L, void* payload) {
+    uint32_t index;
+    memcpy(&index, payload, sizeof(index));
+    __atomic_store_n(&s_timers[index].pending, false, __ATOMIC_RELEASE);
+    call_timer(L, &s_timers[index]);
+}
+
+static void timer_callback(void* arg) {
+    bench_timer_t* timer = arg;
+    if (__atomic_exchange_n(&timer->pending, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (!lua_event_loop_post(run_timer_event, &timer->index, sizeof(timer->index))) {
+        __atomic_store_n(&timer->pending, false, __ATOMIC_RELEASE);
+    }
+}
+
+static void fire(lua_State* L, lua_timer_wheel_entry_t* entry) {
+    bench_timer_t* timer = (bench_timer_t*)entry;
+    int64_t now_us = esp_timer_get_time();
+    uint32_t period_ms = entry->period_ticks * CONFIG_LUA_TIMER_TICK_MS;
+    int64_t early_us = timer->started_us + (int64_t)(timer->fired + 1) * period_ms * 1000 - now_us;
+    if (early_us > timer->early_us) {
+        timer->early_us = early_us;
+    }
+    call_timer(L, timer);
+}
+
+static lua_State* new_app_state(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    if (luaL_dostring(L, s_app) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    memset(s_timers, 0, sizeof(s_timers));
+    for (int t = 0; t < TIMERS; t++) {
+        lua_getglobal(L, "make_timer");
+        lua_pushinteger(L, t);
+        lua_call(L, 1, 1);
+        s_timers[t].ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        s_timers[t].index = (uint32_t)t;
+        lua_timer_wheel_entry_init(&s_timers[t].entry, fire);
+    }
+    return L;
+}
+
+static void frames_for(lua_State* L, int64_t us) {
+    int64_t end_us = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end_us) {
+        vTaskDelay(pdMS_TO_TICKS(FRAME_WAIT_MS));
+        lua_event_loop_drain(L, CONFIG_LUA_EVENT_BUDGET_US);
+    }
+}
+
+static uint32_t expected_calls(void) {
+    uint32_t calls = 0;
+    for (int t = 0; t < TIMERS; t++) {
+        calls += SECONDS * 1000 / s_periods_ms[t % 8];
+    }
+    return calls;
+}
+
+static int run(const char* name, bool wheel) {
+    lua_State* L = new_app_state();
+    lua_event_loop_stats_t events_before, events_after;
+    lua_event_loop_get_stats(&events_before);
+    uint32_t dispatches = host_esp_timer_dispatches();
+    lua_timer_wheel_stats_t stats;
+    lua_timer_wheel_get_stats(&stats);
+
+    for (int t = 0; t < TIMERS; t++) {
+        uint32_t period_ms = s_periods_ms[t % 8];
+        if (wheel) {
+            s_timers[t].started_us = esp_timer_get_time();
+            lua_timer_wheel_start(&s_timers[t].entry, period_ms, true);
+        } else {
+            esp_timer_create_args_t args = {.callback = timer_callback, .arg = &s_timers[t], .name = "lua_timer"};
+            esp_timer_create(&args, &s_timers[t].handle);
+            esp_timer_start_periodic(s_timers[t].handle, (uint64_t)period_ms * 1000);
+        }
+    }
+    frames_for(L, SECONDS * 1000000LL);
+    for (int t = 0; t < TIMERS; t++) {
+        if (wheel) {
+            lua_timer_wheel_stop(&s_timers[t].entry);
+        } else {
+            esp_timer_stop(s_timers[t].handle);
+            esp_timer_delete(s_timers[t].handle);
+        }
+    }
+    frames_for(L, 50000); // Whatever was queued
+
+    dispatches = host_esp_timer_dispatches() - dispatches;
+    lua_event_loop_get_stats(&events_after);
+    lua_timer_wheel_get_stats(&stats);
+    uint32_t calls = 0;
+    int64_t early_us = 0;
+    for (int t = 0; t < TIMERS; t++) {
+        calls += s_timers[t].fired;
+        if (s_timers[t].early_us > early_us) {
+            early_us = s_timers[t].early_us;
+        }
+    }
+    printf("  %-9s %5.0f timer wake-ups/s  %5.0f events/s  %5.0f callbacks/s (%u of %u)", name,
+           (double)dispatches / SECONDS, (double)(events_after.handled - events_before.handled) / SECONDS,
+           (double)calls / SECONDS, (unsigned)calls, (unsigned)expected_calls());
+    if (wheel) {
+        printf("  batches up to %u, late avg %u us, max %u us", (unsigned)stats.batch_max,
+               (unsigned)stats.late_us_avg, (unsigned)stats.late_us_max);
+    }
+    printf("\n");
+    lua_close(L);
+    // Off by at most one per timer for the start and the end of the run
+    return early_us > 0 || calls + TIMERS < expected_calls() || calls > expected_calls() + TIMERS;
+}
+
+// Start, stop, reset and period changes
+static int run_api(void) {
+    lua_State* L = new_app_state();
+    int failed = 0;
+    bench_timer_t* once = &s_timers[0];
+    bench_timer_t* stopped = &s_timers[1];
+    bench_timer_t* reset = &s_timers[2];
+    bench_timer_t* faster = &s_timers[3];
+    int64_t now_us = esp_timer_get_time();
+    for (int t = 0; t < 4; t++) {
+        s_timers[t].started_us = now_us;
+    }
+    lua_timer_wheel_start(&once->entry, 50, false);
+    lua_timer_wheel_start(&stopped->entry, 50, true);
+    lua_timer_wheel_start(&reset->entry, 200, false);
+    lua_timer_wheel_start(&faster->entry, 1000, true);
+    lua_timer_wheel_stop(&stopped->entry);
+
+    frames_for(L, 150000);
+    // 150 ms in: reset restarts the 200 ms countdown; 1 s becomes 100 ms
+    reset->started_us = esp_timer_get_time();
+    lua_timer_wheel_restart(&reset->entry);
+    lua_timer_wheel_set_period(&faster->entry, 100);
+    frames_for(L, 500000);
+
+    bool once_running = lua_timer_wheel_is_running(&once->entry);
+    bool reset_running = lua_timer_wheel_is_running(&reset->entry);
+    lua_timer_wheel_stop(&faster->entry);
+    lua_timer_wheel_stats_t stats;
+    lua_timer_wheel_get_stats(&stats);
+    printf("  api: one-shot %u, stopped %u, reset %u, 1 s -> 100 ms %u times; %u running\n", (unsigned)once->fired,
+           (unsigned)stopped->fired, (unsigned)reset->fired, (unsigned)faster->fired, (unsigned)stats.timers);
+    failed |= once->fired != 1 || once_running;
+    failed |= stopped->fired != 0;
+    failed |= reset->fired != 1 || reset_running || reset->early_us > 0;
+    // Due right away at 150 ms, then every 100 ms up to 650 ms
+    failed |= faster->fired < 5 || faster->fired > 6;
+    failed |= stats.timers != 0;
+    lua_close(L);
+    return failed;
+}
+
+int main(void) {
+    if (!lua_event_loop_init() || !lua_timer_wheel_init()) {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    printf("%d timers of 100 ms to 2 s for %d s, %d ms ticks\n", TIMERS, SECONDS, CONFIG_LUA_TIMER_TICK_MS);
+    int failed = 0;
+    failed |= run("esp_timer", false);
+    failed |= run("wheel", true);
+    failed |= run_api();
+    if (failed) {
+        fprintf(stderr, "timer checks failed\n");
+        return 1;
+    }
+    return 0;
+}
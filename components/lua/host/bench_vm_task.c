@@ -0,0 +1,196 @@
+/*
+ * Lua task benchmark: a 100 Hz GUI loop renders for 2 ms a frame while
+ * input events reach a Lua handler that updates a label three times and,
+ * one event in eight, computes for 40 ms. Reports the frame pacing and the
+ * input latency (from the event being due to its handler starting) with
+ *
+ *   direct   the handler run inside the frame, as without CONFIG_LUA_VM_TASK
+ *   task     the handler run on the Lua task (lua_vm_task.c), its label
+ *            updates carried out on the GUI thread
+ *
+ * FreeRTOS is emulated with pthreads (shim/host_freertos.c), so the two
+ * "cores" are whatever the host scheduler gives the threads.
+ */
+#include "lua_engine.h"
+#include "lua_vm_task.h"
+#include "esp_timer.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FRAMES          600
+#define FRAME_WAIT_MS   10
+#define RENDER_US       2000
+#define INPUT_EVERY_US  30000
+
+typedef struct {
+    int n;
+    int64_t due_us;
+} input_t;
+
+static pthread_t s_gui_thread;
+static int s_wrong_thread = 0;
+static int s_label = 0;
+static lua_engine_fn_t s_on_input = LUA_ENGINE_NOFN;
+
+static int64_t s_intervals[FRAMES];
+static int64_t s_latency_sum = 0;
+static int64_t s_latency_max = 0;
+static int s_posted = 0;
+static volatile int s_handled = 0;
+
+static const char* s_app =
+    "function on_input(n)\n"
+    "  if n % 8 == 0 then busy(40) end\n"
+    "  for i = 1, 3 do set_text(n) end\n"
+    "end\n";
+
+// The bench's stand-ins for the polls run by lua_vm_task_run()
+void lua_engine_poll_memory(lua_State* L) {
+    (void)L;
+}
+
+void lua_hot_reload_poll(lua_State* L) {
+    (void)L;
+}
+
+static void spin_us(int64_t us) {
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+static int l_busy(lua_State* L) {
+    spin_us(luaL_checkinteger(L, 1) * 1000);
+    return 0;
+}
+
+// Stands for an LVGL binding: must run on the GUI thread
+static int set_text(lua_State* L) {
+    if (!pthread_equal(pthread_self(), s_gui_thread)) {
+        s_wrong_thread++;
+    }
+    s_label = (int)luaL_checkinteger(L, 1);
+    return 0;
+}
+
+static int l_set_text(lua_State* L) {
+    return lua_vm_task_ui_call(L, set_text);
+}
+
+static lua_State* new_app_state(void) {
+    lua_State* L = lua_newstate_psram();
+    luaL_openlibs(L);
+    lua_register(L, "busy", l_busy);
+    lua_register(L, "set_text", l_set_text);
+    if (luaL_dostring(L, s_app) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    s_on_input = lua_engine_ref_function(L, "on_input");
+    return L;
+}
+
+static void handle_input(lua_State* L, void* payload) {
+    input_t* input = (input_t*)payload;
+    int64_t latency = esp_timer_get_time() - input->due_us;
+    s_latency_sum += latency;
+    if (latency > s_latency_max) {
+        s_latency_max = latency;
+    }
+    lua_engine_callf(L, s_on_input, "i", input->n);
+    __atomic_add_fetch(&s_handled, 1, __ATOMIC_RELEASE);
+}
+
+// The GUI task's loop; direct_L is the state to run handlers on in the frame
+static void gui_loop(lua_State* direct_L) {
+    int64_t last_frame_us = 0;
+    int64_t next_input_us = esp_timer_get_time() + INPUT_EVERY_US;
+    s_posted = 0;
+    s_handled = 0;
+    s_latency_sum = 0;
+    s_latency_max = 0;
+
+    for (int f = 0; f <= FRAMES; f++) {
+        lua_vm_task_gui_poll(FRAME_WAIT_MS);
+        int64_t frame_start_us = esp_timer_get_time();
+        if (f > 0) {
+            s_intervals[f - 1] = frame_start_us - last_frame_us;
+        }
+        last_frame_us = frame_start_us;
+
+        // lv_timer_handler(): read the input that came in, then render
+        while (frame_start_us >= next_input_us) {
+            input_t input = {s_posted++, next_input_us};
+            if (direct_L != NULL) {
+                handle_input(direct_L, &input);
+            } else if (!lua_vm_task_post(handle_input, &input, sizeof(input))) {
+                s_posted--;
+            }
+            next_input_us += INPUT_EVERY_US;
+        }
+        spin_us(RENDER_US);
+        lua_vm_task_note_frame((uint32_t)(esp_timer_get_time() - frame_start_us));
+    }
+
+    // Let the Lua task finish what was posted, carrying out its calls
+    int64_t give_up_us = esp_timer_get_time() + 2000000;
+    while (__atomic_load_n(&s_handled, __ATOMIC_ACQUIRE) < s_posted && esp_timer_get_time() < give_up_us) {
+        lua_vm_task_gui_poll(1);
+    }
+}
+
+static int compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char* name) {
+    qsort(s_intervals, FRAMES, sizeof(s_intervals[0]), compare_i64);
+    int handled = s_handled;
+    printf("  %-7s frame interval p50 %5.1f ms  p99 %5.1f ms  max %5.1f ms   "
+           "input latency avg %5.1f ms  max %5.1f ms  (%d events)\n",
+           name, s_intervals[FRAMES / 2] / 1e3, s_intervals[FRAMES * 99 / 100] / 1e3,
+           s_intervals[FRAMES - 1] / 1e3, handled ? s_latency_sum / 1e3 / handled : 0.0,
+           s_latency_max / 1e3, handled);
+}
+
+static void lua_task_main(void* arg) {
+    (void)arg;
+    lua_State* L = new_app_state();
+    lua_vm_task_run(L);
+}
+
+int main(void) {
+    s_gui_thread = pthread_self();
+    printf("%d frames: %d ms wait + %d us render, an input every %d ms, 1 in 8 handled in 40 ms\n", FRAMES,
+           FRAME_WAIT_MS, RENDER_US, INPUT_EVERY_US / 1000);
+
+    lua_State* L = new_app_state();
+    gui_loop(L);
+    report("direct");
+    lua_close(L);
+
+    lua_vm_task_stats_t stats;
+    lua_vm_task_get_stats(&stats);
+    if (!lua_vm_task_start(lua_task_main, NULL)) {
+        fprintf(stderr, "starting the Lua task failed\n");
+        return 1;
+    }
+    gui_loop(NULL);
+    report("task");
+    lua_vm_task_get_stats(&stats);
+    printf("  task mode: %u UI calls (longest %u us), queue high water %u, %u dropped\n",
+           (unsigned)stats.ui_calls, (unsigned)stats.ui_call_us_max, (unsigned)stats.job_queue_high_water,
+           (unsigned)stats.jobs_dropped);
+
+    if (s_wrong_thread != 0 || s_handled != s_posted || s_label != s_posted - 1) {
+        fprintf(stderr, "%d UI calls off the GUI thread, %d of %d events handled, label %d\n", s_wrong_thread,
+                s_handled, s_posted, s_label);
+        return 1;
+    }
+    return 0;
+}
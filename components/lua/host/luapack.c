@@ -0,0 +1,289 @@
+/*
+ * App bundle packer: collects the .lua files of an SD card app into one
+ * bundle (lua_app_bundle.h) that the engine reads into PSRAM at startup.
+ *
+ *   luapack [-c] [-s] [-x] [-e entry] -o out.luapack root [dir...]
+ *
+ * Module names are the paths relative to root with the extension dropped
+ * and '/' turned into '.', exactly what require() is called with on the
+ * device: root/APP/main/gui_guider.lua becomes "APP.main.gui_guider".
+ * Only the given dirs under root are packed (default: all of it).
+ *
+ *   -c  store precompiled bytecode instead of source
+ *   -s  strip debug information from the bytecode (implies -c)
+ *   -x  lay bytecode out for execute-in-place from a flash partition
+ *       (LUAC_FORMAT_ALIGNED chunks at aligned offsets; implies -c)
+ *   -e  module to run first (default: APP.main.main, if packed)
+ *
+ * Every file is compiled either way, so syntax errors fail the pack rather
+ * than the boot. The Makefile builds this against Lua objects compiled with
+ * LUA_USE_INT32, the firmware's number model, so the bytecode loads on the
+ * device; the Lua core refuses any other build when undumping.
+ */
+#include "lua_app_bundle.h"
+#include "lua_psram_alloc.h"
+#include "lauxlib.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lundump.h"
+#include "esp_rom_crc.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DEFAULT_ENTRY "APP.main.main"
+#define CHUNK_ALIGN sizeof(Instruction)
+
+typedef struct {
+    char* name;
+    char* path;
+    char* chunk;
+    size_t chunk_size;
+    uint32_t chunk_offset;
+} pack_module_t;
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} pack_buf_t;
+
+static pack_module_t* s_modules = NULL;
+static size_t s_count = 0;
+static size_t s_capacity = 0;
+
+static void buf_append(pack_buf_t* buf, const void* p, size_t size) {
+    if (buf->size + size > buf->capacity) {
+        buf->capacity = (buf->size + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->size, p, size);
+    buf->size += size;
+}
+
+static int dump_writer(lua_State* L, const void* p, size_t size, void* ud) {
+    (void)L;
+    buf_append((pack_buf_t*)ud, p, size);
+    return 0;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(n > 0 ? n : 1);
+    if (fread(data, 1, n, f) != (size_t)n) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = n;
+    return data;
+}
+
+static void add_module(const char* path, const char* rel) {
+    if (s_count == s_capacity) {
+        s_capacity = s_capacity ? s_capacity * 2 : 32;
+        s_modules = realloc(s_modules, s_capacity * sizeof(*s_modules));
+    }
+    pack_module_t* m = &s_modules[s_count++];
+    m->path = strdup(path);
+    m->name = strndup(rel, strlen(rel) - 4); // Drop ".lua"
+    for (char* p = m->name; *p; p++) {
+        if (*p == '/') *p = '.';
+    }
+    m->chunk = NULL;
+    m->chunk_size = 0;
+}
+
+static void collect(const char* root, const char* rel) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "luapack: can't open %s\n", path);
+        exit(1);
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char child_rel[1024], child[2048];
+        snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, rel[0] ? "/" : "", de->d_name);
+        snprintf(child, sizeof(child), "%s/%s", root, child_rel);
+
+        struct stat st;
+        if (stat(child, &st) != 0) {
+            continue;
+        }
+        size_t len = strlen(de->d_name);
+        if (S_ISDIR(st.st_mode)) {
+            collect(root, child_rel);
+        } else if (len > 4 && strcmp(de->d_name + len - 4, ".lua") == 0) {
+            add_module(child, child_rel);
+        }
+    }
+    closedir(dir);
+}
+
+static int compare_modules(const void* a, const void* b) {
+    return strcmp(((const pack_module_t*)a)->name, ((const pack_module_t*)b)->name);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-c] [-s] [-x] [-e entry] -o out.luapack root [dir...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = NULL;
+    const char* entry_name = NULL;
+    int compile = 0, strip = 0, aligned = 0;
+
+    int a = 1;
+    for (; a < argc && argv[a][0] == '-'; a++) {
+        if (strcmp(argv[a], "-c") == 0) {
+            compile = 1;
+        } else if (strcmp(argv[a], "-s") == 0) {
+            compile = strip = 1;
+        } else if (strcmp(argv[a], "-x") == 0) {
+            compile = aligned = 1;
+        } else if (strcmp(argv[a], "-e") == 0 && a + 1 < argc) {
+            entry_name = argv[++a];
+        } else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) {
+            out_path = argv[++a];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (out_path == NULL || a >= argc) {
+        usage(argv[0]);
+    }
+
+    const char* root = argv[a++];
+    if (a == argc) {
+        collect(root, "");
+    }
+    for (; a < argc; a++) {
+        collect(root, argv[a]);
+    }
+    if (s_count == 0) {
+        fprintf(stderr, "luapack: no .lua files under %s\n", root);
+        return 1;
+    }
+    qsort(s_modules, s_count, sizeof(*s_modules), compare_modules);
+
+    lua_State* L = lua_newstate_psram();
+    uint32_t entry = LUA_APP_BUNDLE_NO_ENTRY;
+    size_t names_size = 0;
+    for (size_t i = 0; i < s_count; i++) {
+        pack_module_t* m = &s_modules[i];
+        if (i > 0 && strcmp(s_modules[i - 1].name, m->name) == 0) {
+            fprintf(stderr, "luapack: module %s packed twice\n", m->name);
+            return 1;
+        }
+
+        size_t src_size;
+        char* src = read_file(m->path, &src_size);
+        char chunkname[1024];
+        snprintf(chunkname, sizeof(chunkname), "@%s", m->name);
+        if (src == NULL || luaL_loadbufferx(L, src, src_size, chunkname, "t") != LUA_OK) {
+            fprintf(stderr, "luapack: %s\n", src ? lua_tostring(L, -1) : m->path);
+            return 1;
+        }
+        if (compile) {
+            pack_buf_t code = {0};
+            const Proto* f = getproto(s2v(L->top.p - 1));
+            if (aligned) {
+                luaU_dumpaligned(L, f, dump_writer, &code, strip);
+            } else {
+                luaU_dump(L, f, dump_writer, &code, strip);
+            }
+            free(src);
+            m->chunk = code.data;
+            m->chunk_size = code.size;
+        } else {
+            m->chunk = src;
+            m->chunk_size = src_size;
+        }
+        lua_pop(L, 1);
+
+        if (strcmp(m->name, entry_name ? entry_name : DEFAULT_ENTRY) == 0) {
+            entry = (uint32_t)i;
+        }
+        names_size += strlen(m->name) + 1;
+    }
+    lua_close(L);
+    if (entry_name != NULL && entry == LUA_APP_BUNDLE_NO_ENTRY) {
+        fprintf(stderr, "luapack: entry module %s is not packed\n", entry_name);
+        return 1;
+    }
+
+    // Header and index first, then names, then chunks (each aligned with -x)
+    size_t index_size = s_count * sizeof(lua_app_bundle_entry_t);
+    uint32_t name_offset = sizeof(lua_app_bundle_hdr_t) + index_size;
+    uint32_t chunk_offset = name_offset + names_size;
+    for (size_t i = 0; i < s_count; i++) {
+        if (aligned) {
+            chunk_offset = (chunk_offset + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+        }
+        s_modules[i].chunk_offset = chunk_offset;
+        chunk_offset += s_modules[i].chunk_size;
+    }
+
+    pack_buf_t out = {0};
+    lua_app_bundle_hdr_t hdr = {
+        .version = LUA_APP_BUNDLE_VERSION,
+        .module_count = (uint32_t)s_count,
+        .entry = entry,
+        .total_size = chunk_offset,
+    };
+    memcpy(hdr.magic, LUA_APP_BUNDLE_MAGIC, sizeof(hdr.magic));
+    buf_append(&out, &hdr, sizeof(hdr));
+
+    for (size_t i = 0; i < s_count; i++) {
+        lua_app_bundle_entry_t e = {
+            .name_offset = name_offset,
+            .chunk_offset = s_modules[i].chunk_offset,
+            .chunk_size = (uint32_t)s_modules[i].chunk_size,
+            .flags = (compile ? LUA_APP_BUNDLE_F_BYTECODE : 0) | (aligned ? LUA_APP_BUNDLE_F_ALIGNED : 0),
+        };
+        buf_append(&out, &e, sizeof(e));
+        name_offset += strlen(s_modules[i].name) + 1;
+    }
+    for (size_t i = 0; i < s_count; i++) {
+        buf_append(&out, s_modules[i].name, strlen(s_modules[i].name) + 1);
+    }
+    for (size_t i = 0; i < s_count; i++) {
+        static const char zeros[CHUNK_ALIGN];
+        buf_append(&out, zeros, s_modules[i].chunk_offset - out.size);
+        buf_append(&out, s_modules[i].chunk, s_modules[i].chunk_size);
+    }
+
+    lua_app_bundle_hdr_t* out_hdr = (lua_app_bundle_hdr_t*)out.data;
+    out_hdr->crc = esp_rom_crc32_le(0, (const uint8_t*)out.data + sizeof(hdr), out.size - sizeof(hdr));
+
+    FILE* f = fopen(out_path, "wb");
+    if (f == NULL || fwrite(out.data, 1, out.size, f) != out.size || fclose(f) != 0) {
+        fprintf(stderr, "luapack: failed to write %s\n", out_path);
+        return 1;
+    }
+
+    printf("%s: %zu modules, %zu bytes (%s)%s%s\n", out_path, s_count, out.size,
+           aligned ? (strip ? "stripped in-place bytecode" : "in-place bytecode")
+                   : strip ? "stripped bytecode" : compile ? "bytecode" : "source",
+           entry != LUA_APP_BUNDLE_NO_ENTRY ? ", entry " : "",
+           entry != LUA_APP_BUNDLE_NO_ENTRY ? s_modules[entry].name : "");
+    for (size_t i = 0; i < s_count; i++) {
+        printf("  %-40s %7zu\n", s_modules[i].name, s_modules[i].chunk_size);
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for esp_err.h: the codes the component returns and checks.
+ */
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+
+static inline const char* esp_err_to_name(esp_err_t err) {
+    switch (err) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    default: return "ESP_FAIL";
+    }
+}
+
+#endif // HOST_ESP_ERR_H
@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for esp_log.h: errors and warnings go to stderr, info is
+ * printed only when HOST_LOG_VERBOSE is defined.
+ */
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#ifdef HOST_LOG_VERBOSE
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#else
+#define ESP_LOGI(tag, fmt, ...) do { if (0) fprintf(stderr, "%s" fmt, tag, ##__VA_ARGS__); } while (0)
+#endif
+#define ESP_LOGD(tag, fmt, ...) do { if (0) fprintf(stderr, "%s" fmt, tag, ##__VA_ARGS__); } while (0)
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for esp_memory_utils.h. The host has no external RAM, so
+ * every block is reported as internal.
+ */
+#ifndef HOST_ESP_MEMORY_UTILS_H
+#define HOST_ESP_MEMORY_UTILS_H
+
+#include <stdbool.h>
+
+static inline bool esp_ptr_external_ram(const void* p) {
+    (void)p;
+    return false;
+}
+
+#endif // HOST_ESP_MEMORY_UTILS_H
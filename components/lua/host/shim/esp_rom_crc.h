@@ -0,0 +1,29 @@
+/*
+ * Host stand-in for esp_rom_crc.h: the ROM's CRC32 (same as zlib crc32()),
+ * table driven so checking large images doesn't dominate host timings.
+ */
+#ifndef HOST_ESP_ROM_CRC_H
+#define HOST_ESP_ROM_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c >> 1) ^ (0xEDB88320u & -(c & 1));
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif // HOST_ESP_ROM_CRC_H
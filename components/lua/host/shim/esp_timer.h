@@ -0,0 +1,37 @@
+/*
+ * Host stand-in for esp_timer.h: the microsecond clock, and timers whose
+ * callbacks run on one dispatch thread, like the esp_timer task.
+ */
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+} esp_timer_create_args_t;
+
+typedef struct host_esp_timer* esp_timer_handle_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+// Host only: callbacks run since start, i.e. wake-ups of the esp_timer task
+uint32_t host_esp_timer_dispatches(void);
+
+#endif // HOST_ESP_TIMER_H
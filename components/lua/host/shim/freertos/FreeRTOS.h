@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for FreeRTOS.h: tasks are pthreads and a tick is 1 ms.
+ * Only what the Lua task (lua_vm_task.c) uses.
+ */
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef struct host_task* TaskHandle_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+int xPortGetCoreID(void);
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for freertos/task.h: task creation and notifications.
+ */
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void* arg), const char* name, uint32_t stack_size, void* arg,
+                                   int priority, TaskHandle_t* handle, int core);
+BaseType_t xTaskCreate(void (*fn)(void* arg), const char* name, uint32_t stack_size, void* arg, int priority,
+                       TaskHandle_t* handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskGetCoreID(TaskHandle_t task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif // HOST_FREERTOS_TASK_H
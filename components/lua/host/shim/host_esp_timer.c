@@ -0,0 +1,135 @@
+#include "esp_timer.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct host_esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    int64_t due_us;
+    uint64_t period_us;         // 0 for one-shot
+    bool armed;
+    struct host_esp_timer* next;
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static struct host_esp_timer* s_timers = NULL;
+static bool s_started = false;
+static uint32_t s_dispatches = 0;
+
+static struct host_esp_timer* earliest(void) {
+    struct host_esp_timer* first = NULL;
+    for (struct host_esp_timer* t = s_timers; t != NULL; t = t->next) {
+        if (t->armed && (first == NULL || t->due_us < first->due_us)) {
+            first = t;
+        }
+    }
+    return first;
+}
+
+static void* dispatch_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        struct host_esp_timer* t = earliest();
+        int64_t now_us = esp_timer_get_time();
+        if (t == NULL || t->due_us > now_us) {
+            if (t == NULL) {
+                pthread_cond_wait(&s_cond, &s_lock);
+            } else {
+                // The condition variable runs on CLOCK_REALTIME
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                int64_t ns = deadline.tv_nsec + (t->due_us - now_us) * 1000;
+                deadline.tv_sec += ns / 1000000000;
+                deadline.tv_nsec = ns % 1000000000;
+                pthread_cond_timedwait(&s_cond, &s_lock, &deadline);
+            }
+            continue;
+        }
+        if (t->period_us > 0) {
+            t->due_us += (int64_t)t->period_us;
+        } else {
+            t->armed = false;
+        }
+        s_dispatches++;
+        esp_timer_cb_t callback = t->callback;
+        void* cb_arg = t->arg;
+        pthread_mutex_unlock(&s_lock);
+        callback(cb_arg);
+        pthread_mutex_lock(&s_lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    struct host_esp_timer* t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    pthread_mutex_lock(&s_lock);
+    if (!s_started) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, dispatch_thread, NULL);
+        pthread_detach(thread);
+        s_started = true;
+    }
+    t->next = s_timers;
+    s_timers = t;
+    pthread_mutex_unlock(&s_lock);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t t, uint64_t us, uint64_t period_us) {
+    pthread_mutex_lock(&s_lock);
+    if (t->armed) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->due_us = esp_timer_get_time() + (int64_t)us;
+    t->period_us = period_us;
+    t->armed = true;
+    pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = timer->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&s_lock);
+    for (struct host_esp_timer** p = &s_timers; *p != NULL; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    free(timer);
+    return ESP_OK;
+}
+
+uint32_t host_esp_timer_dispatches(void) {
+    pthread_mutex_lock(&s_lock);
+    uint32_t n = s_dispatches;
+    pthread_mutex_unlock(&s_lock);
+    return n;
+}
@@ -0,0 +1,161 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A task's notification value; binary semaphores are the same thing
+struct host_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+static __thread struct host_task* s_self = NULL;
+
+static struct host_task* host_task_new(void) {
+    struct host_task* task = calloc(1, sizeof(*task));
+    if (task != NULL) {
+        pthread_mutex_init(&task->lock, NULL);
+        pthread_cond_init(&task->cond, NULL);
+    }
+    return task;
+}
+
+static void give(struct host_task* task) {
+    pthread_mutex_lock(&task->lock);
+    task->count++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+static uint32_t take(struct host_task* task, BaseType_t clear, TickType_t ticks) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&task->lock);
+    while (task->count == 0) {
+        int err = ticks == portMAX_DELAY ? pthread_cond_wait(&task->cond, &task->lock)
+                                         : pthread_cond_timedwait(&task->cond, &task->lock, &deadline);
+        if (err == ETIMEDOUT) {
+            break;
+        }
+    }
+    uint32_t count = task->count;
+    if (count > 0) {
+        task->count = clear ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return count;
+}
+
+static void* task_thread(void* arg) {
+    s_self = arg;
+    s_self->fn(s_self->arg);
+    return NULL;
+}
+
+int xPortGetCoreID(void) {
+    return 0;
+}
+
+// The host has one core, every task is pinned to it
+BaseType_t xTaskGetCoreID(TaskHandle_t task) {
+    (void)task;
+    return 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void* arg), const char* name, uint32_t stack_size, void* arg,
+                                   int priority, TaskHandle_t* handle, int core) {
+    (void)name;
+    (void)stack_size;
+    (void)priority;
+    (void)core;
+    struct host_task* task = host_task_new();
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_thread, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(void (*fn)(void* arg), const char* name, uint32_t stack_size, void* arg, int priority,
+                       TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(fn, name, stack_size, arg, priority, handle, -1);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    // Threads not created through xTaskCreatePinnedToCore(), like main()'s
+    if (s_self == NULL) {
+        s_self = host_task_new();
+    }
+    return s_self;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {ticks / 1000, (long)(ticks % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    give(task);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+    give(task);
+    if (woken != NULL) {
+        *woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    return take(xTaskGetCurrentTaskHandle(), clear, ticks);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return host_task_new();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    return take(sem, pdTRUE, ticks) > 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    // Binary: a second give before a take is lost
+    pthread_mutex_lock(&sem->lock);
+    sem->count = 1;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
@@ -0,0 +1,37 @@
+#include "esp_heap_caps.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+static pthread_mutex_t s_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    pthread_mutex_lock(&s_heap_lock);
+    void* p = malloc(size);
+    pthread_mutex_unlock(&s_heap_lock);
+    return p;
+}
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+    (void)caps;
+    pthread_mutex_lock(&s_heap_lock);
+    void* p = realloc(ptr, size);
+    pthread_mutex_unlock(&s_heap_lock);
+    return p;
+}
+
+void heap_caps_free(void* ptr) {
+    pthread_mutex_lock(&s_heap_lock);
+    free(ptr);
+    pthread_mutex_unlock(&s_heap_lock);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
@@ -0,0 +1,11 @@
+#include "sdcard_driver.h"
+
+static uint32_t s_generation = 1;
+
+uint32_t sdcard_get_generation(void) {
+    return s_generation;
+}
+
+void sdcard_mark_changed(void) {
+    s_generation++;
+}
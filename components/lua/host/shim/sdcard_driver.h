@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for components/sdcard/sdcard_driver.h: the mount point and
+ * the change counter, which host_sdcard.c keeps in memory. Host paths under
+ * other directories are used as they are.
+ */
+#ifndef HOST_SDCARD_DRIVER_H
+#define HOST_SDCARD_DRIVER_H
+
+#include <stdint.h>
+
+#define SDCARD_MOUNT_POINT "/sdcard"
+
+uint32_t sdcard_get_generation(void);
+void sdcard_mark_changed(void);
+
+#endif // HOST_SDCARD_DRIVER_H
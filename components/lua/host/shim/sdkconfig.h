@@ -0,0 +1,87 @@
+/*
+ * Host stand-in for the generated sdkconfig.h. Values mirror the Kconfig
+ * defaults of the lua component; the host Makefile overrides them with -D.
+ */
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+#ifndef CONFIG_LUA_SLAB_ALLOC
+#define CONFIG_LUA_SLAB_ALLOC 1
+#endif
+#ifndef CONFIG_LUA_SLAB_BUDGET_KB
+#define CONFIG_LUA_SLAB_BUDGET_KB 32
+#endif
+#ifndef CONFIG_LUA_PLACE_STACKS_INTERNAL
+#define CONFIG_LUA_PLACE_STACKS_INTERNAL 1
+#endif
+#ifndef CONFIG_LUA_PLACE_STRTAB_INTERNAL
+#define CONFIG_LUA_PLACE_STRTAB_INTERNAL 1
+#endif
+#ifndef CONFIG_LUA_PLACE_INTERNAL_KB
+#define CONFIG_LUA_PLACE_INTERNAL_KB 32
+#endif
+#ifndef CONFIG_LUA_PLACE_LARGE_PSRAM_MIN
+#define CONFIG_LUA_PLACE_LARGE_PSRAM_MIN 1024
+#endif
+#ifndef CONFIG_LUA_HEAP_SOFT_LIMIT_KB
+#define CONFIG_LUA_HEAP_SOFT_LIMIT_KB 0
+#endif
+#ifndef CONFIG_LUA_HEAP_HARD_LIMIT_KB
+#define CONFIG_LUA_HEAP_HARD_LIMIT_KB 0
+#endif
+#ifndef CONFIG_LUA_TLSF_POOL
+#define CONFIG_LUA_TLSF_POOL 0
+#endif
+#ifndef CONFIG_LUA_TLSF_POOL_KB
+#define CONFIG_LUA_TLSF_POOL_KB 4096
+#endif
+#ifndef CONFIG_LUA_LOAD_ARENA
+#define CONFIG_LUA_LOAD_ARENA 1
+#endif
+#ifndef CONFIG_LUA_LOAD_ARENA_KB
+#define CONFIG_LUA_LOAD_ARENA_KB 64
+#endif
+#ifndef CONFIG_LUA_ALLOC_TRACE
+#define CONFIG_LUA_ALLOC_TRACE 0
+#endif
+#ifndef CONFIG_LUA_ALLOC_TRACE_KB
+#define CONFIG_LUA_ALLOC_TRACE_KB 256
+#endif
+#ifndef CONFIG_LUA_ALLOC_TAGGING
+#define CONFIG_LUA_ALLOC_TAGGING 0
+#endif
+#ifndef CONFIG_LUA_CALL_BUDGET_MS
+#define CONFIG_LUA_CALL_BUDGET_MS 250
+#endif
+#ifndef CONFIG_LUA_CALL_BUDGET_CHECK_MS
+#define CONFIG_LUA_CALL_BUDGET_CHECK_MS 10
+#endif
+#ifndef CONFIG_LUA_HOT_RELOAD_POLL_MS
+#define CONFIG_LUA_HOT_RELOAD_POLL_MS 1000
+#endif
+#ifndef CONFIG_LUA_VM_TASK_CORE
+#define CONFIG_LUA_VM_TASK_CORE 1
+#endif
+#ifndef CONFIG_LUA_VM_TASK_STACK_SIZE
+#define CONFIG_LUA_VM_TASK_STACK_SIZE 32768
+#endif
+#ifndef CONFIG_LUA_VM_TASK_PRIORITY
+#define CONFIG_LUA_VM_TASK_PRIORITY 4
+#endif
+#ifndef CONFIG_LUA_VM_TASK_QUEUE_LEN
+#define CONFIG_LUA_VM_TASK_QUEUE_LEN 64
+#endif
+#ifndef CONFIG_LUA_EVENT_QUEUE_LEN
+#define CONFIG_LUA_EVENT_QUEUE_LEN 64
+#endif
+#ifndef CONFIG_LUA_EVENT_BUDGET_US
+#define CONFIG_LUA_EVENT_BUDGET_US 4000
+#endif
+#ifndef CONFIG_LUA_CORO_POOL_SIZE
+#define CONFIG_LUA_CORO_POOL_SIZE 8
+#endif
+#ifndef CONFIG_LUA_TIMER_TICK_MS
+#define CONFIG_LUA_TIMER_TICK_MS 10
+#endif
+
+#endif // HOST_SDKCONFIG_H
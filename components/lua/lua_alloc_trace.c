@@ -0,0 +1,144 @@
+#include "lua_alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "LUA_TRACE";
+
+static uint32_t s_recorded = 0;
+static uint32_t s_dropped = 0;
+
+#if CONFIG_LUA_ALLOC_TRACE
+// Single producer (the allocator) and single consumer (the poll), both on
+// the task that owns the Lua state, so plain counters are enough.
+static lua_alloc_trace_rec_t* s_ring = NULL;
+static uint32_t s_capacity = 0;
+static uint32_t s_head = 0;     // Records appended
+static uint32_t s_tail = 0;     // Records written to the file
+static FILE* s_file = NULL;
+
+static void trace_write_pending(void) {
+    uint32_t head = s_head;
+    while (s_tail != head) {
+        uint32_t start = s_tail % s_capacity;
+        uint32_t count = head - s_tail;
+        if (count > s_capacity - start) {
+            count = s_capacity - start; // Up to the end of the ring, then wrap
+        }
+        if (fwrite(&s_ring[start], sizeof(*s_ring), count, s_file) != count) {
+            ESP_LOGE(TAG, "Trace write failed, dropping %u records", (unsigned)(head - s_tail));
+            s_dropped += head - s_tail;
+            s_tail = head;
+            return;
+        }
+        s_tail += count;
+    }
+}
+#endif
+
+bool lua_alloc_trace_start(const char* path) {
+#if CONFIG_LUA_ALLOC_TRACE
+    if (s_file != NULL) {
+        lua_alloc_trace_stop();
+    }
+
+    size_t ring_bytes = (size_t)CONFIG_LUA_ALLOC_TRACE_KB * 1024;
+    s_ring = heap_caps_malloc(ring_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (s_ring == NULL) {
+        s_ring = heap_caps_malloc(ring_bytes, MALLOC_CAP_DEFAULT);
+    }
+    if (s_ring == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %zu byte trace ring", ring_bytes);
+        return false;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to open trace file %s", path);
+        heap_caps_free(s_ring);
+        s_ring = NULL;
+        return false;
+    }
+
+    lua_alloc_trace_hdr_t hdr = {
+        .version = LUA_ALLOC_TRACE_VERSION,
+        .rec_size = sizeof(lua_alloc_trace_rec_t),
+    };
+    memcpy(hdr.magic, LUA_ALLOC_TRACE_MAGIC, sizeof(hdr.magic));
+    fwrite(&hdr, sizeof(hdr), 1, file);
+
+    s_capacity = ring_bytes / sizeof(lua_alloc_trace_rec_t);
+    s_head = s_tail = 0;
+    s_recorded = s_dropped = 0;
+    s_file = file; // Recording starts here
+    ESP_LOGI(TAG, "Tracing Lua allocations to %s (%u record ring)", path, (unsigned)s_capacity);
+    return true;
+#else
+    (void)path;
+    ESP_LOGW(TAG, "Allocation tracing is disabled (CONFIG_LUA_ALLOC_TRACE)");
+    return false;
+#endif
+}
+
+void lua_alloc_trace_stop(void) {
+#if CONFIG_LUA_ALLOC_TRACE
+    if (s_file == NULL) {
+        return;
+    }
+
+    FILE* file = s_file;
+    trace_write_pending();
+    s_file = NULL;
+    fclose(file);
+    heap_caps_free(s_ring);
+    s_ring = NULL;
+    ESP_LOGI(TAG, "Trace stopped: %u records, %u dropped", (unsigned)s_recorded, (unsigned)s_dropped);
+#endif
+}
+
+void lua_alloc_trace_poll(void) {
+#if CONFIG_LUA_ALLOC_TRACE
+    if (s_file != NULL && s_head - s_tail >= s_capacity / 8) {
+        trace_write_pending();
+    }
+#endif
+}
+
+void lua_alloc_trace_record(const void* ptr, size_t osize, size_t nsize, const void* result) {
+#if CONFIG_LUA_ALLOC_TRACE
+    if (s_file == NULL) {
+        return;
+    }
+    if (s_head - s_tail >= s_capacity) {
+        s_dropped++;
+        return;
+    }
+
+    lua_alloc_trace_rec_t* rec = &s_ring[s_head % s_capacity];
+    rec->time_us = (uint32_t)esp_timer_get_time();
+    rec->ptr = (uint32_t)(uintptr_t)ptr;
+    rec->result = (uint32_t)(uintptr_t)result;
+    rec->osize = (uint32_t)osize;
+    rec->nsize = (uint32_t)nsize;
+    s_head++;
+    s_recorded++;
+#else
+    (void)ptr;
+    (void)osize;
+    (void)nsize;
+    (void)result;
+#endif
+}
+
+bool lua_alloc_trace_get_stats(uint32_t* recorded, uint32_t* dropped) {
+    if (recorded) *recorded = s_recorded;
+    if (dropped) *dropped = s_dropped;
+#if CONFIG_LUA_ALLOC_TRACE
+    return s_file != NULL;
+#else
+    return false;
+#endif
+}
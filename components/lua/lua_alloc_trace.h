@@ -0,0 +1,73 @@
+#ifndef LUA_ALLOC_TRACE_H
+#define LUA_ALLOC_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LUA_ALLOC_TRACE_MAGIC "LUATRACE"
+#define LUA_ALLOC_TRACE_VERSION 1
+
+// One allocator call, exactly as Lua made it. Pointers are only used as
+// block identities by the replay tool (host/alloc_replay.c).
+typedef struct {
+    uint32_t time_us;   // Low 32 bits of esp_timer_get_time()
+    uint32_t ptr;       // Block passed in (0 for a new block)
+    uint32_t result;    // Block returned (0 for a free or a failed call)
+    uint32_t osize;     // Old size, or the Lua object tag for a new block
+    uint32_t nsize;     // New size (0 for a free)
+} lua_alloc_trace_rec_t;
+
+// Trace files start with this header, followed by records up to EOF
+typedef struct {
+    char magic[8];      // LUA_ALLOC_TRACE_MAGIC, not NUL-terminated
+    uint32_t version;   // LUA_ALLOC_TRACE_VERSION
+    uint32_t rec_size;  // sizeof(lua_alloc_trace_rec_t)
+} lua_alloc_trace_hdr_t;
+
+/**
+ * @brief Start recording every Lua allocator call to a file
+ * @param path Destination, e.g. "/sdcard/lua.trace" (truncated)
+ * @return bool false if tracing is compiled out or the file/ring can't be set up
+ *
+ * Records go to a PSRAM ring buffer (CONFIG_LUA_ALLOC_TRACE_KB) and are
+ * written out by lua_alloc_trace_poll(). Records that arrive while the
+ * ring is full are dropped and counted.
+ */
+bool lua_alloc_trace_start(const char* path);
+
+/**
+ * @brief Flush the remaining records, close the file and free the ring
+ */
+void lua_alloc_trace_stop(void);
+
+/**
+ * @brief Write buffered records once the ring is 1/8 full
+ *
+ * Called from lua_engine_poll_memory(); must run on the task that owns the
+ * Lua state, never from inside the allocator.
+ */
+void lua_alloc_trace_poll(void);
+
+/**
+ * @brief Append one allocator call to the ring (called by lua_psram_alloc)
+ */
+void lua_alloc_trace_record(const void* ptr, size_t osize, size_t nsize, const void* result);
+
+/**
+ * @brief Get the counters of the current (or last) trace
+ * @param recorded Records written to the ring
+ * @param dropped Records lost because the ring was full
+ * @return bool true while a trace is running
+ */
+bool lua_alloc_trace_get_stats(uint32_t* recorded, uint32_t* dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_ALLOC_TRACE_H
@@ -0,0 +1,261 @@
+#include "lua_app_bundle.h"
+#include "lauxlib.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "LUA_BUNDLE";
+
+static const uint8_t* s_bundle = NULL;
+static const lua_app_bundle_entry_t* s_entries = NULL;
+static uint32_t s_count = 0;
+static uint32_t s_entry = LUA_APP_BUNDLE_NO_ENTRY;
+static char s_path[128];
+
+// Read into PSRAM (freed on close) or mapped from flash (executed in place)
+static uint8_t* s_heap_copy = NULL;
+static esp_partition_mmap_handle_t s_mmap;
+static bool s_mapped = false;
+static uint32_t s_inplace_loads = 0;
+
+static const char* entry_name(uint32_t i) {
+    return (const char*)s_bundle + s_entries[i].name_offset;
+}
+
+// Everything the searcher trusts later is checked once here: offsets in
+// bounds, names terminated, index sorted for the binary search
+static bool bundle_validate(const uint8_t* data, size_t size) {
+    const lua_app_bundle_hdr_t* hdr = (const lua_app_bundle_hdr_t*)data;
+    if (size < sizeof(*hdr) || memcmp(hdr->magic, LUA_APP_BUNDLE_MAGIC, sizeof(hdr->magic)) != 0) {
+        ESP_LOGE(TAG, "Not an app bundle");
+        return false;
+    }
+    if (hdr->version != LUA_APP_BUNDLE_VERSION || hdr->total_size != size) {
+        ESP_LOGE(TAG, "Unsupported version %u or size mismatch (%u/%u bytes)",
+                 (unsigned)hdr->version, (unsigned)hdr->total_size, (unsigned)size);
+        return false;
+    }
+    if (esp_rom_crc32_le(0, data + sizeof(*hdr), size - sizeof(*hdr)) != hdr->crc) {
+        ESP_LOGE(TAG, "Checksum mismatch");
+        return false;
+    }
+    if (hdr->module_count > (size - sizeof(*hdr)) / sizeof(lua_app_bundle_entry_t) ||
+        (hdr->entry != LUA_APP_BUNDLE_NO_ENTRY && hdr->entry >= hdr->module_count)) {
+        ESP_LOGE(TAG, "Corrupt index");
+        return false;
+    }
+
+    const lua_app_bundle_entry_t* entries = (const lua_app_bundle_entry_t*)(data + sizeof(*hdr));
+    const char* prev = NULL;
+    for (uint32_t i = 0; i < hdr->module_count; i++) {
+        const lua_app_bundle_entry_t* e = &entries[i];
+        if (e->name_offset >= size || memchr(data + e->name_offset, '\0', size - e->name_offset) == NULL ||
+            e->chunk_offset > size || e->chunk_size > size - e->chunk_offset ||
+            ((e->flags & LUA_APP_BUNDLE_F_ALIGNED) && e->chunk_offset % 4 != 0)) {
+            ESP_LOGE(TAG, "Module %u out of bounds", (unsigned)i);
+            return false;
+        }
+        const char* name = (const char*)data + e->name_offset;
+        if (prev != NULL && strcmp(prev, name) >= 0) {
+            ESP_LOGE(TAG, "Index not sorted at '%s'", name);
+            return false;
+        }
+        prev = name;
+    }
+    return true;
+}
+
+static void bundle_attach(const uint8_t* data, const char* path) {
+    const lua_app_bundle_hdr_t* hdr = (const lua_app_bundle_hdr_t*)data;
+    s_bundle = data;
+    s_entries = (const lua_app_bundle_entry_t*)(data + sizeof(*hdr));
+    s_count = hdr->module_count;
+    s_entry = hdr->entry;
+    snprintf(s_path, sizeof(s_path), "%s", path);
+}
+
+bool lua_app_bundle_open(const char* path) {
+    lua_app_bundle_close();
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGI(TAG, "No app bundle at %s", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = NULL;
+    if (size > 0) {
+        data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (data == NULL) {
+            data = heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+        }
+    }
+    if (data == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %ld bytes for %s", size, path);
+        fclose(f);
+        return false;
+    }
+
+    // One sequential read instead of a directory walk and open per module
+    bool ok = fread(data, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok || !bundle_validate(data, size)) {
+        ESP_LOGE(TAG, "Rejected app bundle %s", path);
+        heap_caps_free(data);
+        return false;
+    }
+
+    s_heap_copy = data;
+    bundle_attach(data, path);
+    ESP_LOGI(TAG, "Opened %s: %u modules, %ld bytes", path, (unsigned)s_count, size);
+    return true;
+}
+
+bool lua_app_bundle_open_partition(const char* label) {
+    lua_app_bundle_close();
+
+    const esp_partition_t* part =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (part == NULL) {
+        ESP_LOGI(TAG, "No partition '%s'", label);
+        return false;
+    }
+
+    lua_app_bundle_hdr_t hdr;
+    if (esp_partition_read(part, 0, &hdr, sizeof(hdr)) != ESP_OK ||
+        memcmp(hdr.magic, LUA_APP_BUNDLE_MAGIC, sizeof(hdr.magic)) != 0) {
+        ESP_LOGI(TAG, "No app bundle in partition '%s'", label);
+        return false;
+    }
+    if (hdr.total_size < sizeof(hdr) || hdr.total_size > part->size) {
+        ESP_LOGE(TAG, "Bundle in partition '%s' claims %u bytes", label, (unsigned)hdr.total_size);
+        return false;
+    }
+
+    const void* data;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(part, 0, hdr.total_size, ESP_PARTITION_MMAP_DATA, &data, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition '%s': %s", label, esp_err_to_name(err));
+        return false;
+    }
+    if (!bundle_validate(data, hdr.total_size)) {
+        ESP_LOGE(TAG, "Rejected app bundle in partition '%s'", label);
+        esp_partition_munmap(handle);
+        return false;
+    }
+
+    s_mmap = handle;
+    s_mapped = true;
+    bundle_attach(data, label);
+    ESP_LOGI(TAG, "Mapped partition '%s': %u modules, %u bytes executed in place", label,
+             (unsigned)s_count, (unsigned)hdr.total_size);
+    return true;
+}
+
+void lua_app_bundle_close(void) {
+    if (s_bundle == NULL) {
+        return;
+    }
+    if (s_heap_copy != NULL) {
+        heap_caps_free(s_heap_copy);
+        s_heap_copy = NULL;
+    } else if (s_mapped && s_inplace_loads == 0) {
+        esp_partition_munmap(s_mmap);
+    } else if (s_mapped) {
+        // Live functions still run from this mapping
+        ESP_LOGW(TAG, "Leaving %s mapped: %u modules were loaded in place", s_path,
+                 (unsigned)s_inplace_loads);
+    }
+    s_mapped = false;
+    s_inplace_loads = 0;
+    s_bundle = NULL;
+    s_entries = NULL;
+    s_count = 0;
+    s_entry = LUA_APP_BUNDLE_NO_ENTRY;
+    s_path[0] = '\0';
+}
+
+const char* lua_app_bundle_entry(void) {
+    if (s_bundle == NULL || s_entry == LUA_APP_BUNDLE_NO_ENTRY) {
+        return NULL;
+    }
+    return entry_name(s_entry);
+}
+
+const char* lua_app_bundle_file(void) {
+    return s_heap_copy != NULL ? s_path : NULL;
+}
+
+static const lua_app_bundle_entry_t* find_entry(const char* module_name) {
+    uint32_t lo = 0, hi = s_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(module_name, entry_name(mid));
+        if (cmp == 0) {
+            return &s_entries[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+int lua_app_bundle_load(lua_State* L, const char* module_name) {
+    const lua_app_bundle_entry_t* e = find_entry(module_name);
+    if (e == NULL) {
+        return LUA_ERRFILE;
+    }
+    const char* chunk = (const char*)s_bundle + e->chunk_offset;
+    lua_pushfstring(L, "@%s", module_name);
+    int status;
+    if ((e->flags & LUA_APP_BUNDLE_F_BYTECODE) && s_mapped) {
+        // Flash stays mapped for the whole run: point into it instead of copying
+        status = lua_loadinplace(L, chunk, e->chunk_size, lua_tostring(L, -1));
+        s_inplace_loads++;
+    } else {
+        const char* mode = (e->flags & LUA_APP_BUNDLE_F_BYTECODE) ? "b" : "t";
+        status = luaL_loadbufferx(L, chunk, e->chunk_size, lua_tostring(L, -1), mode);
+    }
+    lua_remove(L, -2); // Chunk name
+    return status;
+}
+
+bool lua_app_bundle_module_crc(const char* module_name, uint32_t* crc) {
+    const lua_app_bundle_entry_t* e = find_entry(module_name);
+    if (e == NULL) {
+        return false;
+    }
+    *crc = esp_rom_crc32_le(0, s_bundle + e->chunk_offset, e->chunk_size);
+    return true;
+}
+
+int lua_app_bundle_searcher(lua_State* L) {
+    const char* module_name = luaL_checkstring(L, 1);
+    if (s_bundle == NULL) {
+        lua_pushstring(L, "no app bundle open (bundle_searcher)");
+        return 1;
+    }
+
+    int status = lua_app_bundle_load(L, module_name);
+    if (status == LUA_ERRFILE) {
+        lua_pushfstring(L, "no module '%s' in '%s' (bundle_searcher)", module_name, s_path);
+        return 1;
+    }
+    if (status != LUA_OK) {
+        // Like the stock file searchers: a module that exists but fails to load is an error
+        return luaL_error(L, "error loading module '%s' from '%s':\n\t%s", module_name, s_path,
+                          lua_tostring(L, -1));
+    }
+    lua_pushstring(L, s_path);
+    return 2;
+}
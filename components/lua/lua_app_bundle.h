@@ -0,0 +1,116 @@
+#ifndef LUA_APP_BUNDLE_H
+#define LUA_APP_BUNDLE_H
+
+#include "lua.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LUA_APP_BUNDLE_MAGIC "LUAPACK1"
+#define LUA_APP_BUNDLE_VERSION 1
+#define LUA_APP_BUNDLE_NO_ENTRY UINT32_MAX
+
+// Chunk holds precompiled bytecode rather than source text
+#define LUA_APP_BUNDLE_F_BYTECODE 0x1
+// Bytecode in LUAC_FORMAT_ALIGNED at a 4-byte aligned offset, so its code
+// can be executed in place when the bundle is mapped from flash
+#define LUA_APP_BUNDLE_F_ALIGNED 0x2
+
+// A bundle is one file, all offsets relative to its start:
+//
+//   lua_app_bundle_hdr_t
+//   lua_app_bundle_entry_t[module_count]   sorted by name (strcmp order)
+//   module names                           NUL-terminated
+//   chunks                                 concatenated
+//
+// Written by host/luapack.c.
+typedef struct {
+    char magic[8];          // LUA_APP_BUNDLE_MAGIC, not NUL-terminated
+    uint32_t version;       // LUA_APP_BUNDLE_VERSION
+    uint32_t module_count;
+    uint32_t entry;         // Index of the module to run, or LUA_APP_BUNDLE_NO_ENTRY
+    uint32_t total_size;    // Size of the whole file
+    uint32_t crc;           // CRC32 of everything after this header
+} lua_app_bundle_hdr_t;
+
+typedef struct {
+    uint32_t name_offset;   // Module name as passed to require(), e.g. "APP.main.gui_guider"
+    uint32_t chunk_offset;
+    uint32_t chunk_size;
+    uint32_t flags;         // LUA_APP_BUNDLE_F_*
+} lua_app_bundle_entry_t;
+
+/**
+ * @brief Read a bundle into PSRAM and make its modules visible to require()
+ * @param path Bundle file, e.g. "/sdcard/APP/app.luapack"
+ * @return bool false if the file is missing, truncated or corrupt; any
+ *         previously opened bundle is closed either way
+ */
+bool lua_app_bundle_open(const char* path);
+
+/**
+ * @brief Memory-map a bundle written to a flash data partition
+ * @param label Partition label, e.g. CONFIG_LUA_APP_PARTITION
+ * @return bool false if there is no such partition or it holds no valid
+ *         bundle; any previously opened bundle is closed either way
+ *
+ * The bundle is not copied to RAM, and modules are undumped with lua_loadinplace():
+ * their bytecode and line information stay in flash (execute in place),
+ * only constants, upvalue and local descriptors go to the Lua heap.
+ */
+bool lua_app_bundle_open_partition(const char* label);
+
+/**
+ * @brief Release the open bundle, if any
+ *
+ * Chunks loaded from a bundle read into PSRAM stay valid: luaL_loadbuffer()
+ * copies what it needs. A mapped partition that functions were executed in
+ * place from stays mapped for the rest of the run.
+ */
+void lua_app_bundle_close(void);
+
+/**
+ * @brief Name of the module the bundle was packed to run first
+ * @return const char* Module name, or NULL if no bundle is open or it has no entry
+ */
+const char* lua_app_bundle_entry(void);
+
+/**
+ * @brief Path of the open bundle, if it was read from a file
+ * @return const char* Path, or NULL if no bundle is open or it is mapped from flash
+ */
+const char* lua_app_bundle_file(void);
+
+/**
+ * @brief Checksum one module's chunk in the open bundle
+ * @param module_name Name as passed to require()
+ * @param crc Receives the CRC32 of the chunk
+ * @return bool false if the module is not in the bundle
+ *
+ * Lets lua_hot_reload.c tell which modules of a rewritten bundle changed.
+ */
+bool lua_app_bundle_module_crc(const char* module_name, uint32_t* crc);
+
+/**
+ * @brief Load one module of the open bundle
+ * @param L Lua state
+ * @param module_name Name as passed to require()
+ * @return int LUA_OK with the chunk on the stack, LUA_ERRFILE with nothing
+ *         pushed if the module is not in the bundle, or a load error with
+ *         the message on the stack
+ */
+int lua_app_bundle_load(lua_State* L, const char* module_name);
+
+/**
+ * @brief package.searchers entry resolving require() names in the open bundle
+ */
+int lua_app_bundle_searcher(lua_State* L);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_APP_BUNDLE_H
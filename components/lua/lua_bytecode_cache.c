@@ -0,0 +1,244 @@
+#include "lua_bytecode_cache.h"
+#include "lauxlib.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "sdkconfig.h"
+#include "sdcard_driver.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static lua_bytecode_cache_stats_t s_stats = {0};
+
+#if CONFIG_LUA_BYTECODE_CACHE
+static const char *TAG = "LUA_BCACHE";
+
+// Compiled chunks of files under the SD card mount point live here, one
+// file per source with the path separators replaced by dots.
+#define LUA_BYTECODE_CACHE_DIR SDCARD_MOUNT_POINT "/.luacache"
+
+#define CACHE_MAGIC "LBC1"
+
+// Bump when the layout of a cache entry changes; VM patches are covered by LUA_PATCHES
+#define CACHE_FORMAT 1
+
+#if CONFIG_LUA_BYTECODE_CACHE_STRIP
+#define CACHE_STRIP 1
+#else
+#define CACHE_STRIP 0
+#endif
+
+typedef struct {
+    char magic[4];
+    uint32_t vm_hash;
+    uint32_t src_size;
+    uint32_t path_len;
+    int64_t src_mtime;
+    uint32_t code_size;
+    uint32_t code_crc;
+    // Followed by the source path (path_len bytes) and the dumped chunk
+} cache_hdr_t;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} dump_buf_t;
+
+// FNV-1a over everything that decides whether a dumped chunk can be undumped,
+// including the revisions of this port's VM patches
+static uint32_t vm_build_hash(void) {
+    const struct {
+        uint8_t format;
+        uint8_t int_size;
+        uint8_t num_size;
+        uint8_t ptr_size;
+    } layout = {CACHE_FORMAT, sizeof(lua_Integer), sizeof(lua_Number), sizeof(void*)};
+
+    uint32_t hash = 2166136261u;
+    for (const char* p = LUA_RELEASE; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    for (const char* p = LUA_PATCHES; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    const uint8_t* bytes = (const uint8_t*)&layout;
+    for (size_t i = 0; i < sizeof(layout); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// "/sdcard/APP/main/main.lua" -> "/sdcard/.luacache/APP.main.main.luac"
+static bool cache_path_for(const char* path, char* out, size_t out_size) {
+    size_t root_len = strlen(SDCARD_MOUNT_POINT);
+    if (strncmp(path, SDCARD_MOUNT_POINT "/", root_len + 1) != 0) {
+        return false;
+    }
+
+    const char* rel = path + root_len + 1;
+    size_t rel_len = strlen(rel);
+    if (rel_len > 4 && strcmp(rel + rel_len - 4, ".lua") == 0) {
+        rel_len -= 4;
+    }
+    int n = snprintf(out, out_size, "%s/%.*s.luac", LUA_BYTECODE_CACHE_DIR, (int)rel_len, rel);
+    if (n < 0 || (size_t)n >= out_size) {
+        return false;
+    }
+    for (char* p = out + strlen(LUA_BYTECODE_CACHE_DIR) + 1; *p; p++) {
+        if (*p == '/') *p = '.';
+    }
+    return true;
+}
+
+static void* cache_buf_alloc(size_t size) {
+    void* buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return buf != NULL ? buf : heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+// Try the cache entry; on success the chunk is on the stack
+static bool cache_load(lua_State* L, const char* path, const char* cache_path, const struct stat* st) {
+    FILE* f = fopen(cache_path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    cache_hdr_t hdr;
+    size_t path_len = strlen(path);
+    char stored_path[256];
+    bool valid = fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, CACHE_MAGIC, 4) == 0 &&
+                 hdr.vm_hash == vm_build_hash() && hdr.src_size == (uint32_t)st->st_size &&
+                 hdr.src_mtime == (int64_t)st->st_mtime && hdr.path_len == path_len &&
+                 path_len < sizeof(stored_path) && fread(stored_path, 1, path_len, f) == path_len &&
+                 memcmp(stored_path, path, path_len) == 0;
+
+    uint8_t* code = NULL;
+    if (valid) {
+        code = cache_buf_alloc(hdr.code_size);
+        valid = code != NULL && fread(code, 1, hdr.code_size, f) == hdr.code_size &&
+                esp_rom_crc32_le(0, code, hdr.code_size) == hdr.code_crc;
+    }
+    fclose(f);
+
+    if (!valid) {
+        heap_caps_free(code);
+        s_stats.stale++;
+        ESP_LOGI(TAG, "Stale cache entry for %s", path);
+        return false;
+    }
+
+    lua_pushfstring(L, "@%s", path);
+    int status = luaL_loadbufferx(L, (const char*)code, hdr.code_size, lua_tostring(L, -1), "b");
+    heap_caps_free(code);
+    lua_remove(L, -2); // Chunk name
+    if (status != LUA_OK) {
+        ESP_LOGW(TAG, "Cache entry for %s rejected: %s", path, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        s_stats.stale++;
+        return false;
+    }
+    return true;
+}
+
+static int dump_writer(lua_State* L, const void* p, size_t size, void* ud) {
+    (void)L;
+    dump_buf_t* buf = (dump_buf_t*)ud;
+    if (buf->size + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 4096;
+        while (capacity < buf->size + size) capacity *= 2;
+        uint8_t* data = cache_buf_alloc(capacity);
+        if (data == NULL) {
+            return 1;
+        }
+        if (buf->data != NULL) {
+            memcpy(data, buf->data, buf->size);
+            heap_caps_free(buf->data);
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, p, size);
+    buf->size += size;
+    return 0;
+}
+
+// Dump the chunk on top of the stack and replace the entry atomically, so a
+// power cut mid-write leaves either the old entry or none
+static void cache_store(lua_State* L, const char* path, const char* cache_path, const struct stat* st) {
+    dump_buf_t buf = {0};
+    if (lua_dump(L, dump_writer, &buf, CACHE_STRIP) != 0 || buf.data == NULL) {
+        ESP_LOGW(TAG, "Failed to dump %s", path);
+        heap_caps_free(buf.data);
+        return;
+    }
+
+    if (mkdir(LUA_BYTECODE_CACHE_DIR, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGW(TAG, "Can't create %s: %s", LUA_BYTECODE_CACHE_DIR, strerror(errno));
+        heap_caps_free(buf.data);
+        return;
+    }
+
+    cache_hdr_t hdr = {
+        .vm_hash = vm_build_hash(),
+        .src_size = (uint32_t)st->st_size,
+        .path_len = (uint32_t)strlen(path),
+        .src_mtime = (int64_t)st->st_mtime,
+        .code_size = (uint32_t)buf.size,
+        .code_crc = esp_rom_crc32_le(0, buf.data, buf.size),
+    };
+    memcpy(hdr.magic, CACHE_MAGIC, 4);
+
+    char tmp_path[300];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+    FILE* f = fopen(tmp_path, "wb");
+    bool ok = f != NULL && fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(path, 1, hdr.path_len, f) == hdr.path_len && fwrite(buf.data, 1, buf.size, f) == buf.size;
+    if (f != NULL && fclose(f) != 0) {
+        ok = false;
+    }
+    heap_caps_free(buf.data);
+
+    // FATFS rename() does not replace an existing file
+    remove(cache_path);
+    if (!ok || rename(tmp_path, cache_path) != 0) {
+        ESP_LOGW(TAG, "Failed to write cache entry %s", cache_path);
+        remove(tmp_path);
+        return;
+    }
+    s_stats.stores++;
+    ESP_LOGI(TAG, "Cached %s (%u bytes of bytecode)", path, (unsigned)hdr.code_size);
+}
+#endif
+
+int lua_bytecode_cache_loadfile(lua_State* L, const char* path) {
+#if CONFIG_LUA_BYTECODE_CACHE
+    char cache_path[300];
+    struct stat st;
+    if (!cache_path_for(path, cache_path, sizeof(cache_path)) || stat(path, &st) != 0) {
+        return luaL_loadfile(L, path); // Not cacheable, or missing: let it report the error
+    }
+
+    if (cache_load(L, path, cache_path, &st)) {
+        s_stats.hits++;
+        return LUA_OK;
+    }
+
+    s_stats.misses++;
+    int status = luaL_loadfile(L, path);
+    if (status == LUA_OK) {
+        cache_store(L, path, cache_path, &st);
+    }
+    return status;
+#else
+    return luaL_loadfile(L, path);
+#endif
+}
+
+void lua_bytecode_cache_get_stats(lua_bytecode_cache_stats_t* stats) {
+    if (stats != NULL) {
+        *stats = s_stats;
+    }
+}
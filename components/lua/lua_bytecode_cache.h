@@ -0,0 +1,42 @@
+#ifndef LUA_BYTECODE_CACHE_H
+#define LUA_BYTECODE_CACHE_H
+
+#include "lua.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t hits;          // Loaded from the cache
+    uint32_t misses;        // Compiled from source (no usable cache entry)
+    uint32_t stale;         // Entries rejected: source changed, other VM build or corrupt
+    uint32_t stores;        // Entries written after a miss
+} lua_bytecode_cache_stats_t;
+
+/**
+ * @brief Load a Lua source file, going through the bytecode cache
+ * @param L Lua state
+ * @param path Source file path, e.g. "/sdcard/APP/main/main.lua"
+ * @return int Same as luaL_loadfile(): LUA_OK with the chunk on the stack,
+ *         or an error code with the message on the stack
+ *
+ * An entry is used only if the source size and mtime, the source path and
+ * the VM build hash all match and its checksum is intact; otherwise the
+ * source is compiled and the entry rewritten. Files outside the SD card
+ * and builds without CONFIG_LUA_BYTECODE_CACHE fall back to luaL_loadfile().
+ */
+int lua_bytecode_cache_loadfile(lua_State* L, const char* path);
+
+/**
+ * @brief Get the cache counters since boot
+ * @param stats Destination structure
+ */
+void lua_bytecode_cache_get_stats(lua_bytecode_cache_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_BYTECODE_CACHE_H
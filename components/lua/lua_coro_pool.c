@@ -0,0 +1,123 @@
+#include "lua_coro_pool.h"
+#include "lauxlib.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+
+static const char *TAG = "LUA_CORO_POOL";
+
+#ifndef CONFIG_LUA_CORO_POOL_SIZE
+#define CONFIG_LUA_CORO_POOL_SIZE 0
+#endif
+
+#define POOL_SLOTS (CONFIG_LUA_CORO_POOL_SIZE > 0 ? CONFIG_LUA_CORO_POOL_SIZE : 1)
+
+// Registry table holding the pool's threads, idle or lent out. They are
+// created before the state image baseline is named, so a saved image
+// refers to them by name.
+#define POOL_KEY "lua_coro_pool"
+
+static lua_State* s_threads[POOL_SLOTS];   // Of the current state
+static uint8_t s_idle_slots[POOL_SLOTS];   // Indexes into s_threads, a stack
+static int s_count = 0;
+static int s_idle = 0;
+static bool s_lent[POOL_SLOTS];            // Handed out and not given back yet
+
+static lua_coro_pool_stats_t s_stats = {0};
+
+void lua_coro_pool_init(lua_State* L) {
+    s_count = 0;
+    s_idle = 0;
+    lua_createtable(L, CONFIG_LUA_CORO_POOL_SIZE, 0);
+    for (int i = 0; i < CONFIG_LUA_CORO_POOL_SIZE; i++) {
+        s_threads[i] = lua_newthread(L);
+        lua_rawseti(L, -2, i + 1);
+        s_lent[i] = false;
+        s_idle_slots[s_idle++] = (uint8_t)i;
+        s_count++;
+    }
+    lua_setfield(L, LUA_REGISTRYINDEX, POOL_KEY);
+    if (s_count > 0) {
+        ESP_LOGI(TAG, "%d threads for callbacks", s_count);
+    }
+}
+
+static int find_slot(lua_State* co) {
+    for (int i = 0; i < s_count; i++) {
+        if (s_threads[i] == co) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Puts a pool thread that is done back on the idle stack
+static void make_idle(lua_State* L, int slot) {
+    lua_State* co = s_threads[slot];
+    if (lua_status(co) != LUA_OK) {
+        // Closes its pending to-be-closed variables; leaves the error on its stack
+        lua_closethread(co, L);
+        s_stats.reset++;
+    }
+    lua_settop(co, 0);
+    if (lua_gethook(co) != NULL) {
+        lua_sethook(co, NULL, 0, 0); // Set by debug.sethook() in the callback
+    }
+    s_lent[slot] = false;
+    s_idle_slots[s_idle++] = (uint8_t)slot;
+}
+
+// Takes back the threads given back while suspended that have finished
+// since, when lua_engine_run_suspended() or Lua code resumed them
+static void reclaim(lua_State* L) {
+    for (int i = 0; i < s_count; i++) {
+        lua_State* co = s_threads[i];
+        int status = lua_status(co);
+        lua_Debug ar;
+        if (!s_lent[i] || status == LUA_YIELD) {
+            continue;
+        }
+        // Running, or its function pushed and not resumed yet; a thread
+        // that failed keeps the frames it failed in, but is done
+        if (status == LUA_OK && (lua_getstack(co, 0, &ar) || lua_gettop(co) > 0)) {
+            continue;
+        }
+        make_idle(L, i);
+        s_stats.reclaimed++;
+    }
+}
+
+lua_State* lua_coro_pool_take(lua_State* L) {
+    s_stats.taken++;
+    if (s_idle == 0 && s_count > 0) {
+        reclaim(L);
+    }
+    if (s_idle == 0) {
+        s_stats.created++;
+        return lua_newthread(L);
+    }
+    int slot = s_idle_slots[--s_idle];
+    lua_State* co = s_threads[slot];
+    s_lent[slot] = true;
+    lua_pushthread(co);
+    lua_xmove(co, L, 1);
+    return co;
+}
+
+void lua_coro_pool_give(lua_State* L, lua_State* co, int status) {
+    int slot = find_slot(co);
+    // A suspended thread stays lent out until reclaim() finds it finished
+    if (slot >= 0 && status != LUA_YIELD) {
+        make_idle(L, slot);
+    }
+    lua_pop(L, 1);
+}
+
+void lua_coro_pool_get_stats(lua_coro_pool_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.size = (uint32_t)s_count;
+    s_stats.idle = (uint32_t)s_idle;
+    *stats = s_stats;
+}
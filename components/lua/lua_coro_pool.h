@@ -0,0 +1,64 @@
+#ifndef LUA_CORO_POOL_H
+#define LUA_CORO_POOL_H
+
+#include "lua.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t size;          // Threads in the pool (CONFIG_LUA_CORO_POOL_SIZE)
+    uint32_t idle;          // ... waiting to be taken right now
+    uint32_t taken;         // Threads handed out since boot
+    uint32_t created;       // ... that were new because the pool was empty, left to the GC
+    uint32_t reset;         // Pool threads that failed, reset with lua_closethread()
+    uint32_t reclaimed;     // Pool threads given back suspended, taken back once finished
+} lua_coro_pool_stats_t;
+
+/**
+ * @brief Fill the pool with CONFIG_LUA_CORO_POOL_SIZE threads
+ * @param L Lua state, from lua_engine_init()
+ *
+ * The threads are anchored in the registry, so the pool lives and dies
+ * with the state.
+ */
+void lua_coro_pool_init(lua_State* L);
+
+/**
+ * @brief Borrow a thread to run a callback in, like lua_newthread()
+ * @param L Lua state
+ * @return lua_State* Thread with an empty stack, also pushed onto L
+ *
+ * Push the function and its arguments onto the thread, resume it with
+ * lua_engine_resume(), then hand it back with lua_coro_pool_give().
+ */
+lua_State* lua_coro_pool_take(lua_State* L);
+
+/**
+ * @brief Give back a thread borrowed with lua_coro_pool_take()
+ * @param L Lua state, with the thread on top of its stack; it is popped
+ * @param co The thread
+ * @param status What lua_engine_resume() returned for it
+ *
+ * A thread that returned is left as lua_resume() left it, which is as
+ * lua_closethread() would, except that it keeps its stack grown to what
+ * the callbacks needed. One that failed is reset with lua_closethread().
+ * One that is suspended, by a yield or for running over budget, is taken
+ * back when the pool runs out and it has finished. Threads that weren't
+ * from the pool are left to the GC.
+ */
+void lua_coro_pool_give(lua_State* L, lua_State* co, int status);
+
+/**
+ * @brief Get the pool counters
+ * @param stats Destination structure
+ */
+void lua_coro_pool_get_stats(lua_coro_pool_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_CORO_POOL_H
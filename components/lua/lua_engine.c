@@ -2,10 +2,159 @@
 #include "lvgl_bindings.h"
 #include "system_bindings.h"
 #include "sdcard_lua_bindings.h" // Add sdcard bindings header
+#include "lua_alloc_trace.h"
+#include "lua_bytecode_cache.h"
+#include "lua_app_bundle.h"
+#include "lua_module_index.h"
+#include "lua_hot_reload.h"
+#include "lua_event_loop.h"
+#include "lua_coro_pool.h"
+#include "lua_scheduler.h"
+#include "lua_timer_wheel.h"
+#include "lua_state_image.h"
+#include "sdcard_driver.h"
+#include "esp_timer.h"
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "LUA_ENGINE";
 
+// Libraries left out of the "Open some libraries on first use" menu
+#ifndef CONFIG_LUA_LAZY_COROUTINE
+#define CONFIG_LUA_LAZY_COROUTINE 0
+#endif
+#ifndef CONFIG_LUA_LAZY_TABLE
+#define CONFIG_LUA_LAZY_TABLE 0
+#endif
+#ifndef CONFIG_LUA_LAZY_IO
+#define CONFIG_LUA_LAZY_IO 0
+#endif
+#ifndef CONFIG_LUA_LAZY_OS
+#define CONFIG_LUA_LAZY_OS 0
+#endif
+#ifndef CONFIG_LUA_LAZY_MATH
+#define CONFIG_LUA_LAZY_MATH 0
+#endif
+#ifndef CONFIG_LUA_LAZY_UTF8
+#define CONFIG_LUA_LAZY_UTF8 0
+#endif
+#ifndef CONFIG_LUA_LAZY_DEBUG
+#define CONFIG_LUA_LAZY_DEBUG 0
+#endif
+#ifndef CONFIG_LUA_LAZY_LVGL
+#define CONFIG_LUA_LAZY_LVGL 0
+#endif
+#ifndef CONFIG_LUA_LAZY_SYSTEM
+#define CONFIG_LUA_LAZY_SYSTEM 0
+#endif
+#ifndef CONFIG_LUA_LAZY_SDCARD
+#define CONFIG_LUA_LAZY_SDCARD 0
+#endif
+
+typedef struct {
+    const char* name;
+    lua_CFunction open;
+    bool lazy;  // Opened on first use instead of by lua_engine_init()
+} lua_engine_lib_t;
+
+// Every library is also a global of the same name, which legacy scripts
+// rely on. string must stay eager: it installs the string metatable.
+static const lua_engine_lib_t s_libs[] = {
+    {LUA_GNAME, luaopen_base, false},
+    {LUA_LOADLIBNAME, luaopen_package, false},
+    {LUA_STRLIBNAME, luaopen_string, false},
+    {LUA_COLIBNAME, luaopen_coroutine, CONFIG_LUA_LAZY_COROUTINE},
+    {LUA_TABLIBNAME, luaopen_table, CONFIG_LUA_LAZY_TABLE},
+    {LUA_IOLIBNAME, luaopen_io, CONFIG_LUA_LAZY_IO},
+    {LUA_OSLIBNAME, luaopen_os, CONFIG_LUA_LAZY_OS},
+    {LUA_MATHLIBNAME, luaopen_math, CONFIG_LUA_LAZY_MATH},
+    {LUA_UTF8LIBNAME, luaopen_utf8, CONFIG_LUA_LAZY_UTF8},
+    {LUA_DBLIBNAME, luaopen_debug, CONFIG_LUA_LAZY_DEBUG},
+    {"lvgl", luaopen_lvgl, CONFIG_LUA_LAZY_LVGL},
+    {"system", luaopen_system, CONFIG_LUA_LAZY_SYSTEM},
+    {"sdcard", luaopen_sdcard, CONFIG_LUA_LAZY_SDCARD},
+};
+
+#define LIB_COUNT (sizeof(s_libs) / sizeof(s_libs[0]))
+
+static const lua_engine_lib_t* find_lazy_lib(const char* name) {
+    for (size_t i = 0; i < LIB_COUNT; i++) {
+        if (s_libs[i].lazy && strcmp(s_libs[i].name, name) == 0) {
+            return &s_libs[i];
+        }
+    }
+    return NULL;
+}
+
+// package.preload loader of every lazy library. State images record which
+// libraries were opened after lua_engine_init(), and name their objects.
+static int open_lazy_lib(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+    const lua_engine_lib_t* lib = find_lazy_lib(name);
+    if (lib == NULL) {
+        return luaL_error(L, "no library named '%s'", name);
+    }
+    ESP_LOGI(TAG, "Opening library '%s' on first use", name);
+    lua_pushcfunction(L, lib->open);
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, 1);
+    lua_state_image_add_lib(L, name, -1);
+    return 1;
+}
+
+// _G.__index: opens a lazy library the first time its global is read.
+// luaL_requiref() reuses package.loaded if require() got there first, and
+// stores the global, so later reads no longer come here.
+static int lazy_global_index(lua_State* L) {
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        const char* name = lua_tostring(L, 2);
+        if (find_lazy_lib(name) != NULL) {
+            luaL_requiref(L, name, open_lazy_lib, 1);
+            return 1;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+// Opens the eager libraries and registers the lazy ones in package.preload
+// and behind the _G.__index trigger
+static void open_libs(lua_State* L) {
+    int lazy_count = 0;
+    for (size_t i = 0; i < LIB_COUNT; i++) {
+        if (!s_libs[i].lazy) {
+            luaL_requiref(L, s_libs[i].name, s_libs[i].open, 1);
+            lua_pop(L, 1);
+            continue;
+        }
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+        lua_pushcfunction(L, open_lazy_lib);
+        lua_setfield(L, -2, s_libs[i].name);
+        lua_pop(L, 1);
+        lazy_count++;
+    }
+
+    if (lazy_count > 0) {
+        lua_pushglobaltable(L);
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, lazy_global_index);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, -2);
+        lua_pop(L, 1);
+        ESP_LOGI(TAG, "%d libraries will be opened on first use", lazy_count);
+    }
+}
+
+// Called by io and os after a script changed a file (luai_filechanged); the
+// module index, hot reload and image cache only see the card's contents
+// again once its generation moves
+void lua_engine_file_changed(const char* path) {
+    if (strncmp(path, SDCARD_MOUNT_POINT "/", sizeof(SDCARD_MOUNT_POINT)) == 0) {
+        sdcard_mark_changed();
+    }
+}
+
 // Custom searcher for loading modules from the SD card
 static int sdcard_searcher(lua_State *L) {
     const char *module_name = luaL_checkstring(L, 1);
@@ -25,9 +174,15 @@ static int sdcard_searcher(lua_State *L) {
     char full_path[512];
     snprintf(full_path, sizeof(full_path), "/sdcard/%s.lua", module_path);
 
-    // Try to load the file
-    // We use luaL_loadfile because it checks for file existence and compiles it
-    if (luaL_loadfile(L, full_path) == LUA_OK) {
+    // Modules missing from the card's index fail without touching the card
+    lua_module_index_result_t indexed = lua_module_index_lookup(module_name, full_path, sizeof(full_path), NULL);
+    if (indexed == LUA_MODULE_INDEX_ABSENT) {
+        lua_pushfstring(L, "\n\tno file '%s' (sdcard_searcher)", full_path);
+        return 1;
+    }
+
+    // Try to load the file; a cached compiled chunk is used when it is still valid
+    if (lua_bytecode_cache_loadfile(L, full_path) == LUA_OK) {
         // If successful, push the filename and return 2 (chunk, filename)
         lua_pushstring(L, full_path);
         return 2;
@@ -41,6 +196,7 @@ static int sdcard_searcher(lua_State *L) {
 
 lua_State* lua_engine_init(void) {
     ESP_LOGI(TAG, "Initializing Lua engine with PSRAM support...");
+    int64_t start_us = esp_timer_get_time();
     
     // Log memory before Lua initialization
     ESP_LOGI(TAG, "Memory before Lua init:");
@@ -57,9 +213,9 @@ lua_State* lua_engine_init(void) {
         return NULL;
     }
     
-    // Open standard Lua libraries
-    ESP_LOGI(TAG, "Opening standard Lua libraries...");
-    luaL_openlibs(L);
+    // Open the standard and binding libraries, or register them for first use
+    ESP_LOGI(TAG, "Opening Lua libraries...");
+    open_libs(L);
     
     // --- Replace searchers table with a minimal, embedded-friendly version ---
     ESP_LOGI(TAG, "Replacing Lua searchers for embedded environment...");
@@ -73,7 +229,7 @@ lua_State* lua_engine_init(void) {
         lua_pop(L, 1); // Stack: [package, searchers]
 
         // Create a new, empty table for our searchers
-        lua_createtable(L, 2, 0); // Stack: [package, searchers, new_searchers]
+        lua_createtable(L, 3, 0); // Stack: [package, searchers, new_searchers]
 
         // Add the preload searcher at index 1
         if (preload_searcher) {
@@ -81,40 +237,46 @@ lua_State* lua_engine_init(void) {
             lua_rawseti(L, -2, 1);
         }
 
-        // Add our custom SD card searcher at index 2
-        lua_pushcfunction(L, sdcard_searcher);
+        // Modules of the open app bundle come next, resolved from memory
+        lua_pushcfunction(L, lua_app_bundle_searcher);
         lua_rawseti(L, -2, 2);
 
+        // Add our custom SD card searcher at index 3
+        lua_pushcfunction(L, sdcard_searcher);
+        lua_rawseti(L, -2, 3);
+
         // Replace the old searchers table with our new one
         lua_setfield(L, -3, "searchers"); // package.searchers = new_searchers. Stack: [package, searchers]
-        ESP_LOGI(TAG, "Replaced searchers with: preload, sdcard_searcher");
+        ESP_LOGI(TAG, "Replaced searchers with: preload, bundle_searcher, sdcard_searcher");
     } else {
         ESP_LOGW(TAG, "Could not find package.searchers table to replace.");
     }
     lua_pop(L, 2); // Pop package and original searchers table, cleaning up the stack
+
+    // Tracks the modules require() loads, for system.reload()
+    lua_hot_reload_install(L);
+
+    // Timer and WiFi callbacks are queued here and run by lua_event_loop_drain()
+    lua_event_loop_init();
+    // ...the timers from the one esp_timer of the timer wheel
+    lua_timer_wheel_init();
+    // ...each in a coroutine borrowed from the pool, named in state images
+    lua_coro_pool_init(L);
+    // system.spawn() tasks blocked in system.sleep() or system.wait()
+    lua_scheduler_init(L);
+
+#if CONFIG_LUA_STATE_IMAGE
+    // Names what the C code created, which state images refer to
+    lua_state_image_mark_baseline(L);
+#endif
     
     // Log memory after opening libraries
     size_t total_alloc, psram_alloc, internal_alloc;
     lua_get_memory_stats(L, &total_alloc, &psram_alloc, &internal_alloc);
     
-    // Preload custom C modules to make them available to 'require'
-    ESP_LOGI(TAG, "Preloading custom C modules...");
-    const luaL_Reg loadedlibs[] = {
-        {"lvgl", luaopen_lvgl},
-        {"system", luaopen_system},
-        {"sdcard", luaopen_sdcard},
-        {NULL, NULL}
-    };
-
-    for (const luaL_Reg *lib = loadedlibs; lib->name; lib++) {
-        luaL_requiref(L, lib->name, lib->func, 1);
-        // Also assign it to a global variable of the same name for legacy script compatibility
-        lua_setglobal(L, lib->name);
-    }
-    ESP_LOGI(TAG, "Custom C modules preloaded.");
-    
     // Log final memory usage
-    ESP_LOGI(TAG, "Lua engine initialized successfully");
+    ESP_LOGI(TAG, "Lua engine initialized successfully in %lld us",
+             (long long)(esp_timer_get_time() - start_us));
     lua_get_memory_stats(L, &total_alloc, &psram_alloc, &internal_alloc);
     
     ESP_LOGI(TAG, "Memory after Lua init:");
@@ -164,6 +326,36 @@ int lua_engine_exec_string(lua_State* L, const char* script) {
     return 0;
 }
 
+int lua_engine_exec_bytecode(lua_State* L, const void* bytecode, size_t size, const char* name) {
+    if (L == NULL || bytecode == NULL || name == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters for exec_bytecode");
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "Executing precompiled Lua chunk: %s (%zu bytes)", name, size);
+
+    // Binary chunks only: a source blob here means the build step was skipped
+    int load_result = luaL_loadbufferx(L, (const char*)bytecode, size, name, "b");
+    if (load_result != LUA_OK) {
+        const char* error = lua_tostring(L, -1);
+        ESP_LOGE(TAG, "Failed to load chunk %s: %s", name, error);
+        lua_pop(L, 1); // Remove error message
+        return load_result;
+    }
+
+    // Execute the chunk
+    int exec_result = lua_pcall(L, 0, 0, 0);
+    if (exec_result != LUA_OK) {
+        const char* error = lua_tostring(L, -1);
+        ESP_LOGE(TAG, "Failed to execute chunk %s: %s", name, error);
+        lua_pop(L, 1); // Remove error message
+        return exec_result;
+    }
+
+    ESP_LOGI(TAG, "Chunk executed successfully");
+    return 0;
+}
+
 int lua_engine_exec_file(lua_State* L, const char* filename) {
     if (L == NULL || filename == NULL) {
         ESP_LOGE(TAG, "Invalid parameters for exec_file");
@@ -172,8 +364,8 @@ int lua_engine_exec_file(lua_State* L, const char* filename) {
     
     ESP_LOGI(TAG, "Executing Lua script file: %s", filename);
     
-    // Load and compile the file
-    int load_result = luaL_loadfile(L, filename);
+    // Load and compile the file (or reuse its cached bytecode)
+    int load_result = lua_bytecode_cache_loadfile(L, filename);
     if (load_result != LUA_OK) {
         const char* error = lua_tostring(L, -1);
         ESP_LOGE(TAG, "Failed to load file %s: %s", filename, error);
@@ -194,35 +386,140 @@ int lua_engine_exec_file(lua_State* L, const char* filename) {
     return 0;
 }
 
-int lua_engine_call_function(lua_State* L, const char* function_name, int nargs, int nresults) {
-    if (L == NULL || function_name == NULL) {
-        ESP_LOGE(TAG, "Invalid parameters for call_function");
+// Run the entry module of the bundle that was just opened from 'source'
+static int exec_bundle_entry(lua_State* L, const char* source) {
+    const char* entry = lua_app_bundle_entry();
+    if (entry == NULL) {
+        ESP_LOGE(TAG, "App bundle %s has no entry module", source);
+        lua_app_bundle_close();
         return -1;
     }
-    
-    ESP_LOGI(TAG, "Calling Lua function: %s", function_name);
-    
-    // Get the function from global scope
-    lua_getglobal(L, function_name);
-    if (!lua_isfunction(L, -1)) {
-        ESP_LOGE(TAG, "Function %s not found or not a function", function_name);
-        lua_pop(L, 1);
+
+    ESP_LOGI(TAG, "Executing module %s from app bundle %s", entry, source);
+
+    // Load the entry module; the modules it requires are resolved by the bundle searcher
+    int load_result = lua_app_bundle_load(L, entry);
+    if (load_result != LUA_OK) {
+        const char* error = lua_tostring(L, -1);
+        ESP_LOGE(TAG, "Failed to load module %s: %s", entry, error);
+        lua_pop(L, 1); // Remove error message
+        return load_result;
+    }
+
+    // Execute the script
+    int exec_result = lua_pcall(L, 0, 0, 0);
+    if (exec_result != LUA_OK) {
+        const char* error = lua_tostring(L, -1);
+        ESP_LOGE(TAG, "Failed to execute module %s: %s", entry, error);
+        lua_pop(L, 1); // Remove error message
+        return exec_result;
+    }
+
+    ESP_LOGI(TAG, "App bundle executed successfully");
+    return 0;
+}
+
+int lua_engine_exec_bundle(lua_State* L, const char* path) {
+    if (L == NULL || path == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters for exec_bundle");
         return -1;
     }
-    
-    // Arguments should already be on the stack
-    
-    // Call the function
-    int call_result = lua_pcall(L, nargs, nresults, 0);
-    if (call_result != LUA_OK) {
+
+    if (!lua_app_bundle_open(path)) {
+        return -1;
+    }
+    return exec_bundle_entry(L, path);
+}
+
+int lua_engine_exec_bundle_partition(lua_State* L, const char* label) {
+    if (L == NULL || label == NULL || label[0] == '\0') {
+        return -1;
+    }
+
+    if (!lua_app_bundle_open_partition(label)) {
+        return -1;
+    }
+    return exec_bundle_entry(L, label);
+}
+
+#if CONFIG_LUA_STATE_IMAGE
+// The last image read, kept so restarting the app restores it from memory
+static char s_image_path[128];
+static void* s_image = NULL;
+static size_t s_image_size = 0;
+static uint32_t s_image_generation = 0;
+
+static bool read_image(const char* path) {
+    if (s_image != NULL && strcmp(s_image_path, path) == 0 && s_image_generation == sdcard_get_generation()) {
+        return true;
+    }
+    heap_caps_free(s_image);
+    s_image = NULL;
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void* image = size > 0 ? heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : NULL;
+    if (image == NULL && size > 0) {
+        image = heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+    }
+    bool ok = image != NULL && fread(image, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to read state image %s (%ld bytes)", path, size);
+        heap_caps_free(image);
+        return false;
+    }
+
+    snprintf(s_image_path, sizeof(s_image_path), "%s", path);
+    s_image = image;
+    s_image_size = (size_t)size;
+    s_image_generation = sdcard_get_generation();
+    return true;
+}
+#endif
+
+int lua_engine_exec_image(lua_State* L, const char* path) {
+#if CONFIG_LUA_STATE_IMAGE
+    if (L == NULL || path == NULL || !read_image(path)) {
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "Restoring state image %s (%zu bytes)", path, s_image_size);
+    int64_t start_us = esp_timer_get_time();
+    int restore_result = lua_state_image_undump(L, s_image, s_image_size, lua_state_image_sources_hash(path));
+    if (restore_result != LUA_OK) {
+        ESP_LOGW(TAG, "Can't restore state image %s: %s", path, lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove error message
+        // Rejected before the state was touched
+        return restore_result == LUA_ERRSYNTAX ? -1 : restore_result;
+    }
+    ESP_LOGI(TAG, "State image restored in %lld us", (long long)(esp_timer_get_time() - start_us));
+
+    // Run the entry function it was saved with, if any
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    int exec_result = lua_pcall(L, 0, 0, 0);
+    if (exec_result != LUA_OK) {
         const char* error = lua_tostring(L, -1);
-        ESP_LOGE(TAG, "Failed to call function %s: %s", function_name, error);
+        ESP_LOGE(TAG, "Failed to run the entry of state image %s: %s", path, error);
         lua_pop(L, 1); // Remove error message
-        return call_result;
+        return exec_result;
     }
-    
-    ESP_LOGI(TAG, "Function called successfully");
+
+    ESP_LOGI(TAG, "State image executed successfully");
     return 0;
+#else
+    (void)L;
+    (void)path;
+    return -1;
+#endif
 }
 
 void lua_engine_get_memory_stats(lua_State* L, size_t* total_alloc, size_t* psram_alloc, size_t* internal_alloc) {
@@ -234,3 +531,32 @@ void lua_engine_get_memory_stats(lua_State* L, size_t* total_alloc, size_t* psra
         if (internal_alloc) *internal_alloc = 0;
     }
 }
+
+void lua_engine_set_memory_limits(size_t soft_limit, size_t hard_limit) {
+    lua_alloc_set_limits(soft_limit, hard_limit);
+}
+
+void lua_engine_get_memory_limits(lua_State* L, size_t* soft_limit, size_t* hard_limit, size_t* used) {
+    (void)L;
+    lua_alloc_get_limits(soft_limit, hard_limit);
+    if (used) {
+        lua_memory_stats_t stats;
+        lua_get_memory_snapshot(&stats);
+        *used = stats.total_allocated;
+    }
+}
+
+void lua_engine_poll_memory(lua_State* L) {
+    lua_alloc_trace_poll();
+
+    if (L == NULL || !lua_alloc_take_low_memory_event()) {
+        return;
+    }
+
+    size_t soft_limit, hard_limit, used;
+    lua_engine_get_memory_limits(L, &soft_limit, &hard_limit, &used);
+    ESP_LOGW(TAG, "Lua heap above soft limit: %zu/%zu bytes", used, soft_limit);
+
+    lua_gc(L, LUA_GCSTEP, 0);
+    system_notify_low_memory(L, used, soft_limit);
+}
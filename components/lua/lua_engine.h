@@ -6,6 +6,7 @@
 #include "lauxlib.h"
 #include "esp_log.h"
 #include "lua_psram_alloc.h"
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,16 @@ void lua_engine_deinit(lua_State* L);
  */
 int lua_engine_exec_string(lua_State* L, const char* script);
 
+/**
+ * @brief Execute a chunk precompiled at build time
+ * @param L Lua state
+ * @param bytecode Binary chunk, e.g. a blob embedded with lua_embed_bytecode()
+ * @param size Size of the chunk in bytes
+ * @param name Chunk name used in error messages
+ * @return int 0 on success, non-zero on error (text chunks are rejected)
+ */
+int lua_engine_exec_bytecode(lua_State* L, const void* bytecode, size_t size, const char* name);
+
 /**
  * @brief Execute a Lua script from file
  * @param L Lua state  
@@ -39,6 +50,40 @@ int lua_engine_exec_string(lua_State* L, const char* script);
  */
 int lua_engine_exec_file(lua_State* L, const char* filename);
 
+/**
+ * @brief Open an app bundle and execute its entry module
+ * @param L Lua state
+ * @param path Path to the bundle written by host/luapack
+ * @return int 0 on success, non-zero on error (-1 if the bundle can't be opened)
+ *
+ * The bundle stays open afterwards so require() finds the other modules in it.
+ */
+int lua_engine_exec_bundle(lua_State* L, const char* path);
+
+/**
+ * @brief Map the app bundle in a flash partition and execute its entry module
+ * @param L Lua state
+ * @param label Data partition label (CONFIG_LUA_APP_PARTITION); empty disables
+ * @return int 0 on success, non-zero on error (-1 if there is no usable bundle)
+ *
+ * Like lua_engine_exec_bundle(), but the modules' bytecode runs in place
+ * from flash instead of being copied to the Lua heap.
+ */
+int lua_engine_exec_bundle_partition(lua_State* L, const char* label);
+
+/**
+ * @brief Restore a state image saved by system.save_state() and run its entry
+ * @param L Lua state fresh from lua_engine_init()
+ * @param path Path to the image (CONFIG_LUA_STATE_IMAGE_PATH)
+ * @return int 0 on success, non-zero on error (-1 if there is no usable image)
+ *
+ * -1 leaves the state untouched, e.g. for an image saved by another
+ * firmware. Any other error leaves it half restored: deinit it and start
+ * over with a new one. The image stays in memory, so initializing a new
+ * state and restoring it again doesn't read the card until it changes.
+ */
+int lua_engine_exec_image(lua_State* L, const char* path);
+
 /**
  * @brief Call a Lua function by name
  * @param L Lua state
@@ -46,9 +91,132 @@ int lua_engine_exec_file(lua_State* L, const char* filename);
  * @param nargs Number of arguments
  * @param nresults Number of results expected
  * @return int 0 on success, non-zero on error
+ *
+ * Looks the name up on every call. Hooks called per frame or per event
+ * should resolve the function once with lua_engine_ref_function().
  */
 int lua_engine_call_function(lua_State* L, const char* function_name, int nargs, int nresults);
 
+// Handle of a Lua function held in the registry
+typedef int lua_engine_fn_t;
+
+#define LUA_ENGINE_NOFN LUA_NOREF
+
+/**
+ * @brief Resolve a function once for lua_engine_call_begin()/lua_engine_callf()
+ * @param L Lua state
+ * @param name Global name, or a dotted path such as "app.on_frame"
+ * @return lua_engine_fn_t Handle, or LUA_ENGINE_NOFN if name is not a function
+ *
+ * The handle keeps the function it resolved to, even if the global is
+ * reassigned later. Release it with lua_engine_unref_function().
+ */
+lua_engine_fn_t lua_engine_ref_function(lua_State* L, const char* name);
+
+/**
+ * @brief Make a handle for the function at a stack index
+ * @param L Lua state
+ * @param idx Stack index of the function
+ * @return lua_engine_fn_t Handle, or LUA_ENGINE_NOFN if it isn't a function
+ */
+lua_engine_fn_t lua_engine_ref_value(lua_State* L, int idx);
+
+/**
+ * @brief Release a handle
+ * @param L Lua state
+ * @param fn Handle; LUA_ENGINE_NOFN is ignored
+ */
+void lua_engine_unref_function(lua_State* L, lua_engine_fn_t fn);
+
+/**
+ * @brief Start a call: pushes the traceback handler and the function
+ * @param L Lua state
+ * @param fn Handle from lua_engine_ref_function()
+ * @return int 0, or -1 with nothing pushed if fn is LUA_ENGINE_NOFN
+ *
+ * Push the arguments with lua_push*(), then call lua_engine_call_end().
+ * Neither logs nor looks anything up by name unless the call fails.
+ * lua_engine_callf() does all three for calls without results.
+ */
+int lua_engine_call_begin(lua_State* L, lua_engine_fn_t fn);
+
+/**
+ * @brief Finish a call started with lua_engine_call_begin()
+ * @param L Lua state
+ * @param nargs Number of arguments pushed since lua_engine_call_begin()
+ * @param nresults Number of results to leave on the stack (LUA_MULTRET allowed)
+ * @return int 0 with the results on the stack, or the lua_pcall() error code
+ *         with nothing left on the stack
+ *
+ * Errors are logged with the Lua traceback. A call still running at the
+ * end of its CONFIG_LUA_CALL_BUDGET_MS is aborted with an error; calls made
+ * from inside it share its budget.
+ */
+int lua_engine_call_end(lua_State* L, int nargs, int nresults);
+
+/**
+ * @brief Call a function with typed arguments, discarding its results
+ * @param L Lua state
+ * @param fn Handle from lua_engine_ref_function()
+ * @param args One character per argument: 'i' int, 'I' lua_Integer,
+ *        'n' double, 'b' bool (passed as int), 's' const char*, 'p' void*
+ *        (light userdata); NULL or "" for none
+ * @return int 0 on success, -1 for LUA_ENGINE_NOFN or a bad args string,
+ *         otherwise the lua_pcall() error code
+ */
+int lua_engine_callf(lua_State* L, lua_engine_fn_t fn, const char* args, ...);
+
+/**
+ * @brief Get the counters of the calls made by lua_engine_call_end(),
+ *        lua_engine_callf() and lua_engine_call_function() since boot
+ * @param calls Calls made
+ * @param errors Calls that raised an error
+ */
+void lua_engine_get_call_stats(uint32_t* calls, uint32_t* errors);
+
+/**
+ * @brief Resume a coroutine under the callback time budget
+ * @param co Coroutine with its function and nargs arguments pushed, or a
+ *        suspended one
+ * @param from Thread resuming it, keeps co referenced while it is suspended
+ * @param nargs Number of arguments
+ * @return int LUA_OK, LUA_YIELD, or the error code (logged with the traceback)
+ *
+ * Results and yielded values are discarded. A coroutine still running at
+ * the end of its CONFIG_LUA_CALL_BUDGET_MS is suspended and continued by
+ * lua_engine_run_suspended(), rather than aborted like the calls made by
+ * lua_engine_call_end(); LUA_YIELD is returned for it too.
+ */
+int lua_engine_resume(lua_State* co, lua_State* from, int nargs);
+
+/**
+ * @brief Continue the coroutines suspended for running over budget
+ * @param L Lua state
+ * @return int Number still suspended afterwards
+ *
+ * Call once per frame, from the task that runs Lua.
+ */
+int lua_engine_run_suspended(lua_State* L);
+
+typedef struct {
+    uint32_t handlers;          // Handlers that ran over at least once, up to 16
+    uint32_t overruns;          // Calls that ran over
+    uint32_t aborted;           // ... and were stopped with an error
+    uint32_t suspended;         // Times a coroutine was suspended to the next frame
+    uint32_t pending;           // Coroutines suspended right now
+} lua_engine_budget_stats_t;
+
+/**
+ * @brief Get the callback time budget counters since boot
+ * @param stats Destination structure; zero without CONFIG_LUA_CALL_BUDGET_MS
+ */
+void lua_engine_get_budget_stats(lua_engine_budget_stats_t* stats);
+
+/**
+ * @brief Log one line per handler that ran over its budget
+ */
+void lua_engine_log_budget_stats(void);
+
 /**
  * @brief Get Lua memory usage statistics
  * @param L Lua state
@@ -58,6 +226,34 @@ int lua_engine_call_function(lua_State* L, const char* function_name, int nargs,
  */
 void lua_engine_get_memory_stats(lua_State* L, size_t* total_alloc, size_t* psram_alloc, size_t* internal_alloc);
 
+/**
+ * @brief Set the Lua heap budget
+ * @param soft_limit Bytes above which a GC step and low-memory event are triggered (0 = none)
+ * @param hard_limit Bytes the heap may never exceed; an emergency GC runs before failing (0 = none)
+ *
+ * A soft limit above a non-zero hard limit is lowered to the hard limit.
+ */
+void lua_engine_set_memory_limits(size_t soft_limit, size_t hard_limit);
+
+/**
+ * @brief Get the Lua heap budget and current usage
+ * @param L Lua state
+ * @param soft_limit Soft limit in bytes (0 = none)
+ * @param hard_limit Hard limit in bytes (0 = none)
+ * @param used Bytes currently allocated by Lua
+ */
+void lua_engine_get_memory_limits(lua_State* L, size_t* soft_limit, size_t* hard_limit, size_t* used);
+
+/**
+ * @brief React to a soft-limit crossing, if one is pending
+ * @param L Lua state
+ *
+ * Runs an incremental GC step and calls the Lua handler registered with
+ * system.on_low_memory(). Also writes out buffered allocation trace records.
+ * Call it from the task that owns L, e.g. the GUI loop.
+ */
+void lua_engine_poll_memory(lua_State* L);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,544 @@
+#include "lua_engine.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "LUA_CALL";
+
+#ifndef CONFIG_LUA_CALL_BUDGET_MS
+#define CONFIG_LUA_CALL_BUDGET_MS 0
+#endif
+
+static uint32_t s_calls = 0;
+static uint32_t s_errors = 0;
+
+// Message handler under every call: adds the Lua traceback to the error
+static int traceback_handler(lua_State* L) {
+    const char* msg = lua_tostring(L, 1);
+    if (msg == NULL) {
+        if (luaL_callmeta(L, 1, "__tostring") && lua_type(L, -1) == LUA_TSTRING) {
+            return 1;
+        }
+        msg = lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1));
+    }
+    luaL_traceback(L, L, msg, 1);
+    return 1;
+}
+
+// Logs the error a coroutine stopped with, and its traceback
+static void log_resume_error(lua_State* co, lua_State* from) {
+    s_errors++;
+    luaL_traceback(from, co, lua_tostring(co, -1), 0);
+    ESP_LOGE(TAG, "Lua coroutine failed: %s", lua_tostring(from, -1));
+    lua_pop(from, 1);
+}
+#if CONFIG_LUA_CALL_BUDGET_MS
+// Time budget of the callbacks entered from C. Calls run without a hook,
+// which would make the VM trap on every instruction. A watchdog task
+// checks the deadline of the outermost call every
+// CONFIG_LUA_CALL_BUDGET_CHECK_MS; past it, it sets a count hook on the
+// thread that call runs on (lua_sethook() may be called asynchronously,
+// as lua.c does from its SIGINT handler), and the hook stops the call.
+// The calls made from inside share the outer call's budget.
+
+#define BUDGET_US ((int64_t)CONFIG_LUA_CALL_BUDGET_MS * 1000)
+#define MAX_BUDGET_ENTRIES 16
+#define MAX_SUSPENDED 8
+
+// One handler that ran over, named by where it is defined
+typedef struct {
+    char where[64];
+    uint32_t overruns;
+    uint32_t aborted;
+    uint32_t suspended;
+    uint32_t longest_us;
+} budget_entry_t;
+
+// A coroutine suspended by the hook, resumed by lua_engine_run_suspended()
+typedef struct {
+    lua_State* co;
+    int ref;                    // Keeps co alive while it is suspended
+    budget_entry_t* entry;
+    int64_t started_us;
+    uint32_t frames;
+} suspended_t;
+
+static int s_budget_depth = 0;
+static volatile int64_t s_deadline_us = 0;
+static lua_State* volatile s_budget_L = NULL;  // Thread of the outermost call
+static volatile bool s_hook_armed = false;     // Also tells the call ended that it may have run late
+static bool s_budget_may_yield = false;        // s_budget_L is a coroutine we resumed
+static bool s_overran = false;
+static bool s_budget_yield = false;
+static bool s_watchdog_started = false;
+static BaseType_t s_watchdog_core = tskNO_AFFINITY;  // Core of the task the calls are made on
+// Function of the next outermost call, to name it if it runs over: a
+// handle from lua_engine_call_begin() or a global's name
+static lua_engine_fn_t s_call_fn = LUA_ENGINE_NOFN;
+static const char* s_call_name = NULL;
+
+static budget_entry_t s_budget_entries[MAX_BUDGET_ENTRIES];
+static int s_budget_entry_count = 0;
+static uint32_t s_budget_dropped = 0;  // Overruns of handlers past the first 16
+static suspended_t s_suspended[MAX_SUSPENDED];
+static int s_suspended_count = 0;
+
+static void budget_hook(lua_State* L, lua_Debug* ar) {
+    (void)ar;
+    if (s_budget_depth == 0 || esp_timer_get_time() < s_deadline_us) {
+        // Armed for a call that returned meanwhile, with its deadline: let
+        // the watchdog arm this one again
+        lua_sethook(L, NULL, 0, 0);
+        s_hook_armed = false;
+        return;
+    }
+    s_overran = true;
+    if (s_budget_may_yield && L == s_budget_L && lua_isyieldable(L)) {
+        s_budget_yield = true;
+        lua_yield(L, 0);
+        return;
+    }
+    // The hook stays set, so the error is raised again if Lua code catches it
+    luaL_error(L, "ran over its %d ms budget", CONFIG_LUA_CALL_BUDGET_MS);
+}
+
+static void budget_watchdog_task(void* arg) {
+    (void)arg;
+    TickType_t period = pdMS_TO_TICKS(CONFIG_LUA_CALL_BUDGET_CHECK_MS);
+    for (;;) {
+        vTaskDelay(period > 0 ? period : 1);
+        lua_State* L = s_budget_L;
+        // A hook set with debug.sethook() is left alone
+        if (L == NULL || s_hook_armed || esp_timer_get_time() < s_deadline_us || lua_gethook(L) != NULL) {
+            continue;
+        }
+        s_hook_armed = true;
+        lua_sethook(L, budget_hook, LUA_MASKCOUNT, 1);
+    }
+}
+
+// Returns whether the call is the outermost one, which owns the budget
+static bool budget_begin(lua_State* L, bool may_yield, int64_t start_us) {
+    if (s_budget_depth++ > 0) {
+        return false;
+    }
+    if (!s_watchdog_started) {
+        s_watchdog_started = true;
+        // Above the GUI and Lua tasks, so it runs while a handler spins. On
+        // the core the calls are made on, it only ever sees the budget
+        // state and the thread's hook between two of their steps. That
+        // needs the calling task pinned: one free to move to the other
+        // core would run beside the watchdog while it walks the thread.
+        s_watchdog_core = xTaskGetCoreID(NULL);
+        if (s_watchdog_core == tskNO_AFFINITY) {
+            ESP_LOGE(TAG, "Lua calls are made on a task not pinned to a core, callback budget disabled");
+        } else if (xTaskCreatePinnedToCore(budget_watchdog_task, "lua_budget", 2048, NULL, 10, NULL,
+                                           s_watchdog_core) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start the callback budget watchdog");
+            s_watchdog_core = tskNO_AFFINITY;
+        }
+    }
+    s_overran = false;
+    s_budget_yield = false;
+    // Calls from another core, or with no watchdog, run without a budget
+    if (s_watchdog_core == tskNO_AFFINITY || xTaskGetCoreID(NULL) != s_watchdog_core) {
+        return false;
+    }
+    s_deadline_us = start_us + BUDGET_US;
+    s_budget_may_yield = may_yield;
+    s_hook_armed = false;
+    s_budget_L = L;
+    return true;
+}
+
+static void budget_end(bool outermost) {
+    s_budget_depth--;
+    if (!outermost) {
+        return;
+    }
+    lua_State* L = s_budget_L;
+    s_budget_L = NULL;
+    if (s_hook_armed && lua_gethook(L) == budget_hook) {
+        lua_sethook(L, NULL, 0, 0);
+    }
+}
+
+static budget_entry_t* budget_entry(const lua_Debug* ar) {
+    char where[sizeof(s_budget_entries[0].where)];
+    snprintf(where, sizeof(where), "%.48s:%d", ar->short_src, ar->linedefined);
+    for (int i = 0; i < s_budget_entry_count; i++) {
+        if (strcmp(s_budget_entries[i].where, where) == 0) {
+            return &s_budget_entries[i];
+        }
+    }
+    if (s_budget_entry_count == MAX_BUDGET_ENTRIES) {
+        s_budget_dropped++;
+        return NULL;
+    }
+    budget_entry_t* entry = &s_budget_entries[s_budget_entry_count++];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->where, where, sizeof(where));
+    return entry;
+}
+
+// Entry of the function a handle or global name refers to
+static budget_entry_t* budget_entry_of_call(lua_State* L, lua_engine_fn_t fn, const char* name) {
+    if (fn != LUA_ENGINE_NOFN) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, fn);
+    } else {
+        lua_getglobal(L, name != NULL ? name : "");
+    }
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1); // Released or reassigned by the call itself
+        return NULL;
+    }
+    lua_Debug ar;
+    lua_getinfo(L, ">S", &ar);
+    return budget_entry(&ar);
+}
+
+// Entry of the function at the bottom of a suspended or failed coroutine
+static budget_entry_t* budget_entry_of_coroutine(lua_State* co) {
+    lua_Debug ar;
+    int level = 0;
+    while (lua_getstack(co, level + 1, &ar)) {
+        level++;
+    }
+    if (!lua_getstack(co, level, &ar) || !lua_getinfo(co, "S", &ar)) {
+        return NULL;
+    }
+    return budget_entry(&ar);
+}
+
+typedef enum {
+    OVERRUN_LATE,       // Finished, e.g. the time went into one C function
+    OVERRUN_ABORTED,
+    OVERRUN_SUSPENDED,
+} overrun_t;
+
+static void note_overrun(budget_entry_t* entry, int64_t us, overrun_t outcome) {
+    static const char* const outcomes[] = {"finished late", "aborted", "suspended to the next frame"};
+    if (entry == NULL) {
+        return;
+    }
+    entry->overruns++;
+    if (outcome == OVERRUN_ABORTED) {
+        entry->aborted++;
+    } else if (outcome == OVERRUN_SUSPENDED) {
+        entry->suspended++;
+    }
+    if ((uint32_t)us > entry->longest_us) {
+        entry->longest_us = (uint32_t)us;
+    }
+    ESP_LOGW(TAG, "%s ran %u ms, over its %d ms budget: %s (%u overruns)", entry->where, (unsigned)(us / 1000),
+             CONFIG_LUA_CALL_BUDGET_MS, outcomes[outcome], (unsigned)entry->overruns);
+}
+
+// Outermost lua_engine_call_end(). The clock is only read again when the
+// watchdog found the call past its deadline, so a call that finishes late
+// within one watchdog period goes unreported.
+static int budgeted_pcall(lua_State* L, int handler, int nargs, int nresults) {
+    lua_engine_fn_t fn = s_call_fn;
+    const char* name = s_call_name;
+    int64_t start_us = esp_timer_get_time();
+    bool budgeted = budget_begin(L, false, start_us);
+    int call_result = lua_pcall(L, nargs, nresults, handler);
+    budget_end(budgeted);
+
+    if (budgeted && (s_overran || s_hook_armed)) {
+        int64_t us = esp_timer_get_time() - start_us;
+        if (s_overran || us > BUDGET_US) {
+            note_overrun(budget_entry_of_call(L, fn, name), us,
+                         s_overran && call_result != LUA_OK ? OVERRUN_ABORTED : OVERRUN_LATE);
+        }
+    }
+    return call_result;
+}
+
+// Resumes co under the budget; after the outermost resume, s_overran and
+// s_budget_yield tell whether it ran over and whether the hook suspended it
+static int budgeted_resume(lua_State* co, lua_State* from, int nargs, int64_t start_us) {
+    bool outermost = budget_begin(co, true, start_us);
+    int nres;
+    int status = lua_resume(co, from, nargs, &nres);
+    budget_end(outermost);
+    if (status == LUA_OK || status == LUA_YIELD) {
+        lua_pop(co, nres);
+    }
+    return status;
+}
+
+#endif
+
+// Arguments: path as light userdata. Returns what it names.
+// Protected, since reading a field can run an __index metamethod.
+static int resolve_path(lua_State* L) {
+    const char* p = (const char*)lua_touserdata(L, 1);
+    lua_pushglobaltable(L);
+    for (;;) {
+        const char* dot = strchr(p, '.');
+        size_t len = dot != NULL ? (size_t)(dot - p) : strlen(p);
+        lua_pushlstring(L, p, len);
+        lua_gettable(L, -2);
+        lua_remove(L, -2);
+        if (dot == NULL) {
+            return 1;
+        }
+        if (lua_isnil(L, -1)) {
+            return 1;
+        }
+        p = dot + 1;
+    }
+}
+
+lua_engine_fn_t lua_engine_ref_function(lua_State* L, const char* name) {
+    if (L == NULL || name == NULL) {
+        return LUA_ENGINE_NOFN;
+    }
+    lua_pushcfunction(L, resolve_path);
+    lua_pushlightuserdata(L, (void*)name);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+        ESP_LOGE(TAG, "Failed to resolve %s: %s", name, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return LUA_ENGINE_NOFN;
+    }
+    lua_engine_fn_t fn = lua_engine_ref_value(L, -1);
+    lua_pop(L, 1);
+    if (fn == LUA_ENGINE_NOFN) {
+        ESP_LOGE(TAG, "Function %s not found or not a function", name);
+    }
+    return fn;
+}
+
+lua_engine_fn_t lua_engine_ref_value(lua_State* L, int idx) {
+    if (L == NULL || !lua_isfunction(L, idx)) {
+        return LUA_ENGINE_NOFN;
+    }
+    lua_pushvalue(L, idx);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+void lua_engine_unref_function(lua_State* L, lua_engine_fn_t fn) {
+    if (L != NULL && fn != LUA_ENGINE_NOFN) {
+        luaL_unref(L, LUA_REGISTRYINDEX, fn);
+    }
+}
+
+int lua_engine_call_begin(lua_State* L, lua_engine_fn_t fn) {
+    if (fn == LUA_ENGINE_NOFN) {
+        return -1;
+    }
+    lua_pushcfunction(L, traceback_handler);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, fn);
+#if CONFIG_LUA_CALL_BUDGET_MS
+    s_call_fn = fn;
+    s_call_name = NULL;
+#endif
+    return 0;
+}
+
+int lua_engine_call_end(lua_State* L, int nargs, int nresults) {
+    int handler = lua_gettop(L) - nargs - 1;
+    s_calls++;
+#if CONFIG_LUA_CALL_BUDGET_MS
+    int call_result = s_budget_depth == 0 ? budgeted_pcall(L, handler, nargs, nresults)
+                                          : lua_pcall(L, nargs, nresults, handler);
+#else
+    int call_result = lua_pcall(L, nargs, nresults, handler);
+#endif
+    if (call_result != LUA_OK) {
+        s_errors++;
+        ESP_LOGE(TAG, "Lua call failed: %s", lua_tostring(L, -1));
+        lua_pop(L, 2); // Error message, handler
+        return call_result;
+    }
+    lua_remove(L, handler);
+    return 0;
+}
+
+int lua_engine_callf(lua_State* L, lua_engine_fn_t fn, const char* args, ...) {
+    if (lua_engine_call_begin(L, fn) != 0) {
+        return -1;
+    }
+
+    va_list ap;
+    va_start(ap, args);
+    int nargs = 0;
+    for (const char* a = args != NULL ? args : ""; *a; a++, nargs++) {
+        switch (*a) {
+            case 'i':
+                lua_pushinteger(L, va_arg(ap, int));
+                break;
+            case 'I':
+                lua_pushinteger(L, va_arg(ap, lua_Integer));
+                break;
+            case 'n':
+                lua_pushnumber(L, (lua_Number)va_arg(ap, double));
+                break;
+            case 'b':
+                lua_pushboolean(L, va_arg(ap, int));
+                break;
+            case 's':
+                lua_pushstring(L, va_arg(ap, const char*));
+                break;
+            case 'p':
+                lua_pushlightuserdata(L, va_arg(ap, void*));
+                break;
+            default:
+                va_end(ap);
+                ESP_LOGE(TAG, "Bad argument type '%c' in \"%s\"", *a, args);
+                lua_pop(L, nargs + 2);
+                return -1;
+        }
+    }
+    va_end(ap);
+    return lua_engine_call_end(L, nargs, 0);
+}
+
+int lua_engine_call_function(lua_State* L, const char* function_name, int nargs, int nresults) {
+    if (L == NULL || function_name == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters for call_function");
+        return -1;
+    }
+
+    // Get the function from global scope
+    lua_getglobal(L, function_name);
+    if (!lua_isfunction(L, -1)) {
+        ESP_LOGE(TAG, "Function %s not found or not a function", function_name);
+        lua_pop(L, 1);
+        return -1;
+    }
+
+    // Arguments are already on the stack: slide the handler and function under them
+    lua_insert(L, -(nargs + 1));
+    lua_pushcfunction(L, traceback_handler);
+    lua_insert(L, -(nargs + 2));
+#if CONFIG_LUA_CALL_BUDGET_MS
+    s_call_fn = LUA_ENGINE_NOFN;
+    s_call_name = function_name;
+#endif
+    return lua_engine_call_end(L, nargs, nresults);
+}
+
+void lua_engine_get_call_stats(uint32_t* calls, uint32_t* errors) {
+    if (calls != NULL) {
+        *calls = s_calls;
+    }
+    if (errors != NULL) {
+        *errors = s_errors;
+    }
+}
+
+int lua_engine_resume(lua_State* co, lua_State* from, int nargs) {
+    s_calls++;
+#if CONFIG_LUA_CALL_BUDGET_MS
+    bool outermost = s_budget_depth == 0;
+    int64_t start_us = esp_timer_get_time();
+    int status = budgeted_resume(co, from, nargs, start_us);
+    int64_t us = esp_timer_get_time() - start_us;
+    if (outermost && (s_overran || us > BUDGET_US)) {
+        budget_entry_t* entry = budget_entry_of_coroutine(co);
+        overrun_t outcome = s_budget_yield ? OVERRUN_SUSPENDED : OVERRUN_LATE;
+        if (s_overran && status != LUA_OK && status != LUA_YIELD) {
+            outcome = OVERRUN_ABORTED;
+        }
+        note_overrun(entry, us, outcome);
+        if (s_budget_yield) {
+            if (s_suspended_count == MAX_SUSPENDED) {
+                ESP_LOGE(TAG, "Too many suspended handlers, dropping one");
+            } else {
+                suspended_t* suspended = &s_suspended[s_suspended_count++];
+                lua_pushthread(co);
+                lua_xmove(co, from, 1);
+                suspended->co = co;
+                suspended->ref = luaL_ref(from, LUA_REGISTRYINDEX);
+                suspended->entry = entry;
+                suspended->started_us = start_us;
+                suspended->frames = 0;
+            }
+        }
+    }
+    if (status != LUA_OK && status != LUA_YIELD) {
+        log_resume_error(co, from);
+    }
+    return status;
+#else
+    int nres;
+    int status = lua_resume(co, from, nargs, &nres);
+    if (status == LUA_OK || status == LUA_YIELD) {
+        lua_pop(co, nres);
+    } else {
+        log_resume_error(co, from);
+    }
+    return status;
+#endif
+}
+
+int lua_engine_run_suspended(lua_State* L) {
+#if CONFIG_LUA_CALL_BUDGET_MS
+    int kept = 0;
+    for (int i = 0; i < s_suspended_count; i++) {
+        suspended_t suspended = s_suspended[i];
+        suspended.frames++;
+        int status = budgeted_resume(suspended.co, L, 0, esp_timer_get_time());
+        if (status == LUA_YIELD && s_budget_yield) {
+            if (suspended.entry != NULL) {
+                suspended.entry->suspended++;
+            }
+            s_suspended[kept++] = suspended;
+            continue;
+        }
+        if (status != LUA_OK && status != LUA_YIELD) {
+            if (s_overran && suspended.entry != NULL) {
+                suspended.entry->aborted++;
+            }
+            log_resume_error(suspended.co, L);
+        }
+        int64_t us = esp_timer_get_time() - suspended.started_us;
+        if (suspended.entry != NULL && (uint32_t)us > suspended.entry->longest_us) {
+            suspended.entry->longest_us = (uint32_t)us;
+        }
+        ESP_LOGI(TAG, "%s finished %u frames and %u ms after it started",
+                 suspended.entry != NULL ? suspended.entry->where : "Suspended handler", (unsigned)suspended.frames,
+                 (unsigned)(us / 1000));
+        luaL_unref(L, LUA_REGISTRYINDEX, suspended.ref);
+    }
+    s_suspended_count = kept;
+    return kept;
+#else
+    (void)L;
+    return 0;
+#endif
+}
+
+void lua_engine_get_budget_stats(lua_engine_budget_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+#if CONFIG_LUA_CALL_BUDGET_MS
+    for (int i = 0; i < s_budget_entry_count; i++) {
+        stats->overruns += s_budget_entries[i].overruns;
+        stats->aborted += s_budget_entries[i].aborted;
+        stats->suspended += s_budget_entries[i].suspended;
+    }
+    stats->overruns += s_budget_dropped;
+    stats->handlers = (uint32_t)s_budget_entry_count;
+    stats->pending = (uint32_t)s_suspended_count;
+#endif
+}
+
+void lua_engine_log_budget_stats(void) {
+#if CONFIG_LUA_CALL_BUDGET_MS
+    for (int i = 0; i < s_budget_entry_count; i++) {
+        const budget_entry_t* entry = &s_budget_entries[i];
+        ESP_LOGI(TAG, "Over budget: %s %u times (%u aborted, %u suspensions), longest %u ms", entry->where,
+                 (unsigned)entry->overruns, (unsigned)entry->aborted, (unsigned)entry->suspended,
+                 (unsigned)(entry->longest_us / 1000));
+    }
+#endif
+}
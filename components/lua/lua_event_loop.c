@@ -0,0 +1,133 @@
+#include "lua_event_loop.h"
+#include "lua_ring.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "LUA_EVENTS";
+
+#ifndef CONFIG_LUA_EVENT_QUEUE_LEN
+#define CONFIG_LUA_EVENT_QUEUE_LEN 64
+#endif
+
+typedef struct {
+    lua_event_fn_t fn;
+    uint32_t posted_us;     // Low half of esp_timer_get_time(); differences survive the wrap
+    uint8_t payload[LUA_EVENT_PAYLOAD_SIZE];
+} lua_event_t;
+
+static lua_mpsc_ring_t s_queue;             // lua_event_t: any task or ISR -> the task that runs Lua
+static TaskHandle_t volatile s_owner = NULL; // Last task that drained, woken by posts
+
+static uint32_t s_posted = 0;
+static lua_event_loop_stats_t s_stats = {0};
+static uint64_t s_latency_us_sum = 0;
+static uint32_t s_latency_count = 0;
+
+bool lua_event_loop_init(void) {
+    if (s_queue.slots != NULL) {
+        return true;
+    }
+    if (!lua_mpsc_ring_init(&s_queue, CONFIG_LUA_EVENT_QUEUE_LEN, sizeof(lua_event_t))) {
+        ESP_LOGE(TAG, "Failed to allocate the event queue");
+        return false;
+    }
+    ESP_LOGI(TAG, "Event queue of %u", (unsigned)(s_queue.mask + 1));
+    return true;
+}
+
+static bool push(lua_event_fn_t fn, const void* payload, uint32_t size) {
+    if (s_queue.slots == NULL || size > LUA_EVENT_PAYLOAD_SIZE) {
+        return false;
+    }
+    lua_event_t event = {.fn = fn, .posted_us = (uint32_t)esp_timer_get_time()};
+    memcpy(event.payload, payload, size);
+    if (!lua_mpsc_ring_push(&s_queue, &event)) {
+        return false;
+    }
+    __atomic_add_fetch(&s_posted, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool lua_event_loop_post(lua_event_fn_t fn, const void* payload, uint32_t size) {
+    if (!push(fn, payload, size)) {
+        return false;
+    }
+    TaskHandle_t owner = s_owner;
+    if (owner != NULL) {
+        xTaskNotifyGive(owner);
+    }
+    return true;
+}
+
+bool lua_event_loop_post_from_isr(lua_event_fn_t fn, const void* payload, uint32_t size, BaseType_t* woken) {
+    if (!push(fn, payload, size)) {
+        return false;
+    }
+    TaskHandle_t owner = s_owner;
+    if (owner != NULL) {
+        vTaskNotifyGiveFromISR(owner, woken);
+    }
+    return true;
+}
+
+int lua_event_loop_drain(lua_State* L, uint32_t budget_us) {
+    if (s_queue.slots == NULL) {
+        return 0;
+    }
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (s_owner != self) {
+        s_owner = self;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    int handled = 0;
+    lua_event_t event;
+    while (lua_mpsc_ring_pop(&s_queue, &event)) {
+        uint32_t latency_us = (uint32_t)esp_timer_get_time() - event.posted_us;
+        s_latency_us_sum += latency_us;
+        s_latency_count++;
+        if (latency_us > s_stats.latency_us_max) {
+            s_stats.latency_us_max = latency_us;
+        }
+        event.fn(L, event.payload);
+        handled++;
+        if (esp_timer_get_time() - start_us >= budget_us) {
+            // The rest waits for the next frame rather than delaying this one
+            if (lua_mpsc_ring_depth(&s_queue) > 0) {
+                s_stats.deferred++;
+            }
+            break;
+        }
+    }
+    s_stats.handled += handled;
+
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (handled > 0 && us > s_stats.drain_us_max) {
+        s_stats.drain_us_max = us;
+    }
+    return handled;
+}
+
+uint32_t lua_event_loop_depth(void) {
+    return s_queue.slots != NULL ? lua_mpsc_ring_depth(&s_queue) : 0;
+}
+
+void lua_event_loop_get_stats(lua_event_loop_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.posted = __atomic_load_n(&s_posted, __ATOMIC_RELAXED);
+    s_stats.dropped = __atomic_load_n(&s_queue.dropped, __ATOMIC_RELAXED);
+    s_stats.depth = lua_event_loop_depth();
+    s_stats.depth_high_water = __atomic_load_n(&s_queue.high_water, __ATOMIC_RELAXED);
+    s_stats.latency_us_avg = s_latency_count ? (uint32_t)(s_latency_us_sum / s_latency_count) : 0;
+    *stats = s_stats;
+
+    s_latency_us_sum = 0;
+    s_latency_count = 0;
+    s_stats.latency_us_max = 0;
+    s_stats.drain_us_max = 0;
+}
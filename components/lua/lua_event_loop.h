@@ -0,0 +1,89 @@
+#ifndef LUA_EVENT_LOOP_H
+#define LUA_EVENT_LOOP_H
+
+#include "lua.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Payload of an event posted to the task that runs Lua
+#define LUA_EVENT_PAYLOAD_SIZE 16
+
+// Runs on the task that runs Lua with the payload that was posted
+typedef void (*lua_event_fn_t)(lua_State* L, void* payload);
+
+typedef struct {
+    uint32_t posted;            // Events queued since boot
+    uint32_t dropped;           // Posts refused because the queue was full
+    uint32_t handled;           // Events run
+    uint32_t depth;             // Events queued right now
+    uint32_t depth_high_water;  // Most events queued at once
+    uint32_t deferred;          // Drains that ran out of budget with events left
+    uint32_t latency_us_avg;    // From posting to running, averaged over the last window
+    uint32_t latency_us_max;
+    uint32_t drain_us_max;      // Longest drain of the last window
+} lua_event_loop_stats_t;
+
+/**
+ * @brief Allocate the event queue (CONFIG_LUA_EVENT_QUEUE_LEN)
+ * @return bool false if it can't be allocated
+ *
+ * Called by lua_engine_init(); the queue outlives the state, later calls
+ * do nothing.
+ */
+bool lua_event_loop_init(void);
+
+/**
+ * @brief Queue an event for the task that runs Lua; any task, never blocks
+ * @param fn Handler
+ * @param payload Copied, at most LUA_EVENT_PAYLOAD_SIZE bytes
+ * @param size Size of payload
+ * @return bool false if the queue is full or missing; the event is dropped
+ *
+ * Wakes the task that last drained the queue, for loops that wait on task
+ * notifications like lua_vm_task_run().
+ */
+bool lua_event_loop_post(lua_event_fn_t fn, const void* payload, uint32_t size);
+
+/**
+ * @brief lua_event_loop_post() for interrupt handlers
+ * @param fn Handler
+ * @param payload Copied, at most LUA_EVENT_PAYLOAD_SIZE bytes
+ * @param size Size of payload
+ * @param woken Set to pdTRUE if a context switch should be requested on exit
+ * @return bool false if the queue is full or missing; the event is dropped
+ */
+bool lua_event_loop_post_from_isr(lua_event_fn_t fn, const void* payload, uint32_t size, BaseType_t* woken);
+
+/**
+ * @brief Run queued events in the order they were posted
+ * @param L Lua state the handlers run on
+ * @param budget_us Stop starting new events after this long; at least one runs
+ * @return int Number of events run
+ *
+ * Call it from the task that runs Lua, once per frame, e.g. right after
+ * lv_timer_handler(). Events left over wait for the next call.
+ */
+int lua_event_loop_drain(lua_State* L, uint32_t budget_us);
+
+/**
+ * @brief Number of events queued
+ * @return uint32_t
+ */
+uint32_t lua_event_loop_depth(void);
+
+/**
+ * @brief Get the queue statistics; the averages and maxima restart each call
+ * @param stats Destination structure
+ */
+void lua_event_loop_get_stats(lua_event_loop_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_EVENT_LOOP_H
@@ -0,0 +1,499 @@
+#include "lua_hot_reload.h"
+#include "lua_engine.h"
+#include "lua_app_bundle.h"
+#include "lua_bytecode_cache.h"
+#include "lauxlib.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "sdcard_driver.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *TAG = "LUA_RELOAD";
+
+// system.on_reload() handlers by module name; "" holds the app's
+#define RELOAD_HANDLERS_KEY "lua_hot_reload.handlers"
+
+static lua_hot_reload_stats_t s_stats = {0};
+
+#if CONFIG_LUA_HOT_RELOAD
+typedef enum {
+    ORIGIN_OTHER,           // C library, package.preload, or not loaded
+    ORIGIN_FILE,
+    ORIGIN_BUNDLE,
+} module_origin_t;
+
+typedef struct {
+    char* name;
+    char* path;             // ORIGIN_FILE
+    module_origin_t origin;
+    uint32_t size;          // ORIGIN_FILE: size and mtime of the version running
+    int64_t mtime;
+    uint32_t crc;           // ORIGIN_BUNDLE: chunk CRC of the version running
+    uint32_t* dependents;   // Modules that require()d this one while they were loading
+    uint32_t dependent_count;
+    uint32_t dependent_capacity;
+} module_t;
+
+// Marks of a scan
+#define MARK_CHANGED    1   // File changed
+#define MARK_RELOADED   2   // ... and its new version ran
+#define MARK_DEPENDENT  3   // Requires a reloaded module, directly or not
+
+#define LOADING_DEPTH 16
+
+// In order of the first require(): a module comes before the ones it requires
+static module_t* s_modules = NULL;
+static uint32_t s_count = 0;
+static uint32_t s_capacity = 0;
+static int s_loading[LOADING_DEPTH];    // Modules being loaded, innermost last
+static int s_loading_depth = 0;
+static bool s_scanning = false;
+static uint32_t s_generation = 0;
+static int64_t s_last_poll_us = 0;
+
+// Bundle file the tracked bundle modules were loaded from
+static char s_bundle_path[128];
+static uint32_t s_bundle_size = 0;
+static int64_t s_bundle_mtime = 0;
+
+static void* reload_realloc(void* ptr, size_t size) {
+    void* p = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p != NULL ? p : heap_caps_realloc(ptr, size, MALLOC_CAP_DEFAULT);
+}
+
+static char* reload_strdup(const char* s) {
+    size_t len = strlen(s) + 1;
+    char* copy = reload_realloc(NULL, len);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+static void forget_modules(void) {
+    for (uint32_t i = 0; i < s_count; i++) {
+        heap_caps_free(s_modules[i].name);
+        heap_caps_free(s_modules[i].path);
+        heap_caps_free(s_modules[i].dependents);
+    }
+    heap_caps_free(s_modules);
+    s_modules = NULL;
+    s_count = 0;
+    s_capacity = 0;
+    s_loading_depth = 0;
+    s_bundle_path[0] = '\0';
+}
+
+static int find_module(const char* name) {
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (strcmp(s_modules[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Index of the module, added if it is new; -1 when out of memory
+static int add_module(const char* name) {
+    int i = find_module(name);
+    if (i >= 0) {
+        return i;
+    }
+    if (s_count == s_capacity) {
+        uint32_t capacity = s_capacity ? s_capacity * 2 : 16;
+        module_t* modules = reload_realloc(s_modules, capacity * sizeof(module_t));
+        if (modules == NULL) {
+            return -1;
+        }
+        s_modules = modules;
+        s_capacity = capacity;
+    }
+    module_t* m = &s_modules[s_count];
+    memset(m, 0, sizeof(*m));
+    m->name = reload_strdup(name);
+    if (m->name == NULL) {
+        return -1;
+    }
+    return (int)s_count++;
+}
+
+static void add_dependent(int module, int dependent) {
+    module_t* m = &s_modules[module];
+    for (uint32_t i = 0; i < m->dependent_count; i++) {
+        if (m->dependents[i] == (uint32_t)dependent) {
+            return;
+        }
+    }
+    if (m->dependent_count == m->dependent_capacity) {
+        uint32_t capacity = m->dependent_capacity ? m->dependent_capacity * 2 : 4;
+        uint32_t* dependents = reload_realloc(m->dependents, capacity * sizeof(uint32_t));
+        if (dependents == NULL) {
+            return;
+        }
+        m->dependents = dependents;
+        m->dependent_capacity = capacity;
+    }
+    m->dependents[m->dependent_count++] = (uint32_t)dependent;
+}
+
+static int loading_module(void) {
+    if (s_loading_depth == 0 || s_loading_depth > LOADING_DEPTH) {
+        return -1;
+    }
+    return s_loading[s_loading_depth - 1];
+}
+
+static void push_loading(int i) {
+    if (s_loading_depth < LOADING_DEPTH) {
+        s_loading[s_loading_depth] = i;
+    }
+    s_loading_depth++;
+}
+
+// Where a module require() just loaded came from, by the loader data the
+// searcher returned: the bundle's path or the module's file
+static void note_origin(int i, const char* loader_data) {
+    module_t* m = &s_modules[i];
+    const char* bundle = lua_app_bundle_file();
+    struct stat st;
+    if (bundle != NULL && strcmp(loader_data, bundle) == 0 && lua_app_bundle_module_crc(m->name, &m->crc)) {
+        m->origin = ORIGIN_BUNDLE;
+        if (strcmp(s_bundle_path, bundle) != 0 && stat(bundle, &st) == 0) {
+            snprintf(s_bundle_path, sizeof(s_bundle_path), "%s", bundle);
+            s_bundle_size = (uint32_t)st.st_size;
+            s_bundle_mtime = (int64_t)st.st_mtime;
+        }
+    } else if (stat(loader_data, &st) == 0) {
+        if (m->path == NULL || strcmp(m->path, loader_data) != 0) {
+            heap_caps_free(m->path);
+            m->path = reload_strdup(loader_data);
+        }
+        m->origin = m->path != NULL ? ORIGIN_FILE : ORIGIN_OTHER;
+        m->size = (uint32_t)st.st_size;
+        m->mtime = (int64_t)st.st_mtime;
+    } else {
+        m->origin = ORIGIN_OTHER;
+    }
+}
+
+// require(name), in place of the stock one (upvalue 1)
+static int hot_require(lua_State* L) {
+    const char* name = luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+    int i = add_module(name);
+    int parent = loading_module();
+    if (i >= 0 && parent >= 0 && parent != i) {
+        add_dependent(i, parent);
+    }
+
+    push_loading(i);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 1);
+    int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+    s_loading_depth--;
+    if (status != LUA_OK) {
+        return lua_error(L);
+    }
+
+    // Only a module loaded just now comes with its loader data
+    if (i >= 0 && lua_gettop(L) >= 3 && lua_type(L, 3) == LUA_TSTRING) {
+        note_origin(i, lua_tostring(L, 3));
+    }
+    return lua_gettop(L) - 1;
+}
+
+// The new version's functions reach its table through upvalues, shared by
+// every closure of the chunk: point them at the old table, which the rest
+// of the app holds
+static void rebind_upvalues(lua_State* L, int fn_idx, int old_idx, int new_idx) {
+    for (int n = 1; lua_getupvalue(L, fn_idx, n) != NULL; n++) {
+        bool is_new = lua_rawequal(L, -1, new_idx);
+        lua_pop(L, 1);
+        if (is_new) {
+            lua_pushvalue(L, old_idx);
+            lua_setupvalue(L, fn_idx, n);
+        }
+    }
+}
+
+// Copies the fields of a module's new table into its old one. Fields only
+// the old one has, like state stored in it at run time, stay.
+static void update_table(lua_State* L, int old_idx, int new_idx) {
+    lua_pushnil(L);
+    while (lua_next(L, new_idx) != 0) {
+        if (lua_type(L, -1) == LUA_TFUNCTION && !lua_iscfunction(L, -1)) {
+            rebind_upvalues(L, lua_gettop(L), old_idx, new_idx);
+        }
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, old_idx);
+    }
+    if (lua_getmetatable(L, new_idx)) {
+        lua_setmetatable(L, old_idx);
+    }
+}
+
+// Loads and runs module i again, like require() would
+static bool reload_module(lua_State* L, int i) {
+    int top = lua_gettop(L);
+    // Both stay put while the module runs, even if s_modules grows
+    const char* name = s_modules[i].name;
+    const char* source = s_modules[i].origin == ORIGIN_FILE ? s_modules[i].path : lua_app_bundle_file();
+
+    int status = s_modules[i].origin == ORIGIN_FILE ? lua_bytecode_cache_loadfile(L, source)
+                                                    : lua_app_bundle_load(L, name);
+    if (status != LUA_OK) {
+        ESP_LOGE(TAG, "Can't reload %s: %s", name,
+                 lua_gettop(L) > top ? lua_tostring(L, -1) : "no longer in the bundle");
+        lua_settop(L, top);
+        return false;
+    }
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);      // top + 2
+    lua_getfield(L, top + 2, name);                             // top + 3: old value
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, RELOAD_HANDLERS_KEY); // top + 4
+    lua_getfield(L, top + 4, name);                             // top + 5: old handler
+    // The new version registers its own handler, if it still has one
+    lua_pushnil(L);
+    lua_setfield(L, top + 4, name);
+
+    lua_engine_fn_t fn = lua_engine_ref_value(L, top + 1);
+    push_loading(i);
+    lua_engine_call_begin(L, fn);
+    lua_pushstring(L, name);
+    lua_pushstring(L, source);
+    status = lua_engine_call_end(L, 2, 1);
+    s_loading_depth--;
+    lua_engine_unref_function(L, fn);
+    if (status != LUA_OK) {
+        // Logged with the traceback; the old version keeps running
+        lua_pushvalue(L, top + 5);
+        lua_setfield(L, top + 4, name);
+        lua_settop(L, top);
+        return false;
+    }
+
+    // Like require(): nil stands for what the chunk put in package.loaded, or true
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_getfield(L, top + 2, name);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            lua_pushboolean(L, 1);
+        }
+    }
+    if (lua_istable(L, top + 3) && lua_istable(L, -1) && !lua_rawequal(L, top + 3, -1)) {
+        update_table(L, top + 3, lua_gettop(L));
+        lua_pushvalue(L, top + 3);
+    }
+    lua_setfield(L, top + 2, name);
+    lua_settop(L, top);
+    return true;
+}
+
+static void call_handler(lua_State* L, const char* owner, int names_idx) {
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, RELOAD_HANDLERS_KEY);
+    lua_getfield(L, -1, owner);
+    lua_remove(L, -2);
+    lua_engine_fn_t fn = lua_engine_ref_value(L, -1);
+    lua_pop(L, 1);
+    if (lua_engine_call_begin(L, fn) != 0) {
+        return;
+    }
+    lua_pushvalue(L, names_idx);
+    lua_engine_call_end(L, 1, 0);
+    lua_engine_unref_function(L, fn);
+    s_stats.hooks++;
+}
+
+// Reopens the bundle when its file was rewritten, so its modules can be
+// compared one by one
+static bool reopen_bundle_if_changed(void) {
+    struct stat st;
+    if (s_bundle_path[0] == '\0' || stat(s_bundle_path, &st) != 0 ||
+        ((uint32_t)st.st_size == s_bundle_size && (int64_t)st.st_mtime == s_bundle_mtime)) {
+        return false;
+    }
+    s_bundle_size = (uint32_t)st.st_size;
+    s_bundle_mtime = (int64_t)st.st_mtime;
+    if (!lua_app_bundle_open(s_bundle_path)) {
+        ESP_LOGE(TAG, "Can't open the new %s; the modules loaded from it keep running", s_bundle_path);
+        return false;
+    }
+    return true;
+}
+
+// Marks the modules whose file changed, and takes their new size, mtime or
+// CRC: a version that fails to load is not retried until it changes again
+static int mark_changed(uint8_t* marks, uint32_t count) {
+    bool bundle_changed = reopen_bundle_if_changed();
+    int changed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        module_t* m = &s_modules[i];
+        struct stat st;
+        uint32_t crc;
+        if (m->origin == ORIGIN_FILE && stat(m->path, &st) == 0 &&
+            ((uint32_t)st.st_size != m->size || (int64_t)st.st_mtime != m->mtime)) {
+            m->size = (uint32_t)st.st_size;
+            m->mtime = (int64_t)st.st_mtime;
+        } else if (m->origin == ORIGIN_BUNDLE && bundle_changed && lua_app_bundle_module_crc(m->name, &crc) &&
+                   crc != m->crc) {
+            m->crc = crc;
+        } else {
+            continue;
+        }
+        marks[i] = MARK_CHANGED;
+        changed++;
+    }
+    return changed;
+}
+
+static void mark_dependents(uint8_t* marks, uint32_t count) {
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (marks[i] != MARK_RELOADED && marks[i] != MARK_DEPENDENT) {
+                continue;
+            }
+            const module_t* m = &s_modules[i];
+            for (uint32_t d = 0; d < m->dependent_count; d++) {
+                uint32_t dependent = m->dependents[d];
+                if (dependent < count && marks[dependent] == 0) {
+                    marks[dependent] = MARK_DEPENDENT;
+                    grew = true;
+                }
+            }
+        }
+    }
+}
+#endif
+
+void lua_hot_reload_install(lua_State* L) {
+#if CONFIG_LUA_HOT_RELOAD
+    // A new state: what was recorded for the last one is of no use
+    forget_modules();
+    lua_getglobal(L, "require");
+    lua_pushcclosure(L, hot_require, 1);
+    lua_setglobal(L, "require");
+    s_generation = sdcard_get_generation();
+#else
+    (void)L;
+#endif
+}
+
+int lua_hot_reload_scan(lua_State* L) {
+#if CONFIG_LUA_HOT_RELOAD
+    if (s_scanning || s_count == 0) {
+        return 0;
+    }
+    uint32_t count = s_count;
+    uint8_t* marks = reload_realloc(NULL, count);
+    if (marks == NULL) {
+        ESP_LOGE(TAG, "Out of memory for a scan of %u modules", (unsigned)count);
+        return 0;
+    }
+    memset(marks, 0, count);
+    s_scanning = true;
+    s_stats.scans++;
+    s_generation = sdcard_get_generation();
+    int64_t start_us = esp_timer_get_time();
+
+    int reloaded = 0;
+    if (mark_changed(marks, count) > 0) {
+        // Modules after the ones they require, so each runs against new versions
+        for (int i = (int)count - 1; i >= 0; i--) {
+            if (marks[i] != MARK_CHANGED) {
+                continue;
+            }
+            if (reload_module(L, i)) {
+                marks[i] = MARK_RELOADED;
+                reloaded++;
+                s_stats.reloads++;
+            } else {
+                marks[i] = 0;
+                s_stats.failures++;
+            }
+        }
+    }
+
+    if (reloaded > 0) {
+        mark_dependents(marks, count);
+        lua_createtable(L, reloaded, 0);
+        int names = lua_gettop(L);
+        int n = 0;
+        for (int i = (int)count - 1; i >= 0; i--) {
+            if (marks[i] == MARK_RELOADED) {
+                lua_pushstring(L, s_modules[i].name);
+                lua_rawseti(L, names, ++n);
+            }
+        }
+        // A screen is rebuilt after the parts it is built from
+        for (int i = (int)count - 1; i >= 0; i--) {
+            if (marks[i] != 0) {
+                call_handler(L, s_modules[i].name, names);
+            }
+        }
+        call_handler(L, "", names);
+        lua_pop(L, 1);
+
+        s_stats.last_scan_us = (uint32_t)(esp_timer_get_time() - start_us);
+        ESP_LOGI(TAG, "Reloaded %d of %u modules in %u us", reloaded, (unsigned)count,
+                 (unsigned)s_stats.last_scan_us);
+    }
+    heap_caps_free(marks);
+    s_scanning = false;
+    return reloaded;
+#else
+    (void)L;
+    return 0;
+#endif
+}
+
+void lua_hot_reload_poll(lua_State* L) {
+#if CONFIG_LUA_HOT_RELOAD && CONFIG_LUA_HOT_RELOAD_POLL_MS > 0
+    int64_t now_us = esp_timer_get_time();
+    if (s_count == 0 || now_us - s_last_poll_us < CONFIG_LUA_HOT_RELOAD_POLL_MS * 1000LL) {
+        return;
+    }
+    s_last_poll_us = now_us;
+    if (sdcard_get_generation() != s_generation) {
+        lua_hot_reload_scan(L);
+    }
+#else
+    (void)L;
+#endif
+}
+
+void lua_hot_reload_set_handler(lua_State* L, int idx) {
+    idx = lua_absindex(L, idx);
+    const char* owner = "";
+#if CONFIG_LUA_HOT_RELOAD
+    int loading = loading_module();
+    if (loading >= 0) {
+        owner = s_modules[loading].name;
+    }
+#endif
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, RELOAD_HANDLERS_KEY);
+    lua_pushvalue(L, idx);
+    lua_setfield(L, -2, owner);
+    lua_pop(L, 1);
+}
+
+void lua_hot_reload_get_stats(lua_hot_reload_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.modules = 0;
+#if CONFIG_LUA_HOT_RELOAD
+    for (uint32_t i = 0; i < s_count; i++) {
+        s_stats.modules += s_modules[i].origin != ORIGIN_OTHER;
+    }
+#endif
+    *stats = s_stats;
+}
@@ -0,0 +1,74 @@
+#ifndef LUA_HOT_RELOAD_H
+#define LUA_HOT_RELOAD_H
+
+#include "lua.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t modules;       // Modules require()d from the SD card or the app bundle
+    uint32_t scans;         // Checks of their files since boot
+    uint32_t reloads;       // Modules run again because their file changed
+    uint32_t failures;      // ... that failed to load or run; their old version stays
+    uint32_t hooks;         // system.on_reload() handlers called
+    uint32_t last_scan_us;  // Duration of the last scan that reloaded something, handlers included
+} lua_hot_reload_stats_t;
+
+/**
+ * @brief Replace the global require() with one that records which modules
+ *        came from the SD card or the app bundle, and who required them
+ * @param L Lua state, from lua_engine_init()
+ *
+ * Does nothing without CONFIG_LUA_HOT_RELOAD.
+ */
+void lua_hot_reload_install(lua_State* L);
+
+/**
+ * @brief Run the modules whose file changed since they were loaded again
+ * @param L Lua state
+ * @return int Number of modules reloaded
+ *
+ * Files are compared by size and mtime, bundle modules by the CRC of their
+ * chunk once the bundle file itself changed. A reloaded module that returns
+ * a table has its fields copied into the table it returned before, which
+ * stays in package.loaded: modules holding it see the new functions without
+ * being run again. Then the handlers registered with system.on_reload() by
+ * the reloaded modules, by the modules that required them, directly or not,
+ * and by the app are called, in that order. A module that fails to load or
+ * run is logged and its old version kept.
+ */
+int lua_hot_reload_scan(lua_State* L);
+
+/**
+ * @brief Scan when the SD card changed, at most every CONFIG_LUA_HOT_RELOAD_POLL_MS
+ * @param L Lua state
+ *
+ * Only looks at sdcard_get_generation() otherwise. Call it from the task
+ * that runs Lua, e.g. next to lua_engine_poll_memory().
+ */
+void lua_hot_reload_poll(lua_State* L);
+
+/**
+ * @brief Register the reload handler of the module being loaded
+ * @param L Lua state
+ * @param idx Stack index of the handler, or of nil to remove it
+ *
+ * Outside of a module's loading the handler is the app's, called last.
+ * Handlers get an array of the names of the modules that were reloaded.
+ */
+void lua_hot_reload_set_handler(lua_State* L, int idx);
+
+/**
+ * @brief Get the reload counters since boot
+ * @param stats Destination structure
+ */
+void lua_hot_reload_get_stats(lua_hot_reload_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_HOT_RELOAD_H
@@ -0,0 +1,274 @@
+#include "lua_module_index.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "sdcard_driver.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *TAG = "LUA_MODINDEX";
+
+static lua_module_index_stats_t s_stats = {0};
+
+#if CONFIG_LUA_MODULE_INDEX
+typedef struct {
+    uint32_t hash;          // name_hash() of the module name
+    uint32_t path_offset;   // Into paths: relative to the mount point, e.g. "APP/main/main.lua"
+    uint32_t size;
+} index_entry_t;
+
+typedef struct {
+    index_entry_t* entries;
+    uint32_t count;
+    uint32_t capacity;
+    char* paths;
+    size_t paths_size;
+    size_t paths_capacity;
+    uint32_t* slots;        // Open addressing on the hash: entry index + 1, 0 = empty
+    uint32_t slot_mask;
+} module_index_t;
+
+typedef struct {
+    module_index_t* index;
+    const char* dir;        // Directory being listed, relative to the mount point
+    char** pending;         // Subdirectories still to be listed
+    size_t pending_count;
+    size_t pending_capacity;
+    bool failed;
+} index_walk_t;
+
+static module_index_t s_index;
+static bool s_valid = false;        // s_index describes the card
+static bool s_built = false;        // A build was attempted for s_generation
+static uint32_t s_generation = 0;
+
+static void* index_realloc(void* ptr, size_t size) {
+    void* p = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p != NULL ? p : heap_caps_realloc(ptr, size, MALLOC_CAP_DEFAULT);
+}
+
+static void index_free(module_index_t* index) {
+    heap_caps_free(index->entries);
+    heap_caps_free(index->paths);
+    heap_caps_free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
+
+// FAT names match case-insensitively, and require() turns '.' into '/'
+static inline char fold(char c) {
+    return c == '/' ? '.' : (char)tolower((unsigned char)c);
+}
+
+// FNV-1a over the folded name
+static uint32_t name_hash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)fold(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+static bool name_matches(const char* name, size_t len, const char* rel) {
+    if (strlen(rel) != len + 4) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (fold(name[i]) != fold(rel[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool index_add(module_index_t* index, const char* rel, size_t size) {
+    if (index->count == CONFIG_LUA_MODULE_INDEX_MAX_MODULES) {
+        ESP_LOGW(TAG, "More than %d modules on the card, not indexing", CONFIG_LUA_MODULE_INDEX_MAX_MODULES);
+        return false;
+    }
+    if (index->count == index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : 64;
+        index_entry_t* entries = index_realloc(index->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return false;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    size_t rel_size = strlen(rel) + 1;
+    if (index->paths_size + rel_size > index->paths_capacity) {
+        size_t capacity = index->paths_capacity ? index->paths_capacity * 2 : 2048;
+        while (capacity < index->paths_size + rel_size) capacity *= 2;
+        char* paths = index_realloc(index->paths, capacity);
+        if (paths == NULL) {
+            return false;
+        }
+        index->paths = paths;
+        index->paths_capacity = capacity;
+    }
+
+    index_entry_t* e = &index->entries[index->count++];
+    e->hash = name_hash(rel, rel_size - 1 - 4); // Without ".lua"
+    e->path_offset = (uint32_t)index->paths_size;
+    e->size = (uint32_t)size;
+    memcpy(index->paths + index->paths_size, rel, rel_size);
+    index->paths_size += rel_size;
+    return true;
+}
+
+static bool index_push_dir(index_walk_t* walk, const char* rel) {
+    if (walk->pending_count == walk->pending_capacity) {
+        size_t capacity = walk->pending_capacity ? walk->pending_capacity * 2 : 16;
+        char** pending = realloc(walk->pending, capacity * sizeof(*pending));
+        if (pending == NULL) {
+            return false;
+        }
+        walk->pending = pending;
+        walk->pending_capacity = capacity;
+    }
+    char* dir = strdup(rel);
+    if (dir == NULL) {
+        return false;
+    }
+    walk->pending[walk->pending_count++] = dir;
+    return true;
+}
+
+// sdcard_list_files() callback. Subdirectories are queued rather than
+// listed from here, so only one directory is open at a time.
+static void index_walk_entry(const char* filename, uint8_t type, size_t size, void* user_data) {
+    index_walk_t* walk = (index_walk_t*)user_data;
+    if (walk->failed || filename[0] == '.') {
+        return; // Hidden entries, including the bytecode cache
+    }
+
+    // require() turns every '.' of the name into '/', so a dot anywhere but
+    // in a file's ".lua" suffix makes the file unreachable
+    size_t len = strlen(filename);
+    const char* dot = strchr(filename, '.');
+    char rel[256];
+    int n = snprintf(rel, sizeof(rel), "%s%s%s", walk->dir, walk->dir[0] ? "/" : "", filename);
+    if (n < 0 || (size_t)n >= sizeof(rel)) {
+        return;
+    }
+
+    if (type == DT_DIR) {
+        if (dot == NULL && !index_push_dir(walk, rel)) {
+            walk->failed = true;
+        }
+    } else if (type == DT_REG && len > 4 && dot == filename + len - 4 && strcasecmp(dot, ".lua") == 0) {
+        if (!index_add(walk->index, rel, size)) {
+            walk->failed = true;
+        }
+    }
+}
+
+static bool index_build(module_index_t* index) {
+    index_walk_t walk = {.index = index};
+    bool ok = index_push_dir(&walk, "");
+    while (ok && walk.pending_count > 0) {
+        char* dir = walk.pending[--walk.pending_count];
+        walk.dir = dir;
+        ok = sdcard_list_files(dir[0] ? dir : "/", index_walk_entry, &walk) == ESP_OK && !walk.failed;
+        free(dir);
+    }
+    while (walk.pending_count > 0) {
+        free(walk.pending[--walk.pending_count]);
+    }
+    free(walk.pending);
+    if (!ok) {
+        return false;
+    }
+
+    uint32_t slot_count = 16;
+    while (slot_count < index->count * 2) slot_count *= 2;
+    index->slots = index_realloc(NULL, slot_count * sizeof(*index->slots));
+    if (index->slots == NULL) {
+        return false;
+    }
+    memset(index->slots, 0, slot_count * sizeof(*index->slots));
+    index->slot_mask = slot_count - 1;
+    for (uint32_t i = 0; i < index->count; i++) {
+        uint32_t slot = index->entries[i].hash & index->slot_mask;
+        while (index->slots[slot] != 0) {
+            slot = (slot + 1) & index->slot_mask;
+        }
+        index->slots[slot] = i + 1;
+    }
+    return true;
+}
+
+static void index_rebuild(void) {
+    index_free(&s_index);
+    int64_t start_us = esp_timer_get_time();
+    s_valid = index_build(&s_index);
+    s_stats.builds++;
+    s_stats.build_us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (!s_valid) {
+        index_free(&s_index);
+        ESP_LOGW(TAG, "Module index unavailable, require() will search the card");
+    } else {
+        ESP_LOGI(TAG, "Indexed %u modules on the card in %u us", (unsigned)s_index.count,
+                 (unsigned)s_stats.build_us);
+    }
+    s_stats.modules = s_index.count;
+}
+#endif
+
+lua_module_index_result_t lua_module_index_lookup(const char* module_name, char* path, size_t path_size,
+                                                  size_t* size) {
+#if CONFIG_LUA_MODULE_INDEX
+    if (!sdcard_is_mounted()) {
+        return LUA_MODULE_INDEX_UNKNOWN;
+    }
+
+    // A failed build is not retried until the card changes
+    uint32_t generation = sdcard_get_generation();
+    if (!s_built || generation != s_generation) {
+        index_rebuild();
+        s_generation = generation;
+        s_built = true;
+    }
+    if (!s_valid) {
+        return LUA_MODULE_INDEX_UNKNOWN;
+    }
+
+    size_t len = strlen(module_name);
+    uint32_t hash = name_hash(module_name, len);
+    for (uint32_t slot = hash & s_index.slot_mask; s_index.slots[slot] != 0;
+         slot = (slot + 1) & s_index.slot_mask) {
+        const index_entry_t* e = &s_index.entries[s_index.slots[slot] - 1];
+        const char* rel = s_index.paths + e->path_offset;
+        if (e->hash == hash && name_matches(module_name, len, rel)) {
+            int n = snprintf(path, path_size, "%s/%s", SDCARD_MOUNT_POINT, rel);
+            if (n < 0 || (size_t)n >= path_size) {
+                return LUA_MODULE_INDEX_UNKNOWN;
+            }
+            if (size != NULL) {
+                *size = e->size;
+            }
+            s_stats.hits++;
+            return LUA_MODULE_INDEX_FOUND;
+        }
+    }
+    s_stats.misses++;
+    return LUA_MODULE_INDEX_ABSENT;
+#else
+    (void)module_name;
+    (void)path;
+    (void)path_size;
+    (void)size;
+    return LUA_MODULE_INDEX_UNKNOWN;
+#endif
+}
+
+void lua_module_index_get_stats(lua_module_index_stats_t* stats) {
+    if (stats != NULL) {
+        *stats = s_stats;
+    }
+}
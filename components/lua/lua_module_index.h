@@ -0,0 +1,54 @@
+#ifndef LUA_MODULE_INDEX_H
+#define LUA_MODULE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    LUA_MODULE_INDEX_FOUND,     // The module is on the card, path filled in
+    LUA_MODULE_INDEX_ABSENT,    // The module is not on the card
+    LUA_MODULE_INDEX_UNKNOWN,   // No usable index: look at the filesystem
+} lua_module_index_result_t;
+
+typedef struct {
+    uint32_t modules;       // .lua files in the current index
+    uint32_t builds;        // Directory walks since boot
+    uint32_t build_us;      // Duration of the last walk
+    uint32_t hits;          // Lookups answered with a path
+    uint32_t misses;        // Lookups answered "absent" without touching the card
+} lua_module_index_stats_t;
+
+/**
+ * @brief Resolve a require() name against the index of the SD card's .lua files
+ * @param module_name Name as passed to require(), e.g. "APP.main.gui_guider"
+ * @param path Receives the file path on LUA_MODULE_INDEX_FOUND
+ * @param path_size Size of path
+ * @param size Receives the file size on LUA_MODULE_INDEX_FOUND (may be NULL)
+ * @return lua_module_index_result_t
+ *
+ * The index is built from sdcard_list_files() on the first lookup after
+ * the card was mounted, and rebuilt on the first lookup after anything the
+ * driver counts as a change (sdcard_get_generation(), which io and os
+ * writes under /sdcard also move). It is UNKNOWN when
+ * the card is not mounted, the walk failed or ran out of memory, or the
+ * card holds more modules than CONFIG_LUA_MODULE_INDEX_MAX_MODULES; builds
+ * without CONFIG_LUA_MODULE_INDEX always return UNKNOWN.
+ */
+lua_module_index_result_t lua_module_index_lookup(const char* module_name, char* path, size_t path_size,
+                                                  size_t* size);
+
+/**
+ * @brief Get the index counters since boot
+ * @param stats Destination structure
+ */
+void lua_module_index_get_stats(lua_module_index_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_MODULE_INDEX_H
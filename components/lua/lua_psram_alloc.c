@@ -1,56 +1,648 @@
 #include "lua_psram_alloc.h"
+#include "lua_slab.h"
+#include "lua_tlsf.h"
+#include "lua_alloc_trace.h"
+#include "esp_memory_utils.h"
+#include "sdkconfig.h"
+#include "lobject.h"
+#include "lmem.h"
+#include "lstate.h"
+#include "lgc.h"
 #include <string.h>
 
 static const char *TAG = "LUA_PSRAM_ALLOC";
 
-// Memory usage tracking
-typedef struct {
-    size_t total_allocated;
-    size_t psram_allocated;
-    size_t internal_allocated;
-    size_t peak_total;
-    size_t peak_psram;
-    size_t peak_internal;
-    uint32_t alloc_count;
-    uint32_t free_count;
-} lua_memory_stats_t;
-
 static lua_memory_stats_t g_lua_memory_stats = {0};
 
-// Memory allocation thresholds
-#define LUA_PSRAM_MIN_SIZE 16       // Lower threshold for PSRAM allocation
-#define LUA_LARGE_ALLOC_SIZE 256    // Size considered "large"
-#define LUA_FORCE_PSRAM_SIZE 16     // Force PSRAM for almost everything
+// Heap budget (0 = unlimited). Usage must fall 1/8 below the soft limit
+// before another low-memory event can fire, so GC sawtooth doesn't spam it.
+static size_t s_soft_limit = (size_t)CONFIG_LUA_HEAP_SOFT_LIMIT_KB * 1024;
+static size_t s_hard_limit = (size_t)CONFIG_LUA_HEAP_HARD_LIMIT_KB * 1024;
+static bool s_above_soft_limit = false;
+static volatile bool s_low_memory_pending = false;
 
-// Simple, safe, and robust allocator using default heap capabilities.
-void* lua_psram_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
-    (void)ud; (void)osize; // Unused parameters
+static const char* const s_tag_names[LUA_ALLOC_TAG_COUNT] = {
+    "string", "table", "function", "userdata", "thread", "upvalue", "proto",
+    "stack", "callinfo", "array", "hash", "strtab", "other"
+};
+
+#if CONFIG_LUA_ALLOC_TAGGING
+// Prefix of every block while tagging is on; 8 bytes keeps payload alignment
+typedef union {
+    uint8_t tag;
+    uint64_t align;
+} lua_alloc_tag_hdr_t;
+
+static lua_alloc_tag_stats_t g_lua_tag_stats[LUA_ALLOC_TAG_COUNT];
+#endif
+
+// Placement rules for fresh blocks, checked in order; the first match wins.
+// Blocks no rule matches take the default path (slabs, pool, heap).
+static lua_place_rule_t s_place_rules[LUA_PLACE_MAX_RULES];
+static int s_place_count = 0;
+static uint32_t s_place_unmatched = 0;
+
+static const char* const s_region_names[] = {"default", "internal", "psram"};
+
+// Internal RAM for the blocks rules send there that the slabs don't take,
+// reserved once with CONFIG_LUA_PLACE_INTERNAL_KB; past it they go to PSRAM
+static lua_tlsf_t* s_internal_pool = NULL;
+static uint32_t s_internal_spills = 0;  // Blocks placed or grown in PSRAM instead
+
+#if CONFIG_LUA_TLSF_POOL
+// Private PSRAM pool owned by the Lua heap, carved out in lua_newstate_psram()
+static lua_tlsf_t* s_pool = NULL;
+static uint32_t s_pool_spills = 0;
+#endif
+
+#if CONFIG_LUA_LOAD_ARENA
+// Bump arena for the untagged blocks the parser, code generator and undump
+// create inside lua_load(). Nothing in it is ever freed individually: the
+// finished Proto arrays are copied out when the load ends and the arena is
+// rewound. The region stays reserved, so stale frees of arena blocks (e.g.
+// from a luaL_Buffer box collected later) stay harmless no-ops.
+#define LUA_ARENA_ALIGN 8
+
+static uint8_t* s_arena = NULL;
+static size_t s_arena_size = 0;
+static size_t s_arena_top = 0;
+static uint8_t* s_arena_last = NULL;    // Most recent block, may grow in place
+static int s_arena_depth = 0;           // Nested lua_load() calls
+static bool s_arena_promoting = false;  // Reallocs move arena blocks to the heap
+static bool s_arena_failed = false;     // A load in this session raised an error
+static bool s_arena_pinned = false;     // Arena holds live data and can't be rewound
+#endif
+
+// Fresh block outside the slabs: private pool first, then the shared heap,
+// which prefers PSRAM under MALLOC_CAP_DEFAULT.
+static void* lua_alloc_fresh(size_t nsize) {
+#if CONFIG_LUA_TLSF_POOL
+    if (s_pool != NULL) {
+        void* new_ptr = lua_tlsf_malloc(s_pool, nsize);
+        if (new_ptr != NULL) {
+            return new_ptr;
+        }
+        s_pool_spills++;
+    }
+#endif
+    return heap_caps_malloc(nsize, MALLOC_CAP_DEFAULT);
+}
+
+#if CONFIG_LUA_LOAD_ARENA
+static inline bool lua_arena_owns(const void* ptr) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return p >= s_arena && p < s_arena + s_arena_size;
+}
+
+static void* lua_arena_alloc(size_t nsize) {
+    size_t size = (nsize + LUA_ARENA_ALIGN - 1) & ~(size_t)(LUA_ARENA_ALIGN - 1);
+    if (size > s_arena_size - s_arena_top) {
+        g_lua_memory_stats.arena_overflows++;
+        return NULL;
+    }
+    s_arena_last = s_arena + s_arena_top;
+    s_arena_top += size;
+    if (s_arena_top > g_lua_memory_stats.arena_peak) g_lua_memory_stats.arena_peak = s_arena_top;
+    return s_arena_last;
+}
+
+// Parser vectors grow by doubling, so the newest block is usually the one
+// being resized and can simply be extended in place.
+static void* lua_arena_realloc(void* ptr, size_t osize, size_t nsize) {
+    if (s_arena_promoting || s_arena_depth == 0) {
+        void* new_ptr = lua_alloc_fresh(nsize);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, ptr, osize < nsize ? osize : nsize);
+        }
+        return new_ptr;
+    }
+    if (ptr == s_arena_last) {
+        size_t offset = (uint8_t*)ptr - s_arena;
+        size_t size = (nsize + LUA_ARENA_ALIGN - 1) & ~(size_t)(LUA_ARENA_ALIGN - 1);
+        if (size <= s_arena_size - offset) {
+            s_arena_top = offset + size;
+            if (s_arena_top > g_lua_memory_stats.arena_peak) g_lua_memory_stats.arena_peak = s_arena_top;
+            return ptr;
+        }
+    } else if (nsize <= osize) {
+        return ptr;
+    }
+
+    void* new_ptr = lua_arena_alloc(nsize);
+    if (new_ptr == NULL) {
+        new_ptr = lua_alloc_fresh(nsize);
+        if (new_ptr == NULL) {
+            return NULL;
+        }
+    }
+    memcpy(new_ptr, ptr, osize < nsize ? osize : nsize);
+    return new_ptr;
+}
+#endif
+
+static void lua_free_block(void *ptr) {
+#if CONFIG_LUA_LOAD_ARENA
+    if (lua_arena_owns(ptr)) {
+        return; // Reclaimed when the arena is rewound
+    }
+#endif
+#if CONFIG_LUA_SLAB_ALLOC
+    if (lua_slab_owns(ptr)) {
+        lua_slab_free(ptr);
+        return;
+    }
+#endif
+#if CONFIG_LUA_TLSF_POOL
+    if (lua_tlsf_owns(s_pool, ptr)) {
+        lua_tlsf_free(s_pool, ptr);
+        return;
+    }
+#endif
+    if (lua_tlsf_owns(s_internal_pool, ptr)) {
+        lua_tlsf_free(s_internal_pool, ptr);
+        return;
+    }
+    heap_caps_free(ptr);
+}
+
+// The internal pool is full: a block placed there moves to PSRAM to grow
+static void* lua_spill_internal(void* ptr, size_t osize, size_t nsize) {
+    void* new_ptr = heap_caps_malloc(nsize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (new_ptr == NULL) {
+        new_ptr = lua_alloc_fresh(nsize);
+        if (new_ptr == NULL) {
+            return NULL;
+        }
+    }
+    s_internal_spills++;
+    memcpy(new_ptr, ptr, osize < nsize ? osize : nsize);
+    lua_tlsf_free(s_internal_pool, ptr);
+    return new_ptr;
+}
+
+#if CONFIG_LUA_SLAB_ALLOC || CONFIG_LUA_TLSF_POOL
+// Move a block to a different backend when it no longer fits where it is.
+// Lua always passes the true old size for live blocks, so osize bytes are valid.
+static void* lua_move_block(void *ptr, size_t osize, size_t nsize) {
+    void* new_ptr = NULL;
+#if CONFIG_LUA_SLAB_ALLOC
+    new_ptr = lua_slab_alloc(nsize);
+#endif
+    if (new_ptr == NULL) {
+        new_ptr = lua_alloc_fresh(nsize);
+        if (new_ptr == NULL) {
+            return NULL;
+        }
+    }
+    memcpy(new_ptr, ptr, osize < nsize ? osize : nsize);
+    lua_free_block(ptr);
+    return new_ptr;
+}
+#endif
+
+// Map the tag Lua passes for a new block to an accounting category
+static uint8_t lua_alloc_tag_from_lua(int lua_tag) {
+    switch (lua_tag) {
+        case LUAM_TAG_STACK: return LUA_ALLOC_TAG_STACK;
+        case LUAM_TAG_CALLINFO: return LUA_ALLOC_TAG_CALLINFO;
+        case LUAM_TAG_ARRAY: return LUA_ALLOC_TAG_ARRAY;
+        case LUAM_TAG_HASH: return LUA_ALLOC_TAG_HASH;
+        case LUAM_TAG_STRTAB: return LUA_ALLOC_TAG_STRTAB;
+        default: break;
+    }
+    switch (novariant(lua_tag)) {
+        case LUA_TSTRING: return LUA_ALLOC_TAG_STRING;
+        case LUA_TTABLE: return LUA_ALLOC_TAG_TABLE;
+        case LUA_TFUNCTION: return LUA_ALLOC_TAG_FUNCTION;
+        case LUA_TUSERDATA: return LUA_ALLOC_TAG_USERDATA;
+        case LUA_TTHREAD: return LUA_ALLOC_TAG_THREAD;
+        case LUA_TUPVAL: return LUA_ALLOC_TAG_UPVAL;
+        case LUA_TPROTO: return LUA_ALLOC_TAG_PROTO;
+        default: return LUA_ALLOC_TAG_OTHER;
+    }
+}
+
+// Serve a fresh block from the region the first matching rule asks for.
+// Returns NULL to fall through to the default path: no rule matched, the
+// rule says "default", or the region and PSRAM are both exhausted.
+static void* lua_place_fresh(size_t nsize, int lua_tag) {
+    uint8_t tag = lua_alloc_tag_from_lua(lua_tag);
+    for (int i = 0; i < s_place_count; i++) {
+        lua_place_rule_t* rule = &s_place_rules[i];
+        if ((rule->tag != LUA_PLACE_ANY_TAG && rule->tag != tag) || nsize < rule->min_size ||
+            (rule->max_size != 0 && nsize > rule->max_size)) {
+            continue;
+        }
+
+        rule->hits++;
+        void* new_ptr = NULL;
+        if (rule->region == LUA_PLACE_INTERNAL) {
+#if CONFIG_LUA_SLAB_ALLOC
+            new_ptr = lua_slab_alloc(nsize);
+#endif
+            if (new_ptr == NULL && s_internal_pool != NULL) {
+                new_ptr = lua_tlsf_malloc(s_internal_pool, nsize);
+            }
+            if (new_ptr == NULL) {
+                // Over budget: PSRAM, not wherever the default heap finds room
+                rule->fallbacks++;
+                s_internal_spills++;
+                return heap_caps_malloc(nsize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            }
+            return new_ptr;
+        } else if (rule->region == LUA_PLACE_PSRAM) {
+#if CONFIG_LUA_TLSF_POOL
+            if (s_pool != NULL) {
+                new_ptr = lua_tlsf_malloc(s_pool, nsize);
+            }
+#endif
+            if (new_ptr == NULL) {
+                new_ptr = heap_caps_malloc(nsize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            }
+        } else {
+            return NULL;
+        }
+
+        if (new_ptr == NULL) {
+            rule->fallbacks++;
+        }
+        return new_ptr;
+    }
 
+    s_place_unmatched++;
+    return NULL;
+}
+
+// Untagged blocks created while a chunk is being loaded come from the load
+// arena, then the placement rules get a say. By default small blocks are
+// served from internal-RAM slabs and the rest from the private pool (when
+// enabled) or the default heap capabilities. A block that is resized stays
+// in the memory it was placed in.
+static void* lua_alloc_block(void *ptr, size_t osize, size_t nsize, int lua_tag) {
     if (nsize == 0) {
-        heap_caps_free(ptr);
+        lua_free_block(ptr);
         return NULL;
     }
 
-    // Use heap_caps_realloc_default which is smart about PSRAM.
-    // It will try to allocate from PSRAM first if available and the size is appropriate.
-    // This single call handles malloc (ptr=NULL), realloc, and free (nsize=0) correctly.
-    void* new_ptr = heap_caps_realloc(ptr, nsize, MALLOC_CAP_DEFAULT);
+    void* new_ptr = NULL;
+    if (ptr == NULL) {
+#if CONFIG_LUA_LOAD_ARENA
+        if (lua_tag == 0 && s_arena_depth > 0 && s_arena != NULL && !s_arena_pinned) {
+            new_ptr = lua_arena_alloc(nsize);
+        }
+#endif
+        if (new_ptr == NULL && s_place_count > 0) {
+            new_ptr = lua_place_fresh(nsize, lua_tag);
+        }
+#if CONFIG_LUA_SLAB_ALLOC
+        if (new_ptr == NULL) {
+            new_ptr = lua_slab_alloc(nsize);
+        }
+#endif
+        if (new_ptr == NULL) {
+            new_ptr = lua_alloc_fresh(nsize);
+        }
+    }
+#if CONFIG_LUA_LOAD_ARENA
+    else if (lua_arena_owns(ptr)) {
+        new_ptr = lua_arena_realloc(ptr, osize, nsize);
+    }
+#endif
+#if CONFIG_LUA_SLAB_ALLOC
+    else if (lua_slab_owns(ptr)) {
+        if (nsize <= lua_slab_block_size(ptr)) {
+            return ptr; // Still fits in its class
+        }
+        new_ptr = lua_move_block(ptr, osize, nsize);
+    }
+#endif
+#if CONFIG_LUA_TLSF_POOL
+    else if (lua_tlsf_owns(s_pool, ptr)) {
+        new_ptr = lua_tlsf_realloc(s_pool, ptr, nsize);
+        if (new_ptr == NULL) {
+            new_ptr = lua_move_block(ptr, osize, nsize); // Pool full: spill to the heap
+        }
+    }
+#endif
+    else if (lua_tlsf_owns(s_internal_pool, ptr)) {
+        new_ptr = lua_tlsf_realloc(s_internal_pool, ptr, nsize);
+        if (new_ptr == NULL) {
+            new_ptr = lua_spill_internal(ptr, osize, nsize);
+        }
+    }
+    else {
+        (void)osize;
+        uint32_t caps = esp_ptr_external_ram(ptr) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+        new_ptr = heap_caps_realloc(ptr, nsize, caps | MALLOC_CAP_8BIT);
+        if (new_ptr == NULL) {
+            new_ptr = heap_caps_realloc(ptr, nsize, MALLOC_CAP_DEFAULT);
+        }
+    }
 
-    if (new_ptr == NULL && nsize > 0) {
+    if (new_ptr == NULL) {
         ESP_LOGE(TAG, "Failed to allocate or reallocate %zu bytes for Lua", nsize);
     }
-    
-    // Optional: Add simplified statistics tracking here if needed, but for now,
-    // focus on stability. The complex tracking was a source of confusion.
 
     return new_ptr;
 }
 
+// log2 bucket of a block size; the last bucket collects everything larger
+static inline int lua_mem_bucket(size_t size) {
+    int bucket = 32 - __builtin_clz((uint32_t)size);
+    return bucket < LUA_MEM_HIST_BUCKETS ? bucket : LUA_MEM_HIST_BUCKETS - 1;
+}
+
+static inline void lua_mem_account_add(const void *ptr, size_t size) {
+    lua_memory_stats_t* st = &g_lua_memory_stats;
+    st->total_allocated += size;
+    if (st->total_allocated > st->peak_total) st->peak_total = st->total_allocated;
+    if (esp_ptr_external_ram(ptr)) {
+        st->psram_allocated += size;
+        if (st->psram_allocated > st->peak_psram) st->peak_psram = st->psram_allocated;
+    } else {
+        st->internal_allocated += size;
+        if (st->internal_allocated > st->peak_internal) st->peak_internal = st->internal_allocated;
+    }
+    st->size_histogram[lua_mem_bucket(size)]++;
+}
+
+static inline void lua_mem_account_sub(const void *ptr, size_t size) {
+    lua_memory_stats_t* st = &g_lua_memory_stats;
+    st->total_allocated -= size;
+    if (esp_ptr_external_ram(ptr)) {
+        st->psram_allocated -= size;
+    } else {
+        st->internal_allocated -= size;
+    }
+    st->size_histogram[lua_mem_bucket(size)]--;
+}
+
+// Accounting works purely on the osize/nsize deltas, so it costs a few
+// adds and one address compare per call.
+static void* lua_alloc_accounted(void *ptr, size_t osize, size_t nsize, int lua_tag) {
+    // Refusing growth past the hard limit makes Lua run a full emergency
+    // collection and retry (see tryagain() in lmem.c) before raising an error
+    if (nsize > osize && s_hard_limit != 0 &&
+        g_lua_memory_stats.total_allocated + (nsize - osize) > s_hard_limit) {
+        g_lua_memory_stats.limit_rejects++;
+        return NULL;
+    }
+
+    void* new_ptr = lua_alloc_block(ptr, osize, nsize, lua_tag);
+    if (new_ptr == NULL && nsize > 0) {
+        return NULL; // Old block is untouched, nothing to account
+    }
+
+    if (ptr != NULL) {
+        lua_mem_account_sub(ptr, osize);
+    }
+    if (new_ptr != NULL) {
+        lua_mem_account_add(new_ptr, nsize);
+    }
+
+    if (ptr == NULL) {
+        g_lua_memory_stats.alloc_count++;
+    } else if (nsize == 0) {
+        g_lua_memory_stats.free_count++;
+    } else {
+        g_lua_memory_stats.realloc_count++;
+    }
+
+    if (s_soft_limit != 0) {
+        size_t total = g_lua_memory_stats.total_allocated;
+        if (!s_above_soft_limit && total > s_soft_limit) {
+            s_above_soft_limit = true;
+            s_low_memory_pending = true;
+            g_lua_memory_stats.low_memory_events++;
+        } else if (s_above_soft_limit && total < s_soft_limit - s_soft_limit / 8) {
+            s_above_soft_limit = false;
+        }
+    }
+
+    return new_ptr;
+}
+
+
+static void* lua_alloc_tagged(void *ptr, size_t osize, size_t nsize) {
+    int lua_tag = 0;
+
+    if (ptr == NULL) {
+        lua_tag = (int)osize; // osize carries the object type for new blocks
+        osize = 0;
+    }
+
+#if CONFIG_LUA_ALLOC_TAGGING
+    // The category is stamped into a header on allocation and read back on
+    // realloc/free, since Lua only reports the type when a block is created.
+    lua_alloc_tag_hdr_t* hdr = ptr != NULL ? (lua_alloc_tag_hdr_t*)ptr - 1 : NULL;
+    uint8_t tag = hdr != NULL ? hdr->tag : lua_alloc_tag_from_lua(lua_tag);
+
+    lua_alloc_tag_hdr_t* new_hdr = lua_alloc_accounted(hdr, hdr != NULL ? osize + sizeof(*hdr) : 0,
+                                                       nsize > 0 ? nsize + sizeof(*hdr) : 0, lua_tag);
+    if (new_hdr == NULL && nsize > 0) {
+        return NULL;
+    }
+
+    if (hdr != NULL) {
+        g_lua_tag_stats[tag].live_bytes -= osize;
+        g_lua_tag_stats[tag].live_count--;
+    }
+    if (new_hdr == NULL) {
+        return NULL;
+    }
+    new_hdr->tag = tag;
+    g_lua_tag_stats[tag].live_bytes += nsize;
+    g_lua_tag_stats[tag].live_count++;
+    return new_hdr + 1;
+#else
+    return lua_alloc_accounted(ptr, osize, nsize, lua_tag);
+#endif
+}
+
+// Lua allocator entry point
+void* lua_psram_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud;
+    void* result = lua_alloc_tagged(ptr, osize, nsize);
+#if CONFIG_LUA_ALLOC_TRACE
+    lua_alloc_trace_record(ptr, osize, nsize, result);
+#endif
+    return result;
+}
+
+#if CONFIG_LUA_LOAD_ARENA
+// Copy one finished array out of the arena; Lua sees an ordinary realloc
+static bool lua_arena_promote(void** field, size_t size) {
+    if (size == 0 || !lua_arena_owns(*field)) {
+        return true;
+    }
+    void* new_ptr = lua_psram_alloc(NULL, *field, size, size);
+    if (new_ptr == NULL) {
+        return false;
+    }
+    *field = new_ptr;
+    return true;
+}
+
+static bool lua_arena_promote_proto(Proto* f) {
+    bool ok = lua_arena_promote((void**)&f->code, f->sizecode * sizeof(Instruction)) &&
+              lua_arena_promote((void**)&f->k, f->sizek * sizeof(TValue)) &&
+              lua_arena_promote((void**)&f->p, f->sizep * sizeof(Proto*)) &&
+              lua_arena_promote((void**)&f->lineinfo, f->sizelineinfo * sizeof(ls_byte)) &&
+              lua_arena_promote((void**)&f->abslineinfo, f->sizeabslineinfo * sizeof(AbsLineInfo)) &&
+              lua_arena_promote((void**)&f->locvars, f->sizelocvars * sizeof(LocVar)) &&
+              lua_arena_promote((void**)&f->upvalues, f->sizeupvalues * sizeof(Upvaldesc));
+    for (int i = 0; ok && i < f->sizep; i++) {
+        ok = lua_arena_promote_proto(f->p[i]);
+    }
+    return ok;
+}
+#endif
+
+void lua_alloc_arena_begin(lua_State* L) {
+    (void)L;
+#if CONFIG_LUA_LOAD_ARENA
+    s_arena_depth++;
+#endif
+}
+
+void lua_alloc_arena_end(lua_State* L, int status) {
+#if CONFIG_LUA_LOAD_ARENA
+    if (s_arena_depth == 0) {
+        return;
+    }
+
+    if (status == LUA_OK) {
+        const LClosure* cl = (const LClosure*)lua_topointer(L, -1);
+        s_arena_promoting = true;
+        bool promoted = lua_arena_promote_proto(cl->p);
+        s_arena_promoting = false;
+        if (!promoted) {
+            // The function still points into the arena, so it must never be reused
+            ESP_LOGE(TAG, "Out of memory moving bytecode out of the load arena, arena disabled");
+            s_arena_pinned = true;
+        }
+    } else {
+        s_arena_failed = true;
+    }
+
+    if (--s_arena_depth > 0) {
+        return;
+    }
+
+    // A failed load leaves a half-built Proto whose arrays live in the arena.
+    // It is garbage, but an incremental cycle that marked it while it was on
+    // the stack may still traverse it, so finish that cycle's marking before
+    // those bytes are handed out again. Sweeping and finalizers are left to
+    // the collector's own steps; freeing arena blocks later is a no-op.
+    bool failed = s_arena_failed;
+    s_arena_failed = false;
+    global_State* g = G(L);
+    if (failed && !s_arena_pinned && g->gckind == KGC_INC && keepinvariant(g)) {
+        if (g->gcstp & GCSTPGC) {
+            ESP_LOGW(TAG, "Can't finish marking after a failed load here, arena disabled");
+            s_arena_pinned = true;
+        } else {
+            luaC_runtilstate(L, bitmask(GCSswpallgc));
+        }
+    }
+
+    if (!s_arena_pinned) {
+        s_arena_top = 0;
+        s_arena_last = NULL;
+    }
+#else
+    (void)L;
+    (void)status;
+#endif
+}
+
+// Rules selected in Kconfig; a fresh state always starts from these
+static void lua_alloc_place_defaults(void) {
+    lua_alloc_place_clear();
+#if CONFIG_LUA_PLACE_STACKS_INTERNAL
+    lua_alloc_place_add_rule(LUA_ALLOC_TAG_STACK, 0, 0, LUA_PLACE_INTERNAL);
+    lua_alloc_place_add_rule(LUA_ALLOC_TAG_CALLINFO, 0, 0, LUA_PLACE_INTERNAL);
+#endif
+#if CONFIG_LUA_PLACE_STRTAB_INTERNAL
+    lua_alloc_place_add_rule(LUA_ALLOC_TAG_STRTAB, 0, 0, LUA_PLACE_INTERNAL);
+#endif
+#if CONFIG_LUA_PLACE_LARGE_PSRAM_MIN > 0
+    lua_alloc_place_add_rule(LUA_PLACE_ANY_TAG, CONFIG_LUA_PLACE_LARGE_PSRAM_MIN, 0, LUA_PLACE_PSRAM);
+#endif
+}
+
+// A soft limit above the hard one would never be reached
+static void clamp_soft_limit(void) {
+    if (s_hard_limit != 0 && s_soft_limit > s_hard_limit) {
+        ESP_LOGW(TAG, "Lua heap soft limit %zu above hard limit %zu, using %zu", s_soft_limit, s_hard_limit,
+                 s_hard_limit);
+        s_soft_limit = s_hard_limit;
+    }
+}
+
 lua_State* lua_newstate_psram(void) {
     ESP_LOGI(TAG, "Creating Lua state with PSRAM allocator...");
     
     // Reset memory statistics
     memset(&g_lua_memory_stats, 0, sizeof(g_lua_memory_stats));
+#if CONFIG_LUA_ALLOC_TAGGING
+    memset(g_lua_tag_stats, 0, sizeof(g_lua_tag_stats));
+#endif
+    s_above_soft_limit = false;
+    s_low_memory_pending = false;
+    clamp_soft_limit();
+
+#if CONFIG_LUA_SLAB_ALLOC
+    lua_slab_init((size_t)CONFIG_LUA_SLAB_BUDGET_KB * 1024);
+#endif
+
+    lua_alloc_place_defaults();
+
+#if CONFIG_LUA_LOAD_ARENA
+    if (s_arena == NULL) {
+        size_t arena_bytes = (size_t)CONFIG_LUA_LOAD_ARENA_KB * 1024;
+        s_arena = heap_caps_malloc(arena_bytes, MALLOC_CAP_DEFAULT);
+        s_arena_size = s_arena != NULL ? arena_bytes : 0;
+        if (s_arena == NULL) {
+            ESP_LOGW(TAG, "Failed to reserve %zu byte load arena, compiling on the heap", arena_bytes);
+        }
+    }
+    s_arena_top = 0;
+    s_arena_last = NULL;
+    s_arena_depth = 0;
+    s_arena_failed = false;
+    s_arena_pinned = false;
+#endif
+
+    // Reserve it once, like the PSRAM pool below
+    if (s_internal_pool == NULL) {
+        size_t internal_bytes = (size_t)CONFIG_LUA_PLACE_INTERNAL_KB * 1024;
+        void* region = heap_caps_malloc(internal_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        s_internal_pool = region ? lua_tlsf_create(region, internal_bytes) : NULL;
+        if (s_internal_pool != NULL) {
+            ESP_LOGI(TAG, "Reserved %zu bytes of internal RAM for placed Lua blocks", internal_bytes);
+        } else {
+            ESP_LOGW(TAG, "Failed to reserve %zu bytes of internal RAM, placing those blocks in PSRAM",
+                     internal_bytes);
+            heap_caps_free(region);
+        }
+    }
+    s_internal_spills = 0;
+
+#if CONFIG_LUA_TLSF_POOL
+    // Reserve the pool once; a later state reuses it after the previous one is closed
+    if (s_pool == NULL) {
+        size_t pool_bytes = (size_t)CONFIG_LUA_TLSF_POOL_KB * 1024;
+        void* region = heap_caps_malloc(pool_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        s_pool = region ? lua_tlsf_create(region, pool_bytes) : NULL;
+        if (s_pool != NULL) {
+            ESP_LOGI(TAG, "Reserved %zu byte private PSRAM pool for Lua", pool_bytes);
+        } else {
+            ESP_LOGW(TAG, "Failed to reserve %zu byte PSRAM pool, using shared heap", pool_bytes);
+            heap_caps_free(region);
+        }
+    }
+#endif
     
     // Create Lua state with custom allocator
     lua_State* L = lua_newstate(lua_psram_alloc, NULL);
@@ -84,5 +676,156 @@ void lua_get_memory_stats(lua_State* L, size_t* total_alloc, size_t* psram_alloc
     ESP_LOGI(TAG, "  Peak total: %zu bytes", g_lua_memory_stats.peak_total);
     ESP_LOGI(TAG, "  Peak PSRAM: %zu bytes", g_lua_memory_stats.peak_psram);
     ESP_LOGI(TAG, "  Peak internal: %zu bytes", g_lua_memory_stats.peak_internal);
-    ESP_LOGI(TAG, "  Allocations: %u, Frees: %u", g_lua_memory_stats.alloc_count, g_lua_memory_stats.free_count);
+    ESP_LOGI(TAG, "  Allocations: %u, Frees: %u, Reallocs: %u", g_lua_memory_stats.alloc_count,
+             g_lua_memory_stats.free_count, g_lua_memory_stats.realloc_count);
+#if CONFIG_LUA_LOAD_ARENA
+    ESP_LOGI(TAG, "  Load arena: peak %zu of %zu bytes, overflows %u%s", g_lua_memory_stats.arena_peak,
+             s_arena_size, (unsigned)g_lua_memory_stats.arena_overflows, s_arena_pinned ? " (disabled)" : "");
+#endif
+
+    for (int i = 0; i < s_place_count; i++) {
+        const lua_place_rule_t* rule = &s_place_rules[i];
+        ESP_LOGI(TAG, "  Rule %d: %s %u..%u B -> %s, hits %u, fallbacks %u", i,
+                 rule->tag == LUA_PLACE_ANY_TAG ? "any" : s_tag_names[rule->tag],
+                 (unsigned)rule->min_size, (unsigned)rule->max_size, s_region_names[rule->region],
+                 (unsigned)rule->hits, (unsigned)rule->fallbacks);
+    }
+    ESP_LOGI(TAG, "  Unplaced (default path): %u", (unsigned)s_place_unmatched);
+    if (s_internal_pool != NULL) {
+        lua_tlsf_stats_t internal;
+        lua_tlsf_get_stats(s_internal_pool, &internal);
+        ESP_LOGI(TAG, "  Internal placement: %zu used, %zu free, spilled to PSRAM %u",
+                 internal.used_bytes, internal.free_bytes, (unsigned)s_internal_spills);
+    }
+
+#if CONFIG_LUA_TLSF_POOL
+    lua_tlsf_stats_t pool;
+    if (lua_get_pool_stats(&pool)) {
+        ESP_LOGI(TAG, "  Pool: %zu used, %zu free, largest free %zu, fragmentation %u%%, spills %u",
+                 pool.used_bytes, pool.free_bytes, pool.largest_free, (unsigned)pool.fragmentation,
+                 (unsigned)s_pool_spills);
+    }
+#endif
+
+#if CONFIG_LUA_SLAB_ALLOC
+    lua_slab_stats_t slab;
+    lua_slab_get_stats(&slab);
+    ESP_LOGI(TAG, "  Slab pages: %u/%u (%zu bytes reserved), %u given back",
+             (unsigned)slab.pages_used, (unsigned)slab.pages_total, slab.budget, (unsigned)slab.pages_released);
+    for (int i = 0; i < LUA_SLAB_NUM_CLASSES; i++) {
+        ESP_LOGI(TAG, "    %2zu B: %u pages, %u used, %u free, %u served, %u misses", slab.classes[i].block_size,
+                 (unsigned)slab.classes[i].pages, (unsigned)slab.classes[i].blocks_used,
+                 (unsigned)slab.classes[i].blocks_free, (unsigned)slab.classes[i].allocs,
+                 (unsigned)slab.classes[i].misses);
+    }
+#endif
+}
+
+void lua_get_memory_snapshot(lua_memory_stats_t* stats) {
+    if (stats != NULL) {
+        *stats = g_lua_memory_stats;
+    }
+}
+
+const char* lua_alloc_tag_name(lua_alloc_tag_t tag) {
+    return (unsigned)tag < LUA_ALLOC_TAG_COUNT ? s_tag_names[tag] : "?";
+}
+
+bool lua_get_tag_stats(lua_alloc_tag_stats_t stats[LUA_ALLOC_TAG_COUNT]) {
+#if CONFIG_LUA_ALLOC_TAGGING
+    memcpy(stats, g_lua_tag_stats, sizeof(g_lua_tag_stats));
+    return true;
+#else
+    memset(stats, 0, sizeof(lua_alloc_tag_stats_t) * LUA_ALLOC_TAG_COUNT);
+    return false;
+#endif
+}
+
+void lua_dump_tag_stats(void) {
+    lua_alloc_tag_stats_t stats[LUA_ALLOC_TAG_COUNT];
+    if (!lua_get_tag_stats(stats)) {
+        ESP_LOGW(TAG, "Allocation tagging is disabled (CONFIG_LUA_ALLOC_TAGGING)");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Lua heap by type:");
+    for (int i = 0; i < LUA_ALLOC_TAG_COUNT; i++) {
+        ESP_LOGI(TAG, "  %-9s %8zu bytes in %u blocks", s_tag_names[i],
+                 stats[i].live_bytes, (unsigned)stats[i].live_count);
+    }
+}
+
+void lua_alloc_set_limits(size_t soft_limit, size_t hard_limit) {
+    s_soft_limit = soft_limit;
+    s_hard_limit = hard_limit;
+    s_above_soft_limit = false;
+    clamp_soft_limit();
+    ESP_LOGI(TAG, "Lua heap limits: soft=%zu, hard=%zu bytes (0 = unlimited)", s_soft_limit, s_hard_limit);
+}
+
+void lua_alloc_get_limits(size_t* soft_limit, size_t* hard_limit) {
+    if (soft_limit) *soft_limit = s_soft_limit;
+    if (hard_limit) *hard_limit = s_hard_limit;
+}
+
+bool lua_alloc_take_low_memory_event(void) {
+    if (!s_low_memory_pending) {
+        return false;
+    }
+    s_low_memory_pending = false;
+    return true;
+}
+
+bool lua_get_internal_pool_stats(lua_tlsf_stats_t* stats, uint32_t* spills) {
+    if (spills) *spills = s_internal_spills;
+    if (s_internal_pool != NULL) {
+        lua_tlsf_get_stats(s_internal_pool, stats);
+        return true;
+    }
+    memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+bool lua_get_pool_stats(lua_tlsf_stats_t* stats) {
+#if CONFIG_LUA_TLSF_POOL
+    if (s_pool != NULL) {
+        lua_tlsf_get_stats(s_pool, stats);
+        return true;
+    }
+#endif
+    memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+int lua_alloc_place_add_rule(int tag, size_t min_size, size_t max_size, lua_place_region_t region) {
+    if (s_place_count >= LUA_PLACE_MAX_RULES || tag < 0 || tag > LUA_PLACE_ANY_TAG ||
+        (unsigned)region > LUA_PLACE_PSRAM || (max_size != 0 && max_size < min_size)) {
+        return -1;
+    }
+
+    lua_place_rule_t* rule = &s_place_rules[s_place_count];
+    memset(rule, 0, sizeof(*rule));
+    rule->tag = (uint8_t)tag;
+    rule->region = (uint8_t)region;
+    rule->min_size = (uint32_t)min_size;
+    rule->max_size = (uint32_t)max_size;
+    return s_place_count++;
+}
+
+void lua_alloc_place_clear(void) {
+    s_place_count = 0;
+    s_place_unmatched = 0;
+}
+
+int lua_alloc_place_get_rules(lua_place_rule_t* rules, int max_rules, uint32_t* unmatched) {
+    int count = s_place_count < max_rules ? s_place_count : max_rules;
+    if (rules != NULL && count > 0) {
+        memcpy(rules, s_place_rules, sizeof(*rules) * count);
+    }
+    if (unmatched) *unmatched = s_place_unmatched;
+    return s_place_count;
+}
+
+const char* lua_place_region_name(lua_place_region_t region) {
+    return (unsigned)region <= LUA_PLACE_PSRAM ? s_region_names[region] : "?";
 }
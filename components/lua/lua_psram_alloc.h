@@ -4,11 +4,78 @@
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "lua.h"
+#include "lua_tlsf.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Number of log2 size buckets in the live-block histogram. Bucket i counts
+// blocks of [2^(i-1), 2^i) bytes; the last bucket collects everything larger.
+#define LUA_MEM_HIST_BUCKETS 16
+
+// Memory usage tracking, updated on every allocator call
+typedef struct {
+    size_t total_allocated;
+    size_t psram_allocated;
+    size_t internal_allocated;
+    size_t peak_total;
+    size_t peak_psram;
+    size_t peak_internal;
+    uint32_t alloc_count;
+    uint32_t free_count;
+    uint32_t realloc_count;
+    uint32_t limit_rejects;         // Allocations refused by the hard limit
+    uint32_t low_memory_events;     // Times usage crossed the soft limit
+    size_t arena_peak;              // High-water mark of the load arena
+    uint32_t arena_overflows;       // Load-time blocks that didn't fit in the arena
+    uint32_t size_histogram[LUA_MEM_HIST_BUCKETS];
+} lua_memory_stats_t;
+
+// Accounting categories used by allocation tagging (CONFIG_LUA_ALLOC_TAGGING)
+typedef enum {
+    LUA_ALLOC_TAG_STRING = 0,
+    LUA_ALLOC_TAG_TABLE,
+    LUA_ALLOC_TAG_FUNCTION,
+    LUA_ALLOC_TAG_USERDATA,
+    LUA_ALLOC_TAG_THREAD,
+    LUA_ALLOC_TAG_UPVAL,
+    LUA_ALLOC_TAG_PROTO,
+    LUA_ALLOC_TAG_STACK,        // Thread stacks
+    LUA_ALLOC_TAG_CALLINFO,     // Call frames
+    LUA_ALLOC_TAG_ARRAY,        // Table array parts
+    LUA_ALLOC_TAG_HASH,         // Table hash parts
+    LUA_ALLOC_TAG_STRTAB,       // String table buckets
+    LUA_ALLOC_TAG_OTHER,        // Bytecode, parser buffers, luaL_Buffer boxes...
+    LUA_ALLOC_TAG_COUNT
+} lua_alloc_tag_t;
+
+typedef struct {
+    size_t live_bytes;
+    uint32_t live_count;
+} lua_alloc_tag_stats_t;
+
+// Where a placement rule sends a fresh block
+typedef enum {
+    LUA_PLACE_DEFAULT = 0,      // Slabs, private pool or MALLOC_CAP_DEFAULT
+    LUA_PLACE_INTERNAL,         // Slabs, then CONFIG_LUA_PLACE_INTERNAL_KB of internal RAM, then PSRAM
+    LUA_PLACE_PSRAM,            // Private pool, then PSRAM
+} lua_place_region_t;
+
+// Rule tag that matches every object type
+#define LUA_PLACE_ANY_TAG LUA_ALLOC_TAG_COUNT
+#define LUA_PLACE_MAX_RULES 16
+
+typedef struct {
+    uint8_t tag;            // lua_alloc_tag_t, or LUA_PLACE_ANY_TAG
+    uint8_t region;         // lua_place_region_t
+    uint32_t min_size;      // Smallest matching request in bytes
+    uint32_t max_size;      // Largest matching request (0 = no upper bound)
+    uint32_t hits;          // Fresh blocks this rule matched
+    uint32_t fallbacks;     // Matches whose region was full, served by the default path
+} lua_place_rule_t;
+
 /**
  * @brief Custom memory allocator for Lua that uses PSRAM when available
  * @param ud User data (not used)
@@ -25,6 +92,26 @@ void* lua_psram_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
  */
 lua_State* lua_newstate_psram(void);
 
+/**
+ * @brief Enter the load arena (called by lua_load() via luai_loadbegin)
+ * @param L Lua state
+ *
+ * While at least one load is in progress, untagged blocks (parser and code
+ * generator vectors, undump arrays) are bump-allocated from the arena
+ * reserved by lua_newstate_psram() (CONFIG_LUA_LOAD_ARENA).
+ */
+void lua_alloc_arena_begin(lua_State* L);
+
+/**
+ * @brief Leave the load arena (called by lua_load() via luai_loadend)
+ * @param L Lua state, holding the loaded function on top when status is LUA_OK
+ * @param status Result of the load
+ *
+ * Copies the bytecode, constants and debug info of the loaded function out
+ * of the arena; the outermost call then rewinds the arena in one step.
+ */
+void lua_alloc_arena_end(lua_State* L, int status);
+
 /**
  * @brief Get memory usage statistics for Lua
  * @param L Lua state
@@ -34,6 +121,107 @@ lua_State* lua_newstate_psram(void);
  */
 void lua_get_memory_stats(lua_State* L, size_t* total_alloc, size_t* psram_alloc, size_t* internal_alloc);
 
+/**
+ * @brief Copy the full allocator accounting without logging
+ * @param stats Destination structure
+ */
+void lua_get_memory_snapshot(lua_memory_stats_t* stats);
+
+/**
+ * @brief Set the Lua heap budget
+ * @param soft_limit Usage above which a low-memory event is raised (0 = none)
+ * @param hard_limit Usage the allocator never grows past (0 = none)
+ *
+ * Defaults come from CONFIG_LUA_HEAP_SOFT_LIMIT_KB / CONFIG_LUA_HEAP_HARD_LIMIT_KB.
+ */
+void lua_alloc_set_limits(size_t soft_limit, size_t hard_limit);
+
+/**
+ * @brief Get the current Lua heap budget
+ * @param soft_limit Soft limit in bytes (0 = none)
+ * @param hard_limit Hard limit in bytes (0 = none)
+ */
+void lua_alloc_get_limits(size_t* soft_limit, size_t* hard_limit);
+
+/**
+ * @brief Consume a pending soft-limit crossing
+ * @return bool true once per crossing of the soft limit
+ *
+ * The allocator cannot run Lua code itself; the owner of the lua_State
+ * polls this (see lua_engine_poll_memory()) and reacts outside the allocator.
+ */
+bool lua_alloc_take_low_memory_event(void);
+
+/**
+ * @brief Get occupancy of the internal RAM placement rules send blocks to
+ * @param stats Destination structure
+ * @param spills Set to the blocks placed or grown in PSRAM because it was full (may be NULL)
+ * @return bool false (and zeroed stats) if it couldn't be reserved
+ *
+ * Sized by CONFIG_LUA_PLACE_INTERNAL_KB; blocks of up to 64 bytes come from
+ * the slabs first and aren't counted here.
+ */
+bool lua_get_internal_pool_stats(lua_tlsf_stats_t* stats, uint32_t* spills);
+
+/**
+ * @brief Get occupancy and fragmentation of the private Lua PSRAM pool
+ * @param stats Destination structure
+ * @return bool false (and zeroed stats) if the pool is disabled or unavailable
+ */
+bool lua_get_pool_stats(lua_tlsf_stats_t* stats);
+
+/**
+ * @brief Append a placement rule for fresh blocks
+ * @param tag lua_alloc_tag_t category, or LUA_PLACE_ANY_TAG
+ * @param min_size Smallest request the rule applies to
+ * @param max_size Largest request the rule applies to (0 = no upper bound)
+ * @param region Memory to place matching blocks in
+ * @return int Index of the rule, or -1 if the table is full or the rule invalid
+ *
+ * Rules are checked in order and the first match wins. A resized block
+ * stays in the memory it was placed in. Kconfig (CONFIG_LUA_PLACE_*)
+ * selects the rules installed by lua_newstate_psram().
+ */
+int lua_alloc_place_add_rule(int tag, size_t min_size, size_t max_size, lua_place_region_t region);
+
+/**
+ * @brief Remove all placement rules; every block takes the default path
+ */
+void lua_alloc_place_clear(void);
+
+/**
+ * @brief Copy the placement rules with their hit counts
+ * @param rules Destination array (may be NULL)
+ * @param max_rules Capacity of rules
+ * @param unmatched Fresh blocks no rule matched (may be NULL)
+ * @return int Number of rules installed
+ */
+int lua_alloc_place_get_rules(lua_place_rule_t* rules, int max_rules, uint32_t* unmatched);
+
+/**
+ * @brief Get the name of a placement region ("default", "internal", "psram")
+ */
+const char* lua_place_region_name(lua_place_region_t region);
+
+/**
+ * @brief Get the name of an allocation tag category
+ * @param tag Category
+ * @return const char* Short lowercase name, e.g. "string"
+ */
+const char* lua_alloc_tag_name(lua_alloc_tag_t tag);
+
+/**
+ * @brief Copy live byte and block counts per Lua type
+ * @param stats Array of LUA_ALLOC_TAG_COUNT entries to fill
+ * @return bool false (and zeroed stats) if tagging is compiled out
+ */
+bool lua_get_tag_stats(lua_alloc_tag_stats_t stats[LUA_ALLOC_TAG_COUNT]);
+
+/**
+ * @brief Log live bytes and block counts per Lua type
+ */
+void lua_dump_tag_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,130 @@
+#include "lua_ring.h"
+#include "esp_heap_caps.h"
+#include <string.h>
+
+bool lua_ring_init(lua_ring_t* ring, uint32_t capacity, uint32_t record_size) {
+    uint32_t slots = 2;
+    while (slots < capacity) slots *= 2;
+
+    memset(ring, 0, sizeof(*ring));
+    // Both sides touch the slots on every record: keep them in internal RAM
+    ring->slots = heap_caps_malloc((size_t)slots * record_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ring->slots == NULL) {
+        return false;
+    }
+    ring->record_size = record_size;
+    ring->mask = slots - 1;
+    return true;
+}
+
+void lua_ring_deinit(lua_ring_t* ring) {
+    heap_caps_free(ring->slots);
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool lua_ring_push(lua_ring_t* ring, const void* record) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t depth = head - tail;
+    if (depth > ring->mask) {
+        ring->dropped++;
+        return false;
+    }
+    memcpy(ring->slots + (size_t)(head & ring->mask) * ring->record_size, record, ring->record_size);
+    // The record is in place before the consumer can see the new head
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    if (depth + 1 > ring->high_water) {
+        ring->high_water = depth + 1;
+    }
+    return true;
+}
+
+bool lua_ring_pop(lua_ring_t* ring, void* record) {
+    uint32_t tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    memcpy(record, ring->slots + (size_t)(tail & ring->mask) * ring->record_size, ring->record_size);
+    // The slot is copied out before the producer can reuse it
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t lua_ring_depth(const lua_ring_t* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+bool lua_mpsc_ring_init(lua_mpsc_ring_t* ring, uint32_t capacity, uint32_t record_size) {
+    uint32_t slots = 2;
+    while (slots < capacity) slots *= 2;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->stride = (uint32_t)(sizeof(uint32_t) + (record_size + 3) / 4 * 4);
+    // Compare and swap needs internal RAM
+    ring->slots = heap_caps_malloc((size_t)slots * ring->stride, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ring->slots == NULL) {
+        return false;
+    }
+    ring->record_size = record_size;
+    ring->mask = slots - 1;
+    // Slot i is free for the producer that claims position i
+    for (uint32_t i = 0; i < slots; i++) {
+        *(uint32_t*)(ring->slots + (size_t)i * ring->stride) = i;
+    }
+    return true;
+}
+
+void lua_mpsc_ring_deinit(lua_mpsc_ring_t* ring) {
+    heap_caps_free(ring->slots);
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool lua_mpsc_ring_push(lua_mpsc_ring_t* ring, const void* record) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t* seq;
+    for (;;) {
+        seq = (uint32_t*)(ring->slots + (size_t)(head & ring->mask) * ring->stride);
+        int32_t diff = (int32_t)(__atomic_load_n(seq, __ATOMIC_ACQUIRE) - head);
+        if (diff == 0) {
+            // Free: claim it, or retry from wherever another producer left head
+            if (__atomic_compare_exchange_n(&ring->head, &head, head + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Still holds the record from one lap ago
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(seq + 1, record, ring->record_size);
+    // The record is in place before the consumer sees the slot as full
+    __atomic_store_n(seq, head + 1, __ATOMIC_RELEASE);
+
+    uint32_t depth = head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t high_water = __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+    while (depth > high_water && !__atomic_compare_exchange_n(&ring->high_water, &high_water, depth, true,
+                                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return true;
+}
+
+bool lua_mpsc_ring_pop(lua_mpsc_ring_t* ring, void* record) {
+    uint32_t tail = ring->tail;
+    uint32_t* seq = (uint32_t*)(ring->slots + (size_t)(tail & ring->mask) * ring->stride);
+    if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != tail + 1) {
+        return false;
+    }
+    memcpy(record, seq + 1, ring->record_size);
+    // Copied out before the producers can claim the slot for the next lap
+    __atomic_store_n(seq, tail + ring->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+uint32_t lua_mpsc_ring_depth(const lua_mpsc_ring_t* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
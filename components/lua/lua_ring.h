@@ -0,0 +1,121 @@
+#ifndef LUA_RING_H
+#define LUA_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lock-free ring of fixed-size records between exactly one producer task
+// and one consumer task. Each index is written by one side only, so the
+// two sides never wait on each other or on a lock.
+typedef struct {
+    uint8_t* slots;
+    uint32_t record_size;
+    uint32_t mask;          // Capacity - 1
+    uint32_t head;          // Next slot to write; producer only
+    uint32_t tail;          // Next slot to read; consumer only
+    uint32_t high_water;    // Most records queued at once
+    uint32_t dropped;       // Pushes refused because the ring was full
+} lua_ring_t;
+
+/**
+ * @brief Allocate a ring
+ * @param ring Ring to initialize
+ * @param capacity Records it holds, rounded up to a power of two
+ * @param record_size Size of one record
+ * @return bool false if the slots can't be allocated
+ */
+bool lua_ring_init(lua_ring_t* ring, uint32_t capacity, uint32_t record_size);
+
+/**
+ * @brief Free the slots of a ring no task uses any more
+ * @param ring Ring
+ */
+void lua_ring_deinit(lua_ring_t* ring);
+
+/**
+ * @brief Append a record; producer only
+ * @param ring Ring
+ * @param record record_size bytes
+ * @return bool false (and counted in dropped) if the ring is full
+ */
+bool lua_ring_push(lua_ring_t* ring, const void* record);
+
+/**
+ * @brief Take the oldest record; consumer only
+ * @param ring Ring
+ * @param record Receives record_size bytes
+ * @return bool false if the ring is empty
+ */
+bool lua_ring_pop(lua_ring_t* ring, void* record);
+
+/**
+ * @brief Number of records queued, as seen by the calling side
+ * @param ring Ring
+ * @return uint32_t
+ */
+uint32_t lua_ring_depth(const lua_ring_t* ring);
+
+// Lock-free ring of fixed-size records from any number of producers, tasks
+// or ISRs, to one consumer task. Producers claim a slot with a compare and
+// swap on head; each slot's sequence number tells the consumer when the
+// record in it is complete, and the producers when it was read.
+typedef struct {
+    uint8_t* slots;         // Each a uint32_t sequence number, then the record
+    uint32_t record_size;
+    uint32_t stride;
+    uint32_t mask;          // Capacity - 1
+    uint32_t head;          // Next slot to claim; producers
+    uint32_t tail;          // Next slot to read; consumer only
+    uint32_t high_water;    // Most records queued at once
+    uint32_t dropped;       // Pushes refused because the ring was full
+} lua_mpsc_ring_t;
+
+/**
+ * @brief Allocate a multi-producer ring
+ * @param ring Ring to initialize
+ * @param capacity Records it holds, rounded up to a power of two
+ * @param record_size Size of one record
+ * @return bool false if the slots can't be allocated
+ */
+bool lua_mpsc_ring_init(lua_mpsc_ring_t* ring, uint32_t capacity, uint32_t record_size);
+
+/**
+ * @brief Free the slots of a ring no task or ISR uses any more
+ * @param ring Ring
+ */
+void lua_mpsc_ring_deinit(lua_mpsc_ring_t* ring);
+
+/**
+ * @brief Append a record; any task or ISR, never blocks
+ * @param ring Ring
+ * @param record record_size bytes
+ * @return bool false (and counted in dropped) if the ring is full
+ */
+bool lua_mpsc_ring_push(lua_mpsc_ring_t* ring, const void* record);
+
+/**
+ * @brief Take the oldest record; consumer only
+ * @param ring Ring
+ * @param record Receives record_size bytes
+ * @return bool false if the ring is empty, or its oldest record is still
+ *         being written
+ */
+bool lua_mpsc_ring_pop(lua_mpsc_ring_t* ring, void* record);
+
+/**
+ * @brief Number of records queued or being written
+ * @param ring Ring
+ * @return uint32_t
+ */
+uint32_t lua_mpsc_ring_depth(const lua_mpsc_ring_t* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_RING_H
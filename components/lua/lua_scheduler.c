@@ -0,0 +1,351 @@
+#include "lua_scheduler.h"
+#include "lua_engine.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdbool.h>
+
+static const char *TAG = "LUA_SCHED";
+
+// Registry tables. A coroutine blocks under a sequence number of its own
+// each time; the heap refers to it by that number, so an entry left over
+// from a wait that was woken, or from a state since closed, finds nothing.
+#define TASKS_KEY   "lua_scheduler.tasks"   // seq -> blocked coroutine
+#define WAITERS_KEY "lua_scheduler.waiters" // event -> array of seqs, in the order they started waiting
+#define EVENTS_KEY  "lua_scheduler.events"  // seq -> event, for waits with a timeout
+#define RESULTS_KEY "lua_scheduler.results" // seq -> values to resume a woken waiter with, and n
+
+typedef enum {
+    WAKE_SLEEP,         // Resumed with no values
+    WAKE_TIMEOUT,       // ... with false
+    WAKE_EVENT,         // ... with true and what system.wake() passed
+} wake_kind_t;
+
+typedef struct {
+    int64_t due_us;
+    uint32_t seq;
+    uint8_t kind;
+} wakeup_t;
+
+// Binary min-heap on due_us, then seq so equal times keep their order
+static wakeup_t* s_heap = NULL;
+static uint32_t s_heap_len = 0;
+static uint32_t s_heap_cap = 0;
+static uint32_t s_seq = 0;
+
+static lua_scheduler_stats_t s_stats = {0};
+static uint64_t s_late_us_sum = 0;
+static uint32_t s_late_count = 0;
+
+static bool before(const wakeup_t* a, const wakeup_t* b) {
+    return a->due_us < b->due_us || (a->due_us == b->due_us && (int32_t)(a->seq - b->seq) < 0);
+}
+
+static bool heap_push(const wakeup_t* w) {
+    if (s_heap_len == s_heap_cap) {
+        uint32_t cap = s_heap_cap ? s_heap_cap * 2 : 16;
+        wakeup_t* heap = heap_caps_realloc(s_heap, cap * sizeof(wakeup_t), MALLOC_CAP_DEFAULT);
+        if (heap == NULL) {
+            ESP_LOGE(TAG, "No memory for %u wake-ups", (unsigned)cap);
+            return false;
+        }
+        s_heap = heap;
+        s_heap_cap = cap;
+    }
+    uint32_t i = s_heap_len++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!before(w, &s_heap[parent])) {
+            break;
+        }
+        s_heap[i] = s_heap[parent];
+        i = parent;
+    }
+    s_heap[i] = *w;
+    if (s_heap_len > s_stats.heap_high_water) {
+        s_stats.heap_high_water = s_heap_len;
+    }
+    return true;
+}
+
+static wakeup_t heap_pop(void) {
+    wakeup_t top = s_heap[0];
+    wakeup_t last = s_heap[--s_heap_len];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= s_heap_len) {
+            break;
+        }
+        if (child + 1 < s_heap_len && before(&s_heap[child + 1], &s_heap[child])) {
+            child++;
+        }
+        if (!before(&s_heap[child], &last)) {
+            break;
+        }
+        s_heap[i] = s_heap[child];
+        i = child;
+    }
+    if (s_heap_len > 0) {
+        s_heap[i] = last;
+    }
+    return top;
+}
+
+void lua_scheduler_init(lua_State* L) {
+    static const char* const keys[] = {TASKS_KEY, WAITERS_KEY, EVENTS_KEY, RESULTS_KEY};
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        lua_newtable(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, keys[i]);
+    }
+    // Wake-ups of a previous state refer to nothing in this one
+    s_heap_len = 0;
+    s_stats.blocked = 0;
+}
+
+// Anchors the running coroutine L under a new seq, with a wake-up at
+// due_us unless kind is WAKE_TIMEOUT with no timeout
+static uint32_t block(lua_State* L, int64_t due_us, wake_kind_t kind, bool timed) {
+    if (!lua_isyieldable(L)) {
+        luaL_error(L, "can't suspend outside a coroutine; start one with system.spawn()");
+    }
+    uint32_t seq = ++s_seq;
+    wakeup_t w = {.due_us = due_us, .seq = seq, .kind = (uint8_t)kind};
+    if (timed && !heap_push(&w)) {
+        luaL_error(L, "not enough memory to schedule a wake-up");
+    }
+    lua_getfield(L, LUA_REGISTRYINDEX, TASKS_KEY);
+    lua_pushthread(L);
+    lua_rawseti(L, -2, seq);
+    lua_pop(L, 1);
+    s_stats.blocked++;
+    return seq;
+}
+
+int lua_scheduler_sleep(lua_State* L, uint32_t ms) {
+    block(L, esp_timer_get_time() + (int64_t)ms * 1000, WAKE_SLEEP, true);
+    return lua_yield(L, 0);
+}
+
+int lua_scheduler_wait(lua_State* L, int event, int32_t timeout_ms) {
+    return lua_scheduler_waitk(L, event, timeout_ms, 0, NULL);
+}
+
+int lua_scheduler_waitk(lua_State* L, int event, int32_t timeout_ms, lua_KContext ctx, lua_KFunction k) {
+    event = lua_absindex(L, event);
+    luaL_argcheck(L, !lua_isnil(L, event), event, "event expected");
+    bool timed = timeout_ms >= 0;
+    uint32_t seq = block(L, esp_timer_get_time() + (int64_t)(timed ? timeout_ms : 0) * 1000, WAKE_TIMEOUT, timed);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+    lua_pushvalue(L, event);
+    if (lua_rawget(L, -2) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, 1, 0);
+        lua_pushvalue(L, event);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+    }
+    lua_pushinteger(L, seq);
+    lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+    lua_pop(L, 2);
+    if (timed) {
+        lua_getfield(L, LUA_REGISTRYINDEX, EVENTS_KEY);
+        lua_pushvalue(L, event);
+        lua_rawseti(L, -2, seq);
+        lua_pop(L, 1);
+    }
+    return lua_yieldk(L, 0, ctx, k);
+}
+
+int lua_scheduler_wake(lua_State* L, int event, int nargs) {
+    event = lua_absindex(L, event);
+    int first = lua_gettop(L) - nargs + 1;
+    lua_getfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+    lua_pushvalue(L, event);
+    if (lua_rawget(L, -2) != LUA_TTABLE) {
+        lua_settop(L, first - 1);
+        return 0;
+    }
+    int list = lua_gettop(L);
+    lua_pushvalue(L, event);
+    lua_pushnil(L);
+    lua_rawset(L, list - 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, TASKS_KEY);
+    int tasks = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, EVENTS_KEY);
+    int events = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, RESULTS_KEY);
+    int results = lua_gettop(L);
+
+    // One table of values for all the waiters: true, then the arguments
+    lua_createtable(L, nargs + 1, 1);
+    lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, 1);
+    for (int i = 0; i < nargs; i++) {
+        lua_pushvalue(L, first + i);
+        lua_rawseti(L, -2, i + 2);
+    }
+    lua_pushinteger(L, nargs + 1);
+    lua_setfield(L, -2, "n");
+    int values = lua_gettop(L);
+
+    int woken = 0;
+    int64_t now_us = esp_timer_get_time();
+    lua_Integer n = (lua_Integer)lua_rawlen(L, list);
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, list, i);
+        uint32_t seq = (uint32_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        if (lua_rawgeti(L, tasks, seq) != LUA_TTHREAD) {
+            lua_pop(L, 1);
+            continue; // Timed out since
+        }
+        // Its timeout, if any, now refers to nothing
+        uint32_t woken_seq = ++s_seq;
+        wakeup_t w = {.due_us = now_us, .seq = woken_seq, .kind = WAKE_EVENT};
+        if (!heap_push(&w)) {
+            return luaL_error(L, "not enough memory to schedule a wake-up");
+        }
+        lua_rawseti(L, tasks, woken_seq);
+        lua_pushnil(L);
+        lua_rawseti(L, tasks, seq);
+        lua_pushnil(L);
+        lua_rawseti(L, events, seq);
+        lua_pushvalue(L, values);
+        lua_rawseti(L, results, woken_seq);
+        woken++;
+    }
+    lua_settop(L, first - 1);
+    return woken;
+}
+
+// Takes a waiter that timed out off its event's list
+static void forget_waiter(lua_State* L, int waiters, int events, uint32_t seq) {
+    if (lua_rawgeti(L, events, seq) == LUA_TNIL) {
+        lua_pop(L, 1);
+        return;
+    }
+    int event = lua_gettop(L);
+    lua_pushnil(L);
+    lua_rawseti(L, events, seq);
+    lua_pushvalue(L, event);
+    if (lua_rawget(L, waiters) == LUA_TTABLE) {
+        lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+        lua_Integer j = 1;
+        for (lua_Integer i = 1; i <= n; i++) {
+            lua_rawgeti(L, -1, i);
+            if ((uint32_t)lua_tointeger(L, -1) == seq) {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_rawseti(L, -2, j++);
+        }
+        for (; j <= n; j++) {
+            lua_pushnil(L);
+            lua_rawseti(L, -2, j);
+        }
+        if (n == 1) {
+            lua_pushvalue(L, event);
+            lua_pushnil(L);
+            lua_rawset(L, waiters);
+        }
+    }
+    lua_pop(L, 2); // List, event
+}
+
+int32_t lua_scheduler_run(lua_State* L, uint32_t budget_us) {
+    if (s_heap_len == 0) {
+        return -1;
+    }
+    int top = lua_gettop(L);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, TASKS_KEY) != LUA_TTABLE) {
+        lua_settop(L, top);
+        return -1;
+    }
+    int tasks = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, WAITERS_KEY);
+    int waiters = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, EVENTS_KEY);
+    int events = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, RESULTS_KEY);
+    int results = lua_gettop(L);
+
+    // Wake-ups scheduled while this runs wait for the next call
+    int64_t start_us = esp_timer_get_time();
+    while (s_heap_len > 0 && s_heap[0].due_us <= start_us) {
+        wakeup_t w = heap_pop();
+        if (lua_rawgeti(L, tasks, w.seq) != LUA_TTHREAD) {
+            lua_pop(L, 1);
+            continue; // Woken by an event before its timeout
+        }
+        lua_State* co = lua_tothread(L, -1);
+        lua_pushnil(L);
+        lua_rawseti(L, tasks, w.seq);
+
+        int nargs = 0;
+        if (w.kind == WAKE_EVENT) {
+            lua_rawgeti(L, results, w.seq);
+            lua_getfield(L, -1, "n");
+            nargs = (int)lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            luaL_checkstack(L, nargs, "resuming a waiter");
+            for (int i = 1; i <= nargs; i++) {
+                lua_rawgeti(L, -i, i);
+            }
+            lua_remove(L, -nargs - 1);
+            lua_xmove(L, co, nargs);
+            lua_pushnil(L);
+            lua_rawseti(L, results, w.seq);
+        } else if (w.kind == WAKE_TIMEOUT) {
+            forget_waiter(L, waiters, events, w.seq);
+            lua_pushboolean(co, 0);
+            nargs = 1;
+        }
+
+        uint32_t late_us = (uint32_t)(esp_timer_get_time() - w.due_us);
+        s_late_us_sum += late_us;
+        s_late_count++;
+        if (late_us > s_stats.late_us_max) {
+            s_stats.late_us_max = late_us;
+        }
+        s_stats.blocked--;
+        s_stats.resumed++;
+        lua_engine_resume(co, L, nargs);
+        lua_pop(L, 1); // Coroutine
+
+        if (esp_timer_get_time() - start_us >= budget_us) {
+            break;
+        }
+    }
+    lua_settop(L, top);
+
+    if (s_heap_len == 0) {
+        return -1;
+    }
+    int64_t left_us = s_heap[0].due_us - esp_timer_get_time();
+    return left_us > 0 ? (int32_t)((left_us + 999) / 1000) : 0;
+}
+
+void lua_scheduler_get_stats(lua_scheduler_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.late_us_avg = s_late_count ? (uint32_t)(s_late_us_sum / s_late_count) : 0;
+    *stats = s_stats;
+
+    s_late_us_sum = 0;
+    s_late_count = 0;
+    s_stats.late_us_max = 0;
+}
+
+int lua_scheduler_spawn(lua_State* L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int n = lua_gettop(L);
+    lua_State* co = lua_newthread(L);
+    lua_rotate(L, 1, 1);
+    lua_xmove(L, co, n);
+    s_stats.spawned++;
+    lua_engine_resume(co, L, n - 1);
+    return 1;
+}
@@ -0,0 +1,101 @@
+#ifndef LUA_SCHEDULER_H
+#define LUA_SCHEDULER_H
+
+#include "lua.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t spawned;       // Coroutines started with system.spawn() since boot
+    uint32_t blocked;       // Coroutines sleeping or waiting right now
+    uint32_t resumed;       // Coroutines resumed by lua_scheduler_run() since boot
+    uint32_t heap_high_water;// Most wake-ups pending at once
+    uint32_t late_us_avg;   // From the wake-up time to the resume, averaged over the last window
+    uint32_t late_us_max;
+} lua_scheduler_stats_t;
+
+/**
+ * @brief Create the scheduler's tables in a new state
+ * @param L Lua state, from lua_engine_init()
+ */
+void lua_scheduler_init(lua_State* L);
+
+/**
+ * @brief Start a coroutine and run it up to its first sleep or wait
+ * @param L Lua state with the function at index 1 and its arguments above
+ * @return int 1: the coroutine is pushed
+ */
+int lua_scheduler_spawn(lua_State* L);
+
+/**
+ * @brief Suspend the running coroutine for ms milliseconds
+ * @param L The coroutine
+ * @param ms Delay; 0 waits for the next lua_scheduler_run()
+ * @return int What lua_yield() returns; raises an error outside a coroutine
+ *
+ * For bindings: return lua_scheduler_sleep(L, ms). The coroutine must be
+ * resumed from C, as system.spawn() tasks and timer callbacks are, not
+ * with coroutine.resume().
+ */
+int lua_scheduler_sleep(lua_State* L, uint32_t ms);
+
+/**
+ * @brief Suspend the running coroutine until an event is woken
+ * @param L The coroutine
+ * @param event Stack index of the event, any value but nil or NaN
+ * @param timeout_ms Give up after this long; negative waits forever
+ * @return int What lua_yield() returns; the coroutine gets true and the
+ *         values passed to lua_scheduler_wake(), or false on timeout
+ */
+int lua_scheduler_wait(lua_State* L, int event, int32_t timeout_ms);
+
+/**
+ * @brief lua_scheduler_wait() for bindings that return something else
+ * @param L The coroutine
+ * @param event Stack index of the event
+ * @param timeout_ms Give up after this long; negative waits forever
+ * @param ctx Passed to k
+ * @param k Continuation, as for lua_yieldk(); finds true and the values
+ *        passed to lua_scheduler_wake(), or false, above the stack it left
+ * @return int What lua_yieldk() returns
+ */
+int lua_scheduler_waitk(lua_State* L, int event, int32_t timeout_ms, lua_KContext ctx, lua_KFunction k);
+
+/**
+ * @brief Wake the coroutines waiting for an event
+ * @param L Lua state with nargs values on top, passed to the waiters; popped
+ * @param event Stack index of the event, below the values
+ * @param nargs Number of values
+ * @return int Number of coroutines woken
+ *
+ * They are resumed by the next lua_scheduler_run(), in the order they
+ * started waiting.
+ */
+int lua_scheduler_wake(lua_State* L, int event, int nargs);
+
+/**
+ * @brief Resume the coroutines whose sleep ended or whose event was woken
+ * @param L Lua state
+ * @param budget_us Stop resuming after this long; at least one is resumed
+ * @return int32_t Milliseconds until the next wake-up, -1 if there is none
+ *
+ * Call it from the task that runs Lua, once per frame, e.g. after
+ * lua_event_loop_drain(). Coroutines that go to sleep again meanwhile
+ * are resumed by a later call, even with a 0 ms delay.
+ */
+int32_t lua_scheduler_run(lua_State* L, uint32_t budget_us);
+
+/**
+ * @brief Get the scheduler statistics; the averages and maxima restart each call
+ * @param stats Destination structure
+ */
+void lua_scheduler_get_stats(lua_scheduler_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_SCHEDULER_H
@@ -0,0 +1,260 @@
+#include "lua_slab.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "LUA_SLAB";
+
+#define SLAB_PAGE_UNUSED 0xFF
+#define SLAB_NO_PAGE 0xFFFF
+
+typedef struct slab_block {
+    struct slab_block* next;
+} slab_block_t;
+
+// A page hands out blocks it was given back first, then the ones it has
+// never handed out, from the start; a page taken by a class needs no setup
+typedef struct {
+    slab_block_t* free_list;
+    uint16_t live;          // Blocks handed out and not given back
+    uint16_t carved;        // Blocks handed out at least once
+    uint16_t next;          // In its class's list of pages with room, or the unused pages
+    uint16_t prev;
+    uint8_t cls;
+} slab_page_t;
+
+typedef struct {
+    uint16_t partial;       // Pages with a free block, most recently given one first
+    uint16_t empty;         // Pages in that list with no live block, at most one kept
+    uint32_t pages;
+    uint32_t blocks_used;
+    uint32_t allocs;
+    uint32_t misses;
+} slab_class_t;
+
+static const size_t s_class_sizes[LUA_SLAB_NUM_CLASSES] = {16, 24, 32, 48, 64};
+static const uint16_t s_class_blocks[LUA_SLAB_NUM_CLASSES] = {
+    LUA_SLAB_PAGE_SIZE / 16, LUA_SLAB_PAGE_SIZE / 24, LUA_SLAB_PAGE_SIZE / 32,
+    LUA_SLAB_PAGE_SIZE / 48, LUA_SLAB_PAGE_SIZE / 64
+};
+
+// Maps (size + 7) / 8 to a class index for sizes 1..LUA_SLAB_MAX_SIZE
+static const uint8_t s_class_index[LUA_SLAB_MAX_SIZE / 8 + 1] = {
+    0, 0, 0, 1, 2, 3, 3, 4, 4
+};
+
+static uint8_t* s_region = NULL;
+static size_t s_region_size = 0;
+static uint32_t s_pages_total = 0;
+static uint32_t s_pages_unused = 0;
+static uint32_t s_pages_released = 0;
+static uint16_t s_unused = SLAB_NO_PAGE;   // Pages no class owns
+static slab_page_t* s_pages = NULL;
+static slab_class_t s_classes[LUA_SLAB_NUM_CLASSES];
+
+static void link_partial(slab_class_t* c, uint16_t index) {
+    slab_page_t* page = &s_pages[index];
+    page->prev = SLAB_NO_PAGE;
+    page->next = c->partial;
+    if (c->partial != SLAB_NO_PAGE) {
+        s_pages[c->partial].prev = index;
+    }
+    c->partial = index;
+}
+
+static void unlink_partial(slab_class_t* c, uint16_t index) {
+    slab_page_t* page = &s_pages[index];
+    if (page->prev != SLAB_NO_PAGE) {
+        s_pages[page->prev].next = page->next;
+    } else {
+        c->partial = page->next;
+    }
+    if (page->next != SLAB_NO_PAGE) {
+        s_pages[page->next].prev = page->prev;
+    }
+}
+
+static void push_unused(uint16_t index) {
+    slab_page_t* page = &s_pages[index];
+    page->free_list = NULL;
+    page->live = 0;
+    page->carved = 0;
+    page->cls = SLAB_PAGE_UNUSED;
+    page->next = s_unused;
+    s_unused = index;
+    s_pages_unused++;
+}
+
+bool lua_slab_init(size_t budget) {
+    if (s_region != NULL) {
+        return true;
+    }
+
+    uint32_t pages = budget / LUA_SLAB_PAGE_SIZE;
+    if (pages == 0) {
+        ESP_LOGW(TAG, "Slab budget %zu bytes is below one page, slabs disabled", budget);
+        return false;
+    }
+    if (pages >= SLAB_NO_PAGE) {
+        pages = SLAB_NO_PAGE - 1;
+    }
+
+    // The page map lives with the pages so a single allocation covers the whole budget
+    size_t region_size = (size_t)pages * LUA_SLAB_PAGE_SIZE;
+    uint8_t* region = heap_caps_malloc(region_size + pages * sizeof(slab_page_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (region == NULL) {
+        ESP_LOGW(TAG, "Failed to reserve %zu bytes of internal RAM for slabs", region_size);
+        return false;
+    }
+
+    s_region = region;
+    s_region_size = region_size;
+    s_pages_total = pages;
+    s_pages_unused = 0;
+    s_pages = (slab_page_t*)(region + region_size);
+    s_unused = SLAB_NO_PAGE;
+    // Pushed last to first so pages are taken from the start of the region
+    for (uint32_t i = pages; i-- > 0;) {
+        push_unused((uint16_t)i);
+    }
+    memset(s_classes, 0, sizeof(s_classes));
+    for (int i = 0; i < LUA_SLAB_NUM_CLASSES; i++) {
+        s_classes[i].partial = SLAB_NO_PAGE;
+    }
+
+    ESP_LOGI(TAG, "Reserved %u slab pages (%zu bytes) in internal RAM", (unsigned)pages, region_size);
+    return true;
+}
+
+// Finds an empty page some class keeps, when no page is unused
+static bool steal_empty_page(void) {
+    for (int i = 0; i < LUA_SLAB_NUM_CLASSES; i++) {
+        slab_class_t* c = &s_classes[i];
+        if (c->empty == 0) {
+            continue;
+        }
+        for (uint16_t index = c->partial; index != SLAB_NO_PAGE; index = s_pages[index].next) {
+            if (s_pages[index].live == 0) {
+                unlink_partial(c, index);
+                c->empty--;
+                c->pages--;
+                s_pages_released++;
+                push_unused(index);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Hand an unused page to a size class
+static bool slab_grow(uint8_t cls) {
+    if (s_unused == SLAB_NO_PAGE && !steal_empty_page()) {
+        return false;
+    }
+
+    uint16_t index = s_unused;
+    slab_page_t* page = &s_pages[index];
+    s_unused = page->next;
+    s_pages_unused--;
+    page->cls = cls;
+
+    slab_class_t* c = &s_classes[cls];
+    link_partial(c, index);
+    c->empty++;
+    c->pages++;
+    return true;
+}
+
+void* lua_slab_alloc(size_t size) {
+    if (s_region == NULL || size == 0 || size > LUA_SLAB_MAX_SIZE) {
+        return NULL;
+    }
+
+    uint8_t cls = s_class_index[(size + 7) / 8];
+    slab_class_t* c = &s_classes[cls];
+
+    if (c->partial == SLAB_NO_PAGE && !slab_grow(cls)) {
+        c->misses++;
+        return NULL;
+    }
+
+    uint16_t index = c->partial;
+    slab_page_t* page = &s_pages[index];
+    slab_block_t* b = page->free_list;
+    if (b != NULL) {
+        page->free_list = b->next;
+    } else {
+        b = (slab_block_t*)(s_region + (size_t)index * LUA_SLAB_PAGE_SIZE + (size_t)page->carved * s_class_sizes[cls]);
+        page->carved++;
+    }
+    if (page->live++ == 0) {
+        c->empty--;
+    }
+    if (page->free_list == NULL && page->carved == s_class_blocks[cls]) {
+        unlink_partial(c, index);
+    }
+    c->blocks_used++;
+    c->allocs++;
+    return b;
+}
+
+void lua_slab_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    uint16_t index = (uint16_t)(((uint8_t*)ptr - s_region) / LUA_SLAB_PAGE_SIZE);
+    slab_page_t* page = &s_pages[index];
+    uint8_t cls = page->cls;
+    slab_class_t* c = &s_classes[cls];
+    bool was_full = page->free_list == NULL && page->carved == s_class_blocks[cls];
+
+    slab_block_t* b = (slab_block_t*)ptr;
+    b->next = page->free_list;
+    page->free_list = b;
+    c->blocks_used--;
+    if (was_full) {
+        link_partial(c, index);
+    }
+
+    if (--page->live == 0) {
+        if (c->empty > 0) {
+            unlink_partial(c, index);
+            c->pages--;
+            s_pages_released++;
+            push_unused(index);
+        } else {
+            c->empty++;
+        }
+    }
+}
+
+bool lua_slab_owns(const void* ptr) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return p >= s_region && p < s_region + s_region_size;
+}
+
+size_t lua_slab_block_size(const void* ptr) {
+    uint32_t page = ((const uint8_t*)ptr - s_region) / LUA_SLAB_PAGE_SIZE;
+    return s_class_sizes[s_pages[page].cls];
+}
+
+void lua_slab_get_stats(lua_slab_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->budget = s_region_size;
+    stats->pages_total = s_pages_total;
+    stats->pages_used = s_pages_total - s_pages_unused;
+    stats->pages_released = s_pages_released;
+    for (int i = 0; i < LUA_SLAB_NUM_CLASSES; i++) {
+        stats->classes[i].block_size = s_class_sizes[i];
+        stats->classes[i].pages = s_classes[i].pages;
+        stats->classes[i].blocks_used = s_classes[i].blocks_used;
+        stats->classes[i].blocks_free = s_classes[i].pages * s_class_blocks[i] - s_classes[i].blocks_used;
+        stats->classes[i].allocs = s_classes[i].allocs;
+        stats->classes[i].misses = s_classes[i].misses;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef LUA_SLAB_H
+#define LUA_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest request served by the slab pools; anything bigger goes to the heap.
+#define LUA_SLAB_MAX_SIZE 64
+
+// Slab pages are carved out of the budget on demand. A page whose blocks are
+// all free goes back to the unused pages, and may serve another class next;
+// each class keeps one empty page so a block freed and allocated again at a
+// page boundary doesn't hand the page back and forth.
+#define LUA_SLAB_PAGE_SIZE 1024
+
+// Number of size classes (16, 24, 32, 48, 64 bytes)
+#define LUA_SLAB_NUM_CLASSES 5
+
+typedef struct {
+    size_t block_size;      // Size of one block in this class
+    uint32_t pages;         // Pages currently owned by this class
+    uint32_t blocks_used;   // Live blocks handed out
+    uint32_t blocks_free;   // Blocks free in the pages it owns
+    uint32_t allocs;        // Requests served since boot
+    uint32_t misses;        // Requests that fell back to the heap
+} lua_slab_class_stats_t;
+
+typedef struct {
+    size_t budget;          // Bytes reserved for slabs in internal RAM
+    uint32_t pages_total;
+    uint32_t pages_used;
+    uint32_t pages_released;    // Pages given back by a class since boot
+    lua_slab_class_stats_t classes[LUA_SLAB_NUM_CLASSES];
+} lua_slab_stats_t;
+
+/**
+ * @brief Reserve the slab region from internal RAM
+ * @param budget Number of bytes to reserve (rounded down to whole pages)
+ * @return bool true if the slab region is ready (or was already initialized)
+ *
+ * Safe to call more than once; only the first call allocates.
+ */
+bool lua_slab_init(size_t budget);
+
+/**
+ * @brief Allocate a block of at most LUA_SLAB_MAX_SIZE bytes
+ * @param size Requested size
+ * @return void* Block from a slab, or NULL if the class is exhausted
+ */
+void* lua_slab_alloc(size_t size);
+
+/**
+ * @brief Return a block to its slab
+ * @param ptr Block previously returned by lua_slab_alloc()
+ */
+void lua_slab_free(void* ptr);
+
+/**
+ * @brief Check whether a pointer lies inside the slab region
+ * @param ptr Pointer to test
+ * @return bool true if ptr was handed out by lua_slab_alloc()
+ */
+bool lua_slab_owns(const void* ptr);
+
+/**
+ * @brief Usable size of a slab block (its class size)
+ * @param ptr Block owned by the slab region
+ * @return size_t Block size in bytes
+ */
+size_t lua_slab_block_size(const void* ptr);
+
+/**
+ * @brief Snapshot the slab occupancy counters
+ * @param stats Destination structure
+ */
+void lua_slab_get_stats(lua_slab_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_SLAB_H
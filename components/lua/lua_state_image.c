@@ -0,0 +1,1110 @@
+#include "lua_state_image.h"
+#include "lauxlib.h"
+#include "lrotable.h"
+#include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *TAG = "LUA_IMAGE";
+
+// Registry key of the names table: object -> name for every named object,
+// plus the libraries opened after the baseline at 1..n in opening order
+static const char s_perms_key = 0;
+
+// Value tags
+enum {
+    IMG_NIL,
+    IMG_FALSE,
+    IMG_TRUE,
+    IMG_INT,        // int64
+    IMG_FLT,        // double
+    IMG_STR,        // u32 length, bytes; repeats are written as IMG_REF
+    IMG_REF,        // u32: string or object already read
+    IMG_NAMED,      // name: object of the restoring state; C closures add upvalues as IMG_CCLOSURE
+    IMG_NAMED_TABLE,// name, then contents as IMG_TABLE without the sizes
+    IMG_TABLE,      // u32 array size, u32 hash size, key/value pairs up to a nil key, metatable
+    IMG_LFUNC,      // u32 size, bytecode, u8 upvalue count, upvalues
+    IMG_CFUNC,      // int64 address relative to image_anchor()
+    IMG_ROTABLE,    // int64 address relative to image_anchor()
+    IMG_CCLOSURE,   // int64 address relative to image_anchor(), u8 upvalue count, upvalues
+};
+
+// Upvalue tags
+enum {
+    IMG_UPVAL,      // Value follows
+    IMG_UPJOIN,     // u32 ref of a function read earlier, u8 upvalue index: shared with it
+};
+
+#define IMAGE_MAX_DEPTH 200
+
+typedef struct {
+    lua_State* L;
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    int names;              // Stack index: object -> name
+    int refs;               // Stack index: object -> ref
+    int upvals;             // Stack index: upvalue id -> ref * 256 + index
+    lua_Integer next_ref;
+    bool strip;
+    int depth;
+} image_writer_t;
+
+typedef struct {
+    lua_State* L;
+    const uint8_t* p;
+    const uint8_t* end;
+    int objects;            // Stack index: name -> object
+    int refs;               // Stack index: ref -> object
+    lua_Integer next_ref;
+    int depth;
+} image_reader_t;
+
+// Light C functions and rotables live in the firmware image, so their
+// distance from a function of the same image is what gets stored
+static uintptr_t image_anchor(void) {
+    return (uintptr_t)&lua_state_image_dump;
+}
+
+// FNV-1a over the firmware identity and the VM's value layout
+static uint32_t image_build_hash(void) {
+    char elf_sha[65] = {0};
+    esp_app_get_elf_sha256(elf_sha, sizeof(elf_sha));
+    const struct {
+        uint8_t int_size;
+        uint8_t num_size;
+        uint8_t ptr_size;
+    } layout = {sizeof(lua_Integer), sizeof(lua_Number), sizeof(void*)};
+
+    uint32_t hash = 2166136261u;
+    for (const char* p = elf_sha; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    for (const char* p = LUA_RELEASE; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    const uint8_t* bytes = (const uint8_t*)&layout;
+    for (size_t i = 0; i < sizeof(layout); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+#define SOURCES_MAX_DEPTH 8
+
+// Adds one hash per file, so the order the directory is listed in doesn't matter
+static uint32_t sources_walk(const char* dir, size_t root_len, const char* image_path, int depth) {
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    uint32_t sum = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        char path[300];
+        struct stat st;
+        if (entry->d_name[0] == '.' ||
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path) ||
+            stat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < SOURCES_MAX_DEPTH) {
+                sum += sources_walk(path, root_len, image_path, depth + 1);
+            }
+            continue;
+        }
+        // The image and the temporary file it is saved through
+        if (strncmp(path, image_path, strlen(image_path)) == 0) {
+            continue;
+        }
+        const struct {
+            uint32_t size;
+            int64_t mtime;
+        } meta = {(uint32_t)st.st_size, (int64_t)st.st_mtime};
+        uint32_t hash = 2166136261u;
+        for (const char* p = path + root_len; *p; p++) {
+            hash = (hash ^ (uint8_t)*p) * 16777619u;
+        }
+        const uint8_t* bytes = (const uint8_t*)&meta;
+        for (size_t i = 0; i < sizeof(meta); i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        sum += hash;
+    }
+    closedir(d);
+    return sum;
+}
+
+uint32_t lua_state_image_sources_hash(const char* image_path) {
+    char dir[256];
+    const char* slash = strrchr(image_path, '/');
+    size_t len = slash != NULL ? (size_t)(slash - image_path) : 0;
+    if (len == 0 || len >= sizeof(dir)) {
+        snprintf(dir, sizeof(dir), "%s", slash == image_path ? "/" : ".");
+        len = strlen(dir);
+    } else {
+        memcpy(dir, image_path, len);
+        dir[len] = '\0';
+    }
+    uint32_t hash = sources_walk(dir, len, image_path, 0);
+    return hash != 0 ? hash : 1;
+}
+
+static void* image_buf_alloc(size_t size) {
+    void* buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return buf != NULL ? buf : heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+// --- Naming ---
+
+// C closures are the functions with upvalues; light C functions have none
+static bool is_cclosure(lua_State* L, int idx) {
+    if (!lua_iscfunction(L, idx) || lua_getupvalue(L, idx, 1) == NULL) {
+        return false;
+    }
+    lua_pop(L, 1);
+    return true;
+}
+
+// Objects the image refers to by name rather than writing them out
+static bool is_nameable(lua_State* L, int idx) {
+    switch (lua_type(L, idx)) {
+        case LUA_TTABLE:
+            return lua_torotable(L, idx) == NULL;
+        case LUA_TFUNCTION:
+            return is_cclosure(L, idx);
+        case LUA_TUSERDATA:
+        case LUA_TTHREAD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    int type;
+    lua_Number n;
+    const char* s;
+    size_t len;
+} sort_key_t;
+
+static int compare_keys(const void* a, const void* b) {
+    const sort_key_t* ka = (const sort_key_t*)a;
+    const sort_key_t* kb = (const sort_key_t*)b;
+    if (ka->type != kb->type) {
+        return ka->type < kb->type ? -1 : 1;
+    }
+    if (ka->type == LUA_TSTRING) {
+        size_t len = ka->len < kb->len ? ka->len : kb->len;
+        int c = memcmp(ka->s, kb->s, len);
+        return c != 0 ? c : (ka->len < kb->len ? -1 : ka->len > kb->len);
+    }
+    return ka->n < kb->n ? -1 : ka->n > kb->n;
+}
+
+// Push "parent.key", or "parent[...]" for keys that aren't identifiers
+static void push_child_name(lua_State* L, const char* parent, const sort_key_t* key) {
+    if (key->type == LUA_TSTRING) {
+        bool ident = key->len > 0 && !(key->s[0] >= '0' && key->s[0] <= '9');
+        for (size_t i = 0; ident && i < key->len; i++) {
+            char c = key->s[i];
+            ident = c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        }
+        if (ident) {
+            lua_pushfstring(L, "%s.%s", parent, key->s);
+        } else {
+            luaL_Buffer b;
+            luaL_buffinit(L, &b);
+            lua_pushfstring(L, "%s[%d:", parent, (int)key->len);
+            luaL_addvalue(&b);
+            luaL_addlstring(&b, key->s, key->len);
+            luaL_addchar(&b, ']');
+            luaL_pushresult(&b);
+        }
+    } else if (key->type == LUA_TBOOLEAN) {
+        lua_pushfstring(L, "%s[%s]", parent, key->n != 0 ? "true" : "false");
+    } else {
+        lua_pushfstring(L, "%s[%f]", parent, key->n);
+    }
+}
+
+// Name the value at idx if it needs a name and has none yet, and queue it
+// so the objects reachable from it are named too
+static void name_value(lua_State* L, int names, int queue, int idx, const char* name) {
+    idx = lua_absindex(L, idx);
+    if (!is_nameable(L, idx)) {
+        return;
+    }
+    lua_pushvalue(L, idx);
+    if (lua_rawget(L, names) != LUA_TNIL) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, idx);
+    lua_pushstring(L, name);
+    lua_rawset(L, names);
+    lua_pushvalue(L, idx);
+    lua_rawseti(L, queue, (lua_Integer)lua_rawlen(L, queue) + 1);
+}
+
+static void name_table_entries(lua_State* L, int names, int queue, int t, const char* name) {
+    size_t count = 0, capacity = 16;
+    sort_key_t* keys = malloc(capacity * sizeof(*keys));
+    lua_pushnil(L);
+    while (keys != NULL && lua_next(L, t) != 0) {
+        lua_pop(L, 1);
+        int type = lua_type(L, -1);
+        if (type != LUA_TSTRING && type != LUA_TNUMBER && type != LUA_TBOOLEAN) {
+            continue; // Only these make stable names
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            sort_key_t* grown = realloc(keys, capacity * sizeof(*keys));
+            if (grown == NULL) {
+                free(keys);
+                keys = NULL;
+                lua_pop(L, 1);
+                break;
+            }
+            keys = grown;
+        }
+        sort_key_t* k = &keys[count++];
+        k->type = type;
+        k->n = type == LUA_TNUMBER ? lua_tonumber(L, -1) : type == LUA_TBOOLEAN ? lua_toboolean(L, -1) : 0;
+        k->s = type == LUA_TSTRING ? lua_tolstring(L, -1, &k->len) : NULL;
+    }
+    if (keys == NULL) {
+        luaL_error(L, "not enough memory to name the objects of %s", name);
+    }
+
+    // Table order depends on the per-state string seed; sorted keys don't
+    qsort(keys, count, sizeof(*keys), compare_keys);
+    for (size_t i = 0; i < count; i++) {
+        const sort_key_t* k = &keys[i];
+        if (k->type == LUA_TSTRING) {
+            lua_pushlstring(L, k->s, k->len);
+        } else if (k->type == LUA_TBOOLEAN) {
+            lua_pushboolean(L, k->n != 0);
+        } else {
+            lua_pushnumber(L, k->n);
+        }
+        lua_rawget(L, t);
+        push_child_name(L, name, k);
+        name_value(L, names, queue, -2, lua_tostring(L, -1));
+        lua_pop(L, 2);
+    }
+    free(keys);
+}
+
+// Breadth first, so every object gets the shortest path to it as its name
+static void name_reachable(lua_State* L, int names, int root, const char* root_name) {
+    lua_newtable(L);
+    int queue = lua_gettop(L);
+    name_value(L, names, queue, root, root_name);
+
+    for (lua_Integer head = 1; lua_rawgeti(L, queue, head) != LUA_TNIL; head++) {
+        int obj = lua_gettop(L);
+        lua_pushvalue(L, obj);
+        lua_rawget(L, names);
+        const char* name = lua_tostring(L, -1);
+        luaL_checkstack(L, 8, "naming objects");
+
+        if (lua_type(L, obj) == LUA_TTABLE) {
+            name_table_entries(L, names, queue, obj, name);
+        } else if (lua_type(L, obj) == LUA_TFUNCTION) {
+            for (int i = 1; lua_getupvalue(L, obj, i) != NULL; i++) {
+                lua_pushfstring(L, "%s^%d", name, i);
+                name_value(L, names, queue, -2, lua_tostring(L, -1));
+                lua_pop(L, 2);
+            }
+        } else if (lua_type(L, obj) == LUA_TUSERDATA) {
+            for (int i = 1; lua_getiuservalue(L, obj, i) != LUA_TNONE; i++) {
+                lua_pushfstring(L, "%s#uv%d", name, i);
+                name_value(L, names, queue, -2, lua_tostring(L, -1));
+                lua_pop(L, 2);
+            }
+            lua_pop(L, 1);
+        }
+        if (lua_type(L, obj) != LUA_TTHREAD && lua_getmetatable(L, obj)) {
+            lua_pushfstring(L, "%s#mt", name);
+            name_value(L, names, queue, -2, lua_tostring(L, -1));
+            lua_pop(L, 2);
+        }
+        lua_pop(L, 2); // Name, object
+    }
+    lua_pop(L, 2); // Terminating nil, queue
+}
+
+static int mark_baseline(lua_State* L) {
+    lua_newtable(L);
+    int names = lua_gettop(L);
+    lua_pushvalue(L, names);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &s_perms_key);
+
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    name_reachable(L, names, lua_gettop(L), "R");
+    lua_pop(L, 1);
+    lua_pushliteral(L, "");
+    if (lua_getmetatable(L, -1)) {
+        name_reachable(L, names, lua_gettop(L), "S");
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+    return 0;
+}
+
+void lua_state_image_mark_baseline(lua_State* L) {
+    int64_t start_us = esp_timer_get_time();
+    lua_pushcfunction(L, mark_baseline);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+        ESP_LOGW(TAG, "State images disabled: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &s_perms_key);
+        return;
+    }
+    ESP_LOGI(TAG, "Named the baseline objects in %lld us", (long long)(esp_timer_get_time() - start_us));
+}
+
+static int add_lib(lua_State* L) {
+    int names = lua_upvalueindex(1);
+    const char* name = lua_tostring(L, 1);
+    lua_Integer n = (lua_Integer)lua_rawlen(L, names);
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, names, i);
+        bool seen = strcmp(lua_tostring(L, -1), name) == 0;
+        lua_pop(L, 1);
+        if (seen) {
+            return 0;
+        }
+    }
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, names, n + 1);
+    lua_pushfstring(L, "lib:%s", name);
+    name_reachable(L, lua_upvalueindex(1), 2, lua_tostring(L, -1));
+    return 0;
+}
+
+void lua_state_image_add_lib(lua_State* L, const char* name, int idx) {
+    idx = lua_absindex(L, idx);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &s_perms_key) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return; // No baseline
+    }
+    lua_pushcclosure(L, add_lib, 1);
+    lua_pushstring(L, name);
+    lua_pushvalue(L, idx);
+    if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+        ESP_LOGW(TAG, "Failed to name the objects of %s: %s", name, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+// --- Writing ---
+
+static void put(image_writer_t* w, const void* p, size_t size) {
+    if (w->size + size > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 16384;
+        while (capacity < w->size + size) capacity *= 2;
+        uint8_t* data = image_buf_alloc(capacity);
+        if (data == NULL) {
+            luaL_error(w->L, "not enough memory for the image");
+        }
+        if (w->data != NULL) {
+            memcpy(data, w->data, w->size);
+            heap_caps_free(w->data);
+        }
+        w->data = data;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, p, size);
+    w->size += size;
+}
+
+static void put_u8(image_writer_t* w, uint8_t v) {
+    put(w, &v, sizeof(v));
+}
+
+static void put_u32(image_writer_t* w, uint32_t v) {
+    put(w, &v, sizeof(v));
+}
+
+static void put_i64(image_writer_t* w, int64_t v) {
+    put(w, &v, sizeof(v));
+}
+
+static void put_string(image_writer_t* w, const char* s, size_t len) {
+    put_u32(w, (uint32_t)len);
+    put(w, s, len);
+}
+
+static void put_address(image_writer_t* w, uint8_t tag, const void* p) {
+    put_u8(w, tag);
+    put_i64(w, (int64_t)((uintptr_t)p - image_anchor()));
+}
+
+static int image_dump_writer(lua_State* L, const void* p, size_t size, void* ud) {
+    (void)L;
+    put((image_writer_t*)ud, p, size);
+    return 0;
+}
+
+static void write_value(image_writer_t* w, int idx);
+
+// Writes a reference to an object already written, or gives it a ref.
+// Returns true if nothing more needs to be written for it.
+static bool write_ref(image_writer_t* w, int idx) {
+    lua_State* L = w->L;
+    lua_pushvalue(L, idx);
+    if (lua_rawget(L, w->refs) == LUA_TNUMBER) {
+        put_u8(w, IMG_REF);
+        put_u32(w, (uint32_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        return true;
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, idx);
+    lua_pushinteger(L, ++w->next_ref);
+    lua_rawset(L, w->refs);
+    return false;
+}
+
+static void write_table_contents(image_writer_t* w, int t) {
+    lua_State* L = w->L;
+    lua_pushnil(L);
+    while (lua_next(L, t) != 0) {
+        if (lua_touserdata(L, -2) == &s_perms_key) {
+            lua_pop(L, 1);
+            continue; // The names belong to the state, not the image
+        }
+        write_value(w, -2);
+        write_value(w, -1);
+        lua_pop(L, 1);
+    }
+    put_u8(w, IMG_NIL);
+    if (lua_getmetatable(L, t)) {
+        write_value(w, -1);
+        lua_pop(L, 1);
+    } else {
+        put_u8(w, IMG_NIL);
+    }
+}
+
+static void write_table(image_writer_t* w, int t) {
+    lua_State* L = w->L;
+    uint32_t narr = (uint32_t)lua_rawlen(L, t), count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, t) != 0) {
+        lua_pop(L, 1);
+        count++;
+    }
+    put_u8(w, IMG_TABLE);
+    put_u32(w, narr);
+    put_u32(w, count > narr ? count - narr : 0);
+    write_table_contents(w, t);
+}
+
+static void write_lfunc(image_writer_t* w, int f) {
+    lua_State* L = w->L;
+    put_u8(w, IMG_LFUNC);
+    size_t size_at = w->size;
+    put_u32(w, 0);
+    lua_pushvalue(L, f);
+    lua_dump(L, image_dump_writer, w, w->strip);
+    lua_pop(L, 1);
+    uint32_t size = (uint32_t)(w->size - size_at - sizeof(uint32_t));
+    memcpy(w->data + size_at, &size, sizeof(size));
+
+    int nups = 0;
+    while (lua_getupvalue(L, f, nups + 1) != NULL) {
+        lua_pop(L, 1);
+        nups++;
+    }
+    put_u8(w, (uint8_t)nups);
+
+    lua_pushvalue(L, f);
+    lua_rawget(L, w->refs);
+    lua_Integer ref = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    for (int i = 1; i <= nups; i++) {
+        lua_pushlightuserdata(L, lua_upvalueid(L, f, i));
+        if (lua_rawget(L, w->upvals) == LUA_TNUMBER) {
+            lua_Integer shared = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            put_u8(w, IMG_UPJOIN);
+            put_u32(w, (uint32_t)(shared / 256));
+            put_u8(w, (uint8_t)(shared % 256));
+            continue;
+        }
+        lua_pop(L, 1);
+        lua_pushlightuserdata(L, lua_upvalueid(L, f, i));
+        lua_pushinteger(L, ref * 256 + i);
+        lua_rawset(L, w->upvals);
+
+        put_u8(w, IMG_UPVAL);
+        lua_getupvalue(L, f, i);
+        write_value(w, -1);
+        lua_pop(L, 1);
+    }
+}
+
+static void write_cclosure_upvalues(image_writer_t* w, int f) {
+    lua_State* L = w->L;
+    int nups = 0;
+    while (lua_getupvalue(L, f, nups + 1) != NULL) {
+        lua_pop(L, 1);
+        nups++;
+    }
+    put_u8(w, (uint8_t)nups);
+    for (int i = 1; i <= nups; i++) {
+        lua_getupvalue(L, f, i);
+        write_value(w, -1);
+        lua_pop(L, 1);
+    }
+}
+
+static void write_value(image_writer_t* w, int idx) {
+    lua_State* L = w->L;
+    idx = lua_absindex(L, idx);
+    if (++w->depth > IMAGE_MAX_DEPTH) {
+        luaL_error(L, "objects nested too deeply to save");
+    }
+    luaL_checkstack(L, 8, "saving the state");
+
+    int type = lua_type(L, idx);
+    switch (type) {
+        case LUA_TNIL:
+            put_u8(w, IMG_NIL);
+            break;
+        case LUA_TBOOLEAN:
+            put_u8(w, lua_toboolean(L, idx) ? IMG_TRUE : IMG_FALSE);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                put_u8(w, IMG_INT);
+                put_i64(w, (int64_t)lua_tointeger(L, idx));
+            } else {
+                double n = (double)lua_tonumber(L, idx);
+                put_u8(w, IMG_FLT);
+                put(w, &n, sizeof(n));
+            }
+            break;
+        case LUA_TSTRING: {
+            if (write_ref(w, idx)) {
+                break;
+            }
+            size_t len;
+            const char* s = lua_tolstring(L, idx, &len);
+            put_u8(w, IMG_STR);
+            put_string(w, s, len);
+            break;
+        }
+        case LUA_TLIGHTUSERDATA:
+            luaL_error(L, "light userdata can't be saved");
+            break;
+        default: {
+            const luaR_entry* rotable = lua_torotable(L, idx);
+            if (rotable != NULL) {
+                put_address(w, IMG_ROTABLE, rotable);
+                break;
+            }
+            if (type == LUA_TFUNCTION && lua_iscfunction(L, idx) && !is_cclosure(L, idx)) {
+                put_address(w, IMG_CFUNC, (const void*)lua_tocfunction(L, idx));
+                break;
+            }
+            if (write_ref(w, idx)) {
+                break;
+            }
+
+            lua_pushvalue(L, idx);
+            if (lua_rawget(L, w->names) == LUA_TSTRING) {
+                size_t len;
+                const char* name = lua_tolstring(L, -1, &len);
+                put_u8(w, type == LUA_TTABLE ? IMG_NAMED_TABLE : IMG_NAMED);
+                put_string(w, name, len);
+                lua_pop(L, 1);
+                if (type == LUA_TTABLE) {
+                    write_table_contents(w, idx);
+                } else if (type == LUA_TFUNCTION) {
+                    write_cclosure_upvalues(w, idx);
+                }
+                break;
+            }
+            lua_pop(L, 1);
+
+            if (type == LUA_TTABLE) {
+                write_table(w, idx);
+            } else if (type == LUA_TFUNCTION && lua_iscfunction(L, idx)) {
+                put_address(w, IMG_CCLOSURE, (const void*)lua_tocfunction(L, idx));
+                write_cclosure_upvalues(w, idx);
+            } else if (type == LUA_TFUNCTION) {
+                write_lfunc(w, idx);
+            } else {
+                luaL_error(L, "%s created after startup can't be saved", lua_typename(L, type));
+            }
+            break;
+        }
+    }
+    w->depth--;
+}
+
+// Arguments: writer state, entry function or nil
+static int dump_protected(lua_State* L) {
+    image_writer_t* w = (image_writer_t*)lua_touserdata(L, 1);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &s_perms_key) != LUA_TTABLE) {
+        return luaL_error(L, "state has no baseline to save against");
+    }
+    w->names = lua_gettop(L);
+    lua_newtable(L);
+    w->refs = lua_gettop(L);
+    lua_newtable(L);
+    w->upvals = lua_gettop(L);
+
+    // Libraries opened after the baseline, which the restore opens first
+    lua_Integer libs = (lua_Integer)lua_rawlen(L, w->names);
+    put_u32(w, (uint32_t)libs);
+    for (lua_Integer i = 1; i <= libs; i++) {
+        size_t len;
+        lua_rawgeti(L, w->names, i);
+        const char* name = lua_tolstring(L, -1, &len);
+        put_string(w, name, len);
+        lua_pop(L, 1);
+    }
+
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    write_value(w, -1);
+    lua_pushliteral(L, "");
+    if (!lua_getmetatable(L, -1)) {
+        lua_pushnil(L);
+    }
+    write_value(w, -1);
+    write_value(w, 2);
+    return 0;
+}
+
+int lua_state_image_dump(lua_State* L, int entry, uint32_t sources_hash, lua_Writer writer, void* data, bool strip) {
+    image_writer_t w = {.L = L, .strip = strip};
+    int64_t start_us = esp_timer_get_time();
+    int gc_was_running = lua_gc(L, LUA_GCISRUNNING);
+    lua_gc(L, LUA_GCSTOP);
+
+    if (entry != 0) {
+        entry = lua_absindex(L, entry);
+    }
+    lua_pushcfunction(L, dump_protected);
+    lua_pushlightuserdata(L, &w);
+    if (entry != 0) {
+        lua_pushvalue(L, entry);
+    } else {
+        lua_pushnil(L);
+    }
+    int status = lua_pcall(L, 2, 0, 0);
+
+    if (gc_was_running) {
+        lua_gc(L, LUA_GCRESTART);
+    }
+    if (status == LUA_OK) {
+        lua_state_image_hdr_t hdr = {
+            .version = LUA_STATE_IMAGE_VERSION,
+            .build_hash = image_build_hash(),
+            .sources_hash = sources_hash,
+            .payload_size = (uint32_t)w.size,
+            .payload_crc = esp_rom_crc32_le(0, w.data, w.size),
+        };
+        memcpy(hdr.magic, LUA_STATE_IMAGE_MAGIC, sizeof(hdr.magic));
+        if (writer(L, &hdr, sizeof(hdr), data) != 0 || writer(L, w.data, w.size, data) != 0) {
+            lua_pushliteral(L, "failed to write the image");
+            status = LUA_ERRERR;
+        } else {
+            ESP_LOGI(TAG, "Saved %lld objects in %zu bytes in %lld us", (long long)w.next_ref, w.size,
+                     (long long)(esp_timer_get_time() - start_us));
+        }
+    }
+    heap_caps_free(w.data);
+    return status;
+}
+
+// --- Reading ---
+
+static void get(image_reader_t* r, void* p, size_t size) {
+    if ((size_t)(r->end - r->p) < size) {
+        luaL_error(r->L, "truncated image");
+    }
+    memcpy(p, r->p, size);
+    r->p += size;
+}
+
+static uint8_t get_u8(image_reader_t* r) {
+    uint8_t v;
+    get(r, &v, sizeof(v));
+    return v;
+}
+
+static uint32_t get_u32(image_reader_t* r) {
+    uint32_t v;
+    get(r, &v, sizeof(v));
+    return v;
+}
+
+static int64_t get_i64(image_reader_t* r) {
+    int64_t v;
+    get(r, &v, sizeof(v));
+    return v;
+}
+
+// Returns the string in place; it is not NUL-terminated
+static const char* get_string(image_reader_t* r, size_t* len) {
+    *len = get_u32(r);
+    if ((size_t)(r->end - r->p) < *len) {
+        luaL_error(r->L, "truncated image");
+    }
+    const char* s = (const char*)r->p;
+    r->p += *len;
+    return s;
+}
+
+static void* get_address(image_reader_t* r) {
+    return (void*)(image_anchor() + (uintptr_t)get_i64(r));
+}
+
+static void read_value(image_reader_t* r);
+
+static void add_ref(image_reader_t* r, int idx) {
+    lua_pushvalue(r->L, idx);
+    lua_rawseti(r->L, r->refs, ++r->next_ref);
+}
+
+static void push_named(image_reader_t* r) {
+    lua_State* L = r->L;
+    size_t len;
+    const char* name = get_string(r, &len);
+    lua_pushlstring(L, name, len);
+    if (lua_rawget(L, r->objects) == LUA_TNIL) {
+        luaL_error(L, "image refers to %s, which this state doesn't have", lua_pushlstring(L, name, len));
+    }
+}
+
+// Entries up to the nil key, then the metatable
+static void read_table_contents(image_reader_t* r, int t) {
+    lua_State* L = r->L;
+    for (;;) {
+        read_value(r);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        read_value(r);
+        lua_rawset(L, t);
+    }
+    read_value(r);
+    if (!lua_isnil(L, -1) && lua_type(L, -1) != LUA_TTABLE) {
+        luaL_error(L, "corrupt image: bad metatable");
+    }
+    lua_setmetatable(L, t);
+}
+
+// A named table keeps its identity; its contents become the saved ones
+static void clear_table(lua_State* L, int t) {
+    lua_pushnil(L);
+    while (lua_next(L, t) != 0) {
+        lua_pop(L, 1);
+        if (lua_touserdata(L, -1) == &s_perms_key) {
+            continue;
+        }
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, t);
+    }
+}
+
+// Upvalues of the C closure on top of the stack
+static void read_cclosure_upvalues(image_reader_t* r) {
+    lua_State* L = r->L;
+    int f = lua_gettop(L);
+    int nups = get_u8(r);
+    for (int i = 1; i <= nups; i++) {
+        read_value(r);
+        if (lua_setupvalue(L, f, i) == NULL) {
+            luaL_error(L, "corrupt image: bad upvalue");
+        }
+    }
+}
+
+static void read_lfunc(image_reader_t* r) {
+    lua_State* L = r->L;
+    size_t size = get_u32(r);
+    if ((size_t)(r->end - r->p) < size) {
+        luaL_error(L, "truncated image");
+    }
+    if (luaL_loadbufferx(L, (const char*)r->p, size, "=image", "b") != LUA_OK) {
+        lua_error(L);
+    }
+    r->p += size;
+    int f = lua_gettop(L);
+    add_ref(r, f);
+
+    int nups = get_u8(r);
+    for (int i = 1; i <= nups; i++) {
+        if (get_u8(r) == IMG_UPJOIN) {
+            lua_Integer ref = get_u32(r);
+            int n = get_u8(r);
+            if (lua_rawgeti(L, r->refs, ref) != LUA_TFUNCTION || lua_iscfunction(L, -1) ||
+                lua_getupvalue(L, -1, n) == NULL) {
+                luaL_error(L, "corrupt image: bad shared upvalue");
+            }
+            lua_pop(L, 1);
+            lua_upvaluejoin(L, f, i, -1, n);
+            lua_pop(L, 1);
+        } else {
+            read_value(r);
+            if (lua_setupvalue(L, f, i) == NULL) {
+                luaL_error(L, "corrupt image: bad upvalue");
+            }
+        }
+    }
+}
+
+// Pushes the next value of the image
+static void read_value(image_reader_t* r) {
+    lua_State* L = r->L;
+    if (++r->depth > IMAGE_MAX_DEPTH) {
+        luaL_error(L, "corrupt image: nested too deeply");
+    }
+    luaL_checkstack(L, 8, "restoring the state");
+
+    switch (get_u8(r)) {
+        case IMG_NIL:
+            lua_pushnil(L);
+            break;
+        case IMG_FALSE:
+            lua_pushboolean(L, 0);
+            break;
+        case IMG_TRUE:
+            lua_pushboolean(L, 1);
+            break;
+        case IMG_INT:
+            lua_pushinteger(L, (lua_Integer)get_i64(r));
+            break;
+        case IMG_FLT: {
+            double n;
+            get(r, &n, sizeof(n));
+            lua_pushnumber(L, (lua_Number)n);
+            break;
+        }
+        case IMG_STR: {
+            size_t len;
+            const char* s = get_string(r, &len);
+            lua_pushlstring(L, s, len);
+            add_ref(r, -1);
+            break;
+        }
+        case IMG_REF: {
+            lua_Integer ref = get_u32(r);
+            if (ref < 1 || ref > r->next_ref) {
+                luaL_error(L, "corrupt image: bad reference");
+            }
+            lua_rawgeti(L, r->refs, ref);
+            break;
+        }
+        case IMG_NAMED:
+            push_named(r);
+            add_ref(r, -1);
+            if (is_cclosure(L, -1)) {
+                read_cclosure_upvalues(r);
+            }
+            break;
+        case IMG_NAMED_TABLE:
+            push_named(r);
+            if (lua_type(L, -1) != LUA_TTABLE) {
+                luaL_error(L, "corrupt image: named object is not a table");
+            }
+            add_ref(r, -1);
+            clear_table(L, lua_gettop(L));
+            read_table_contents(r, lua_gettop(L));
+            break;
+        case IMG_TABLE: {
+            uint32_t narr = get_u32(r);
+            uint32_t nrec = get_u32(r);
+            if (narr > (uint32_t)(r->end - r->p) || nrec > (uint32_t)(r->end - r->p)) {
+                luaL_error(L, "corrupt image: bad table size");
+            }
+            lua_createtable(L, (int)narr, (int)nrec);
+            add_ref(r, -1);
+            read_table_contents(r, lua_gettop(L));
+            break;
+        }
+        case IMG_LFUNC:
+            read_lfunc(r);
+            break;
+        case IMG_CFUNC:
+            lua_pushcfunction(L, (lua_CFunction)get_address(r));
+            break;
+        case IMG_ROTABLE:
+            lua_pushrotable(L, (const luaR_entry*)get_address(r));
+            break;
+        case IMG_CCLOSURE: {
+            lua_CFunction f = (lua_CFunction)get_address(r);
+            int nups = r->p < r->end ? *r->p : 0;
+            if (nups == 0) {
+                luaL_error(L, "corrupt image: C closure without upvalues");
+            }
+            // Created with nils so it has a ref before its upvalues are read
+            for (int i = 0; i < nups; i++) {
+                lua_pushnil(L);
+            }
+            lua_pushcclosure(L, f, nups);
+            add_ref(r, -1);
+            read_cclosure_upvalues(r);
+            break;
+        }
+        default:
+            luaL_error(L, "corrupt image: unknown tag");
+    }
+    r->depth--;
+}
+
+// Opens a library that was opened on first use before the save, through
+// its package.preload loader, which names its objects like it did then
+static void open_lib(lua_State* L, const char* name, size_t len) {
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_pushlstring(L, name, len);
+    if (lua_rawget(L, -2) != LUA_TNIL) {
+        lua_pop(L, 2);
+        return;
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushlstring(L, name, len);
+    if (lua_rawget(L, -2) != LUA_TFUNCTION) {
+        luaL_error(L, "image needs library %s, which this state can't open", lua_pushlstring(L, name, len));
+    }
+    lua_pushlstring(L, name, len);
+    lua_call(L, 1, 1);
+    lua_pushlstring(L, name, len);
+    lua_insert(L, -2);
+    lua_rawset(L, -4); // package.loaded[name]
+    lua_pop(L, 2);
+}
+
+// Arguments: reader state. Returns the entry function or nil.
+static int undump_protected(lua_State* L) {
+    image_reader_t* r = (image_reader_t*)lua_touserdata(L, 1);
+
+    uint32_t libs = get_u32(r);
+    for (uint32_t i = 0; i < libs; i++) {
+        size_t len;
+        const char* name = get_string(r, &len);
+        open_lib(L, name, len);
+    }
+
+    // Invert the names of this state's objects
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &s_perms_key) != LUA_TTABLE) {
+        return luaL_error(L, "state has no baseline to restore into");
+    }
+    lua_newtable(L);
+    r->objects = lua_gettop(L);
+    lua_pushnil(L);
+    while (lua_next(L, -3) != 0) {
+        if (lua_type(L, -1) == LUA_TSTRING && lua_type(L, -2) != LUA_TNUMBER) {
+            lua_pushvalue(L, -2);
+            lua_rawset(L, r->objects);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+    lua_newtable(L);
+    r->refs = lua_gettop(L);
+
+    read_value(r); // Registry
+    read_value(r); // String metatable
+    read_value(r); // Entry
+    if (r->p != r->end) {
+        return luaL_error(L, "corrupt image: trailing data");
+    }
+    return 1;
+}
+
+int lua_state_image_undump(lua_State* L, const void* image, size_t size, uint32_t sources_hash) {
+    lua_state_image_hdr_t hdr;
+    if (size < sizeof(hdr)) {
+        lua_pushliteral(L, "not a state image");
+        return LUA_ERRSYNTAX;
+    }
+    memcpy(&hdr, image, sizeof(hdr));
+    const uint8_t* payload = (const uint8_t*)image + sizeof(hdr);
+    if (memcmp(hdr.magic, LUA_STATE_IMAGE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != LUA_STATE_IMAGE_VERSION) {
+        lua_pushliteral(L, "not a state image");
+        return LUA_ERRSYNTAX;
+    }
+    if (hdr.build_hash != image_build_hash()) {
+        lua_pushliteral(L, "state image was saved by another firmware");
+        return LUA_ERRSYNTAX;
+    }
+    if (hdr.sources_hash != 0 && sources_hash != 0 && hdr.sources_hash != sources_hash) {
+        lua_pushliteral(L, "the app's files changed since the state image was saved");
+        return LUA_ERRSYNTAX;
+    }
+    if (hdr.payload_size != size - sizeof(hdr) || esp_rom_crc32_le(0, payload, hdr.payload_size) != hdr.payload_crc) {
+        lua_pushliteral(L, "state image is truncated or corrupt");
+        return LUA_ERRSYNTAX;
+    }
+
+    image_reader_t r = {.L = L, .p = payload, .end = payload + hdr.payload_size};
+    int64_t start_us = esp_timer_get_time();
+    int gc_was_running = lua_gc(L, LUA_GCISRUNNING);
+    lua_gc(L, LUA_GCSTOP);
+    lua_pushcfunction(L, undump_protected);
+    lua_pushlightuserdata(L, &r);
+    int status = lua_pcall(L, 1, 1, 0);
+    if (gc_was_running) {
+        lua_gc(L, LUA_GCRESTART);
+    }
+    if (status == LUA_OK) {
+        ESP_LOGI(TAG, "Restored %lld objects from %u bytes in %lld us", (long long)r.next_ref,
+                 (unsigned)hdr.payload_size, (long long)(esp_timer_get_time() - start_us));
+    }
+    return status;
+}
+
+static int file_writer(lua_State* L, const void* p, size_t size, void* ud) {
+    (void)L;
+    return fwrite(p, 1, size, (FILE*)ud) == size ? 0 : 1;
+}
+
+int lua_state_image_save(lua_State* L, int entry, const char* path) {
+    char tmp_path[300];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        lua_pushfstring(L, "can't create %s", tmp_path);
+        return LUA_ERRFILE;
+    }
+    int status = lua_state_image_dump(L, entry, lua_state_image_sources_hash(path), file_writer, f, false);
+    if (fclose(f) != 0 && status == LUA_OK) {
+        lua_pushfstring(L, "failed to write %s", tmp_path);
+        status = LUA_ERRFILE;
+    }
+
+    // FATFS rename() does not replace an existing file
+    if (status == LUA_OK) {
+        remove(path);
+        if (rename(tmp_path, path) != 0) {
+            lua_pushfstring(L, "can't rename %s to %s", tmp_path, path);
+            status = LUA_ERRFILE;
+        }
+    }
+    if (status != LUA_OK) {
+        remove(tmp_path);
+    }
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef LUA_STATE_IMAGE_H
+#define LUA_STATE_IMAGE_H
+
+#include "lua.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LUA_STATE_IMAGE_MAGIC "LIMG"
+#define LUA_STATE_IMAGE_VERSION 2
+
+// An image is this header followed by the serialized object graph: the
+// libraries opened on first use before the save, the registry (globals,
+// package.loaded, ...), the string metatable and the entry function.
+typedef struct {
+    char magic[4];          // LUA_STATE_IMAGE_MAGIC, not NUL-terminated
+    uint32_t version;       // LUA_STATE_IMAGE_VERSION
+    uint32_t build_hash;    // Firmware the image was saved by
+    uint32_t sources_hash;  // lua_state_image_sources_hash() when saved, 0 = not checked
+    uint32_t payload_size;
+    uint32_t payload_crc;   // CRC32 of the payload
+} lua_state_image_hdr_t;
+
+/**
+ * @brief Name the objects created by the engine's C code
+ * @param L Lua state, right after its libraries were opened
+ *
+ * Objects that can't be serialized by value (C closures, userdata, the main
+ * thread) and the tables the libraries created are given a name derived
+ * from the shortest path to them from the registry or the string metatable.
+ * A state set up the same way names them the same, which is how an image
+ * refers to them. lua_engine_init() calls this once its libraries are open.
+ */
+void lua_state_image_mark_baseline(lua_State* L);
+
+/**
+ * @brief Name the objects of a library opened after the baseline
+ * @param L Lua state
+ * @param name Library name
+ * @param idx Stack index of the value the library's luaopen_ function returned
+ *
+ * Called for libraries opened on first use. An image records which of them
+ * were open, and restoring it opens them, in the same order, first.
+ */
+void lua_state_image_add_lib(lua_State* L, const char* name, int idx);
+
+/**
+ * @brief Fingerprint the app files an image was saved from
+ * @param image_path Path of the image
+ * @return uint32_t Hash of the path, size and modification time of every file
+ *         in the image's directory and below it, the image itself and
+ *         hidden entries left out; never 0
+ *
+ * An image restores the modules the app had loaded when it was saved, so
+ * editing any script next to it must make it stale.
+ */
+uint32_t lua_state_image_sources_hash(const char* image_path);
+
+/**
+ * @brief Serialize a state
+ * @param L Lua state marked with lua_state_image_mark_baseline()
+ * @param entry Stack index of the function to run after a restore, or 0
+ * @param sources_hash Stored in the header for lua_state_image_undump() to check, or 0
+ * @param writer Receives the image (header first) in pieces
+ * @param data Passed to writer
+ * @param strip Leave debug information out of the functions' bytecode
+ * @return int LUA_OK, or an error code with the message on the stack
+ *
+ * Everything reachable from the registry and the string metatable is
+ * written. Tables, Lua functions with their shared upvalues, strings,
+ * numbers and booleans are written by value; light C functions, rotables
+ * and C closures by address, valid for the same firmware only; named
+ * objects by name. Any other userdata (LVGL objects, timers) or coroutine
+ * fails the save, so take the image before the app builds its UI.
+ */
+int lua_state_image_dump(lua_State* L, int entry, uint32_t sources_hash, lua_Writer writer, void* data, bool strip);
+
+/**
+ * @brief Restore an image into a freshly initialized state
+ * @param L Lua state set up like the one that was saved, and not used since
+ * @param image Image, e.g. read into PSRAM or mapped from flash
+ * @param size Size of the image
+ * @param sources_hash Must match the one it was saved with, unless either is 0
+ * @return int LUA_OK with the entry function (or nil) on the stack, or an
+ *         error code with the message on the stack
+ *
+ * The saved contents replace those of the state's own tables, so the C
+ * functions holding on to them see the restored values. LUA_ERRSYNTAX means
+ * the image was rejected (wrong firmware, changed sources, corrupt) and the
+ * state untouched;
+ * after any other error it is left half restored and must be closed.
+ */
+int lua_state_image_undump(lua_State* L, const void* image, size_t size, uint32_t sources_hash);
+
+/**
+ * @brief Save a state to a file
+ * @param L Lua state
+ * @param entry Stack index of the function to run after a restore, or 0
+ * @param path Destination, e.g. "/sdcard/APP/app.image"
+ * @return int LUA_OK, or an error code with the message on the stack
+ *
+ * The file is replaced atomically: a power cut leaves the old image or none.
+ * It records lua_state_image_sources_hash() of path.
+ */
+int lua_state_image_save(lua_State* L, int entry, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_STATE_IMAGE_H
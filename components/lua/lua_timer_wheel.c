@@ -0,0 +1,344 @@
+#include "lua_timer_wheel.h"
+#include "lua_event_loop.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "LUA_TIMER_WHEEL";
+
+#ifndef CONFIG_LUA_TIMER_TICK_MS
+#define CONFIG_LUA_TIMER_TICK_MS 10
+#endif
+
+#define TICK_US     ((int64_t)CONFIG_LUA_TIMER_TICK_MS * 1000)
+
+// Four levels of 64 slots: level k holds the timers due in the current
+// 64^(k+1)-tick span but not in the current 64^k one, in the slot for
+// their due tick's k-th group of 6 bits. When the level below wraps to a
+// slot, its timers are cascaded down. Timers due beyond the top level,
+// 4.6 hours at 1 ms ticks, wait on a list rechecked each time it wraps.
+#define LEVEL_BITS  6
+#define LEVELS      4
+#define SLOTS       (1 << LEVEL_BITS)
+#define SLOT_MASK   (SLOTS - 1)
+
+static lua_timer_wheel_entry_t* s_slots[LEVELS][SLOTS];
+static uint64_t s_occupied[LEVELS];         // A slot's bit may outlive its timers; cleared when seen empty
+static lua_timer_wheel_entry_t* s_far = NULL;
+static lua_timer_wheel_entry_t* s_expired = NULL;   // Batch being dispatched
+static uint64_t s_now = 0;                  // Last tick the wheel has been advanced to
+
+static esp_timer_handle_t s_timer = NULL;
+static bool s_armed = false;                // s_timer is set to go off at s_armed_tick
+static uint64_t s_armed_tick = 0;
+static bool s_pending = false;              // An event is queued; set by the esp_timer task
+
+static lua_timer_wheel_stats_t s_stats = {0};
+static uint64_t s_late_us_sum = 0;
+static uint32_t s_late_count = 0;
+
+static uint64_t current_tick(void) {
+    return (uint64_t)(esp_timer_get_time() / TICK_US);
+}
+
+static void link_entry(lua_timer_wheel_entry_t** head, lua_timer_wheel_entry_t* entry) {
+    entry->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &entry->next;
+    }
+    *head = entry;
+    entry->pprev = head;
+}
+
+static void unlink_entry(lua_timer_wheel_entry_t* entry) {
+    *entry->pprev = entry->next;
+    if (entry->next != NULL) {
+        entry->next->pprev = entry->pprev;
+    }
+    entry->next = NULL;
+    entry->pprev = NULL;
+}
+
+// Files a timer by how far its due tick is from s_now
+static void insert(lua_timer_wheel_entry_t* entry) {
+    uint64_t differs = entry->expires ^ s_now;
+    for (int level = 0; level < LEVELS; level++) {
+        if ((differs >> (LEVEL_BITS * (level + 1))) == 0) {
+            int slot = (int)(entry->expires >> (LEVEL_BITS * level)) & SLOT_MASK;
+            link_entry(&s_slots[level][slot], entry);
+            s_occupied[level] |= 1ULL << slot;
+            return;
+        }
+    }
+    link_entry(&s_far, entry);
+}
+
+// Moves every timer on a list to where it belongs now
+static void refile(lua_timer_wheel_entry_t** head) {
+    lua_timer_wheel_entry_t* entry = *head;
+    *head = NULL;
+    while (entry != NULL) {
+        lua_timer_wheel_entry_t* next = entry->next;
+        entry->pprev = NULL;
+        insert(entry);
+        entry = next;
+    }
+}
+
+// The next tick after s_now that something happens at: a level 0 slot
+// expires, or a higher one cascades. With exact set, the due tick of the
+// earliest timer instead, for arming the esp_timer. UINT64_MAX if idle.
+static uint64_t next_tick(bool exact) {
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = LEVEL_BITS * level;
+        int index = (int)(s_now >> shift) & SLOT_MASK;
+        uint64_t later = index == SLOT_MASK ? 0 : s_occupied[level] & (~0ULL << (index + 1));
+        while (later != 0) {
+            int slot = __builtin_ctzll(later);
+            lua_timer_wheel_entry_t* entry = s_slots[level][slot];
+            if (entry == NULL) {
+                s_occupied[level] &= ~(1ULL << slot);
+                later &= later - 1;
+                continue;
+            }
+            // Everything on lower levels has expired, everything later on
+            // this one and above is due later
+            if (!exact || level == 0) {
+                return ((s_now >> (shift + LEVEL_BITS)) << (shift + LEVEL_BITS)) | ((uint64_t)slot << shift);
+            }
+            uint64_t earliest = entry->expires;
+            for (entry = entry->next; entry != NULL; entry = entry->next) {
+                if (entry->expires < earliest) {
+                    earliest = entry->expires;
+                }
+            }
+            return earliest;
+        }
+    }
+    if (s_far == NULL) {
+        return UINT64_MAX;
+    }
+    uint64_t wrap = ((s_now >> (LEVEL_BITS * LEVELS)) + 1) << (LEVEL_BITS * LEVELS);
+    if (!exact) {
+        return wrap;
+    }
+    uint64_t earliest = UINT64_MAX;
+    for (lua_timer_wheel_entry_t* entry = s_far; entry != NULL; entry = entry->next) {
+        if (entry->expires < earliest) {
+            earliest = entry->expires;
+        }
+    }
+    return earliest > wrap ? earliest : wrap;
+}
+
+// Cascades what wraps at tick, then moves its level 0 slot to s_expired
+static void process_tick(uint64_t tick) {
+    s_now = tick;
+    if ((tick & ((1ULL << (LEVEL_BITS * LEVELS)) - 1)) == 0) {
+        refile(&s_far);
+    }
+    for (int level = LEVELS - 1; level > 0; level--) {
+        int shift = LEVEL_BITS * level;
+        if ((tick & ((1ULL << shift) - 1)) != 0) {
+            continue;
+        }
+        int slot = (int)(tick >> shift) & SLOT_MASK;
+        s_occupied[level] &= ~(1ULL << slot);
+        refile(&s_slots[level][slot]);
+    }
+    int slot = (int)tick & SLOT_MASK;
+    s_occupied[0] &= ~(1ULL << slot);
+    lua_timer_wheel_entry_t* entry = s_slots[0][slot];
+    while (entry != NULL) {
+        lua_timer_wheel_entry_t* next = entry->next;
+        unlink_entry(entry);
+        link_entry(&s_expired, entry);
+        entry = next;
+    }
+}
+
+// Skips the ticks nothing happens at
+static void advance(uint64_t target) {
+    while (s_now < target) {
+        uint64_t tick = next_tick(false);
+        if (tick > target) {
+            s_now = target;
+            break;
+        }
+        process_tick(tick);
+    }
+}
+
+// Sets the esp_timer to the earliest due tick, unless it already is
+static void arm(void) {
+    uint64_t tick = next_tick(true);
+    if (s_armed && tick == s_armed_tick) {
+        return;
+    }
+    if (s_armed) {
+        esp_timer_stop(s_timer);
+        s_armed = false;
+    }
+    if (tick == UINT64_MAX || s_timer == NULL) {
+        return;
+    }
+    int64_t delay_us = (int64_t)tick * TICK_US - esp_timer_get_time();
+    if (esp_timer_start_once(s_timer, delay_us > 0 ? (uint64_t)delay_us : 0) == ESP_OK) {
+        s_armed = true;
+        s_armed_tick = tick;
+        s_stats.rearms++;
+    }
+}
+
+// Runs on the task that runs Lua: dispatches every timer due by now, as
+// one batch, and sets the esp_timer to the next deadline
+static void run_wheel_event(lua_State* L, void* payload) {
+    (void)payload;
+    __atomic_store_n(&s_pending, false, __ATOMIC_RELEASE);
+    s_armed = false; // It went off; a one-shot timer is stopped
+    s_stats.wakeups++;
+    int64_t now_us = esp_timer_get_time();
+    advance((uint64_t)(now_us / TICK_US));
+
+    uint32_t batch = 0;
+    lua_timer_wheel_entry_t* entry;
+    while ((entry = s_expired) != NULL) {
+        unlink_entry(entry);
+        uint32_t late_us = (uint32_t)(now_us - (int64_t)entry->expires * TICK_US);
+        if (entry->periodic) {
+            // Periods missed while the Lua task was busy are skipped
+            uint64_t periods = (s_now - entry->expires) / entry->period_ticks + 1;
+            entry->base = entry->expires + (periods - 1) * entry->period_ticks;
+            entry->expires = entry->base + entry->period_ticks;
+            insert(entry);
+        } else {
+            s_stats.timers--;
+        }
+        s_late_us_sum += late_us;
+        s_late_count++;
+        if (late_us > s_stats.late_us_max) {
+            s_stats.late_us_max = late_us;
+        }
+        batch++;
+        s_stats.fired++;
+        entry->fire(L, entry);
+    }
+    if (batch > s_stats.batch_max) {
+        s_stats.batch_max = batch;
+    }
+    arm();
+}
+
+// Runs on the esp_timer task; tries again a tick later if the queue is full
+static void wheel_timer_callback(void* arg) {
+    (void)arg;
+    if (__atomic_exchange_n(&s_pending, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    uint8_t none = 0;
+    if (!lua_event_loop_post(run_wheel_event, &none, 0)) {
+        __atomic_store_n(&s_pending, false, __ATOMIC_RELEASE);
+        esp_timer_start_once(s_timer, TICK_US);
+    }
+}
+
+bool lua_timer_wheel_init(void) {
+    // The previous state's timers went with it
+    for (int level = 0; level < LEVELS; level++) {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            s_slots[level][slot] = NULL;
+        }
+        s_occupied[level] = 0;
+    }
+    s_far = NULL;
+    s_expired = NULL;
+    s_now = current_tick();
+    s_stats.timers = 0;
+    if (s_timer != NULL) {
+        return true;
+    }
+    esp_timer_create_args_t args = {.callback = &wheel_timer_callback, .arg = NULL, .name = "lua_timers"};
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the timer: %s", esp_err_to_name(err));
+        s_timer = NULL;
+        return false;
+    }
+    ESP_LOGI(TAG, "Lua timers on one esp_timer, %d ms ticks", CONFIG_LUA_TIMER_TICK_MS);
+    return true;
+}
+
+void lua_timer_wheel_entry_init(lua_timer_wheel_entry_t* entry, lua_timer_wheel_fire_fn_t fire) {
+    entry->fire = fire;
+    entry->next = NULL;
+    entry->pprev = NULL;
+    entry->expires = 0;
+    entry->base = 0;
+    entry->period_ticks = 1;
+    entry->periodic = false;
+}
+
+// Files a timer due at expires, or the first tick still to come
+static void schedule(lua_timer_wheel_entry_t* entry, uint64_t expires) {
+    if (entry->pprev != NULL) {
+        unlink_entry(entry);
+    } else {
+        if (s_stats.timers == 0) {
+            s_now = current_tick(); // Nothing to cascade on the way
+        }
+        s_stats.timers++;
+    }
+    entry->expires = expires > s_now ? expires : s_now + 1;
+    insert(entry);
+    if (!s_armed || entry->expires < s_armed_tick) {
+        arm();
+    }
+}
+
+void lua_timer_wheel_start(lua_timer_wheel_entry_t* entry, uint32_t period_ms, bool periodic) {
+    uint64_t ticks = ((uint64_t)period_ms + CONFIG_LUA_TIMER_TICK_MS - 1) / CONFIG_LUA_TIMER_TICK_MS;
+    entry->period_ticks = ticks > 0 ? (uint32_t)ticks : 1;
+    entry->periodic = periodic;
+    lua_timer_wheel_restart(entry);
+}
+
+void lua_timer_wheel_restart(lua_timer_wheel_entry_t* entry) {
+    // Rounded up: never goes off early
+    int64_t now_us = esp_timer_get_time();
+    entry->base = (uint64_t)((now_us + TICK_US - 1) / TICK_US);
+    schedule(entry, entry->base + entry->period_ticks);
+}
+
+void lua_timer_wheel_set_period(lua_timer_wheel_entry_t* entry, uint32_t period_ms) {
+    uint64_t ticks = ((uint64_t)period_ms + CONFIG_LUA_TIMER_TICK_MS - 1) / CONFIG_LUA_TIMER_TICK_MS;
+    entry->period_ticks = ticks > 0 ? (uint32_t)ticks : 1;
+    if (entry->pprev != NULL) {
+        schedule(entry, entry->base + entry->period_ticks);
+    }
+}
+
+void lua_timer_wheel_stop(lua_timer_wheel_entry_t* entry) {
+    if (entry->pprev == NULL) {
+        return;
+    }
+    unlink_entry(entry);
+    s_stats.timers--;
+    // The esp_timer may go off for nothing; cheaper than re-arming here
+}
+
+bool lua_timer_wheel_is_running(const lua_timer_wheel_entry_t* entry) {
+    return entry->pprev != NULL;
+}
+
+void lua_timer_wheel_get_stats(lua_timer_wheel_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.late_us_avg = s_late_count ? (uint32_t)(s_late_us_sum / s_late_count) : 0;
+    *stats = s_stats;
+
+    s_late_us_sum = 0;
+    s_late_count = 0;
+    s_stats.late_us_max = 0;
+    s_stats.batch_max = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef LUA_TIMER_WHEEL_H
+#define LUA_TIMER_WHEEL_H
+
+#include "lua.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lua_timer_wheel_entry;
+
+// Runs on the task that runs Lua for each expired timer. A one-shot timer
+// is stopped by then, a periodic one already scheduled for its next period;
+// it may start, stop or change any timer.
+typedef void (*lua_timer_wheel_fire_fn_t)(lua_State* L, struct lua_timer_wheel_entry* entry);
+
+// A timer on the wheel; embed it in the structure the fire callback needs.
+// Only touched on the task that runs Lua.
+typedef struct lua_timer_wheel_entry {
+    lua_timer_wheel_fire_fn_t fire;
+    struct lua_timer_wheel_entry* next;
+    struct lua_timer_wheel_entry** pprev;   // NULL while stopped
+    uint64_t expires;           // Tick it is due at
+    uint64_t base;              // Tick its current period started at
+    uint32_t period_ticks;
+    bool periodic;
+} lua_timer_wheel_entry_t;
+
+typedef struct {
+    uint32_t timers;            // Timers running right now
+    uint32_t wakeups;           // Times the esp_timer went off since boot
+    uint32_t fired;             // Expiries dispatched since boot
+    uint32_t rearms;            // Times the esp_timer was moved to a new deadline
+    uint32_t batch_max;         // Most expiries dispatched by one wake-up in the last window
+    uint32_t late_us_avg;       // From the due time to the dispatch, averaged over the last window
+    uint32_t late_us_max;
+} lua_timer_wheel_stats_t;
+
+/**
+ * @brief Create the esp_timer the wheel runs on
+ * @return bool false if the esp_timer can't be created
+ *
+ * Called by lua_engine_init(). The esp_timer outlives the state; the timers
+ * of a previous state are forgotten.
+ */
+bool lua_timer_wheel_init(void);
+
+/**
+ * @brief Set up an entry; it starts stopped
+ * @param entry Entry to initialise
+ * @param fire Called each time it expires
+ */
+void lua_timer_wheel_entry_init(lua_timer_wheel_entry_t* entry, lua_timer_wheel_fire_fn_t fire);
+
+/**
+ * @brief (Re)start a timer, due period_ms from now
+ * @param entry The timer, running or not
+ * @param period_ms Period, rounded up to whole CONFIG_LUA_TIMER_TICK_MS ticks
+ * @param periodic true to go off every period until stopped
+ */
+void lua_timer_wheel_start(lua_timer_wheel_entry_t* entry, uint32_t period_ms, bool periodic);
+
+/**
+ * @brief Restart a timer's countdown from now, with the period it has
+ * @param entry The timer, running or not
+ */
+void lua_timer_wheel_restart(lua_timer_wheel_entry_t* entry);
+
+/**
+ * @brief Change the period of a timer
+ * @param entry The timer
+ * @param period_ms New period
+ *
+ * A running timer's current period is counted from when it started, so it
+ * goes off right away if the new period has already passed.
+ */
+void lua_timer_wheel_set_period(lua_timer_wheel_entry_t* entry, uint32_t period_ms);
+
+/**
+ * @brief Stop a timer; also before the memory it is in is freed
+ * @param entry The timer, running or not
+ */
+void lua_timer_wheel_stop(lua_timer_wheel_entry_t* entry);
+
+/**
+ * @brief Whether a timer is running
+ * @param entry The timer
+ * @return bool
+ */
+bool lua_timer_wheel_is_running(const lua_timer_wheel_entry_t* entry);
+
+/**
+ * @brief Get the wheel statistics; the batch and lateness windows restart each call
+ * @param stats Destination structure
+ */
+void lua_timer_wheel_get_stats(lua_timer_wheel_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_TIMER_WHEEL_H
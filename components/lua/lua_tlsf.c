@@ -0,0 +1,299 @@
+#include "lua_tlsf.h"
+#include <string.h>
+
+// Block sizes are multiples of 8; each first-level class (a power of two)
+// is split into 16 second-level lists. Blocks below 128 bytes share the
+// first first-level class in 8-byte steps.
+#define TLSF_ALIGN_LOG2 3
+#define TLSF_ALIGN (1u << TLSF_ALIGN_LOG2)
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1u << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_SMALL_BLOCK (1u << TLSF_FL_SHIFT)
+#define TLSF_FL_MAX 30 // Largest block: 1 GB
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+
+#define TLSF_BLOCK_FREE 1u
+
+typedef struct tlsf_block {
+    struct tlsf_block* prev_phys;   // Physically preceding block (NULL for the first)
+    size_t size;                    // Payload size | TLSF_BLOCK_FREE
+    // Payload starts here; while the block is free it holds the list links
+    struct tlsf_block* next_free;
+    struct tlsf_block* prev_free;
+} tlsf_block_t;
+
+#define TLSF_BLOCK_HDR offsetof(tlsf_block_t, next_free)
+#define TLSF_MIN_PAYLOAD ((sizeof(tlsf_block_t) - TLSF_BLOCK_HDR + TLSF_ALIGN - 1) & ~(size_t)(TLSF_ALIGN - 1))
+
+struct lua_tlsf {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_COUNT];
+    tlsf_block_t* blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    tlsf_block_t* first;
+    const uint8_t* start;
+    const uint8_t* end;
+    size_t pool_size;
+};
+
+static inline size_t align_up(size_t x) {
+    return (x + TLSF_ALIGN - 1) & ~(size_t)(TLSF_ALIGN - 1);
+}
+
+static inline int tlsf_fls(size_t x) {
+    return 31 - __builtin_clz((uint32_t)x);
+}
+
+static inline size_t block_size(const tlsf_block_t* b) {
+    return b->size & ~(size_t)TLSF_BLOCK_FREE;
+}
+
+static inline bool block_is_free(const tlsf_block_t* b) {
+    return (b->size & TLSF_BLOCK_FREE) != 0;
+}
+
+static inline tlsf_block_t* block_next(const tlsf_block_t* b) {
+    return (tlsf_block_t*)((uint8_t*)b + TLSF_BLOCK_HDR + block_size(b));
+}
+
+static inline tlsf_block_t* block_from_ptr(const void* ptr) {
+    return (tlsf_block_t*)((uint8_t*)ptr - TLSF_BLOCK_HDR);
+}
+
+static inline void* block_to_ptr(tlsf_block_t* b) {
+    return (uint8_t*)b + TLSF_BLOCK_HDR;
+}
+
+static void mapping_insert(size_t size, int* fl, int* sl) {
+    if (size < TLSF_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT));
+    } else {
+        int f = tlsf_fls(size);
+        *sl = (int)((size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT);
+        *fl = f - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+// Round up to the next list boundary so any block found there is big enough
+static void mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= TLSF_SMALL_BLOCK) {
+        size += ((size_t)1 << (tlsf_fls(size) - TLSF_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static tlsf_block_t* search_suitable(lua_tlsf_t* pool, int* fl, int* sl) {
+    uint32_t sl_map = pool->sl_bitmap[*fl] & (~0u << *sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = pool->fl_bitmap & (~0u << (*fl + 1));
+        if (fl_map == 0) {
+            return NULL;
+        }
+        *fl = __builtin_ctz(fl_map);
+        sl_map = pool->sl_bitmap[*fl];
+    }
+    *sl = __builtin_ctz(sl_map);
+    return pool->blocks[*fl][*sl];
+}
+
+static void remove_free(lua_tlsf_t* pool, tlsf_block_t* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    if (pool->blocks[fl][sl] == b) {
+        pool->blocks[fl][sl] = b->next_free;
+        if (b->next_free == NULL) {
+            pool->sl_bitmap[fl] &= ~(1u << sl);
+            if (pool->sl_bitmap[fl] == 0) {
+                pool->fl_bitmap &= ~(1u << fl);
+            }
+        }
+    }
+}
+
+static void insert_free(lua_tlsf_t* pool, tlsf_block_t* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+
+    b->prev_free = NULL;
+    b->next_free = pool->blocks[fl][sl];
+    if (b->next_free) b->next_free->prev_free = b;
+    pool->blocks[fl][sl] = b;
+    pool->sl_bitmap[fl] |= 1u << sl;
+    pool->fl_bitmap |= 1u << fl;
+}
+
+// Absorb the physically next block if it is free; keeps b's own free flag
+static void merge_next(lua_tlsf_t* pool, tlsf_block_t* b) {
+    tlsf_block_t* next = block_next(b);
+    if (!block_is_free(next)) {
+        return;
+    }
+    remove_free(pool, next);
+    b->size += TLSF_BLOCK_HDR + block_size(next);
+    block_next(b)->prev_phys = b;
+}
+
+// Cut b down to 'size' and return the tail to the free lists
+static void split(lua_tlsf_t* pool, tlsf_block_t* b, size_t size) {
+    size_t total = block_size(b);
+    if (total < size + TLSF_BLOCK_HDR + TLSF_MIN_PAYLOAD) {
+        return;
+    }
+
+    tlsf_block_t* rest = (tlsf_block_t*)((uint8_t*)b + TLSF_BLOCK_HDR + size);
+    rest->size = (total - size - TLSF_BLOCK_HDR) | TLSF_BLOCK_FREE;
+    rest->prev_phys = b;
+    b->size = size | (b->size & TLSF_BLOCK_FREE);
+    block_next(rest)->prev_phys = rest;
+
+    merge_next(pool, rest);
+    insert_free(pool, rest);
+}
+
+static inline size_t adjust_size(size_t size) {
+    size = align_up(size);
+    return size < TLSF_MIN_PAYLOAD ? TLSF_MIN_PAYLOAD : size;
+}
+
+lua_tlsf_t* lua_tlsf_create(void* mem, size_t bytes) {
+    uint8_t* start = (uint8_t*)align_up((uintptr_t)mem);
+    uint8_t* end = (uint8_t*)mem + bytes;
+    uint8_t* blocks = start + align_up(sizeof(lua_tlsf_t));
+
+    // Room for one free block plus the zero-size sentinel that ends the chain
+    if (end <= blocks || (size_t)(end - blocks) < 2 * TLSF_BLOCK_HDR + TLSF_MIN_PAYLOAD) {
+        return NULL;
+    }
+    size_t payload = ((size_t)(end - blocks) - 2 * TLSF_BLOCK_HDR) & ~(size_t)(TLSF_ALIGN - 1);
+    if (payload >= ((size_t)1 << TLSF_FL_MAX)) {
+        payload = ((size_t)1 << TLSF_FL_MAX) - TLSF_ALIGN;
+    }
+
+    lua_tlsf_t* pool = (lua_tlsf_t*)start;
+    memset(pool, 0, sizeof(*pool));
+
+    tlsf_block_t* first = (tlsf_block_t*)blocks;
+    first->prev_phys = NULL;
+    first->size = payload | TLSF_BLOCK_FREE;
+
+    tlsf_block_t* sentinel = block_next(first);
+    sentinel->prev_phys = first;
+    sentinel->size = 0;
+
+    pool->first = first;
+    pool->start = blocks;
+    pool->end = (uint8_t*)sentinel;
+    pool->pool_size = payload;
+    insert_free(pool, first);
+    return pool;
+}
+
+void* lua_tlsf_malloc(lua_tlsf_t* pool, size_t size) {
+    if (size == 0 || size >= ((size_t)1 << (TLSF_FL_MAX - 1))) {
+        return NULL;
+    }
+
+    size_t adjusted = adjust_size(size);
+    int fl, sl;
+    mapping_search(adjusted, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL;
+    }
+
+    tlsf_block_t* b = search_suitable(pool, &fl, &sl);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    remove_free(pool, b);
+    b->size &= ~(size_t)TLSF_BLOCK_FREE;
+    split(pool, b, adjusted);
+    return block_to_ptr(b);
+}
+
+void lua_tlsf_free(lua_tlsf_t* pool, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    tlsf_block_t* b = block_from_ptr(ptr);
+    b->size |= TLSF_BLOCK_FREE;
+
+    tlsf_block_t* prev = b->prev_phys;
+    if (prev != NULL && block_is_free(prev)) {
+        remove_free(pool, prev);
+        prev->size += TLSF_BLOCK_HDR + block_size(b);
+        block_next(prev)->prev_phys = prev;
+        b = prev;
+    }
+    merge_next(pool, b);
+    insert_free(pool, b);
+}
+
+void* lua_tlsf_realloc(lua_tlsf_t* pool, void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return lua_tlsf_malloc(pool, size);
+    }
+    if (size == 0) {
+        lua_tlsf_free(pool, ptr);
+        return NULL;
+    }
+    if (size >= ((size_t)1 << (TLSF_FL_MAX - 1))) {
+        return NULL;
+    }
+
+    tlsf_block_t* b = block_from_ptr(ptr);
+    size_t current = block_size(b);
+    size_t adjusted = adjust_size(size);
+
+    if (adjusted > current) {
+        tlsf_block_t* next = block_next(b);
+        if (!block_is_free(next) || current + TLSF_BLOCK_HDR + block_size(next) < adjusted) {
+            // Can't grow in place: move
+            void* new_ptr = lua_tlsf_malloc(pool, size);
+            if (new_ptr == NULL) {
+                return NULL;
+            }
+            memcpy(new_ptr, ptr, current);
+            lua_tlsf_free(pool, ptr);
+            return new_ptr;
+        }
+        merge_next(pool, b);
+    }
+
+    split(pool, b, adjusted);
+    return ptr;
+}
+
+bool lua_tlsf_owns(const lua_tlsf_t* pool, const void* ptr) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return pool != NULL && p >= pool->start && p < pool->end;
+}
+
+void lua_tlsf_get_stats(const lua_tlsf_t* pool, lua_tlsf_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (pool == NULL) {
+        return;
+    }
+
+    stats->pool_size = pool->pool_size;
+    for (const tlsf_block_t* b = pool->first; block_size(b) != 0; b = block_next(b)) {
+        size_t size = block_size(b);
+        if (block_is_free(b)) {
+            stats->free_bytes += size;
+            stats->free_blocks++;
+            if (size > stats->largest_free) stats->largest_free = size;
+        } else {
+            stats->used_bytes += size;
+            stats->used_blocks++;
+        }
+    }
+
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 100 - (uint32_t)((uint64_t)stats->largest_free * 100 / stats->free_bytes);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef LUA_TLSF_H
+#define LUA_TLSF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Two-level segregated fit allocator managing one fixed memory region.
+// Not thread-safe: a pool is meant to be owned by a single lua_State.
+typedef struct lua_tlsf lua_tlsf_t;
+
+typedef struct {
+    size_t pool_size;       // Bytes under management (after the control block)
+    size_t used_bytes;      // Payload bytes in allocated blocks
+    size_t free_bytes;      // Payload bytes in free blocks
+    size_t largest_free;    // Payload bytes of the largest free block
+    uint32_t used_blocks;
+    uint32_t free_blocks;
+    uint32_t fragmentation; // 0..100: 100 * (1 - largest_free / free_bytes)
+} lua_tlsf_stats_t;
+
+/**
+ * @brief Create a pool inside a caller-provided region
+ * @param mem Start of the region; the control block is placed at its head
+ * @param bytes Size of the region
+ * @return lua_tlsf_t* Pool handle, or NULL if the region is too small
+ */
+lua_tlsf_t* lua_tlsf_create(void* mem, size_t bytes);
+
+/**
+ * @brief Allocate a block from the pool
+ * @param pool Pool handle
+ * @param size Requested size
+ * @return void* 8-byte aligned block, or NULL if no free block is large enough
+ */
+void* lua_tlsf_malloc(lua_tlsf_t* pool, size_t size);
+
+/**
+ * @brief Resize a block, in place when the neighbouring block allows it
+ * @param pool Pool handle
+ * @param ptr Block owned by the pool (or NULL)
+ * @param size New size (0 frees the block)
+ * @return void* Resized block, or NULL on failure (ptr is left untouched)
+ */
+void* lua_tlsf_realloc(lua_tlsf_t* pool, void* ptr, size_t size);
+
+/**
+ * @brief Return a block to the pool
+ * @param pool Pool handle
+ * @param ptr Block owned by the pool (or NULL)
+ */
+void lua_tlsf_free(lua_tlsf_t* pool, void* ptr);
+
+/**
+ * @brief Check whether a pointer lies inside the pool region
+ */
+bool lua_tlsf_owns(const lua_tlsf_t* pool, const void* ptr);
+
+/**
+ * @brief Walk the pool and collect occupancy and fragmentation figures
+ * @param pool Pool handle
+ * @param stats Destination structure
+ *
+ * Cost is linear in the number of blocks; meant for diagnostics.
+ */
+void lua_tlsf_get_stats(const lua_tlsf_t* pool, lua_tlsf_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_TLSF_H
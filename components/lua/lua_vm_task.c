@@ -0,0 +1,231 @@
+#include "lua_vm_task.h"
+#include "lua_engine.h"
+#include "lua_event_loop.h"
+#include "lua_hot_reload.h"
+#include "lua_ring.h"
+#include "lua_scheduler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "LUA_VM_TASK";
+
+#ifndef CONFIG_LUA_VM_TASK
+#define CONFIG_LUA_VM_TASK 0
+#endif
+
+// An LVGL call the Lua task is waiting on. It lives on the Lua task's
+// stack; the ring carries a pointer to it.
+typedef struct {
+    lua_State* L;
+    lua_CFunction fn;
+    int nargs;
+    int status;
+    int nresults;
+} ui_call_t;
+
+typedef struct {
+    lua_vm_job_fn_t fn;
+    int64_t posted_us;
+    uint8_t payload[LUA_VM_JOB_PAYLOAD_SIZE];
+} vm_job_t;
+
+static volatile bool s_active = false;
+static TaskHandle_t s_lua_task = NULL;     // Set by the Lua task itself
+static TaskHandle_t s_gui_task = NULL;
+static SemaphoreHandle_t s_call_done = NULL;
+static lua_ring_t s_calls;                  // ui_call_t*: Lua task -> GUI task
+static lua_ring_t s_jobs;                   // vm_job_t: GUI task -> Lua task
+static void (*s_main)(void* arg) = NULL;
+static void* s_main_arg = NULL;
+
+static lua_vm_task_stats_t s_stats = {0};
+static uint64_t s_frame_us_sum = 0;
+static uint32_t s_frame_count = 0;
+static uint64_t s_latency_us_sum = 0;
+static uint32_t s_latency_count = 0;
+
+#if CONFIG_LUA_VM_TASK
+static void lua_task_entry(void* arg) {
+    (void)arg;
+    s_lua_task = xTaskGetCurrentTaskHandle();
+    ESP_LOGI(TAG, "Lua task running on core %d", xPortGetCoreID());
+    s_main(s_main_arg);
+    ESP_LOGE(TAG, "Lua task main returned");
+    vTaskDelete(NULL);
+}
+#endif
+
+bool lua_vm_task_start(void (*main)(void* arg), void* arg) {
+#if CONFIG_LUA_VM_TASK
+    s_call_done = xSemaphoreCreateBinary();
+    // One call is in flight at most: the Lua task waits for each
+    if (s_call_done == NULL || !lua_ring_init(&s_calls, 2, sizeof(ui_call_t*)) ||
+        !lua_ring_init(&s_jobs, CONFIG_LUA_VM_TASK_QUEUE_LEN, sizeof(vm_job_t))) {
+        ESP_LOGE(TAG, "Failed to allocate the Lua task queues");
+        if (s_call_done != NULL) {
+            vSemaphoreDelete(s_call_done);
+            s_call_done = NULL;
+        }
+        lua_ring_deinit(&s_calls);
+        lua_ring_deinit(&s_jobs);
+        return false;
+    }
+
+    s_gui_task = xTaskGetCurrentTaskHandle();
+    s_main = main;
+    s_main_arg = arg;
+    s_active = true;
+    BaseType_t result = xTaskCreatePinnedToCore(lua_task_entry, "lua", CONFIG_LUA_VM_TASK_STACK_SIZE, NULL,
+                                                CONFIG_LUA_VM_TASK_PRIORITY, NULL, CONFIG_LUA_VM_TASK_CORE);
+    if (result != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the Lua task: %d", result);
+        s_active = false;
+        return false;
+    }
+    ESP_LOGI(TAG, "Lua runs on its own task (core %d); LVGL calls go to the GUI task",
+             CONFIG_LUA_VM_TASK_CORE);
+    return true;
+#else
+    (void)main;
+    (void)arg;
+    return false;
+#endif
+}
+
+bool lua_vm_task_active(void) {
+    return s_active;
+}
+
+int lua_vm_task_ui_call(lua_State* L, lua_CFunction fn) {
+    if (!s_active || xTaskGetCurrentTaskHandle() != s_lua_task) {
+        return fn(L);
+    }
+
+    ui_call_t call = {.L = L, .fn = fn, .nargs = lua_gettop(L)};
+    ui_call_t* pending = &call;
+    int64_t start_us = esp_timer_get_time();
+    lua_ring_push(&s_calls, &pending);
+    xTaskNotifyGive(s_gui_task);
+    xSemaphoreTake(s_call_done, portMAX_DELAY);
+
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start_us);
+    s_stats.ui_calls++;
+    if (us > s_stats.ui_call_us_max) {
+        s_stats.ui_call_us_max = us;
+    }
+    if (call.status != LUA_OK) {
+        return lua_error(L); // Message left on the stack by the GUI task
+    }
+    return call.nresults;
+}
+
+// Runs on the GUI task while the Lua task is blocked in lua_vm_task_ui_call()
+static void run_ui_calls(void) {
+    ui_call_t* call;
+    while (lua_ring_pop(&s_calls, &call)) {
+        lua_State* L = call->L;
+        lua_pushcfunction(L, call->fn);
+        lua_insert(L, 1);
+        call->status = lua_pcall(L, call->nargs, LUA_MULTRET, 0);
+        call->nresults = lua_gettop(L);
+        xSemaphoreGive(s_call_done);
+    }
+}
+
+void lua_vm_task_gui_poll(uint32_t wait_ms) {
+    if (!s_active) {
+        vTaskDelay(pdMS_TO_TICKS(wait_ms));
+        return;
+    }
+
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)wait_ms * 1000;
+    for (;;) {
+        run_ui_calls();
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0) {
+            break;
+        }
+        TickType_t ticks = pdMS_TO_TICKS((left_us + 999) / 1000);
+        ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+    }
+}
+
+bool lua_vm_task_post(lua_vm_job_fn_t fn, const void* payload, uint32_t size) {
+    if (!s_active || size > LUA_VM_JOB_PAYLOAD_SIZE) {
+        return false;
+    }
+    vm_job_t job = {.fn = fn, .posted_us = esp_timer_get_time()};
+    memcpy(job.payload, payload, size);
+    if (!lua_ring_push(&s_jobs, &job)) {
+        return false;
+    }
+    xTaskNotifyGive(s_lua_task);
+    return true;
+}
+
+void lua_vm_task_run(lua_State* L) {
+    ESP_LOGI(TAG, "Lua task serving events");
+    int suspended = 0;
+    int32_t next_wake_ms = -1;
+    for (;;) {
+        // Woken by every post, here or to the event loop; the timeout keeps
+        // the memory poll going, is one frame while handlers that ran over
+        // budget are suspended or events wait for the next drain, and ends
+        // early for the next system.sleep() to finish
+        uint32_t wait_ms = suspended > 0 || lua_event_loop_depth() > 0 ? 10 : 100;
+        if (next_wake_ms >= 0 && (uint32_t)next_wake_ms < wait_ms) {
+            wait_ms = (uint32_t)next_wake_ms;
+        }
+        TickType_t ticks = pdMS_TO_TICKS(wait_ms);
+        ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+        vm_job_t job;
+        while (lua_ring_pop(&s_jobs, &job)) {
+            uint32_t latency_us = (uint32_t)(esp_timer_get_time() - job.posted_us);
+            s_latency_us_sum += latency_us;
+            s_latency_count++;
+            if (latency_us > s_stats.job_latency_us_max) {
+                s_stats.job_latency_us_max = latency_us;
+            }
+            s_stats.jobs++;
+            job.fn(L, job.payload);
+        }
+        lua_event_loop_drain(L, CONFIG_LUA_EVENT_BUDGET_US);
+        next_wake_ms = lua_scheduler_run(L, CONFIG_LUA_EVENT_BUDGET_US);
+        suspended = lua_engine_run_suspended(L);
+        lua_engine_poll_memory(L);
+        lua_hot_reload_poll(L);
+    }
+}
+
+void lua_vm_task_note_frame(uint32_t us) {
+    s_stats.frames++;
+    s_frame_us_sum += us;
+    s_frame_count++;
+    if (us > s_stats.frame_us_max) {
+        s_stats.frame_us_max = us;
+    }
+}
+
+void lua_vm_task_get_stats(lua_vm_task_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    s_stats.frame_us_avg = s_frame_count ? (uint32_t)(s_frame_us_sum / s_frame_count) : 0;
+    s_stats.job_latency_us_avg = s_latency_count ? (uint32_t)(s_latency_us_sum / s_latency_count) : 0;
+    s_stats.jobs_dropped = s_jobs.dropped;
+    s_stats.job_queue_high_water = s_jobs.high_water;
+    *stats = s_stats;
+
+    s_frame_us_sum = 0;
+    s_frame_count = 0;
+    s_latency_us_sum = 0;
+    s_latency_count = 0;
+    s_stats.frame_us_max = 0;
+    s_stats.job_latency_us_max = 0;
+    s_stats.ui_call_us_max = 0;
+}
@@ -0,0 +1,102 @@
+#ifndef LUA_VM_TASK_H
+#define LUA_VM_TASK_H
+
+#include "lua.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Payload of a job posted to the Lua task
+#define LUA_VM_JOB_PAYLOAD_SIZE 40
+
+// Runs on the Lua task with the payload that was posted
+typedef void (*lua_vm_job_fn_t)(lua_State* L, void* payload);
+
+typedef struct {
+    uint32_t frames;            // lv_timer_handler() runs
+    uint32_t frame_us_avg;      // Their duration, averaged over the last window
+    uint32_t frame_us_max;
+    uint32_t ui_calls;          // LVGL calls made by the Lua task on the GUI task
+    uint32_t ui_call_us_max;    // Longest round trip of one
+    uint32_t jobs;              // Jobs (LVGL events, ...) run on the Lua task
+    uint32_t job_latency_us_avg;// From posting to starting, averaged over the last window
+    uint32_t job_latency_us_max;
+    uint32_t jobs_dropped;      // Posts refused because the queue was full
+    uint32_t job_queue_high_water;
+} lua_vm_task_stats_t;
+
+/**
+ * @brief Start the Lua task (CONFIG_LUA_VM_TASK)
+ * @param main Runs first on the new task, e.g. to create the state and load the app
+ * @param arg Passed to main
+ * @return bool false if the queues or the task can't be created
+ *
+ * Call it from the GUI task, which becomes the task LVGL calls from Lua are
+ * carried out on. main must end by calling lua_vm_task_run().
+ */
+bool lua_vm_task_start(void (*main)(void* arg), void* arg);
+
+/**
+ * @brief Serve the Lua task's jobs forever; never returns
+ * @param L Lua state the jobs run on
+ */
+void lua_vm_task_run(lua_State* L);
+
+/**
+ * @brief Whether Lua runs on its own task
+ * @return bool true once lua_vm_task_start() succeeded
+ */
+bool lua_vm_task_active(void);
+
+/**
+ * @brief Call a binding on the GUI task
+ * @param L Lua state, with the binding's arguments on the stack
+ * @param fn Binding that touches LVGL
+ * @return int What fn returns; fn's errors are raised in the caller
+ *
+ * From the Lua task, the call is queued for the GUI task and the Lua task
+ * waits for it; L is only used by the GUI task meanwhile. From any other
+ * task, or without a Lua task, fn is called directly.
+ */
+int lua_vm_task_ui_call(lua_State* L, lua_CFunction fn);
+
+/**
+ * @brief Carry out the calls queued for the GUI task, for up to wait_ms
+ * @param wait_ms How long the GUI task can spend waiting for calls
+ *
+ * Replaces the GUI loop's delay before lv_timer_handler(): returns once
+ * wait_ms have passed, running calls as soon as they arrive.
+ */
+void lua_vm_task_gui_poll(uint32_t wait_ms);
+
+/**
+ * @brief Queue a job for the Lua task
+ * @param fn Job
+ * @param payload Copied, at most LUA_VM_JOB_PAYLOAD_SIZE bytes
+ * @param size Size of payload
+ * @return bool false if the queue is full; the job is dropped
+ *
+ * Only the GUI task may post, e.g. from LVGL event callbacks.
+ */
+bool lua_vm_task_post(lua_vm_job_fn_t fn, const void* payload, uint32_t size);
+
+/**
+ * @brief Record the duration of one lv_timer_handler() run
+ * @param us Duration in microseconds
+ */
+void lua_vm_task_note_frame(uint32_t us);
+
+/**
+ * @brief Get the frame and queue statistics; the averages restart each call
+ * @param stats Destination structure
+ */
+void lua_vm_task_get_stats(lua_vm_task_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LUA_VM_TASK_H
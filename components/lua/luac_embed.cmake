@@ -0,0 +1,52 @@
+# Compile one Lua script to stripped bytecode with the host luac and check
+# that the result can be undumped by the firmware's VM.
+#
+#   cmake -DLUAC=<host luac> -DSOURCE=<script.lua> -DOUTPUT=<blob>
+#         -DLUA_H=<src/lua.h> -DINT_SIZE=<target lua_Integer size> -P luac_embed.cmake
+#
+# Run by lua_embed_bytecode() (project_include.cmake). The header lundump.c
+# checks on the device is rebuilt here from the firmware's number model, so
+# a host luac built with a different one fails the build instead of the boot.
+
+foreach(var LUAC SOURCE OUTPUT LUA_H INT_SIZE)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "luac_embed.cmake: ${var} not set")
+    endif()
+endforeach()
+
+execute_process(
+    COMMAND ${LUAC} -s -o ${OUTPUT}.tmp ${SOURCE}
+    RESULT_VARIABLE result
+    ERROR_VARIABLE error)
+if(NOT result EQUAL 0)
+    file(REMOVE ${OUTPUT}.tmp)
+    message(FATAL_ERROR "luac failed on ${SOURCE}:\n${error}")
+endif()
+
+# "\x1bLua", LUAC_VERSION, LUAC_FORMAT, LUAC_DATA, then the sizes of
+# Instruction, lua_Integer and lua_Number, LUAC_INT and LUAC_NUM (370.5 as
+# a little-endian double)
+file(STRINGS ${LUA_H} major REGEX "#define LUA_VERSION_MAJOR[ \t]")
+file(STRINGS ${LUA_H} minor REGEX "#define LUA_VERSION_MINOR[ \t]")
+string(REGEX MATCH "[0-9]+" major "${major}")
+string(REGEX MATCH "[0-9]+" minor "${minor}")
+
+set(luac_int "7856")
+foreach(i RANGE 3 ${INT_SIZE})
+    string(APPEND luac_int "00")
+endforeach()
+set(expected "1b4c7561${major}${minor}0019930d0a1a0a040${INT_SIZE}08${luac_int}0000000000287740")
+
+string(LENGTH "${expected}" hex_len)
+math(EXPR header_len "${hex_len} / 2")
+file(READ ${OUTPUT}.tmp header LIMIT ${header_len} HEX)
+if(NOT header STREQUAL expected)
+    file(REMOVE ${OUTPUT}.tmp)
+    message(FATAL_ERROR "Host luac writes bytecode the firmware VM rejects:\n"
+                        "  expected header ${expected}\n"
+                        "  got             ${header}\n"
+                        "Rebuild the host luac with the firmware's number model (LUA_USE_INT32 for "
+                        "32-bit integers).")
+endif()
+
+file(RENAME ${OUTPUT}.tmp ${OUTPUT})
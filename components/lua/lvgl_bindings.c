@@ -1,5 +1,9 @@
 #include "lvgl_bindings.h"
+#include "lrotable.h"
+#include "lua_engine.h"
+#include "lua_vm_task.h"
 #include "esp_log.h"
+#include <string.h>
 
 static const char *TAG = "LVGL_BINDINGS";
 
@@ -616,14 +620,121 @@ int lvgl_label_set_long_mode(lua_State* L) {
 }
 
 // Event handling - Fixed: Per-object callback storage
-typedef struct {
+typedef struct lua_event_data {
     lua_State* L;
     int callback_ref;
+    volatile bool deleted;      // Set by the GUI task once the object's DELETE event was sent
+    struct lua_event_data* next; // Deleted objects' data waiting to be released
 } lua_event_data_t;
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+// With a Lua task (CONFIG_LUA_VM_TASK) events are posted to it instead of
+// running the handler inside lv_timer_handler()
+typedef struct {
+    lua_event_data_t* event_data;
+    lv_obj_t* target;
+    lv_obj_t* current_target;
+    uint32_t key;               // Copy of the LV_EVENT_KEY param, which only lives while the event is sent
+    lv_event_code_t code;
+} lua_event_job_t;
+
+// Data of deleted objects not yet handed to the Lua task; GUI task only
+static lua_event_data_t* s_unreleased = NULL;
+
+// Runs on the Lua task; the handler sees a copy of the event. Jobs queued
+// before the object was deleted still arrive, but its handler is not run.
+static void run_event_job(lua_State* L, void* payload) {
+    lua_event_job_t* job = (lua_event_job_t*)payload;
+    if (job->event_data->deleted) {
+        return;
+    }
+    lv_event_t e;
+    memset(&e, 0, sizeof(e));
+    e.target = job->target;
+    e.current_target = job->current_target;
+    e.code = job->code;
+    e.user_data = job->event_data;
+    e.param = job->code == LV_EVENT_KEY ? &job->key : NULL;
+
+    if (lua_engine_call_begin(L, job->event_data->callback_ref) == 0) {
+        lua_pushlightuserdata(L, &e);
+        lua_engine_call_end(L, 1, 0);
+    }
+}
+
+// Runs on the Lua task after every event queued before the batch was posted
+static void release_event_jobs(lua_State* L, void* payload) {
+    lua_event_data_t* event_data = *(lua_event_data_t**)payload;
+    while (event_data != NULL) {
+        lua_event_data_t* next = event_data->next;
+        luaL_unref(L, LUA_REGISTRYINDEX, event_data->callback_ref);
+        free(event_data);
+        event_data = next;
+    }
+}
+
+// Hands the deleted objects' data to the Lua task. A full queue keeps it
+// here for the next event, as deleting a screen sends a DELETE per child
+// while the Lua task may be waiting on the GUI task.
+static void post_unreleased(void) {
+    if (s_unreleased != NULL && lua_vm_task_post(release_event_jobs, &s_unreleased, sizeof(s_unreleased))) {
+        s_unreleased = NULL;
+    }
+}
+
+// Events sent while LVGL draws or lays out an object: their param only
+// lives during the call and is where a result goes, so a handler running
+// later on the Lua task can't use them, and each redraw sends dozens
+static bool is_draw_event(lv_event_code_t code) {
+    switch (code) {
+        case LV_EVENT_HIT_TEST:
+        case LV_EVENT_COVER_CHECK:
+        case LV_EVENT_REFR_EXT_DRAW_SIZE:
+        case LV_EVENT_DRAW_MAIN_BEGIN:
+        case LV_EVENT_DRAW_MAIN:
+        case LV_EVENT_DRAW_MAIN_END:
+        case LV_EVENT_DRAW_POST_BEGIN:
+        case LV_EVENT_DRAW_POST:
+        case LV_EVENT_DRAW_POST_END:
+        case LV_EVENT_DRAW_PART_BEGIN:
+        case LV_EVENT_DRAW_PART_END:
+        case LV_EVENT_GET_SELF_SIZE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void post_event(lv_event_t* e, lua_event_data_t* event_data, lv_event_code_t code) {
+    if (code == LV_EVENT_DELETE) {
+        // Released after the jobs already queued for the object
+        event_data->deleted = true;
+        event_data->next = s_unreleased;
+        s_unreleased = event_data;
+        post_unreleased();
+        return;
+    }
+    post_unreleased();
+    if (is_draw_event(code)) {
+        return;
+    }
+
+    lua_event_job_t job = {
+        .event_data = event_data,
+        .target = lv_event_get_target(e),
+        .current_target = lv_event_get_current_target(e),
+        .code = code,
+    };
+    if (code == LV_EVENT_KEY) {
+        job.key = lv_event_get_key(e);
+    }
+    if (!lua_vm_task_post(run_event_job, &job, sizeof(job))) {
+        ESP_LOGW(TAG, "Lua task queue full, dropped event %d", code);
+    }
+}
+
 static void lua_event_callback(lv_event_t* e) {
     lua_event_data_t* event_data = (lua_event_data_t*)lv_event_get_user_data(e);
     if (!event_data || !event_data->L || event_data->callback_ref == LUA_NOREF) {
@@ -633,19 +744,17 @@ static void lua_event_callback(lv_event_t* e) {
     lua_State* L = event_data->L;
     lv_event_code_t code = lv_event_get_code(e);
 
+    if (lua_vm_task_active()) {
+        post_event(e, event_data, code);
+        return;
+    }
+
     // Handle regular event callbacks
     if (code != LV_EVENT_DELETE) {
-        lua_rawgeti(L, LUA_REGISTRYINDEX, event_data->callback_ref);
-        if (lua_isfunction(L, -1)) {
+        // Under the callback budget: a runaway handler can't hang lv_timer_handler()
+        if (lua_engine_call_begin(L, event_data->callback_ref) == 0) {
             lua_pushlightuserdata(L, e);
-            int pcall_result = lua_pcall(L, 1, 0, 0);
-            if (pcall_result != LUA_OK) {
-                const char* error_msg = lua_tostring(L, -1);
-                ESP_LOGE("LVGL_EVENT", "Lua callback error: %s", error_msg ? error_msg : "unknown error");
-                lua_pop(L, 1);
-            }
-        } else {
-            lua_pop(L, 1);
+            lua_engine_call_end(L, 1, 0);
         }
     }
     // Handle the DELETE event to clean up resources
@@ -671,6 +780,8 @@ int lvgl_obj_add_event_cb(lua_State* L) {
 
     // Store the Lua state and create a reference to the callback function
     event_data->L = L;
+    event_data->deleted = false;
+    event_data->next = NULL;
     lua_pushvalue(L, 2); // Duplicate function on stack for luaL_ref
     event_data->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
@@ -739,6 +850,10 @@ int lvgl_event_get_code(lua_State* L) {
 int lvgl_event_get_target(lua_State* L) {
     lv_event_t* event = (lv_event_t*)lua_touserdata(L, 1);
     lv_obj_t* target = lv_event_get_target(event);
+    // An event queued for the Lua task can outlive its target
+    if (lua_vm_task_active() && !lv_obj_is_valid(target)) {
+        target = NULL;
+    }
     push_lvgl_obj(L, target);
     return 1;
 }
@@ -784,10 +899,11 @@ int lvgl_obj_clear_flag(lua_State* L) {
     return 0;
 }
 
+// false for a deleted object, rather than the error other calls raise
 int lvgl_obj_is_valid(lua_State* L) {
-    lv_obj_t* obj = check_lvgl_obj(L, 1);
-    bool is_valid = lv_obj_is_valid(obj);
-    lua_pushboolean(L, is_valid);
+    void** obj_ptr = (void**)luaL_checkudata(L, 1, LVGL_OBJ_METATABLE);
+    lv_obj_t* obj = (lv_obj_t*)*obj_ptr;
+    lua_pushboolean(L, obj != NULL && lv_obj_is_valid(obj));
     return 1;
 }
 
@@ -1123,248 +1239,288 @@ static int lvgl_obj_tostring(lua_State* L) {
     return 1;
 }
 
-// Function registry
-static const luaL_Reg lvgl_functions[] = {
+// Layout ids are not compile-time constants: LVGL assigns them when the
+// flex and grid layouts register during lv_init(). Copied in luaopen_lvgl().
+static lua_Integer s_lv_layout_flex;
+static lua_Integer s_lv_layout_grid;
+
+// Library map: functions and constants live in flash as a read-only table,
+// nothing is copied to the Lua heap when the module is opened
+static const luaR_entry lvgl_map[] = {
     // Core functions
-    {"scr_act", lvgl_scr_act},
-    {"obj_create", lvgl_obj_create},
-    {"obj_set_size", lvgl_obj_set_size},
-    {"obj_set_pos", lvgl_obj_set_pos},
-    {"obj_align", lvgl_obj_align},
-    {"obj_align_to", lvgl_obj_align_to},
-    {"obj_center", lvgl_obj_center},
-    {"obj_clean", lvgl_obj_clean},
-    {"obj_invalidate", lvgl_obj_invalidate},
-    {"obj_set_scrollbar_mode", lvgl_obj_set_scrollbar_mode},
-    {"obj_set_width", lvgl_obj_set_width},
-    {"obj_add_event_cb", lvgl_obj_add_event_cb},
+    LROT_FUNCENTRY(scr_act, lvgl_scr_act),
+    LROT_FUNCENTRY(obj_create, lvgl_obj_create),
+    LROT_FUNCENTRY(obj_set_size, lvgl_obj_set_size),
+    LROT_FUNCENTRY(obj_set_pos, lvgl_obj_set_pos),
+    LROT_FUNCENTRY(obj_align, lvgl_obj_align),
+    LROT_FUNCENTRY(obj_align_to, lvgl_obj_align_to),
+    LROT_FUNCENTRY(obj_center, lvgl_obj_center),
+    LROT_FUNCENTRY(obj_clean, lvgl_obj_clean),
+    LROT_FUNCENTRY(obj_invalidate, lvgl_obj_invalidate),
+    LROT_FUNCENTRY(obj_set_scrollbar_mode, lvgl_obj_set_scrollbar_mode),
+    LROT_FUNCENTRY(obj_set_width, lvgl_obj_set_width),
+    LROT_FUNCENTRY(obj_add_event_cb, lvgl_obj_add_event_cb),
     
     // Style functions
-    {"obj_set_style_bg_color", lvgl_obj_set_style_bg_color},
-    {"obj_set_style_text_color", lvgl_obj_set_style_text_color},
-    {"obj_set_style_text_font", lvgl_obj_set_style_text_font},
-    {"obj_set_style_border_width", lvgl_obj_set_style_border_width},
-    {"obj_set_style_border_color", lvgl_obj_set_style_border_color},
-    {"obj_set_style_bg_opa", lvgl_obj_set_style_bg_opa},
-    {"obj_set_style_border_opa", lvgl_obj_set_style_border_opa},
-    {"obj_set_style_border_side", lvgl_obj_set_style_border_side},
-    {"obj_set_style_radius", lvgl_obj_set_style_radius},
-    {"obj_set_style_bg_grad_dir", lvgl_obj_set_style_bg_grad_dir},
-    {"obj_set_style_pad_all", lvgl_obj_set_style_pad_all},
-    {"obj_set_style_pad_top", lvgl_obj_set_style_pad_top},
-    {"obj_set_style_pad_bottom", lvgl_obj_set_style_pad_bottom},
-    {"obj_set_style_pad_left", lvgl_obj_set_style_pad_left},
-    {"obj_set_style_pad_right", lvgl_obj_set_style_pad_right},
-    {"obj_set_style_shadow_width", lvgl_obj_set_style_shadow_width},
-    {"obj_set_style_shadow_opa", lvgl_obj_set_style_shadow_opa},
-    {"obj_set_style_shadow_ofs_y", lvgl_obj_set_style_shadow_ofs_y},
-    {"obj_set_style_text_opa", lvgl_obj_set_style_text_opa},
-    {"obj_set_style_text_letter_space", lvgl_obj_set_style_text_letter_space},
-    {"obj_set_style_text_line_space", lvgl_obj_set_style_text_line_space},
-    {"obj_set_style_text_align", lvgl_obj_set_style_text_align},
-    {"obj_set_style_text_decor", lvgl_obj_set_style_text_decor},
-    {"obj_set_style_anim_time", lvgl_obj_set_style_anim_time},
+    LROT_FUNCENTRY(obj_set_style_bg_color, lvgl_obj_set_style_bg_color),
+    LROT_FUNCENTRY(obj_set_style_text_color, lvgl_obj_set_style_text_color),
+    LROT_FUNCENTRY(obj_set_style_text_font, lvgl_obj_set_style_text_font),
+    LROT_FUNCENTRY(obj_set_style_border_width, lvgl_obj_set_style_border_width),
+    LROT_FUNCENTRY(obj_set_style_border_color, lvgl_obj_set_style_border_color),
+    LROT_FUNCENTRY(obj_set_style_bg_opa, lvgl_obj_set_style_bg_opa),
+    LROT_FUNCENTRY(obj_set_style_border_opa, lvgl_obj_set_style_border_opa),
+    LROT_FUNCENTRY(obj_set_style_border_side, lvgl_obj_set_style_border_side),
+    LROT_FUNCENTRY(obj_set_style_radius, lvgl_obj_set_style_radius),
+    LROT_FUNCENTRY(obj_set_style_bg_grad_dir, lvgl_obj_set_style_bg_grad_dir),
+    LROT_FUNCENTRY(obj_set_style_pad_all, lvgl_obj_set_style_pad_all),
+    LROT_FUNCENTRY(obj_set_style_pad_top, lvgl_obj_set_style_pad_top),
+    LROT_FUNCENTRY(obj_set_style_pad_bottom, lvgl_obj_set_style_pad_bottom),
+    LROT_FUNCENTRY(obj_set_style_pad_left, lvgl_obj_set_style_pad_left),
+    LROT_FUNCENTRY(obj_set_style_pad_right, lvgl_obj_set_style_pad_right),
+    LROT_FUNCENTRY(obj_set_style_shadow_width, lvgl_obj_set_style_shadow_width),
+    LROT_FUNCENTRY(obj_set_style_shadow_opa, lvgl_obj_set_style_shadow_opa),
+    LROT_FUNCENTRY(obj_set_style_shadow_ofs_y, lvgl_obj_set_style_shadow_ofs_y),
+    LROT_FUNCENTRY(obj_set_style_text_opa, lvgl_obj_set_style_text_opa),
+    LROT_FUNCENTRY(obj_set_style_text_letter_space, lvgl_obj_set_style_text_letter_space),
+    LROT_FUNCENTRY(obj_set_style_text_line_space, lvgl_obj_set_style_text_line_space),
+    LROT_FUNCENTRY(obj_set_style_text_align, lvgl_obj_set_style_text_align),
+    LROT_FUNCENTRY(obj_set_style_text_decor, lvgl_obj_set_style_text_decor),
+    LROT_FUNCENTRY(obj_set_style_anim_time, lvgl_obj_set_style_anim_time),
     
     // Widget functions
-    {"label_create", lvgl_label_create},
-    {"label_set_text", lvgl_label_set_text},
-    {"label_set_long_mode", lvgl_label_set_long_mode},
-    {"btn_create", lvgl_btn_create},
-    {"slider_create", lvgl_slider_create},
-    {"slider_set_value", lvgl_slider_set_value},
-    {"switch_create", lvgl_switch_create},
-    {"bar_create", lvgl_bar_create},
-    {"bar_set_value", lvgl_bar_set_value},
-    {"bar_set_range", lvgl_bar_set_range},
-    {"bar_set_mode", lvgl_bar_set_mode},
-    {"spangroup_create", lvgl_spangroup_create},
-    {"spangroup_new_span", lvgl_spangroup_new_span},
-    {"span_set_text", lvgl_span_set_text},
-    {"spangroup_set_align", lvgl_spangroup_set_align},
-    {"spangroup_set_overflow", lvgl_spangroup_set_overflow},
-    {"spangroup_set_mode", lvgl_spangroup_set_mode},
-    {"spangroup_refr_mode", lvgl_spangroup_refr_mode},
-    {"msgbox_create", lvgl_msgbox_create},
-    {"msgbox_get_btns", lvgl_msgbox_get_btns},
-    {"msgbox_get_title", lvgl_msgbox_get_title},
-    {"msgbox_get_text", lvgl_msgbox_get_text},
-    {"list_create", lvgl_list_create},
-    {"list_add_text", lvgl_list_add_text},
-    {"list_add_btn", lvgl_list_add_btn},
-    {"img_create", lvgl_img_create},
-    {"textarea_create", lvgl_textarea_create},
-    {"textarea_set_text", lvgl_textarea_set_text},
-    {"textarea_get_text", lvgl_textarea_get_text},
-    {"textarea_set_one_line", lvgl_textarea_set_one_line},
-    {"textarea_set_placeholder_text", lvgl_textarea_set_placeholder_text},
-    {"textarea_set_max_length", lvgl_textarea_set_max_length},
-    {"textarea_set_password_mode", lvgl_textarea_set_password_mode},
-    {"keyboard_create", lvgl_keyboard_create},
-    {"keyboard_set_textarea", lvgl_keyboard_set_textarea},
+    LROT_FUNCENTRY(label_create, lvgl_label_create),
+    LROT_FUNCENTRY(label_set_text, lvgl_label_set_text),
+    LROT_FUNCENTRY(label_set_long_mode, lvgl_label_set_long_mode),
+    LROT_FUNCENTRY(btn_create, lvgl_btn_create),
+    LROT_FUNCENTRY(slider_create, lvgl_slider_create),
+    LROT_FUNCENTRY(slider_set_value, lvgl_slider_set_value),
+    LROT_FUNCENTRY(switch_create, lvgl_switch_create),
+    LROT_FUNCENTRY(bar_create, lvgl_bar_create),
+    LROT_FUNCENTRY(bar_set_value, lvgl_bar_set_value),
+    LROT_FUNCENTRY(bar_set_range, lvgl_bar_set_range),
+    LROT_FUNCENTRY(bar_set_mode, lvgl_bar_set_mode),
+    LROT_FUNCENTRY(spangroup_create, lvgl_spangroup_create),
+    LROT_FUNCENTRY(spangroup_new_span, lvgl_spangroup_new_span),
+    LROT_FUNCENTRY(span_set_text, lvgl_span_set_text),
+    LROT_FUNCENTRY(spangroup_set_align, lvgl_spangroup_set_align),
+    LROT_FUNCENTRY(spangroup_set_overflow, lvgl_spangroup_set_overflow),
+    LROT_FUNCENTRY(spangroup_set_mode, lvgl_spangroup_set_mode),
+    LROT_FUNCENTRY(spangroup_refr_mode, lvgl_spangroup_refr_mode),
+    LROT_FUNCENTRY(msgbox_create, lvgl_msgbox_create),
+    LROT_FUNCENTRY(msgbox_get_btns, lvgl_msgbox_get_btns),
+    LROT_FUNCENTRY(msgbox_get_title, lvgl_msgbox_get_title),
+    LROT_FUNCENTRY(msgbox_get_text, lvgl_msgbox_get_text),
+    LROT_FUNCENTRY(list_create, lvgl_list_create),
+    LROT_FUNCENTRY(list_add_text, lvgl_list_add_text),
+    LROT_FUNCENTRY(list_add_btn, lvgl_list_add_btn),
+    LROT_FUNCENTRY(img_create, lvgl_img_create),
+    LROT_FUNCENTRY(textarea_create, lvgl_textarea_create),
+    LROT_FUNCENTRY(textarea_set_text, lvgl_textarea_set_text),
+    LROT_FUNCENTRY(textarea_get_text, lvgl_textarea_get_text),
+    LROT_FUNCENTRY(textarea_set_one_line, lvgl_textarea_set_one_line),
+    LROT_FUNCENTRY(textarea_set_placeholder_text, lvgl_textarea_set_placeholder_text),
+    LROT_FUNCENTRY(textarea_set_max_length, lvgl_textarea_set_max_length),
+    LROT_FUNCENTRY(textarea_set_password_mode, lvgl_textarea_set_password_mode),
+    LROT_FUNCENTRY(keyboard_create, lvgl_keyboard_create),
+    LROT_FUNCENTRY(keyboard_set_textarea, lvgl_keyboard_set_textarea),
 
     // Tabview functions
-    {"tabview_create", lvgl_tabview_create},
-    {"tabview_add_tab", lvgl_tabview_add_tab},
+    LROT_FUNCENTRY(tabview_create, lvgl_tabview_create),
+    LROT_FUNCENTRY(tabview_add_tab, lvgl_tabview_add_tab),
 
     // Menu functions
-    {"menu_create", lvgl_menu_create},
-    {"menu_page_create", lvgl_menu_page_create},
-    {"menu_cont_create", lvgl_menu_cont_create},
-    {"menu_set_sidebar_page", lvgl_menu_set_sidebar_page},
-    {"menu_set_load_page_event", lvgl_menu_set_load_page_event},
-    {"menu_get_sidebar_header", lvgl_menu_get_sidebar_header},
+    LROT_FUNCENTRY(menu_create, lvgl_menu_create),
+    LROT_FUNCENTRY(menu_page_create, lvgl_menu_page_create),
+    LROT_FUNCENTRY(menu_cont_create, lvgl_menu_cont_create),
+    LROT_FUNCENTRY(menu_set_sidebar_page, lvgl_menu_set_sidebar_page),
+    LROT_FUNCENTRY(menu_set_load_page_event, lvgl_menu_set_load_page_event),
+    LROT_FUNCENTRY(menu_get_sidebar_header, lvgl_menu_get_sidebar_header),
 
     // Other functions
-    {"obj_update_layout", lvgl_obj_update_layout},
-    {"obj_move_foreground", lvgl_obj_move_foreground},
-    {"obj_move_background", lvgl_obj_move_background},
-
-    {"obj_add_flag", lvgl_obj_add_flag},
-    {"obj_clear_flag", lvgl_obj_clear_flag},
-    {"obj_has_state", lvgl_obj_has_state},
-    {"obj_is_valid", lvgl_obj_is_valid},
-    {"obj_del", lvgl_obj_del},
-    {"obj_get_x", lvgl_obj_get_x},
-    {"obj_get_y", lvgl_obj_get_y},
-    {"obj_get_width", lvgl_obj_get_width},
-    {"obj_get_height", lvgl_obj_get_height},
-    {"pct", lvgl_pct},
+    LROT_FUNCENTRY(obj_update_layout, lvgl_obj_update_layout),
+    LROT_FUNCENTRY(obj_move_foreground, lvgl_obj_move_foreground),
+    LROT_FUNCENTRY(obj_move_background, lvgl_obj_move_background),
+
+    LROT_FUNCENTRY(obj_add_flag, lvgl_obj_add_flag),
+    LROT_FUNCENTRY(obj_clear_flag, lvgl_obj_clear_flag),
+    LROT_FUNCENTRY(obj_has_state, lvgl_obj_has_state),
+    LROT_FUNCENTRY(obj_is_valid, lvgl_obj_is_valid),
+    LROT_FUNCENTRY(obj_del, lvgl_obj_del),
+    LROT_FUNCENTRY(obj_get_x, lvgl_obj_get_x),
+    LROT_FUNCENTRY(obj_get_y, lvgl_obj_get_y),
+    LROT_FUNCENTRY(obj_get_width, lvgl_obj_get_width),
+    LROT_FUNCENTRY(obj_get_height, lvgl_obj_get_height),
+    LROT_FUNCENTRY(pct, lvgl_pct),
     
     // Event functions
-    {"event_get_code", lvgl_event_get_code},
-    {"event_get_target", lvgl_event_get_target},
-    {"event_get_user_data", lvgl_event_get_user_data},
-    {"event_send", lvgl_event_send},
+    LROT_FUNCENTRY(event_get_code, lvgl_event_get_code),
+    LROT_FUNCENTRY(event_get_target, lvgl_event_get_target),
+    LROT_FUNCENTRY(event_get_user_data, lvgl_event_get_user_data),
+    LROT_FUNCENTRY(event_send, lvgl_event_send),
     
     // Utility functions
-    {"color_hex", lvgl_color_hex},
-    {"color_white", lvgl_color_white},
-    {"color_black", lvgl_color_black},
-    {"refr_now", lvgl_refr_now},
-    {"scr_load_anim", lvgl_scr_load_anim},
+    LROT_FUNCENTRY(color_hex, lvgl_color_hex),
+    LROT_FUNCENTRY(color_white, lvgl_color_white),
+    LROT_FUNCENTRY(color_black, lvgl_color_black),
+    LROT_FUNCENTRY(refr_now, lvgl_refr_now),
+    LROT_FUNCENTRY(scr_load_anim, lvgl_scr_load_anim),
     
     // Font constants
-    {"font_montserrat_14", lvgl_font_montserrat_14},
-    {"font_montserrat_16", lvgl_font_montserrat_16},
-    {"font_montserrat_20", lvgl_font_montserrat_20},
-    {"font_montserrat_12", lvgl_font_montserrat_12},
+    LROT_FUNCENTRY(font_montserrat_14, lvgl_font_montserrat_14),
+    LROT_FUNCENTRY(font_montserrat_16, lvgl_font_montserrat_16),
+    LROT_FUNCENTRY(font_montserrat_20, lvgl_font_montserrat_20),
+    LROT_FUNCENTRY(font_montserrat_12, lvgl_font_montserrat_12),
     
     // Animation constants
-    {"ANIM_ON", lvgl_anim_on},
+    LROT_FUNCENTRY(ANIM_ON, lvgl_anim_on),
 
     // Layout and Flexbox bindings
-    {"obj_set_layout", lvgl_obj_set_layout},
-    {"obj_set_flex_flow", lvgl_obj_set_flex_flow},
-    {"obj_set_flex_align", lvgl_obj_set_flex_align},
-    {"obj_set_style_pad_gap", lvgl_obj_set_style_pad_gap},
-    
-    {NULL, NULL}
-};
-
-// Helper macro to register a constant value
-#define LUA_REG_CONST_INT(L, name, value) \
-    lua_pushinteger(L, value); \
-    lua_setfield(L, -2, name);
+    LROT_FUNCENTRY(obj_set_layout, lvgl_obj_set_layout),
+    LROT_FUNCENTRY(obj_set_flex_flow, lvgl_obj_set_flex_flow),
+    LROT_FUNCENTRY(obj_set_flex_align, lvgl_obj_set_flex_align),
+    LROT_FUNCENTRY(obj_set_style_pad_gap, lvgl_obj_set_style_pad_gap),
 
-// This function will be called from luaopen_lvgl to register all constants
-static void register_lvgl_constants(lua_State* L) {
     // Parts
-    LUA_REG_CONST_INT(L, "PART_MAIN", LV_PART_MAIN);
-    LUA_REG_CONST_INT(L, "PART_INDICATOR", LV_PART_INDICATOR);
-    LUA_REG_CONST_INT(L, "PART_KNOB", LV_PART_KNOB);
+    LROT_INTENTRY(PART_MAIN, LV_PART_MAIN),
+    LROT_INTENTRY(PART_INDICATOR, LV_PART_INDICATOR),
+    LROT_INTENTRY(PART_KNOB, LV_PART_KNOB),
 
     // States
-    LUA_REG_CONST_INT(L, "STATE_DEFAULT", LV_STATE_DEFAULT);
-    LUA_REG_CONST_INT(L, "STATE_CHECKED", LV_STATE_CHECKED);
+    LROT_INTENTRY(STATE_DEFAULT, LV_STATE_DEFAULT),
+    LROT_INTENTRY(STATE_CHECKED, LV_STATE_CHECKED),
 
     // Alignments
-    LUA_REG_CONST_INT(L, "ALIGN_CENTER", LV_ALIGN_CENTER);
-    LUA_REG_CONST_INT(L, "ALIGN_TOP_LEFT", LV_ALIGN_TOP_LEFT);
-    LUA_REG_CONST_INT(L, "ALIGN_TOP_MID", LV_ALIGN_TOP_MID);
-    LUA_REG_CONST_INT(L, "ALIGN_TOP_RIGHT", LV_ALIGN_TOP_RIGHT);
-    LUA_REG_CONST_INT(L, "ALIGN_BOTTOM_LEFT", LV_ALIGN_BOTTOM_LEFT);
-    LUA_REG_CONST_INT(L, "ALIGN_BOTTOM_MID", LV_ALIGN_BOTTOM_MID);
-    LUA_REG_CONST_INT(L, "ALIGN_BOTTOM_RIGHT", LV_ALIGN_BOTTOM_RIGHT);
-    LUA_REG_CONST_INT(L, "ALIGN_LEFT_MID", LV_ALIGN_LEFT_MID);
-    LUA_REG_CONST_INT(L, "ALIGN_RIGHT_MID", LV_ALIGN_RIGHT_MID);
-    LUA_REG_CONST_INT(L, "ALIGN_OUT_TOP_MID", LV_ALIGN_OUT_TOP_MID);
-    LUA_REG_CONST_INT(L, "ALIGN_OUT_BOTTOM_LEFT", LV_ALIGN_OUT_BOTTOM_LEFT);
+    LROT_INTENTRY(ALIGN_CENTER, LV_ALIGN_CENTER),
+    LROT_INTENTRY(ALIGN_TOP_LEFT, LV_ALIGN_TOP_LEFT),
+    LROT_INTENTRY(ALIGN_TOP_MID, LV_ALIGN_TOP_MID),
+    LROT_INTENTRY(ALIGN_TOP_RIGHT, LV_ALIGN_TOP_RIGHT),
+    LROT_INTENTRY(ALIGN_BOTTOM_LEFT, LV_ALIGN_BOTTOM_LEFT),
+    LROT_INTENTRY(ALIGN_BOTTOM_MID, LV_ALIGN_BOTTOM_MID),
+    LROT_INTENTRY(ALIGN_BOTTOM_RIGHT, LV_ALIGN_BOTTOM_RIGHT),
+    LROT_INTENTRY(ALIGN_LEFT_MID, LV_ALIGN_LEFT_MID),
+    LROT_INTENTRY(ALIGN_RIGHT_MID, LV_ALIGN_RIGHT_MID),
+    LROT_INTENTRY(ALIGN_OUT_TOP_MID, LV_ALIGN_OUT_TOP_MID),
+    LROT_INTENTRY(ALIGN_OUT_BOTTOM_LEFT, LV_ALIGN_OUT_BOTTOM_LEFT),
 
     // Text Alignments
-    LUA_REG_CONST_INT(L, "TEXT_ALIGN_LEFT", LV_TEXT_ALIGN_LEFT);
-    LUA_REG_CONST_INT(L, "TEXT_ALIGN_CENTER", LV_TEXT_ALIGN_CENTER);
-    LUA_REG_CONST_INT(L, "TEXT_ALIGN_RIGHT", LV_TEXT_ALIGN_RIGHT);
+    LROT_INTENTRY(TEXT_ALIGN_LEFT, LV_TEXT_ALIGN_LEFT),
+    LROT_INTENTRY(TEXT_ALIGN_CENTER, LV_TEXT_ALIGN_CENTER),
+    LROT_INTENTRY(TEXT_ALIGN_RIGHT, LV_TEXT_ALIGN_RIGHT),
 
     // Directions
-    LUA_REG_CONST_INT(L, "DIR_TOP", LV_DIR_TOP);
+    LROT_INTENTRY(DIR_TOP, LV_DIR_TOP),
 
     // Flex Flow
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_ROW", LV_FLEX_FLOW_ROW);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_COLUMN", LV_FLEX_FLOW_COLUMN);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_ROW_WRAP", LV_FLEX_FLOW_ROW_WRAP);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_COLUMN_WRAP", LV_FLEX_FLOW_COLUMN_WRAP);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_ROW_REVERSE", LV_FLEX_FLOW_ROW_REVERSE);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_COLUMN_REVERSE", LV_FLEX_FLOW_COLUMN_REVERSE);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_ROW_WRAP_REVERSE", LV_FLEX_FLOW_ROW_WRAP_REVERSE);
-    LUA_REG_CONST_INT(L, "FLEX_FLOW_COLUMN_WRAP_REVERSE", LV_FLEX_FLOW_COLUMN_WRAP_REVERSE);
+    LROT_INTENTRY(FLEX_FLOW_ROW, LV_FLEX_FLOW_ROW),
+    LROT_INTENTRY(FLEX_FLOW_COLUMN, LV_FLEX_FLOW_COLUMN),
+    LROT_INTENTRY(FLEX_FLOW_ROW_WRAP, LV_FLEX_FLOW_ROW_WRAP),
+    LROT_INTENTRY(FLEX_FLOW_COLUMN_WRAP, LV_FLEX_FLOW_COLUMN_WRAP),
+    LROT_INTENTRY(FLEX_FLOW_ROW_REVERSE, LV_FLEX_FLOW_ROW_REVERSE),
+    LROT_INTENTRY(FLEX_FLOW_COLUMN_REVERSE, LV_FLEX_FLOW_COLUMN_REVERSE),
+    LROT_INTENTRY(FLEX_FLOW_ROW_WRAP_REVERSE, LV_FLEX_FLOW_ROW_WRAP_REVERSE),
+    LROT_INTENTRY(FLEX_FLOW_COLUMN_WRAP_REVERSE, LV_FLEX_FLOW_COLUMN_WRAP_REVERSE),
 
     // Flex Align
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_START", LV_FLEX_ALIGN_START);
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_END", LV_FLEX_ALIGN_END);
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_CENTER", LV_FLEX_ALIGN_CENTER);
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_SPACE_EVENLY", LV_FLEX_ALIGN_SPACE_EVENLY);
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_SPACE_AROUND", LV_FLEX_ALIGN_SPACE_AROUND);
-    LUA_REG_CONST_INT(L, "FLEX_ALIGN_SPACE_BETWEEN", LV_FLEX_ALIGN_SPACE_BETWEEN);
+    LROT_INTENTRY(FLEX_ALIGN_START, LV_FLEX_ALIGN_START),
+    LROT_INTENTRY(FLEX_ALIGN_END, LV_FLEX_ALIGN_END),
+    LROT_INTENTRY(FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER),
+    LROT_INTENTRY(FLEX_ALIGN_SPACE_EVENLY, LV_FLEX_ALIGN_SPACE_EVENLY),
+    LROT_INTENTRY(FLEX_ALIGN_SPACE_AROUND, LV_FLEX_ALIGN_SPACE_AROUND),
+    LROT_INTENTRY(FLEX_ALIGN_SPACE_BETWEEN, LV_FLEX_ALIGN_SPACE_BETWEEN),
 
     // Layouts
-    LUA_REG_CONST_INT(L, "LAYOUT_FLEX", LV_LAYOUT_FLEX);
-    LUA_REG_CONST_INT(L, "LAYOUT_GRID", LV_LAYOUT_GRID);
+    LROT_INTREFENTRY(LAYOUT_FLEX, &s_lv_layout_flex),
+    LROT_INTREFENTRY(LAYOUT_GRID, &s_lv_layout_grid),
 
     // Other constants
-    LUA_REG_CONST_INT(L, "BORDER_SIDE_FULL", LV_BORDER_SIDE_FULL);
-    LUA_REG_CONST_INT(L, "GRAD_DIR_NONE", LV_GRAD_DIR_NONE);
-    LUA_REG_CONST_INT(L, "SCROLLBAR_MODE_OFF", LV_SCROLLBAR_MODE_OFF);
-    LUA_REG_CONST_INT(L, "SCROLLBAR_MODE_ON", LV_SCROLLBAR_MODE_ON);
-    LUA_REG_CONST_INT(L, "LABEL_LONG_WRAP", LV_LABEL_LONG_WRAP);
-    LUA_REG_CONST_INT(L, "BAR_MODE_NORMAL", LV_BAR_MODE_NORMAL);
-    LUA_REG_CONST_INT(L, "SCR_LOAD_ANIM_NONE", LV_SCR_LOAD_ANIM_NONE);
-    LUA_REG_CONST_INT(L, "TEXT_DECOR_NONE", LV_TEXT_DECOR_NONE);
-    LUA_REG_CONST_INT(L, "SPAN_MODE_BREAK", LV_SPAN_MODE_BREAK);
-    LUA_REG_CONST_INT(L, "SPAN_OVERFLOW_CLIP", LV_SPAN_OVERFLOW_CLIP);
+    LROT_INTENTRY(BORDER_SIDE_FULL, LV_BORDER_SIDE_FULL),
+    LROT_INTENTRY(GRAD_DIR_NONE, LV_GRAD_DIR_NONE),
+    LROT_INTENTRY(SCROLLBAR_MODE_OFF, LV_SCROLLBAR_MODE_OFF),
+    LROT_INTENTRY(SCROLLBAR_MODE_ON, LV_SCROLLBAR_MODE_ON),
+    LROT_INTENTRY(LABEL_LONG_WRAP, LV_LABEL_LONG_WRAP),
+    LROT_INTENTRY(BAR_MODE_NORMAL, LV_BAR_MODE_NORMAL),
+    LROT_INTENTRY(SCR_LOAD_ANIM_NONE, LV_SCR_LOAD_ANIM_NONE),
+    LROT_INTENTRY(TEXT_DECOR_NONE, LV_TEXT_DECOR_NONE),
+    LROT_INTENTRY(SPAN_MODE_BREAK, LV_SPAN_MODE_BREAK),
+    LROT_INTENTRY(SPAN_OVERFLOW_CLIP, LV_SPAN_OVERFLOW_CLIP),
 
     // Events
-    LUA_REG_CONST_INT(L, "EVENT_ALL", LV_EVENT_ALL);
-    LUA_REG_CONST_INT(L, "EVENT_CLICKED", LV_EVENT_CLICKED);
-    LUA_REG_CONST_INT(L, "EVENT_VALUE_CHANGED", LV_EVENT_VALUE_CHANGED);
-    LUA_REG_CONST_INT(L, "EVENT_READY", LV_EVENT_READY);
-    LUA_REG_CONST_INT(L, "EVENT_CANCEL", LV_EVENT_CANCEL);
-    LUA_REG_CONST_INT(L, "EVENT_FOCUSED", LV_EVENT_FOCUSED);
-    LUA_REG_CONST_INT(L, "EVENT_DEFOCUSED", LV_EVENT_DEFOCUSED);
+    LROT_INTENTRY(EVENT_ALL, LV_EVENT_ALL),
+    LROT_INTENTRY(EVENT_CLICKED, LV_EVENT_CLICKED),
+    LROT_INTENTRY(EVENT_VALUE_CHANGED, LV_EVENT_VALUE_CHANGED),
+    LROT_INTENTRY(EVENT_READY, LV_EVENT_READY),
+    LROT_INTENTRY(EVENT_CANCEL, LV_EVENT_CANCEL),
+    LROT_INTENTRY(EVENT_FOCUSED, LV_EVENT_FOCUSED),
+    LROT_INTENTRY(EVENT_DEFOCUSED, LV_EVENT_DEFOCUSED),
 
     // Object Flags
-    LUA_REG_CONST_INT(L, "OBJ_FLAG_HIDDEN", LV_OBJ_FLAG_HIDDEN);
-    LUA_REG_CONST_INT(L, "OBJ_FLAG_SCROLLABLE", LV_OBJ_FLAG_SCROLLABLE);
-    LUA_REG_CONST_INT(L, "OBJ_FLAG_CLICKABLE", LV_OBJ_FLAG_CLICKABLE);
+    LROT_INTENTRY(OBJ_FLAG_HIDDEN, LV_OBJ_FLAG_HIDDEN),
+    LROT_INTENTRY(OBJ_FLAG_SCROLLABLE, LV_OBJ_FLAG_SCROLLABLE),
+    LROT_INTENTRY(OBJ_FLAG_CLICKABLE, LV_OBJ_FLAG_CLICKABLE),
 
     // Symbols (as strings)
-    lua_pushstring(L, LV_SYMBOL_WIFI);
-    lua_setfield(L, -2, "SYMBOL_WIFI");
-    lua_pushstring(L, LV_SYMBOL_OK);
-    lua_setfield(L, -2, "SYMBOL_OK");
-    lua_pushstring(L, LV_SYMBOL_CLOSE);
-    lua_setfield(L, -2, "SYMBOL_CLOSE");
+    LROT_STRENTRY(SYMBOL_WIFI, LV_SYMBOL_WIFI),
+    LROT_STRENTRY(SYMBOL_OK, LV_SYMBOL_OK),
+    LROT_STRENTRY(SYMBOL_CLOSE, LV_SYMBOL_CLOSE),
+
+    LROT_END
+};
+
+// With a Lua task every binding is called through lvgl_marshal(), which runs
+// the binding (upvalue 1) on the GUI task, the only task touching LVGL
+static int lvgl_marshal(lua_State* L) {
+    return lua_vm_task_ui_call(L, lua_tocfunction(L, lua_upvalueindex(1)));
+}
+
+static void push_marshalled(lua_State* L, lua_CFunction fn) {
+    lua_pushcfunction(L, fn);
+    lua_pushcclosure(L, lvgl_marshal, 1);
+}
+
+#if CONFIG_LUA_READONLY_LIBS
+static int lvgl_readonly(lua_State* L) {
+    return luaL_error(L, "attempt to modify a read-only table");
+}
+#endif
+
+// Library table of marshalled functions, as writable as the direct-mode one
+static void push_marshalled_map(lua_State* L) {
+#if CONFIG_LUA_READONLY_LIBS
+    // Constants still come from the map; writes fail as they do on the map
+    lua_newtable(L);
+    for (const luaR_entry* entry = lvgl_map; entry->key != NULL; entry++) {
+        if (entry->tt == LUAR_TFUNC) {
+            push_marshalled(L, entry->v.f);
+            lua_setfield(L, -2, entry->key);
+        }
+    }
+    lua_newtable(L);
+    lua_pushrotable(L, lvgl_map);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, lvgl_readonly);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushboolean(L, 0);
+    lua_setfield(L, -2, "__metatable");
+    lua_setmetatable(L, -2);
+#else
+    lua_pushlibmap(L, lvgl_map);
+    for (const luaR_entry* entry = lvgl_map; entry->key != NULL; entry++) {
+        if (entry->tt == LUAR_TFUNC) {
+            push_marshalled(L, entry->v.f);
+            lua_setfield(L, -2, entry->key);
+        }
+    }
+#endif
 }
 
 int luaopen_lvgl(lua_State* L) {
     ESP_LOGI(TAG, "Registering LVGL bindings...");
 
-    // Create the main lvgl library table and register functions
-    luaL_newlib(L, lvgl_functions);
-    int lib_idx = lua_gettop(L);
+    s_lv_layout_flex = LV_LAYOUT_FLEX;
+    s_lv_layout_grid = LV_LAYOUT_GRID;
 
     // Create the metatable for LVGL objects
     luaL_newmetatable(L, LVGL_OBJ_METATABLE);
-    int meta_idx = lua_gettop(L);
 
     // Define metatable methods locally to avoid static analysis issues.
     const luaL_Reg obj_methods[] = {
@@ -1373,23 +1529,33 @@ int luaopen_lvgl(lua_State* L) {
         {NULL, NULL}
     };
 
-    // Set __index = lvgl_table
-    // This makes obj:method() work by looking up methods in the main lvgl table
-    lua_pushvalue(L, lib_idx);
-    lua_setfield(L, meta_idx, "__index");
+    if (lua_vm_task_active()) {
+        push_marshalled_map(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, "__index");
+        for (const luaL_Reg* method = obj_methods; method->name != NULL; method++) {
+            push_marshalled(L, method->func);
+            lua_setfield(L, -3, method->name);
+        }
+        lua_remove(L, -2); // Metatable
+        ESP_LOGI(TAG, "LVGL bindings registered for the Lua task");
+        return 1;
+    }
+
+    // Set __index = the lvgl table
+    // This makes obj:method() work by looking up methods in the main lvgl table,
+    // including functions a script adds to it
+    lua_pushlibmap(L, lvgl_map);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, "__index");
+    lua_insert(L, -2);
 
     // Register the __gc and __tostring methods to the metatable
     luaL_setfuncs(L, obj_methods, 0);
 
     lua_pop(L, 1); // Pop the metatable
 
-    // Register all constants into the main lvgl library table
-    lua_pushvalue(L, lib_idx); // Push library table to top
-    register_lvgl_constants(L);
-    lua_pop(L, 1); // Pop library table
-
     ESP_LOGI(TAG, "LVGL bindings registered successfully");
-    
-    // Return the main library table, which is already on the stack
+
     return 1;
 }
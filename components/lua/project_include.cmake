@@ -0,0 +1,55 @@
+# Included by the project before any component is processed, so other
+# components can precompile their embedded Lua scripts.
+
+set(LUA_COMPONENT_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+# lua_embed_bytecode(<script.lua>)
+#
+# Compiles <script.lua> (relative to the calling component) to stripped
+# bytecode at build time and embeds it in the calling component. For
+# oobe_lua.lua the blob is _binary_oobe_lua_luac_start/_end; load it with
+# lua_engine_exec_bytecode().
+#
+# The compiler is the component's own src/luac.c, built for the host with
+# the firmware's number model: the firmware builds with LUA_USE_C89, so
+# lua_Integer is a C 'long', 32 bits on this target. luac_embed.cmake
+# fails the build if the bytecode would not load on the device.
+function(lua_embed_bytecode script)
+    idf_build_get_property(build_dir BUILD_DIR)
+    set(luac ${build_dir}/lua_host/luac)
+
+    # The target's 'long' is as wide as its pointers
+    set(int_size ${CMAKE_SIZEOF_VOID_P})
+
+    if(NOT TARGET lua_host_luac)
+        find_program(LUA_HOST_CC NAMES cc gcc clang REQUIRED)
+        file(GLOB luac_srcs ${LUA_COMPONENT_DIR}/src/*.c)
+        list(FILTER luac_srcs EXCLUDE REGEX "/lua\\.c$")
+        set(luac_defs -DLUA_USE_C89 -DLUA_COMPAT_5_3)
+        if(int_size EQUAL 4)
+            list(APPEND luac_defs -DLUA_USE_INT32)
+        endif()
+
+        add_custom_command(OUTPUT ${luac}
+            COMMAND ${CMAKE_COMMAND} -E make_directory ${build_dir}/lua_host
+            COMMAND ${LUA_HOST_CC} -std=gnu99 -O2 ${luac_defs} -o ${luac} ${luac_srcs} -lm
+            DEPENDS ${luac_srcs} ${LUA_COMPONENT_DIR}/src/luaconf.h
+            COMMENT "Building host luac"
+            VERBATIM)
+        add_custom_target(lua_host_luac DEPENDS ${luac})
+    endif()
+
+    get_filename_component(source ${script} ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
+    get_filename_component(name ${script} NAME_WE)
+    set(blob ${CMAKE_CURRENT_BINARY_DIR}/${name}.luac)
+
+    add_custom_command(OUTPUT ${blob}
+        COMMAND ${CMAKE_COMMAND} -DLUAC=${luac} -DSOURCE=${source} -DOUTPUT=${blob}
+                -DLUA_H=${LUA_COMPONENT_DIR}/src/lua.h -DINT_SIZE=${int_size}
+                -P ${LUA_COMPONENT_DIR}/luac_embed.cmake
+        DEPENDS ${source} lua_host_luac ${LUA_COMPONENT_DIR}/luac_embed.cmake
+        COMMENT "Precompiling ${script}"
+        VERBATIM)
+
+    target_add_binary_data(${COMPONENT_LIB} ${blob} BINARY DEPENDS ${blob})
+endfunction()
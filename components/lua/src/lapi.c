@@ -23,6 +23,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lrotable.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -465,6 +466,12 @@ LUA_API lua_State *lua_tothread (lua_State *L, int idx) {
 }
 
 
+LUA_API const luaR_entry *lua_torotable (lua_State *L, int idx) {
+  const TValue *o = index2value(L, idx);
+  return (!ttisrotable(o)) ? NULL : rtvalue(o);
+}
+
+
 /*
 ** Returns a pointer to the internal representation of an object.
 ** Note that ANSI C does not allow the conversion of a pointer to
@@ -478,6 +485,7 @@ LUA_API const void *lua_topointer (lua_State *L, int idx) {
     case LUA_VLCF: return cast_voidp(cast_sizet(fvalue(o)));
     case LUA_VUSERDATA: case LUA_VLIGHTUSERDATA:
       return touserdata(o);
+    case LUA_VROTABLE: return rtvalue(o);
     default: {
       if (iscollectable(o))
         return gcvalue(o);
@@ -621,6 +629,14 @@ LUA_API void lua_pushlightuserdata (lua_State *L, void *p) {
 }
 
 
+LUA_API void lua_pushrotable (lua_State *L, const luaR_entry *t) {
+  lua_lock(L);
+  setrtvalue(s2v(L->top.p), t);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_pushthread (lua_State *L) {
   lua_lock(L);
   setthvalue(L, s2v(L->top.p), L);
@@ -729,11 +745,30 @@ static Table *gettable (lua_State *L, int idx) {
 }
 
 
+/*
+** A read-only table has no metamethods, so its raw reads are plain
+** lookups; it has only string keys, so 'lua_rawgeti' and 'lua_rawgetp'
+** on it always give nil.
+*/
+static int rotableget (lua_State *L, const TValue *t, const TValue *key) {
+  if (key != NULL)
+    luaR_get(L, rtvalue(t), key, s2v(L->top.p - 1));
+  else {
+    setnilvalue(s2v(L->top.p));
+    api_incr_top(L);
+  }
+  lua_unlock(L);
+  return ttype(s2v(L->top.p - 1));
+}
+
+
 LUA_API int lua_rawget (lua_State *L, int idx) {
   Table *t;
   const TValue *val;
   lua_lock(L);
   api_checknelems(L, 1);
+  if (ttisrotable(index2value(L, idx)))  /* replace key with the value */
+    return rotableget(L, index2value(L, idx), s2v(L->top.p - 1));
   t = gettable(L, idx);
   val = luaH_get(t, s2v(L->top.p - 1));
   L->top.p--;  /* remove key */
@@ -744,6 +779,8 @@ LUA_API int lua_rawget (lua_State *L, int idx) {
 LUA_API int lua_rawgeti (lua_State *L, int idx, lua_Integer n) {
   Table *t;
   lua_lock(L);
+  if (ttisrotable(index2value(L, idx)))
+    return rotableget(L, index2value(L, idx), NULL);
   t = gettable(L, idx);
   return finishrawget(L, luaH_getint(t, n));
 }
@@ -753,6 +790,8 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
   Table *t;
   TValue k;
   lua_lock(L);
+  if (ttisrotable(index2value(L, idx)))
+    return rotableget(L, index2value(L, idx), NULL);
   t = gettable(L, idx);
   setpvalue(&k, cast_voidp(p));
   return finishrawget(L, luaH_get(t, &k));
@@ -779,8 +818,8 @@ LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   lua_lock(L);
   obj = index2value(L, objindex);
   switch (ttype(obj)) {
-    case LUA_TTABLE:
-      mt = hvalue(obj)->metatable;
+    case LUA_TTABLE:  /* a read-only table has no metatable */
+      mt = ttistable(obj) ? hvalue(obj)->metatable : NULL;
       break;
     case LUA_TUSERDATA:
       mt = uvalue(obj)->metatable;
@@ -897,6 +936,8 @@ static void aux_rawset (lua_State *L, int idx, TValue *key, int n) {
   Table *t;
   lua_lock(L);
   api_checknelems(L, n);
+  if (l_unlikely(ttisrotable(index2value(L, idx))))
+    luaR_readonly(L);
   t = gettable(L, idx);
   luaH_set(L, t, key, s2v(L->top.p - 1));
   invalidateTMcache(t);
@@ -922,6 +963,8 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   Table *t;
   lua_lock(L);
   api_checknelems(L, 1);
+  if (l_unlikely(ttisrotable(index2value(L, idx))))
+    luaR_readonly(L);
   t = gettable(L, idx);
   luaH_setint(L, t, n, s2v(L->top.p - 1));
   luaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
@@ -944,6 +987,8 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      if (l_unlikely(ttisrotable(obj)))
+        luaR_readonly(L);
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1084,14 +1129,15 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname, const char *mode) {
+static int loadchunk (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode, int inplace) {
   ZIO z;
   int status;
   lua_lock(L);
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
+  luai_loadbegin(L);
+  status = luaD_protectedparser(L, &z, chunkname, mode, inplace);
   if (status == LUA_OK) {  /* no errors? */
     LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
@@ -1103,10 +1149,47 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
     }
   }
   lua_unlock(L);
+  luai_loadend(L, status);
   return status;
 }
 
 
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode) {
+  return loadchunk(L, reader, data, chunkname, mode, 0);
+}
+
+
+typedef struct InPlace {
+  const char *buff;
+  size_t size;
+} InPlace;
+
+
+static const char *getinplace (lua_State *L, void *ud, size_t *size) {
+  InPlace *ip = (InPlace *)ud;
+  (void)L;  /* not used */
+  if (ip->size == 0) return NULL;
+  *size = ip->size;
+  ip->size = 0;
+  return ip->buff;
+}
+
+
+/*
+** Load a binary chunk whose code and line information stay in 'buff'
+** (execute in place). Not reachable from Lua: 'buff' must outlive every
+** function loaded from it, which only C code can promise.
+*/
+LUA_API int lua_loadinplace (lua_State *L, const char *buff, size_t size,
+                             const char *chunkname) {
+  InPlace ip;
+  ip.buff = buff;
+  ip.size = size;
+  return loadchunk(L, getinplace, &ip, chunkname, "b", 1);
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
@@ -1255,8 +1338,12 @@ LUA_API int lua_next (lua_State *L, int idx) {
   int more;
   lua_lock(L);
   api_checknelems(L, 1);
-  t = gettable(L, idx);
-  more = luaH_next(L, t, L->top.p - 1);
+  if (ttisrotable(index2value(L, idx)))
+    more = luaR_next(L, rtvalue(index2value(L, idx)), L->top.p - 1);
+  else {
+    t = gettable(L, idx);
+    more = luaH_next(L, t, L->top.p - 1);
+  }
   if (more) {
     api_incr_top(L);
   }
@@ -337,11 +337,23 @@ static int load_aux (lua_State *L, int status, int envidx) {
 }
 
 
+/*
+** Loading in place (lua_loadinplace) was once asked for with an 'x' in
+** the mode; refuse it rather than let a script think it got it
+*/
+static void checkloadmode (lua_State *L, const char *mode, int arg) {
+  luaL_argcheck(L, mode == NULL || strchr(mode, 'x') == NULL, arg,
+                "mode 'x' is not available to Lua code");
+}
+
+
 static int luaB_loadfile (lua_State *L) {
   const char *fname = luaL_optstring(L, 1, NULL);
   const char *mode = luaL_optstring(L, 2, NULL);
   int env = (!lua_isnone(L, 3) ? 3 : 0);  /* 'env' index or 0 if no 'env' */
-  int status = luaL_loadfilex(L, fname, mode);
+  int status;
+  checkloadmode(L, mode, 2);
+  status = luaL_loadfilex(L, fname, mode);
   return load_aux(L, status, env);
 }
 
@@ -390,6 +402,7 @@ static int luaB_load (lua_State *L) {
   const char *s = lua_tolstring(L, 1, &l);
   const char *mode = luaL_optstring(L, 3, "bt");
   int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
+  checkloadmode(L, mode, 3);
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = luaL_optstring(L, 2, s);
     status = luaL_loadbufferx(L, s, l, chunkname, mode);
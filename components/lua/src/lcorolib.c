@@ -16,6 +16,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 static lua_State *getco (lua_State *L) {
@@ -189,22 +190,22 @@ static int luaB_close (lua_State *L) {
 }
 
 
-static const luaL_Reg co_funcs[] = {
-  {"create", luaB_cocreate},
-  {"resume", luaB_coresume},
-  {"running", luaB_corunning},
-  {"status", luaB_costatus},
-  {"wrap", luaB_cowrap},
-  {"yield", luaB_yield},
-  {"isyieldable", luaB_yieldable},
-  {"close", luaB_close},
-  {NULL, NULL}
+static const luaR_entry co_funcs[] = {
+  LROT_FUNCENTRY(create, luaB_cocreate),
+  LROT_FUNCENTRY(resume, luaB_coresume),
+  LROT_FUNCENTRY(running, luaB_corunning),
+  LROT_FUNCENTRY(status, luaB_costatus),
+  LROT_FUNCENTRY(wrap, luaB_cowrap),
+  LROT_FUNCENTRY(yield, luaB_yield),
+  LROT_FUNCENTRY(isyieldable, luaB_yieldable),
+  LROT_FUNCENTRY(close, luaB_close),
+  LROT_END
 };
 
 
 
 LUAMOD_API int luaopen_coroutine (lua_State *L) {
-  luaL_newlib(L, co_funcs);
+  lua_pushlibmap(L, co_funcs);
   return 1;
 }
 
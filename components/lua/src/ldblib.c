@@ -18,6 +18,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 /*
@@ -454,30 +455,30 @@ static int db_setcstacklimit (lua_State *L) {
 }
 
 
-static const luaL_Reg dblib[] = {
-  {"debug", db_debug},
-  {"getuservalue", db_getuservalue},
-  {"gethook", db_gethook},
-  {"getinfo", db_getinfo},
-  {"getlocal", db_getlocal},
-  {"getregistry", db_getregistry},
-  {"getmetatable", db_getmetatable},
-  {"getupvalue", db_getupvalue},
-  {"upvaluejoin", db_upvaluejoin},
-  {"upvalueid", db_upvalueid},
-  {"setuservalue", db_setuservalue},
-  {"sethook", db_sethook},
-  {"setlocal", db_setlocal},
-  {"setmetatable", db_setmetatable},
-  {"setupvalue", db_setupvalue},
-  {"traceback", db_traceback},
-  {"setcstacklimit", db_setcstacklimit},
-  {NULL, NULL}
+static const luaR_entry dblib[] = {
+  LROT_FUNCENTRY(debug, db_debug),
+  LROT_FUNCENTRY(getuservalue, db_getuservalue),
+  LROT_FUNCENTRY(gethook, db_gethook),
+  LROT_FUNCENTRY(getinfo, db_getinfo),
+  LROT_FUNCENTRY(getlocal, db_getlocal),
+  LROT_FUNCENTRY(getregistry, db_getregistry),
+  LROT_FUNCENTRY(getmetatable, db_getmetatable),
+  LROT_FUNCENTRY(getupvalue, db_getupvalue),
+  LROT_FUNCENTRY(upvaluejoin, db_upvaluejoin),
+  LROT_FUNCENTRY(upvalueid, db_upvalueid),
+  LROT_FUNCENTRY(setuservalue, db_setuservalue),
+  LROT_FUNCENTRY(sethook, db_sethook),
+  LROT_FUNCENTRY(setlocal, db_setlocal),
+  LROT_FUNCENTRY(setmetatable, db_setmetatable),
+  LROT_FUNCENTRY(setupvalue, db_setupvalue),
+  LROT_FUNCENTRY(traceback, db_traceback),
+  LROT_FUNCENTRY(setcstacklimit, db_setcstacklimit),
+  LROT_END
 };
 
 
 LUAMOD_API int luaopen_debug (lua_State *L) {
-  luaL_newlib(L, dblib);
+  lua_pushlibmap(L, dblib);
   return 1;
 }
 
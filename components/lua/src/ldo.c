@@ -973,6 +973,7 @@ struct SParser {  /* data to 'f_parser' */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  int inplace;  /* the chunk outlives its functions, execute it in place */
 };
 
 
@@ -991,7 +992,7 @@ static void f_parser (lua_State *L, void *ud) {
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    cl = luaU_undump(L, p->z, p->name, p->inplace);
   }
   else {
     checkmode(L, p->mode, "text");
@@ -1003,11 +1004,11 @@ static void f_parser (lua_State *L, void *ud) {
 
 
 int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
-                                        const char *mode) {
+                                        const char *mode, int inplace) {
   struct SParser p;
   int status;
   incnny(L);  /* cannot yield during parsing */
-  p.z = z; p.name = name; p.mode = mode;
+  p.z = z; p.name = name; p.mode = mode; p.inplace = inplace;
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
@@ -26,6 +26,8 @@ typedef struct {
   void *data;
   int strip;
   int status;
+  int aligned;  /* LUAC_FORMAT_ALIGNED? */
+  size_t offset;  /* bytes written so far */
 } DumpState;
 
 
@@ -43,10 +45,21 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+    D->offset += size;
   }
 }
 
 
+/*
+** Pad with zeros up to a multiple of 'align' from the start of the chunk
+*/
+static void dumpAlign (DumpState *D, size_t align) {
+  static const lu_byte zeros[sizeof(Instruction)] = {0};
+  lua_assert(align <= sizeof(zeros));
+  dumpBlock(D, zeros, (align - D->offset % align) % align);
+}
+
+
 #define dumpVar(D,x)		dumpVector(D,&x,1)
 
 
@@ -103,6 +116,8 @@ static void dumpString (DumpState *D, const TString *s) {
 
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+  if (D->aligned)
+    dumpAlign(D, sizeof(Instruction));
   dumpVector(D, f->code, f->sizecode);
 }
 
@@ -201,7 +216,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 static void dumpHeader (DumpState *D) {
   dumpLiteral(D, LUA_SIGNATURE);
   dumpByte(D, LUAC_VERSION);
-  dumpByte(D, LUAC_FORMAT);
+  dumpByte(D, D->aligned ? LUAC_FORMAT_ALIGNED : LUAC_FORMAT);
   dumpLiteral(D, LUAC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(lua_Integer));
@@ -214,17 +229,34 @@ static void dumpHeader (DumpState *D) {
 /*
 ** dump Lua function as precompiled chunk
 */
-int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+static int dump (lua_State *L, const Proto *f, lua_Writer w, void *data,
+                 int strip, int aligned) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
   D.status = 0;
+  D.aligned = aligned;
+  D.offset = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
   return D.status;
 }
 
+
+int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
+              int strip) {
+  return dump(L, f, w, data, strip, 0);
+}
+
+
+/*
+** dump in LUAC_FORMAT_ALIGNED, for images executed in place
+*/
+int luaU_dumpaligned(lua_State *L, const Proto *f, lua_Writer w, void *data,
+                     int strip) {
+  return dump(L, f, w, data, strip, 1);
+}
+
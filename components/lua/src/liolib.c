@@ -199,7 +199,8 @@ static FILE *tofile (lua_State *L) {
 ** handle is in a consistent state.
 */
 static LStream *newprefile (lua_State *L) {
-  LStream *p = (LStream *)lua_newuserdatauv(L, sizeof(LStream), 0);
+  /* user value: name of a file opened for writing (see 'checkchanged') */
+  LStream *p = (LStream *)lua_newuserdatauv(L, sizeof(LStream), 1);
   p->closef = NULL;  /* mark file handle as 'closed' */
   luaL_setmetatable(L, LUA_FILEHANDLE);
   return p;
@@ -258,11 +259,40 @@ static LStream *newfile (lua_State *L) {
 }
 
 
+/*
+** function to close a file opened for writing: its contents are final
+*/
+static int io_wclose (lua_State *L) {
+  LStream *p = tolstream(L);
+  int res = fclose(p->f);
+  lua_getiuservalue(L, 1, 1);
+  luai_filechanged(lua_tostring(L, -1));
+  lua_pop(L, 1);
+  return luaL_fileresult(L, (res == 0), NULL);
+}
+
+
+/*
+** A file opened for writing may have just been created or truncated;
+** it is reported again when closed. 'p' is on the top of the stack.
+*/
+static void checkchanged (lua_State *L, LStream *p, const char *fname,
+                                                   const char *mode) {
+  if (mode[0] != 'r' || strchr(mode, '+') != NULL) {
+    lua_pushstring(L, fname);
+    lua_setiuservalue(L, -2, 1);
+    p->closef = &io_wclose;
+    luai_filechanged(fname);
+  }
+}
+
+
 static void opencheck (lua_State *L, const char *fname, const char *mode) {
   LStream *p = newfile(L);
   p->f = fopen(fname, mode);
   if (l_unlikely(p->f == NULL))
     luaL_error(L, "cannot open file '%s' (%s)", fname, strerror(errno));
+  checkchanged(L, p, fname, mode);
 }
 
 
@@ -273,7 +303,10 @@ static int io_open (lua_State *L) {
   const char *md = mode;  /* to traverse/check mode */
   luaL_argcheck(L, l_checkmode(md), 2, "invalid mode");
   p->f = fopen(filename, mode);
-  return (p->f == NULL) ? luaL_fileresult(L, 0, filename) : 1;
+  if (p->f == NULL)
+    return luaL_fileresult(L, 0, filename);
+  checkchanged(L, p, filename, mode);
+  return 1;
 }
 
 
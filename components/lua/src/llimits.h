@@ -303,6 +303,21 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** these macros bracket the compilation (or undump) of a chunk in
+** 'lua_load', so an embedder can scope transient allocations to it.
+** 'luai_loadend' runs with the new function on the top of the stack
+** when 'status' is LUA_OK.
+*/
+#if !defined(luai_loadbegin)
+#define luai_loadbegin(L)		((void)L)
+#endif
+
+#if !defined(luai_loadend)
+#define luai_loadend(L,status)		((void)L)
+#endif
+
+
 
 /*
 ** The luai_num* macros define the primitive operations over numbers.
@@ -189,6 +189,27 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
 }
 
 
+/*
+** Like 'luaM_realloc_', but a fresh block is allocated with the given
+** tag, so that the allocator knows what it is for.
+*/
+void *luaM_realloctagged_ (lua_State *L, void *block, size_t osize,
+                                        size_t nsize, int tag) {
+  if (block == NULL && nsize > 0) {
+    global_State *g = G(L);
+    void *newblock = firsttry(g, NULL, tag, nsize);
+    if (l_unlikely(newblock == NULL)) {
+      newblock = tryagain(L, NULL, tag, nsize);
+      if (newblock == NULL)
+        return NULL;  /* do not update 'GCdebt' */
+    }
+    g->GCdebt += nsize;
+    return newblock;
+  }
+  return luaM_realloc_(L, block, osize, nsize);
+}
+
+
 void *luaM_saferealloc_ (lua_State *L, void *block, size_t osize,
                                                     size_t nsize) {
   void *newblock = luaM_realloc_(L, block, osize, nsize);
@@ -63,6 +63,24 @@
 
 #define luaM_newobject(L,tag,s)	luaM_malloc_(L, (s), tag)
 
+/*
+** Tags passed to the allocator (in 'osize', with a NULL block) for internal
+** blocks that are not objects, so that it can attribute them. They never
+** collide with object tags, which always fit in 6 bits.
+*/
+#define LUAM_TAG_STACK		0x40  /* thread stacks */
+#define LUAM_TAG_CALLINFO	0x41  /* CallInfo records */
+#define LUAM_TAG_ARRAY		0x42  /* table array parts */
+#define LUAM_TAG_HASH		0x43  /* table hash parts */
+#define LUAM_TAG_STRTAB		0x44  /* string table buckets */
+
+#define luaM_newtagged(L,t,tag)	cast(t*, luaM_malloc_(L, sizeof(t), tag))
+#define luaM_newvectortagged(L,n,t,tag) \
+	cast(t*, luaM_malloc_(L, (n)*sizeof(t), tag))
+#define luaM_reallocvectortagged(L,v,oldn,n,t,tag) \
+   (cast(t *, luaM_realloctagged_(L, v, cast_sizet(oldn) * sizeof(t), \
+                                        cast_sizet(n) * sizeof(t), tag)))
+
 #define luaM_growvector(L,v,nelems,size,t,limit,e) \
 	((v)=cast(t *, luaM_growaux_(L,v,nelems,&(size),sizeof(t), \
                          luaM_limitN(limit,t),e)))
@@ -88,6 +106,8 @@ LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int nelems,
 LUAI_FUNC void *luaM_shrinkvector_ (lua_State *L, void *block, int *nelem,
                                     int final_n, int size_elem);
 LUAI_FUNC void *luaM_malloc_ (lua_State *L, size_t size, int tag);
+LUAI_FUNC void *luaM_realloctagged_ (lua_State *L, void *block, size_t oldsize,
+                                     size_t size, int tag);
 
 #endif
 
@@ -554,6 +554,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte inimage;  /* arrays owned by a loaded image, not the heap (PF_*) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -574,6 +575,14 @@ typedef struct Proto {
   GCObject *gclist;
 } Proto;
 
+
+/*
+** Bits in 'inimage': the array points into the chunk it was undumped
+** from (execute-in-place, see 'luaU_undump') and must not be freed
+*/
+#define PF_CODEINIMAGE		1
+#define PF_LINEINFOINIMAGE	2
+
 /* }================================================================== */
 
 
@@ -690,6 +699,19 @@ typedef union Closure {
 
 #define sethvalue2s(L,o,h)	sethvalue(L,s2v(o),h)
 
+/*
+** Read-only tables (lrotable.h) are constant arrays outside the Lua
+** heap: a non-collectable variant of tables, never marked or freed.
+*/
+#define LUA_VROTABLE	makevariant(LUA_TTABLE, 1)
+
+#define ttisrotable(o)		checktag((o), LUA_VROTABLE)
+
+#define rtvalue(o)	check_exp(ttisrotable(o), (const struct luaR_entry *)val_(o).p)
+
+#define setrtvalue(obj,x) \
+  { TValue *io=(obj); val_(io).p=cast_voidp(x); settt_(io, LUA_VROTABLE); }
+
 
 /*
 ** Nodes for Hash tables: A pack of two TValue's (key-value pairs)
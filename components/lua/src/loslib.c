@@ -20,6 +20,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 /*
@@ -155,14 +156,22 @@ static int os_execute (lua_State *L) {
 
 static int os_remove (lua_State *L) {
   const char *filename = luaL_checkstring(L, 1);
-  return luaL_fileresult(L, remove(filename) == 0, filename);
+  int stat = (remove(filename) == 0);
+  if (stat)
+    luai_filechanged(filename);
+  return luaL_fileresult(L, stat, filename);
 }
 
 
 static int os_rename (lua_State *L) {
   const char *fromname = luaL_checkstring(L, 1);
   const char *toname = luaL_checkstring(L, 2);
-  return luaL_fileresult(L, rename(fromname, toname) == 0, NULL);
+  int stat = (rename(fromname, toname) == 0);
+  if (stat) {
+    luai_filechanged(fromname);
+    luai_filechanged(toname);
+  }
+  return luaL_fileresult(L, stat, NULL);
 }
 
 
@@ -402,19 +411,19 @@ static int os_exit (lua_State *L) {
 }
 
 
-static const luaL_Reg syslib[] = {
-  {"clock",     os_clock},
-  {"date",      os_date},
-  {"difftime",  os_difftime},
-  {"execute",   os_execute},
-  {"exit",      os_exit},
-  {"getenv",    os_getenv},
-  {"remove",    os_remove},
-  {"rename",    os_rename},
-  {"setlocale", os_setlocale},
-  {"time",      os_time},
-  {"tmpname",   os_tmpname},
-  {NULL, NULL}
+static const luaR_entry syslib[] = {
+  LROT_FUNCENTRY(clock, os_clock),
+  LROT_FUNCENTRY(date, os_date),
+  LROT_FUNCENTRY(difftime, os_difftime),
+  LROT_FUNCENTRY(execute, os_execute),
+  LROT_FUNCENTRY(exit, os_exit),
+  LROT_FUNCENTRY(getenv, os_getenv),
+  LROT_FUNCENTRY(remove, os_remove),
+  LROT_FUNCENTRY(rename, os_rename),
+  LROT_FUNCENTRY(setlocale, os_setlocale),
+  LROT_FUNCENTRY(time, os_time),
+  LROT_FUNCENTRY(tmpname, os_tmpname),
+  LROT_END
 };
 
 /* }====================================================== */
@@ -422,7 +431,7 @@ static const luaL_Reg syslib[] = {
 
 
 LUAMOD_API int luaopen_os (lua_State *L) {
-  luaL_newlib(L, syslib);
+  lua_pushlibmap(L, syslib);
   return 1;
 }
 
@@ -0,0 +1,134 @@
+/*
+** $Id: lrotable.c $
+** Read-only tables stored in ROM
+** See Copyright Notice in lua.h
+*/
+
+#define lrotable_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lobject.h"
+#include "lrotable.h"
+#include "lstate.h"
+#include "lstring.h"
+
+
+/*
+** Find the entry of 't' with string key 'key', or NULL. Lookups with
+** short strings are cached by the string's hash; 'luaS_remove' drops
+** a string's line when the string is collected, so a hit needs no
+** comparison.
+*/
+static const luaR_entry *findentry (lua_State *L, const luaR_entry *t,
+                                                  const TValue *key) {
+  luaR_cacheline *c = NULL;
+  const luaR_entry *e;
+  const TString *ts;
+  const char *s;
+  size_t l;
+  if (ttisshrstring(key)) {
+    ts = tsvalue(key);
+    c = &G(L)->rotcache[lmod(ts->hash, LUAR_CACHESIZE)];
+    if (c->t == t && c->key == ts)
+      return c->e;
+  }
+  else if (!ttislngstring(key))
+    return NULL;  /* only string keys */
+  ts = tsvalue(key);
+  s = getstr(ts);
+  l = tsslen(ts);
+  for (e = t; e->key != NULL; e++) {
+    if (e->keylen == l && memcmp(e->key, s, l) == 0) {
+      if (c != NULL) {
+        c->t = t;
+        c->key = ts;
+        c->e = e;
+      }
+      return e;
+    }
+  }
+  return NULL;
+}
+
+
+static void setentryvalue (lua_State *L, TValue *res, const luaR_entry *e) {
+  switch (e->tt) {
+    case LUAR_TFUNC: setfvalue(res, e->v.f); break;
+    case LUAR_TINT: setivalue(res, e->v.i); break;
+    case LUAR_TNUM: setfltvalue(res, e->v.n); break;
+    case LUAR_TSTR: setsvalue(L, res, luaS_newlstr(L, e->v.s, e->slen)); break;
+    case LUAR_TTABLE: setrtvalue(res, e->v.t); break;
+    case LUAR_TINTREF: setivalue(res, *e->v.ip); break;
+    default: lua_assert(0);
+  }
+}
+
+
+void luaR_get (lua_State *L, const luaR_entry *t, const TValue *key,
+                                                  TValue *res) {
+  const luaR_entry *e = findentry(L, t, key);
+  if (e == NULL)
+    setnilvalue(res);
+  else
+    setentryvalue(L, res, e);
+}
+
+
+/*
+** Same protocol as 'luaH_next': entries are traversed in array order.
+*/
+int luaR_next (lua_State *L, const luaR_entry *t, StkId key) {
+  const luaR_entry *e;
+  if (ttisnil(s2v(key)))
+    e = t;
+  else {
+    e = findentry(L, t, s2v(key));
+    if (l_unlikely(e == NULL))
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    e++;
+  }
+  if (e->key == NULL)
+    return 0;  /* no more elements */
+  setsvalue2s(L, key, luaS_newlstr(L, e->key, e->keylen));
+  setentryvalue(L, s2v(key + 1), e);
+  return 1;
+}
+
+
+l_noret luaR_readonly (lua_State *L) {
+  luaG_runerror(L, "attempt to modify a read-only table");
+}
+
+
+
+LUA_API void lua_pushlibmap (lua_State *L, const luaR_entry *t) {
+#if defined(LUA_READONLY_LIBS)
+  lua_pushrotable(L, t);
+#else
+  const luaR_entry *e;
+  int n = 0;
+  for (e = t; e->key != NULL; e++)
+    n++;
+  lua_createtable(L, 0, n);
+  for (e = t; e->key != NULL; e++) {
+    switch (e->tt) {
+      case LUAR_TFUNC: lua_pushcfunction(L, e->v.f); break;
+      case LUAR_TINT: lua_pushinteger(L, e->v.i); break;
+      case LUAR_TNUM: lua_pushnumber(L, e->v.n); break;
+      case LUAR_TSTR: lua_pushlstring(L, e->v.s, e->slen); break;
+      case LUAR_TTABLE: lua_pushlibmap(L, e->v.t); break;
+      case LUAR_TINTREF: lua_pushinteger(L, *e->v.ip); break;
+      default: lua_assert(0); lua_pushnil(L);
+    }
+    lua_setfield(L, -2, e->key);
+  }
+#endif
+}
@@ -0,0 +1,89 @@
+/*
+** $Id: lrotable.h $
+** Read-only tables stored in ROM
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lrotable_h
+#define lrotable_h
+
+#include "lua.h"
+
+
+/*
+** A read-only table ("rotable") is a constant array of entries ending
+** with LROT_END, so a library's function list and constants can live in
+** .rodata instead of the Lua heap:
+**
+**   static const luaR_entry mylib[] = {
+**     LROT_FUNCENTRY(open, mylib_open),
+**     LROT_INTENTRY(MODE_FAST, 2),
+**     LROT_STRENTRY(VERSION, "1.0"),
+**     LROT_END
+**   };
+**   ...
+**   lua_pushrotable(L, mylib);
+**
+** To Lua a rotable is a table with string keys and no metatable.
+** Indexing, 'next'/'pairs', 'rawget' and 'rawequal' work as usual and
+** its length is 0, as for any table without integer keys; any
+** assignment or 'setmetatable' on it is an error. Lookups are linear
+** scans, memoized per (table, key string) in the global state.
+**
+** Libraries push their map with 'lua_pushlibmap' instead. Unless
+** LUA_READONLY_LIBS is defined (see luaconf.h) that builds an ordinary
+** table with the same entries, so scripts can still add to or patch a
+** library; a LROT_INTREFENTRY is read once, when the table is built.
+*/
+
+#define LUAR_TFUNC	0
+#define LUAR_TINT	1
+#define LUAR_TNUM	2
+#define LUAR_TSTR	3
+#define LUAR_TTABLE	4
+#define LUAR_TINTREF	5
+
+typedef struct luaR_entry {
+  const char *key;  /* NULL in the terminating entry */
+  unsigned char keylen;
+  unsigned char tt;  /* LUAR_T* */
+  unsigned short slen;  /* length of a LUAR_TSTR value */
+  union {
+    lua_CFunction f;
+    lua_Integer i;
+    lua_Number n;
+    const char *s;
+    const struct luaR_entry *t;
+    const lua_Integer *ip;
+  } v;
+} luaR_entry;
+
+
+/* 'k' is the key as a bare name; string values must be literals */
+#define LROT_FUNCENTRY(k,fn)	{ #k, sizeof(#k) - 1, LUAR_TFUNC, 0, { .f = (fn) } }
+#define LROT_INTENTRY(k,iv)	{ #k, sizeof(#k) - 1, LUAR_TINT, 0, { .i = (iv) } }
+#define LROT_NUMENTRY(k,nv)	{ #k, sizeof(#k) - 1, LUAR_TNUM, 0, { .n = (nv) } }
+#define LROT_STRENTRY(k,sv)	{ #k, sizeof(#k) - 1, LUAR_TSTR, sizeof(sv) - 1, { .s = (sv) } }
+#define LROT_TABENTRY(k,tv)	{ #k, sizeof(#k) - 1, LUAR_TTABLE, 0, { .t = (tv) } }
+/* integer only known at run time, read from the variable on each access */
+#define LROT_INTREFENTRY(k,pv)	{ #k, sizeof(#k) - 1, LUAR_TINTREF, 0, { .ip = (pv) } }
+#define LROT_END		{ NULL, 0, 0, 0, { NULL } }
+
+
+LUA_API void (lua_pushrotable) (lua_State *L, const luaR_entry *t);
+LUA_API const luaR_entry *(lua_torotable) (lua_State *L, int idx);
+LUA_API void (lua_pushlibmap) (lua_State *L, const luaR_entry *t);
+
+
+#if defined(LUA_CORE)
+
+#include "lobject.h"
+
+LUAI_FUNC void luaR_get (lua_State *L, const luaR_entry *t,
+                                       const TValue *key, TValue *res);
+LUAI_FUNC int luaR_next (lua_State *L, const luaR_entry *t, StkId key);
+LUAI_FUNC l_noret luaR_readonly (lua_State *L);
+
+#endif
+
+#endif
@@ -248,6 +248,20 @@ struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+/*
+** Memoized lookups in read-only tables (lrotable.c): entry 'e' of table
+** 't' matched short string 'key', at line 'key->hash % LUAR_CACHESIZE'.
+** LUAR_CACHESIZE must be a power of 2.
+*/
+#define LUAR_CACHESIZE	64
+
+typedef struct luaR_cacheline {
+  const struct luaR_entry *t;
+  const TString *key;
+  const struct luaR_entry *e;
+} luaR_cacheline;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -298,6 +312,7 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  luaR_cacheline rotcache[LUAR_CACHESIZE];  /* cache for rotable lookups */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
 } global_State;
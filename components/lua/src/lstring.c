@@ -124,7 +124,8 @@ void luaS_init (lua_State *L) {
   global_State *g = G(L);
   int i, j;
   stringtable *tb = &G(L)->strt;
-  tb->hash = luaM_newvector(L, MINSTRTABSIZE, TString*);
+  tb->hash = luaM_newvectortagged(L, MINSTRTABSIZE, TString*,
+                                  LUAM_TAG_STRTAB);
   tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
   tb->size = MINSTRTABSIZE;
   /* pre-create memory-error message */
@@ -164,10 +165,13 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
   TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  luaR_cacheline *c = &G(L)->rotcache[lmod(ts->hash, LUAR_CACHESIZE)];
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
   tb->nuse--;
+  if (c->key == ts)  /* cached as a read-only table key? */
+    c->key = NULL;
 }
 
 
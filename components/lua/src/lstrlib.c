@@ -24,6 +24,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 /*
@@ -1827,25 +1828,25 @@ static int str_unpack (lua_State *L) {
 /* }====================================================== */
 
 
-static const luaL_Reg strlib[] = {
-  {"byte", str_byte},
-  {"char", str_char},
-  {"dump", str_dump},
-  {"find", str_find},
-  {"format", str_format},
-  {"gmatch", gmatch},
-  {"gsub", str_gsub},
-  {"len", str_len},
-  {"lower", str_lower},
-  {"match", str_match},
-  {"rep", str_rep},
-  {"reverse", str_reverse},
-  {"sub", str_sub},
-  {"upper", str_upper},
-  {"pack", str_pack},
-  {"packsize", str_packsize},
-  {"unpack", str_unpack},
-  {NULL, NULL}
+static const luaR_entry strlib[] = {
+  LROT_FUNCENTRY(byte, str_byte),
+  LROT_FUNCENTRY(char, str_char),
+  LROT_FUNCENTRY(dump, str_dump),
+  LROT_FUNCENTRY(find, str_find),
+  LROT_FUNCENTRY(format, str_format),
+  LROT_FUNCENTRY(gmatch, gmatch),
+  LROT_FUNCENTRY(gsub, str_gsub),
+  LROT_FUNCENTRY(len, str_len),
+  LROT_FUNCENTRY(lower, str_lower),
+  LROT_FUNCENTRY(match, str_match),
+  LROT_FUNCENTRY(rep, str_rep),
+  LROT_FUNCENTRY(reverse, str_reverse),
+  LROT_FUNCENTRY(sub, str_sub),
+  LROT_FUNCENTRY(upper, str_upper),
+  LROT_FUNCENTRY(pack, str_pack),
+  LROT_FUNCENTRY(packsize, str_packsize),
+  LROT_FUNCENTRY(unpack, str_unpack),
+  LROT_END
 };
 
 
@@ -1867,7 +1868,7 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  lua_pushlibmap(L, strlib);
   createmetatable(L);
   return 1;
 }
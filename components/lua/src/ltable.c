@@ -178,6 +178,10 @@ static Node *mainpositionTV (const Table *t, const TValue *key) {
       lua_CFunction f = fvalue(key);
       return hashpointer(t, f);
     }
+    case LUA_VROTABLE: {
+      const void *p = rtvalue(key);
+      return hashpointer(t, p);
+    }
     default: {
       GCObject *o = gcvalue(key);
       return hashpointer(t, o);
@@ -228,6 +232,8 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
       return pvalue(k1) == pvalueraw(keyval(n2));
     case LUA_VLCF:
       return fvalue(k1) == fvalueraw(keyval(n2));
+    case LUA_VROTABLE:
+      return rtvalue(k1) == pvalueraw(keyval(n2));
     case ctb(LUA_VLNGSTR):
       return luaS_eqlngstr(tsvalue(k1), keystrval(n2));
     default:
@@ -489,7 +495,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
+    t->node = luaM_newvectortagged(L, size, Node, LUAM_TAG_HASH);
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -570,7 +576,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
     exchangehashpart(t, &newt);  /* and hash (in case of errors) */
   }
   /* allocate new array */
-  newarray = luaM_reallocvector(L, t->array, oldasize, newasize, TValue);
+  newarray = luaM_reallocvectortagged(L, t->array, oldasize, newasize, TValue,
+                                      LUAM_TAG_ARRAY);
   if (l_unlikely(newarray == NULL && newasize > 0)) {  /* allocation failed? */
     freehash(L, &newt);  /* release new hash part */
     luaM_error(L);  /* raise error (with array unchanged) */
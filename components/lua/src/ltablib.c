@@ -18,6 +18,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 /*
@@ -411,20 +412,20 @@ static int sort (lua_State *L) {
 /* }====================================================== */
 
 
-static const luaL_Reg tab_funcs[] = {
-  {"concat", tconcat},
-  {"insert", tinsert},
-  {"pack", tpack},
-  {"unpack", tunpack},
-  {"remove", tremove},
-  {"move", tmove},
-  {"sort", sort},
-  {NULL, NULL}
+static const luaR_entry tab_funcs[] = {
+  LROT_FUNCENTRY(concat, tconcat),
+  LROT_FUNCENTRY(insert, tinsert),
+  LROT_FUNCENTRY(pack, tpack),
+  LROT_FUNCENTRY(unpack, tunpack),
+  LROT_FUNCENTRY(remove, tremove),
+  LROT_FUNCENTRY(move, tmove),
+  LROT_FUNCENTRY(sort, sort),
+  LROT_END
 };
 
 
 LUAMOD_API int luaopen_table (lua_State *L) {
-  luaL_newlib(L, tab_funcs);
+  lua_pushlibmap(L, tab_funcs);
   return 1;
 }
 
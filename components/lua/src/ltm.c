@@ -71,8 +71,8 @@ const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
 const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
   Table *mt;
   switch (ttype(o)) {
-    case LUA_TTABLE:
-      mt = hvalue(o)->metatable;
+    case LUA_TTABLE:  /* a read-only table has no metatable */
+      mt = ttistable(o) ? hvalue(o)->metatable : NULL;
       break;
     case LUA_TUSERDATA:
       mt = uvalue(o)->metatable;
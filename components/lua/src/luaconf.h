@@ -148,6 +148,14 @@
 #endif
 #define LUA_FLOAT_TYPE	LUA_FLOAT_FLOAT
 
+#elif defined(LUA_USE_INT32)	/* }{ */
+/*
+** 32-bit integers and 'double': what LUA_C89_NUMBERS gives on a 32-bit
+** target, for host tools that precompile bytecode for such a target
+*/
+#define LUA_INT_TYPE	LUA_INT_INT
+#define LUA_FLOAT_TYPE	LUA_FLOAT_DOUBLE
+
 #elif LUA_C89_NUMBERS	/* }{ */
 /*
 ** largest types available for C89 ('long' and 'double')
@@ -785,6 +793,50 @@
 ** without modifying the main part of the file.
 */
 
+/*
+@@ LUA_PATCHES lists the changes made to the VM for this port, each with
+** a revision. Bump a patch's revision whenever it changes what the VM
+** loads or executes: caches of compiled chunks are keyed on this string.
+*/
+#define LUA_PATCHES	"alloctag.1 loadarena.1 xip.1 rotable.1"
+
+
+/*
+@@ LUA_READONLY_LIBS makes 'lua_pushlibmap' push a library's map as a
+** read-only table (see lrotable.h) instead of copying it to the heap.
+** Saves the library tables' RAM, but scripts can no longer add
+** functions to 'string', 'table', 'os', etc.
+*/
+/* #define LUA_READONLY_LIBS */
+
+
+/*
+@@ luai_filechanged is called with the name of a file a script created,
+** wrote, renamed or removed through 'io' or 'os'. With LUA_USE_FILE_HOOK
+** it tells the engine (lua_engine.c), whose caches of the SD card's
+** contents would otherwise miss the change.
+*/
+#if defined(LUA_USE_FILE_HOOK)
+void lua_engine_file_changed (const char *path);
+#define luai_filechanged(path)		lua_engine_file_changed(path)
+#else
+#define luai_filechanged(path)		((void)0)
+#endif
+
+
+/*
+@@ LUA_USE_LOAD_ARENA routes the transient allocations made while a chunk
+** is compiled to a bump arena (see lua_psram_alloc.c). The arena is
+** entered and left around every 'lua_load'.
+*/
+#if defined(LUA_USE_LOAD_ARENA)
+struct lua_State;
+void lua_alloc_arena_begin (struct lua_State *L);
+void lua_alloc_arena_end (struct lua_State *L, int status);
+#define luai_loadbegin(L)		lua_alloc_arena_begin(L)
+#define luai_loadend(L,status)		lua_alloc_arena_end(L, status)
+#endif
+
 
 
 
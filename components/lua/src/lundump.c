@@ -34,6 +34,9 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  size_t offset;  /* bytes read so far */
+  int aligned;  /* LUAC_FORMAT_ALIGNED? */
+  int inplace;  /* point into the chunk instead of copying? */
 } LoadState;
 
 
@@ -52,6 +55,7 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  S->offset += size;
 }
 
 
@@ -62,10 +66,29 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  S->offset++;
   return cast_byte(b);
 }
 
 
+/*
+** In-place load: if the next 'size' bytes are in the reader's current
+** block and suitably aligned, return a pointer to them and skip them;
+** otherwise return NULL and let the caller copy. The block must stay
+** unchanged for as long as any function loaded from it is alive.
+*/
+static const void *loadInPlace (LoadState *S, size_t size, size_t align) {
+  const char *p = S->Z->p;
+  if (!S->inplace || size == 0 || S->Z->n < size ||
+      (size_t)p % align != 0)
+    return NULL;
+  S->Z->p += size;
+  S->Z->n -= size;
+  S->offset += size;
+  return p;
+}
+
+
 static size_t loadUnsigned (LoadState *S, size_t limit) {
   size_t x = 0;
   int b;
@@ -143,9 +166,22 @@ static TString *loadString (LoadState *S, Proto *p) {
 
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
-  f->code = luaM_newvectorchecked(S->L, n, Instruction);
-  f->sizecode = n;
-  loadVector(S, f->code, n);
+  const void *code;
+  if (S->aligned) {  /* skip padding up to the code array */
+    while (S->offset % sizeof(Instruction) != 0)
+      loadByte(S);
+  }
+  code = loadInPlace(S, n * sizeof(Instruction), sizeof(Instruction));
+  if (code != NULL) {
+    f->code = cast(Instruction *, code);
+    f->sizecode = n;
+    f->inimage |= PF_CODEINIMAGE;
+  }
+  else {
+    f->code = luaM_newvectorchecked(S->L, n, Instruction);
+    f->sizecode = n;
+    loadVector(S, f->code, n);
+  }
 }
 
 
@@ -226,10 +262,19 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
+  const void *lineinfo;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  lineinfo = loadInPlace(S, n * sizeof(ls_byte), 1);
+  if (lineinfo != NULL) {
+    f->lineinfo = cast(ls_byte *, lineinfo);
+    f->sizelineinfo = n;
+    f->inimage |= PF_LINEINFOINIMAGE;
+  }
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
@@ -294,8 +339,11 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != LUAC_VERSION)
     error(S, "version mismatch");
-  if (loadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch");
+  switch (loadByte(S)) {
+    case LUAC_FORMAT: break;
+    case LUAC_FORMAT_ALIGNED: S->aligned = 1; break;
+    default: error(S, "format mismatch");
+  }
   checkliteral(S, LUAC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, lua_Integer);
@@ -308,9 +356,12 @@ static void checkHeader (LoadState *S) {
 
 
 /*
-** Load precompiled chunk.
+** Load precompiled chunk. With 'inplace', code and line information are
+** used straight from the reader's buffer when possible (execute in place).
+** Code needs an aligned address, which LUAC_FORMAT_ALIGNED guarantees for
+** chunks that start at one.
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int inplace) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -321,6 +372,9 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* 1st char already read */
+  S.aligned = 0;
+  S.inplace = inplace;
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
@@ -26,11 +26,21 @@
 
 #define LUAC_FORMAT	0	/* this is the official format */
 
+/*
+** Same as the official format, except that every code array is preceded
+** by zero padding up to a multiple of sizeof(Instruction) from the start
+** of the chunk, so it can be executed in place
+*/
+#define LUAC_FORMAT_ALIGNED	1
+
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name,
+                                 int inplace);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
+LUAI_FUNC int luaU_dumpaligned (lua_State* L, const Proto* f, lua_Writer w,
+                                void* data, int strip);
 
 #endif
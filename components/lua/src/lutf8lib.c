@@ -19,6 +19,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 
 
 #define MAXUNICODE	0x10FFFFu
@@ -270,22 +271,19 @@ static int iter_codes (lua_State *L) {
 #define UTF8PATT	"[\0-\x7F\xC2-\xFD][\x80-\xBF]*"
 
 
-static const luaL_Reg funcs[] = {
-  {"offset", byteoffset},
-  {"codepoint", codepoint},
-  {"char", utfchar},
-  {"len", utflen},
-  {"codes", iter_codes},
-  /* placeholders */
-  {"charpattern", NULL},
-  {NULL, NULL}
+static const luaR_entry funcs[] = {
+  LROT_FUNCENTRY(offset, byteoffset),
+  LROT_FUNCENTRY(codepoint, codepoint),
+  LROT_FUNCENTRY(char, utfchar),
+  LROT_FUNCENTRY(len, utflen),
+  LROT_FUNCENTRY(codes, iter_codes),
+  LROT_STRENTRY(charpattern, UTF8PATT),
+  LROT_END
 };
 
 
 LUAMOD_API int luaopen_utf8 (lua_State *L) {
-  luaL_newlib(L, funcs);
-  lua_pushlstring(L, UTF8PATT, sizeof(UTF8PATT)/sizeof(char) - 1);
-  lua_setfield(L, -2, "charpattern");
+  lua_pushlibmap(L, funcs);
   return 1;
 }
 
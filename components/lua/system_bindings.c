@@ -2,6 +2,7 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lrotable.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -10,9 +11,18 @@
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
 #include "nvs_flash.h"
+#include "lua_engine.h"
+#include "lua_psram_alloc.h"
+#include "lua_alloc_trace.h"
+#include "lua_state_image.h"
+#include "lua_hot_reload.h"
+#include "lua_event_loop.h"
+#include "lua_coro_pool.h"
+#include "lua_scheduler.h"
+#include "lua_timer_wheel.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
+#include <stdatomic.h>
 #include <string.h>
 
 // Include the new unified SD card driver header
@@ -20,29 +30,140 @@
 
 static const char *TAG = "SYSTEM_BINDINGS";
 
-// WiFi event bits
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
-
-static EventGroupHandle_t s_wifi_event_group;
 static int s_retry_num = 0;
 static bool s_wifi_initialized = false;
-static bool s_wifi_connecting = false;
+// Shared by the task that runs Lua and the event loop's task
+static atomic_bool s_wifi_connecting = false;
+static atomic_bool s_wifi_connected = false;
+static bool s_wifi_scanning = false;
 
 // Globals for async WiFi connection
 static int s_wifi_connect_callback_ref = LUA_NOREF;
-static lua_State* g_main_L = NULL;
-static esp_timer_handle_t s_wifi_check_timer = NULL;
+static _Atomic uint32_t s_wifi_attempt = 0;        // Results of earlier attempts are ignored
+static _Atomic uint32_t s_wifi_link_attempt = 0;   // Attempt the driver's events belong to
+static atomic_bool s_wifi_leaving = false;         // The link of an earlier attempt is being torn down
+
+// Registry keys: the callbacks of the scan in progress, and the handler
+// set with system.wifi_on_disconnect()
+#define WIFI_SCAN_CALLBACKS_KEY "system.wifi_scan"
+#define WIFI_DISCONNECT_HANDLER_KEY "system.wifi_on_disconnect"
+
+// Registry keys of the timeouts, timer wheel entries in userdata so they go
+// with the state whose wheel they are on
+#define WIFI_SCAN_TIMEOUT_KEY "system.wifi_scan_timeout"
+#define WIFI_CONNECT_TIMEOUT_KEY "system.wifi_connect_timeout"
+
+// A scan that reports nothing by then failed; a connection not up by then
+// is given up on
+#define WIFI_SCAN_TIMEOUT_MS 15000
+#define WIFI_CONNECT_TIMEOUT_MS 30000
 
+// A full event queue is retried this often, this far apart, before a
+// result is given up to the timeout
+#define WIFI_POST_TRIES 5
+#define WIFI_POST_RETRY_MS 10
+
+// Events system.spawn() tasks wait on, with no callback; their addresses
+// are the keys, which Lua code can't make
+static const char s_wifi_scan_event = 0;
+static const char s_wifi_connect_event = 0;
+
+// Most networks a scan reports, strongest first
+#define WIFI_SCAN_MAX_RECORDS 32
+
+// A network as Lua sees it; about half of a wifi_ap_record_t
 typedef struct {
+    char ssid[33];
+    int8_t rssi;
+    uint8_t authmode;
+    uint8_t channel;
+} wifi_scan_record_t;
+
+// Posted by the event handler to the task that runs Lua. The records are
+// heap allocated, freed by the Lua side.
+typedef struct {
+    wifi_scan_record_t* records;
+    uint16_t count;
+    bool ok;
+} wifi_scan_event_t;
+
+typedef struct {
+    uint32_t attempt;
     bool success;
-    char msg[128];
-} wifi_connect_result_t;
+} wifi_connect_event_t;
+
+static void run_wifi_scan_event(lua_State* L, void* payload);
+static void fire_wifi_scan_timeout(lua_State* L, lua_timer_wheel_entry_t* entry);
+static void run_wifi_connect_event(lua_State* L, void* payload);
+static void run_wifi_disconnect_event(lua_State* L, void* payload);
 
-static volatile bool s_wifi_result_ready = false;
-static wifi_connect_result_t s_wifi_result;
+// Runs on the event task. The task that runs Lua drains the queue at least
+// once a frame, so a full queue has room again within a few ms.
+static bool post_wifi_event(lua_event_fn_t fn, const void* payload, uint32_t size) {
+    for (int i = 0; i < WIFI_POST_TRIES; i++) {
+        if (lua_event_loop_post(fn, payload, size)) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WIFI_POST_RETRY_MS));
+    }
+    return false;
+}
+
+// Runs on the event task: copies the results out of the driver once
+static void post_scan_results(const wifi_event_sta_scan_done_t* done) {
+    wifi_scan_event_t event = {.records = NULL, .count = 0, .ok = done->status == 0};
+    uint16_t count = 0;
+    if (event.ok && esp_wifi_scan_get_ap_num(&count) == ESP_OK && count > 0) {
+        if (count > WIFI_SCAN_MAX_RECORDS) {
+            count = WIFI_SCAN_MAX_RECORDS;
+        }
+        wifi_ap_record_t* ap_info = malloc(sizeof(wifi_ap_record_t) * count);
+        event.records = malloc(sizeof(wifi_scan_record_t) * count);
+        // Frees the driver's list, all of it even when asked for fewer
+        if (ap_info != NULL && event.records != NULL && esp_wifi_scan_get_ap_records(&count, ap_info) == ESP_OK) {
+            for (int i = 0; i < count; i++) {
+                wifi_scan_record_t* record = &event.records[i];
+                memcpy(record->ssid, ap_info[i].ssid, sizeof(record->ssid) - 1);
+                record->ssid[sizeof(record->ssid) - 1] = '\0';
+                record->rssi = ap_info[i].rssi;
+                record->authmode = (uint8_t)ap_info[i].authmode;
+                record->channel = ap_info[i].primary;
+            }
+            event.count = count;
+        } else {
+            esp_wifi_clear_ap_list();
+            free(event.records);
+            event.records = NULL;
+            event.ok = false;
+        }
+        free(ap_info);
+    }
+    if (!post_wifi_event(run_wifi_scan_event, &event, sizeof(event))) {
+        // The scan stays in progress until its timeout reports it failed,
+        // to its callbacks and waiting tasks alike
+        ESP_LOGE(TAG, "Event queue full, WiFi scan results lost");
+        free(event.records);
+    }
+}
+
+// Moves the attempt the driver's events are stamped with forward, never
+// back: both tasks move it, and either may see a newer attempt
+static void wifi_link_to(uint32_t attempt) {
+    uint32_t link = s_wifi_link_attempt;
+    while (link < attempt && !atomic_compare_exchange_weak(&s_wifi_link_attempt, &link, attempt)) {
+    }
+}
+
+static void post_connect_result(bool success) {
+    wifi_connect_event_t event = {.attempt = s_wifi_link_attempt, .success = success};
+    if (!post_wifi_event(run_wifi_connect_event, &event, sizeof(event))) {
+        // The attempt's timeout reports how it ended instead
+        ESP_LOGE(TAG, "Event queue full, WiFi connect result lost");
+    }
+}
 
-// WiFi event handler
+// WiFi event handler; runs on the default event loop's task, and hands
+// what Lua needs to the task that runs it
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                               int32_t event_id, void* event_data)
 {
@@ -50,22 +171,48 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         if (s_wifi_connecting) {
             esp_wifi_connect();
         }
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        post_scan_results((const wifi_event_sta_scan_done_t*)event_data);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)event_data;
+        bool was_connected = s_wifi_connected;
+        s_wifi_connected = false;
+        if (s_wifi_leaving) {
+            // The end of the link system.wifi_connect() tore down, not a
+            // failure of the attempt it started, whatever the reason: the
+            // link may have dropped just before it asked. What follows is
+            // the new attempt's.
+            s_wifi_leaving = false;
+            wifi_link_to(s_wifi_attempt);
+            return;
+        }
         if (s_wifi_connecting && s_retry_num < 10) {
             esp_wifi_connect();
             s_retry_num++;
             ESP_LOGI(TAG, "retry to connect to the AP");
-        } else {
+        } else if (s_wifi_connecting) {
             s_wifi_connecting = false;
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            post_connect_result(false);
+        } else if (was_connected) {
+            uint8_t reason = event->reason;
+            if (!post_wifi_event(run_wifi_disconnect_event, &reason, sizeof(reason))) {
+                ESP_LOGE(TAG, "Event queue full, WiFi disconnect lost");
+            }
         }
         ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        if (s_wifi_leaving) {
+            // The link being torn down came up late
+            return;
+        }
         s_retry_num = 0;
-        s_wifi_connecting = false;
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        s_wifi_connected = true;
+        if (s_wifi_connecting) {
+            s_wifi_connecting = false;
+            post_connect_result(true);
+        }
     }
 }
 
@@ -150,6 +297,7 @@ int system_sd_write_file(lua_State* L) {
     
     fprintf(f, "%s", data);
     fclose(f);
+    sdcard_mark_changed();
     
     lua_pushboolean(L, true);
     lua_pushstring(L, "File written successfully");
@@ -218,8 +366,6 @@ int system_wifi_init(lua_State* L) {
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     
-    s_wifi_event_group = xEventGroupCreate();
-    
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
     
@@ -233,109 +379,213 @@ int system_wifi_init(lua_State* L) {
     return 2;
 }
 
-int system_wifi_scan(lua_State* L) {
-    if (!s_wifi_initialized) {
-        lua_pushnil(L);
-        lua_pushstring(L, "WiFi not initialized");
+// Continuation of system.wifi_scan() and system.wifi_connect() in a task:
+// returns what lua_scheduler_wake() passed after the true
+static int wifi_wait_k(lua_State* L, int status, lua_KContext base) {
+    (void)status;
+    return lua_gettop(L) - (int)base - 1;
+}
+
+// Same for system.wifi_connect(), which stops waiting at its timeout
+static int wifi_connect_k(lua_State* L, int status, lua_KContext base) {
+    if (!lua_toboolean(L, (int)base + 1)) {
+        lua_pushboolean(L, false);
+        lua_pushliteral(L, "Timed out connecting to WiFi");
         return 2;
     }
+    return wifi_wait_k(L, status, base);
+}
 
-    esp_err_t ret = esp_wifi_scan_start(NULL, true);
-    if (ret != ESP_OK) {
-        lua_pushnil(L);
-        lua_pushfstring(L, "Failed to start WiFi scan: %s", esp_err_to_name(ret));
-        return 2;
+// The timeout under key, made the first time this state asks for it
+static lua_timer_wheel_entry_t* wifi_timeout(lua_State* L, const char* key, lua_timer_wheel_fire_fn_t fire) {
+    lua_timer_wheel_entry_t* entry;
+    if (lua_getfield(L, LUA_REGISTRYINDEX, key) == LUA_TUSERDATA) {
+        entry = (lua_timer_wheel_entry_t*)lua_touserdata(L, -1);
+    } else {
+        lua_pop(L, 1);
+        entry = (lua_timer_wheel_entry_t*)lua_newuserdata(L, sizeof(lua_timer_wheel_entry_t));
+        lua_timer_wheel_entry_init(entry, fire);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, key);
     }
+    lua_pop(L, 1);
+    return entry;
+}
+
+// Pushes a coroutine's resume values, or calls a callback, on a pool thread
+static void call_wifi_callback(lua_State* L, int nargs) {
+    lua_State* co = lua_coro_pool_take(L);
+    lua_rotate(L, -nargs - 2, 1); // Thread below the function and arguments
+    lua_xmove(L, co, nargs + 1);
+    lua_coro_pool_give(L, co, lua_engine_resume(co, L, nargs));
+}
 
-    vTaskDelay(pdMS_TO_TICKS(20));
+// Runs on the task that runs Lua: turns the records into one table, given
+// to every callback and waiting task
+static void run_wifi_scan_event(lua_State* L, void* payload) {
+    wifi_scan_event_t event;
+    memcpy(&event, payload, sizeof(event));
+    s_wifi_scanning = false;
+    lua_timer_wheel_stop(wifi_timeout(L, WIFI_SCAN_TIMEOUT_KEY, fire_wifi_scan_timeout));
 
-    uint16_t ap_count = 0;
-    ret = esp_wifi_scan_get_ap_num(&ap_count);
-    if (ret != ESP_OK) {
+    if (event.ok) {
+        lua_createtable(L, event.count, 0);
+        for (int i = 0; i < event.count; i++) {
+            lua_createtable(L, 0, 4);
+            lua_pushstring(L, event.records[i].ssid);
+            lua_setfield(L, -2, "ssid");
+            lua_pushinteger(L, event.records[i].rssi);
+            lua_setfield(L, -2, "rssi");
+            lua_pushinteger(L, event.records[i].authmode);
+            lua_setfield(L, -2, "authmode");
+            lua_pushinteger(L, event.records[i].channel);
+            lua_setfield(L, -2, "channel");
+            lua_rawseti(L, -2, i + 1);
+        }
         lua_pushnil(L);
-        lua_pushfstring(L, "Failed to get AP number: %s", esp_err_to_name(ret));
-        return 2;
+    } else {
+        lua_pushnil(L);
+        lua_pushliteral(L, "WiFi scan failed");
     }
+    free(event.records);
+    int results = lua_gettop(L) - 1;
 
-    if (ap_count == 0) {
-        lua_newtable(L);
-        return 1;
+    lua_getfield(L, LUA_REGISTRYINDEX, WIFI_SCAN_CALLBACKS_KEY);
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, WIFI_SCAN_CALLBACKS_KEY);
+    int callbacks = lua_gettop(L);
+    lua_Integer n = lua_istable(L, callbacks) ? (lua_Integer)lua_rawlen(L, callbacks) : 0;
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_rawgeti(L, callbacks, i);
+        lua_pushvalue(L, results);
+        lua_pushvalue(L, results + 1);
+        call_wifi_callback(L, 2);
     }
+    lua_pop(L, 1);
+
+    lua_pushlightuserdata(L, (void*)&s_wifi_scan_event);
+    lua_insert(L, results);
+    lua_scheduler_wake(L, results, 2);
+    lua_pop(L, 1); // Event
+}
+
+// Runs on the task that runs Lua when a scan reported nothing in time,
+// its results lost to a full queue or never sent by the driver
+static void fire_wifi_scan_timeout(lua_State* L, lua_timer_wheel_entry_t* entry) {
+    (void)entry;
+    ESP_LOGW(TAG, "No WiFi scan results in %d ms", WIFI_SCAN_TIMEOUT_MS);
+    wifi_scan_event_t event = {.records = NULL, .count = 0, .ok = false};
+    run_wifi_scan_event(L, &event);
+}
 
-    wifi_ap_record_t *ap_info = malloc(sizeof(wifi_ap_record_t) * ap_count);
-    if (ap_info == NULL) {
+// system.wifi_scan(fn(networks) or fn(nil, err)) -> true or nil, err
+// In a system.spawn() task, system.wifi_scan() -> networks or nil, err
+// Returns right away; a scan already running is joined.
+int system_wifi_scan(lua_State* L) {
+    if (!s_wifi_initialized) {
         lua_pushnil(L);
-        lua_pushfstring(L, "Failed to allocate memory for %d APs", ap_count);
+        lua_pushstring(L, "WiFi not initialized");
         return 2;
     }
+    bool wait = lua_isnoneornil(L, 1);
+    if (!wait) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    } else if (!lua_isyieldable(L)) {
+        return luaL_error(L, "system.wifi_scan() needs a callback outside a system.spawn() task");
+    }
 
-    ret = esp_wifi_scan_get_ap_records(&ap_count, ap_info);
-    if (ret != ESP_OK) {
-        free(ap_info);
-        lua_pushnil(L);
-        lua_pushfstring(L, "Failed to get AP records: %s", esp_err_to_name(ret));
-        return 2;
+    if (!s_wifi_scanning) {
+        esp_err_t ret = esp_wifi_scan_start(NULL, false);
+        if (ret != ESP_OK) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "Failed to start WiFi scan: %s", esp_err_to_name(ret));
+            return 2;
+        }
+        s_wifi_scanning = true;
+        lua_timer_wheel_start(wifi_timeout(L, WIFI_SCAN_TIMEOUT_KEY, fire_wifi_scan_timeout),
+                              WIFI_SCAN_TIMEOUT_MS, false);
     }
 
-    lua_newtable(L);
-    for (int i = 0; i < ap_count; i++) {
+    if (wait) {
+        lua_settop(L, 0);
+        lua_pushlightuserdata(L, (void*)&s_wifi_scan_event);
+        return lua_scheduler_waitk(L, 1, -1, 1, wifi_wait_k);
+    }
+    if (lua_getfield(L, LUA_REGISTRYINDEX, WIFI_SCAN_CALLBACKS_KEY) != LUA_TTABLE) {
+        lua_pop(L, 1);
         lua_newtable(L);
-        lua_pushstring(L, (char*)ap_info[i].ssid);
-        lua_setfield(L, -2, "ssid");
-        lua_pushinteger(L, ap_info[i].rssi);
-        lua_setfield(L, -2, "rssi");
-        lua_pushinteger(L, ap_info[i].authmode);
-        lua_setfield(L, -2, "authmode");
-        lua_rawseti(L, -2, i + 1);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, WIFI_SCAN_CALLBACKS_KEY);
     }
-
-    free(ap_info);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+    lua_pushboolean(L, true);
     return 1;
 }
 
-static void wifi_connect_task(void* arg) {
-    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           pdMS_TO_TICKS(30000));
-    if (bits & WIFI_CONNECTED_BIT) {
-        s_wifi_result.success = true;
-        strncpy(s_wifi_result.msg, "Connected to WiFi", sizeof(s_wifi_result.msg) - 1);
-    } else {
-        s_wifi_result.success = false;
-        strncpy(s_wifi_result.msg, "Failed to connect to WiFi", sizeof(s_wifi_result.msg) - 1);
+static void fire_wifi_connect_timeout(lua_State* L, lua_timer_wheel_entry_t* entry);
+
+// Hands the current attempt's result to its callback and waiting tasks.
+// Harmless if repeated: both are gone after the first time.
+static void finish_wifi_connect(lua_State* L, bool success, const char* message) {
+    lua_timer_wheel_stop(wifi_timeout(L, WIFI_CONNECT_TIMEOUT_KEY, fire_wifi_connect_timeout));
+    if (s_wifi_connect_callback_ref != LUA_NOREF) {
+        int ref = s_wifi_connect_callback_ref;
+        s_wifi_connect_callback_ref = LUA_NOREF;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        lua_pushboolean(L, success);
+        lua_pushstring(L, message);
+        call_wifi_callback(L, 2);
+    }
+    lua_pushlightuserdata(L, (void*)&s_wifi_connect_event);
+    lua_pushboolean(L, success);
+    lua_pushstring(L, message);
+    lua_scheduler_wake(L, -3, 2);
+    lua_pop(L, 1); // Event
+}
+
+// Runs on the task that runs Lua
+static void run_wifi_connect_event(lua_State* L, void* payload) {
+    wifi_connect_event_t event;
+    memcpy(&event, payload, sizeof(event));
+    if (event.attempt != s_wifi_attempt) {
+        return;
+    }
+    finish_wifi_connect(L, event.success, event.success ? "Connected to WiFi" : "Failed to connect to WiFi");
+}
+
+// Runs on the task that runs Lua when the current attempt has had no result
+// in time: gives up on it, or reports how it ended if the result was lost
+static void fire_wifi_connect_timeout(lua_State* L, lua_timer_wheel_entry_t* entry) {
+    (void)entry;
+    if (s_wifi_connecting) {
         s_wifi_connecting = false;
+        s_wifi_leaving = true;
+        esp_wifi_disconnect();
+        finish_wifi_connect(L, false, "Timed out connecting to WiFi");
+    } else if (s_wifi_connected) {
+        finish_wifi_connect(L, true, "Connected to WiFi");
+    } else {
+        finish_wifi_connect(L, false, "Failed to connect to WiFi");
     }
-    s_wifi_result.msg[sizeof(s_wifi_result.msg) - 1] = '\0';
-    s_wifi_result_ready = true;
-    vTaskDelete(NULL);
-}
-
-static void check_wifi_result_callback(void* arg) {
-    if (s_wifi_result_ready) {
-        esp_timer_stop(s_wifi_check_timer);
-        esp_timer_delete(s_wifi_check_timer);
-        s_wifi_check_timer = NULL;
-        if (g_main_L && s_wifi_connect_callback_ref != LUA_NOREF) {
-            lua_State* co = lua_newthread(g_main_L);
-            lua_rawgeti(g_main_L, LUA_REGISTRYINDEX, s_wifi_connect_callback_ref);
-            lua_xmove(g_main_L, co, 1);
-            lua_pushboolean(co, s_wifi_result.success);
-            lua_pushstring(co, s_wifi_result.msg);
-            int nres;
-            int status = lua_resume(co, g_main_L, 2, &nres);
-            if (status != LUA_OK && status != LUA_YIELD) {
-                ESP_LOGE(TAG, "Lua WiFi callback error: %s", lua_tostring(co, -1) ? lua_tostring(co, -1) : "Unknown");
-            }
-            luaL_unref(g_main_L, LUA_REGISTRYINDEX, s_wifi_connect_callback_ref);
-            s_wifi_connect_callback_ref = LUA_NOREF;
-        }
-        s_wifi_result_ready = false;
+}
+
+// Runs on the task that runs Lua when an established connection drops
+static void run_wifi_disconnect_event(lua_State* L, void* payload) {
+    uint8_t reason;
+    memcpy(&reason, payload, sizeof(reason));
+    if (lua_getfield(L, LUA_REGISTRYINDEX, WIFI_DISCONNECT_HANDLER_KEY) != LUA_TFUNCTION) {
+        lua_pop(L, 1);
+        return;
     }
+    lua_pushinteger(L, reason);
+    call_wifi_callback(L, 1);
 }
 
+// system.wifi_connect(ssid, password, fn(ok, message))
+// In a system.spawn() task the callback can be left out: returns ok, message
+// Gives up after WIFI_CONNECT_TIMEOUT_MS; a new call ends the attempt before.
 int system_wifi_connect(lua_State* L) {
     if (!s_wifi_initialized) {
         luaL_error(L, "WiFi not initialized");
@@ -343,23 +593,33 @@ int system_wifi_connect(lua_State* L) {
     }
     const char* ssid = luaL_checkstring(L, 1);
     const char* password = luaL_checkstring(L, 2);
-    luaL_checktype(L, 3, LUA_TFUNCTION);
-
-    if (s_wifi_check_timer) {
-        esp_timer_stop(s_wifi_check_timer);
-        esp_timer_delete(s_wifi_check_timer);
-        s_wifi_check_timer = NULL;
+    bool wait = lua_isnoneornil(L, 3);
+    if (!wait) {
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+    } else if (!lua_isyieldable(L)) {
+        return luaL_error(L, "system.wifi_connect() needs a callback outside a system.spawn() task");
     }
+
     if (s_wifi_connect_callback_ref != LUA_NOREF) {
         luaL_unref(L, LUA_REGISTRYINDEX, s_wifi_connect_callback_ref);
+        s_wifi_connect_callback_ref = LUA_NOREF;
+    }
+    if (!wait) {
+        lua_pushvalue(L, 3);
+        s_wifi_connect_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
     }
 
-    lua_pushvalue(L, 3);
-    s_wifi_connect_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-
-    if (s_wifi_connecting) {
+    // The disconnect below ends the attempt in progress or the link that is
+    // up, not this attempt: the event handler skips the events up to its
+    // disconnect event, then stamps the rest with this attempt. The driver
+    // is connecting or connected then, so that event does come.
+    uint32_t attempt = ++s_wifi_attempt;
+    if (s_wifi_connecting || s_wifi_connected) {
+        s_wifi_connecting = false;
+        s_wifi_leaving = true;
         esp_wifi_disconnect();
-        vTaskDelay(pdMS_TO_TICKS(100));
+    } else if (!s_wifi_leaving) {
+        wifi_link_to(attempt);
     }
     
     wifi_config_t wifi_config = {0};
@@ -371,16 +631,26 @@ int system_wifi_connect(lua_State* L) {
     
     s_wifi_connecting = true;
     s_retry_num = 0;
-    s_wifi_result_ready = false;
-    
-    xTaskCreate(wifi_connect_task, "wifi_connect_task", 4096, NULL, 5, NULL);
+    esp_wifi_connect();
+    lua_timer_wheel_start(wifi_timeout(L, WIFI_CONNECT_TIMEOUT_KEY, fire_wifi_connect_timeout),
+                          WIFI_CONNECT_TIMEOUT_MS, false);
 
-    esp_timer_create_args_t timer_args = {.callback = &check_wifi_result_callback, .name = "wifi_result_checker"};
-    esp_timer_create(&timer_args, &s_wifi_check_timer);
-    esp_timer_start_periodic(s_wifi_check_timer, 100 * 1000);
+    if (wait) {
+        lua_settop(L, 0);
+        lua_pushlightuserdata(L, (void*)&s_wifi_connect_event);
+        return lua_scheduler_waitk(L, 1, WIFI_CONNECT_TIMEOUT_MS, 1, wifi_connect_k);
+    }
+    return 0;
+}
 
-    esp_wifi_connect();
-    
+// system.wifi_on_disconnect(fn(reason)) or system.wifi_on_disconnect(nil);
+// called when a connection that was up drops
+int system_wifi_on_disconnect(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+    lua_settop(L, 1);
+    lua_setfield(L, LUA_REGISTRYINDEX, WIFI_DISCONNECT_HANDLER_KEY);
     return 0;
 }
 
@@ -419,6 +689,31 @@ int system_delay(lua_State* L) {
     return 0;
 }
 
+// --- Cooperative tasks, run by lua_scheduler_run() between frames ---
+int system_spawn(lua_State* L) {
+    return lua_scheduler_spawn(L);
+}
+
+// Unlike system.delay(), lets the GUI and the other tasks run meanwhile
+int system_sleep(lua_State* L) {
+    lua_Integer ms = luaL_optinteger(L, 1, 0);
+    luaL_argcheck(L, ms >= 0 && ms <= INT32_MAX, 1, "out of range");
+    return lua_scheduler_sleep(L, (uint32_t)ms);
+}
+
+int system_wait(lua_State* L) {
+    lua_Integer timeout_ms = luaL_optinteger(L, 2, -1);
+    luaL_argcheck(L, timeout_ms <= INT32_MAX, 2, "out of range");
+    lua_settop(L, 2);
+    return lua_scheduler_wait(L, 1, timeout_ms < 0 ? -1 : (int32_t)timeout_ms);
+}
+
+int system_wake(lua_State* L) {
+    luaL_checkany(L, 1);
+    lua_pushinteger(L, lua_scheduler_wake(L, 1, lua_gettop(L) - 1));
+    return 1;
+}
+
 int system_get_free_heap(lua_State* L) {
     lua_pushinteger(L, esp_get_free_heap_size());
     return 1;
@@ -433,138 +728,433 @@ int system_get_psram_size(lua_State* L) {
     return 1;
 }
 
+// Snapshot of the Lua allocator accounting. histogram[i] counts live blocks
+// of [2^(i-2), 2^(i-1)) bytes (Lua arrays are 1-based).
+int system_lua_mem(lua_State* L) {
+    lua_memory_stats_t st;
+    lua_get_memory_snapshot(&st);
+
+    lua_createtable(L, 0, 13);
+    lua_pushinteger(L, st.total_allocated);
+    lua_setfield(L, -2, "total");
+    lua_pushinteger(L, st.psram_allocated);
+    lua_setfield(L, -2, "psram");
+    lua_pushinteger(L, st.internal_allocated);
+    lua_setfield(L, -2, "internal");
+    lua_pushinteger(L, st.peak_total);
+    lua_setfield(L, -2, "peak_total");
+    lua_pushinteger(L, st.peak_psram);
+    lua_setfield(L, -2, "peak_psram");
+    lua_pushinteger(L, st.peak_internal);
+    lua_setfield(L, -2, "peak_internal");
+    lua_pushinteger(L, st.alloc_count);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, st.free_count);
+    lua_setfield(L, -2, "frees");
+    lua_pushinteger(L, st.realloc_count);
+    lua_setfield(L, -2, "reallocs");
+    lua_pushinteger(L, st.limit_rejects);
+    lua_setfield(L, -2, "limit_rejects");
+    lua_pushinteger(L, st.low_memory_events);
+    lua_setfield(L, -2, "low_memory_events");
+    lua_pushinteger(L, st.arena_peak);
+    lua_setfield(L, -2, "arena_peak");
+    lua_pushinteger(L, st.arena_overflows);
+    lua_setfield(L, -2, "arena_overflows");
+
+    lua_createtable(L, LUA_MEM_HIST_BUCKETS, 0);
+    for (int i = 0; i < LUA_MEM_HIST_BUCKETS; i++) {
+        lua_pushinteger(L, st.size_histogram[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "histogram");
+    return 1;
+}
+
+// Live bytes and block counts per Lua type, keyed by type name.
+// Returns nil plus a message when allocation tagging is compiled out.
+int system_lua_mem_tags(lua_State* L) {
+    lua_alloc_tag_stats_t stats[LUA_ALLOC_TAG_COUNT];
+    if (!lua_get_tag_stats(stats)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "allocation tagging disabled (CONFIG_LUA_ALLOC_TAGGING)");
+        return 2;
+    }
+
+    lua_createtable(L, 0, LUA_ALLOC_TAG_COUNT);
+    for (int i = 0; i < LUA_ALLOC_TAG_COUNT; i++) {
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, stats[i].live_bytes);
+        lua_setfield(L, -2, "bytes");
+        lua_pushinteger(L, stats[i].live_count);
+        lua_setfield(L, -2, "count");
+        lua_setfield(L, -2, lua_alloc_tag_name(i));
+    }
+    return 1;
+}
+
+// --- Placement rules ---
+
+// system.mem_place_rules() -> {{tag=, min=, max=, region=, hits=, fallbacks=}, ...}, unmatched
+int system_mem_place_rules(lua_State* L) {
+    lua_place_rule_t rules[LUA_PLACE_MAX_RULES];
+    uint32_t unmatched;
+    int count = lua_alloc_place_get_rules(rules, LUA_PLACE_MAX_RULES, &unmatched);
+
+    lua_createtable(L, count, 0);
+    for (int i = 0; i < count; i++) {
+        lua_createtable(L, 0, 6);
+        lua_pushstring(L, rules[i].tag == LUA_PLACE_ANY_TAG ? "any" : lua_alloc_tag_name(rules[i].tag));
+        lua_setfield(L, -2, "tag");
+        lua_pushinteger(L, rules[i].min_size);
+        lua_setfield(L, -2, "min");
+        lua_pushinteger(L, rules[i].max_size);
+        lua_setfield(L, -2, "max");
+        lua_pushstring(L, lua_place_region_name(rules[i].region));
+        lua_setfield(L, -2, "region");
+        lua_pushinteger(L, rules[i].hits);
+        lua_setfield(L, -2, "hits");
+        lua_pushinteger(L, rules[i].fallbacks);
+        lua_setfield(L, -2, "fallbacks");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushinteger(L, unmatched);
+    return 2;
+}
+
+// system.mem_place_add(tag, min, max, region), e.g. ("string", 256, 0, "psram")
+int system_mem_place_add(lua_State* L) {
+    const char* tag_name = luaL_checkstring(L, 1);
+    lua_Integer min_size = luaL_checkinteger(L, 2);
+    lua_Integer max_size = luaL_checkinteger(L, 3);
+    static const char* const regions[] = {"default", "internal", "psram", NULL};
+    int region = luaL_checkoption(L, 4, NULL, regions);
+
+    int tag = LUA_PLACE_ANY_TAG;
+    if (strcmp(tag_name, "any") != 0) {
+        for (tag = 0; tag < LUA_ALLOC_TAG_COUNT; tag++) {
+            if (strcmp(tag_name, lua_alloc_tag_name(tag)) == 0) break;
+        }
+        luaL_argcheck(L, tag < LUA_ALLOC_TAG_COUNT, 1, "unknown object type");
+    }
+    luaL_argcheck(L, min_size >= 0, 2, "size must be >= 0");
+    luaL_argcheck(L, max_size >= 0, 3, "size must be >= 0");
+
+    int index = lua_alloc_place_add_rule(tag, (size_t)min_size, (size_t)max_size, (lua_place_region_t)region);
+    if (index < 0) {
+        return luaL_error(L, "can't add placement rule (table full or max < min)");
+    }
+    lua_pushinteger(L, index + 1);
+    return 1;
+}
+
+int system_mem_place_clear(lua_State* L) {
+    (void)L;
+    lua_alloc_place_clear();
+    return 0;
+}
+
+// system.alloc_trace_start(path) -> true, or nil plus a message
+int system_alloc_trace_start(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    if (!lua_alloc_trace_start(path)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "can't start trace (needs CONFIG_LUA_ALLOC_TRACE and a writable path)");
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// system.alloc_trace_stop() -> records, dropped
+int system_alloc_trace_stop(lua_State* L) {
+    uint32_t recorded, dropped;
+    lua_alloc_trace_stop();
+    lua_alloc_trace_get_stats(&recorded, &dropped);
+    lua_pushinteger(L, recorded);
+    lua_pushinteger(L, dropped);
+    return 2;
+}
+
+// --- Heap budget ---
+#define LOW_MEMORY_HANDLER_KEY "system.low_memory_handler"
+
+int system_set_mem_limits(lua_State* L) {
+    lua_Integer soft_limit = luaL_checkinteger(L, 1);
+    lua_Integer hard_limit = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, soft_limit >= 0, 1, "limit must be >= 0");
+    luaL_argcheck(L, hard_limit >= 0, 2, "limit must be >= 0");
+    luaL_argcheck(L, hard_limit == 0 || soft_limit <= hard_limit, 1, "soft limit above hard limit");
+    lua_alloc_set_limits((size_t)soft_limit, (size_t)hard_limit);
+    return 0;
+}
+
+int system_get_mem_limits(lua_State* L) {
+    size_t soft_limit, hard_limit;
+    lua_memory_stats_t st;
+    lua_alloc_get_limits(&soft_limit, &hard_limit);
+    lua_get_memory_snapshot(&st);
+    lua_pushinteger(L, soft_limit);
+    lua_pushinteger(L, hard_limit);
+    lua_pushinteger(L, st.total_allocated);
+    return 3;
+}
+
+// system.on_low_memory(fn(used, soft_limit)) or system.on_low_memory(nil)
+int system_on_low_memory(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+    lua_settop(L, 1);
+    lua_setfield(L, LUA_REGISTRYINDEX, LOW_MEMORY_HANDLER_KEY);
+    return 0;
+}
+
+void system_notify_low_memory(lua_State* L, size_t used, size_t soft_limit) {
+    if (lua_getfield(L, LUA_REGISTRYINDEX, LOW_MEMORY_HANDLER_KEY) != LUA_TFUNCTION) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pushinteger(L, used);
+    lua_pushinteger(L, soft_limit);
+    if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+        ESP_LOGE(TAG, "Lua low-memory handler error: %s", lua_tostring(L, -1) ? lua_tostring(L, -1) : "Unknown");
+        lua_pop(L, 1);
+    }
+}
+
+// system.reload() -> number of modules reloaded
+int system_reload(lua_State* L) {
+    lua_pushinteger(L, lua_hot_reload_scan(L));
+    return 1;
+}
+
+// system.on_reload(fn(modules)) or system.on_reload(nil); called while a
+// module loads, fn is that module's, otherwise the app's
+int system_on_reload(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+    lua_settop(L, 1);
+    lua_hot_reload_set_handler(L, 1);
+    return 0;
+}
+
 int system_restart(lua_State* L) {
     esp_restart();
     return 0;
 }
 
-// --- Timer functions (unchanged) ---
+// system.save_state([path[, entry]]) -> true | nil, err
+// Saves the state as it is now; the next boot restores it and calls entry
+int system_save_state(lua_State* L) {
+#if CONFIG_LUA_STATE_IMAGE
+    const char* path = luaL_optstring(L, 1, CONFIG_LUA_STATE_IMAGE_PATH);
+    if (!lua_isnoneornil(L, 2)) {
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+    }
+    int status = lua_state_image_save(L, lua_isnoneornil(L, 2) ? 0 : 2, path);
+    if (strncmp(path, SDCARD_MOUNT_POINT "/", sizeof(SDCARD_MOUNT_POINT)) == 0) {
+        sdcard_mark_changed();
+    }
+    if (status != LUA_OK) {
+        lua_pushnil(L);
+        lua_insert(L, -2);
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+#else
+    lua_pushnil(L);
+    lua_pushstring(L, "state images are disabled (CONFIG_LUA_STATE_IMAGE)");
+    return 2;
+#endif
+}
+
+// --- Timer functions ---
 #define LUA_TIMER_METATABLE "lua_timer"
+// Registry table of the live timers by id, weak so it doesn't keep them alive
+#define LUA_TIMER_LIVE "lua_timer.live"
 
+// All of them run on the one esp_timer of lua_timer_wheel.c
 typedef struct {
-    esp_timer_handle_t timer_handle;
-    lua_State* g_L;
+    lua_timer_wheel_entry_t entry;  // First, so the fire callback can cast back
+    uint32_t id;
     int callback_ref;
-    bool auto_reload;
-    bool running;
 } lua_timer_t;
 
-static void timer_callback(void* arg) {
-    lua_timer_t* timer = (lua_timer_t*)arg;
-    if (!timer || !timer->g_L || timer->callback_ref == LUA_NOREF) return;
-    lua_State* co = lua_newthread(timer->g_L);
-    lua_rawgeti(timer->g_L, LUA_REGISTRYINDEX, timer->callback_ref);
-    lua_xmove(timer->g_L, co, 1);
-    int nres;
-    int status = lua_resume(co, timer->g_L, 0, &nres);
-    if (status != LUA_OK && status != LUA_YIELD) {
-        ESP_LOGE(TAG, "Lua timer callback error: %s", lua_tostring(co, -1) ? lua_tostring(co, -1) : "Unknown");
+static uint32_t s_next_timer_id = 0;
+
+static void push_live_timers(lua_State* L) {
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_TIMER_LIVE)) {
+        lua_createtable(L, 0, 1);
+        lua_pushliteral(L, "v");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
     }
-    if (!timer->auto_reload) timer->running = false;
+}
+
+// Runs on the task that runs Lua for each timer of a batch that expired.
+// The timer is anchored on the stack through its id while the callback
+// runs, in case that drops the last reference to it.
+static void fire_timer(lua_State* L, lua_timer_wheel_entry_t* entry) {
+    lua_timer_t* timer = (lua_timer_t*)entry;
+    push_live_timers(L);
+    lua_rawgeti(L, -1, timer->id);
+    if (timer->callback_ref == LUA_NOREF) {
+        lua_pop(L, 2);
+        return;
+    }
+
+    lua_State* co = lua_coro_pool_take(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, timer->callback_ref);
+    lua_xmove(L, co, 1);
+    // Suspended to the next frame rather than aborted if it runs over budget
+    lua_coro_pool_give(L, co, lua_engine_resume(co, L, 0));
+    lua_pop(L, 2); // Timer, live timers
 }
 
 static int timer_gc(lua_State* L) {
     lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
     if (timer) {
-        if (timer->running) esp_timer_stop(timer->timer_handle);
-        esp_timer_delete(timer->timer_handle);
+        lua_timer_wheel_stop(&timer->entry);
         luaL_unref(L, LUA_REGISTRYINDEX, timer->callback_ref);
         timer->callback_ref = LUA_NOREF;
-        timer->running = false;
     }
     return 0;
 }
 
+static uint32_t check_period(lua_State* L, int arg) {
+    lua_Integer period_ms = luaL_checkinteger(L, arg);
+    luaL_argcheck(L, period_ms >= 0 && period_ms <= UINT32_MAX, arg, "out of range");
+    return (uint32_t)period_ms;
+}
+
 int system_timer_create(lua_State* L) {
-    uint32_t period_ms = luaL_checkinteger(L, 1);
+    uint32_t period_ms = check_period(L, 1);
     bool auto_reload = lua_toboolean(L, 2);
     luaL_checktype(L, 3, LUA_TFUNCTION);
 
     lua_timer_t* timer = (lua_timer_t*)lua_newuserdata(L, sizeof(lua_timer_t));
+    lua_timer_wheel_entry_init(&timer->entry, fire_timer);
+    timer->id = ++s_next_timer_id;
+    timer->callback_ref = LUA_NOREF;
     luaL_getmetatable(L, LUA_TIMER_METATABLE);
     lua_setmetatable(L, -2);
 
-    timer->g_L = L;
-    timer->auto_reload = auto_reload;
-    timer->running = false;
     lua_pushvalue(L, 3);
     timer->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    push_live_timers(L);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, timer->id);
+    lua_pop(L, 1);
 
-    esp_timer_create_args_t timer_args = {.callback = &timer_callback, .arg = timer, .name = "lua_timer"};
-    esp_err_t err = esp_timer_create(&timer_args, &timer->timer_handle);
-    if (err != ESP_OK) {
-        luaL_unref(L, LUA_REGISTRYINDEX, timer->callback_ref);
-        return luaL_error(L, "Failed to create timer: %s", esp_err_to_name(err));
-    }
-    
-    if (auto_reload) err = esp_timer_start_periodic(timer->timer_handle, (uint64_t)period_ms * 1000);
-    else err = esp_timer_start_once(timer->timer_handle, (uint64_t)period_ms * 1000);
-    
-    if (err != ESP_OK) {
-        esp_timer_delete(timer->timer_handle);
-        luaL_unref(L, LUA_REGISTRYINDEX, timer->callback_ref);
-        return luaL_error(L, "Failed to start timer: %s", esp_err_to_name(err));
-    }
-    timer->running = true;
+    lua_timer_wheel_start(&timer->entry, period_ms, auto_reload);
     return 1;
 }
 
+// system.timer_start(timer[, period_ms]): (re)starts the countdown
+int system_timer_start(lua_State* L) {
+    lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
+    if (!lua_isnoneornil(L, 2)) {
+        lua_timer_wheel_set_period(&timer->entry, check_period(L, 2));
+    }
+    lua_timer_wheel_restart(&timer->entry);
+    return 0;
+}
+
 int system_timer_stop(lua_State* L) {
     lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
-    if (timer && timer->running) {
-        if (esp_timer_stop(timer->timer_handle) == ESP_OK) {
-            timer->running = false;
-            lua_pushboolean(L, true);
-        } else {
-            lua_pushboolean(L, false);
-            return 1;
-        }
-    } else {
-        lua_pushboolean(L, false);
+    bool running = lua_timer_wheel_is_running(&timer->entry);
+    lua_timer_wheel_stop(&timer->entry);
+    lua_pushboolean(L, running);
+    return 1;
+}
+
+// Restarts the countdown of a running timer; a stopped one stays stopped
+int system_timer_reset(lua_State* L) {
+    lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
+    bool running = lua_timer_wheel_is_running(&timer->entry);
+    if (running) {
+        lua_timer_wheel_restart(&timer->entry);
     }
+    lua_pushboolean(L, running);
+    return 1;
+}
+
+// Counted from the start of the current period if running
+int system_timer_set_period(lua_State* L) {
+    lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
+    lua_timer_wheel_set_period(&timer->entry, check_period(L, 2));
+    return 0;
+}
+
+int system_timer_is_running(lua_State* L) {
+    lua_timer_t* timer = (lua_timer_t*)luaL_checkudata(L, 1, LUA_TIMER_METATABLE);
+    lua_pushboolean(L, lua_timer_wheel_is_running(&timer->entry));
     return 1;
 }
 
 // --- Function Registry ---
-static const luaL_Reg system_functions[] = {
+static const luaR_entry system_map[] = {
     // SD Card wrappers
-    {"sd_init", system_sd_init},
-    {"sd_is_mounted", system_sd_is_mounted},
-    {"sd_get_info", system_sd_get_info},
-    {"sd_write_file", system_sd_write_file},
-    {"sd_read_file", system_sd_read_file},
+    LROT_FUNCENTRY(sd_init, system_sd_init),
+    LROT_FUNCENTRY(sd_is_mounted, system_sd_is_mounted),
+    LROT_FUNCENTRY(sd_get_info, system_sd_get_info),
+    LROT_FUNCENTRY(sd_write_file, system_sd_write_file),
+    LROT_FUNCENTRY(sd_read_file, system_sd_read_file),
     
     // WiFi functions
-    {"wifi_init", system_wifi_init},
-    {"wifi_scan", system_wifi_scan},
-    {"wifi_connect", system_wifi_connect},
-    {"wifi_disconnect", system_wifi_disconnect},
-    {"wifi_is_connected", system_wifi_is_connected},
-    {"wifi_get_ip", system_wifi_get_ip},
+    LROT_FUNCENTRY(wifi_init, system_wifi_init),
+    LROT_FUNCENTRY(wifi_scan, system_wifi_scan),
+    LROT_FUNCENTRY(wifi_connect, system_wifi_connect),
+    LROT_FUNCENTRY(wifi_disconnect, system_wifi_disconnect),
+    LROT_FUNCENTRY(wifi_is_connected, system_wifi_is_connected),
+    LROT_FUNCENTRY(wifi_get_ip, system_wifi_get_ip),
+    LROT_FUNCENTRY(wifi_on_disconnect, system_wifi_on_disconnect),
     
     // System functions
-    {"delay", system_delay},
-    {"get_free_heap", system_get_free_heap},
-    {"get_psram_size", system_get_psram_size},
-    {"restart", system_restart},
+    LROT_FUNCENTRY(delay, system_delay),
+    LROT_FUNCENTRY(spawn, system_spawn),
+    LROT_FUNCENTRY(sleep, system_sleep),
+    LROT_FUNCENTRY(wait, system_wait),
+    LROT_FUNCENTRY(wake, system_wake),
+    LROT_FUNCENTRY(get_free_heap, system_get_free_heap),
+    LROT_FUNCENTRY(get_psram_size, system_get_psram_size),
+    LROT_FUNCENTRY(lua_mem, system_lua_mem),
+    LROT_FUNCENTRY(lua_mem_tags, system_lua_mem_tags),
+    LROT_FUNCENTRY(mem_place_rules, system_mem_place_rules),
+    LROT_FUNCENTRY(mem_place_add, system_mem_place_add),
+    LROT_FUNCENTRY(mem_place_clear, system_mem_place_clear),
+    LROT_FUNCENTRY(alloc_trace_start, system_alloc_trace_start),
+    LROT_FUNCENTRY(alloc_trace_stop, system_alloc_trace_stop),
+    LROT_FUNCENTRY(set_mem_limits, system_set_mem_limits),
+    LROT_FUNCENTRY(get_mem_limits, system_get_mem_limits),
+    LROT_FUNCENTRY(on_low_memory, system_on_low_memory),
+    LROT_FUNCENTRY(restart, system_restart),
+    LROT_FUNCENTRY(save_state, system_save_state),
+    LROT_FUNCENTRY(reload, system_reload),
+    LROT_FUNCENTRY(on_reload, system_on_reload),
     
     // Timer functions
-    {"timer_create", system_timer_create},
-    {"timer_stop", system_timer_stop},
+    LROT_FUNCENTRY(timer_create, system_timer_create),
+    LROT_FUNCENTRY(timer_start, system_timer_start),
+    LROT_FUNCENTRY(timer_stop, system_timer_stop),
+    LROT_FUNCENTRY(timer_reset, system_timer_reset),
+    LROT_FUNCENTRY(timer_set_period, system_timer_set_period),
+    LROT_FUNCENTRY(timer_is_running, system_timer_is_running),
     
-    {NULL, NULL}
+    LROT_END
 };
 
 int luaopen_system(lua_State* L) {
     ESP_LOGI(TAG, "Registering system bindings...");
-    g_main_L = L;
-
     luaL_newmetatable(L, LUA_TIMER_METATABLE);
     lua_pushcfunction(L, timer_gc);
     lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);
     
-    luaL_newlib(L, system_functions);
+    lua_pushlibmap(L, system_map);
     
     ESP_LOGI(TAG, "System bindings registered successfully");
     return 1;
@@ -3,6 +3,7 @@
 
 #include "lua.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @brief Registers the system library for the Lua state.
@@ -12,4 +13,13 @@
  */
 int luaopen_system(lua_State* L);
 
+/**
+ * @brief Call the Lua handler registered with system.on_low_memory(), if any.
+ *
+ * @param L The Lua state.
+ * @param used Bytes currently allocated by Lua.
+ * @param soft_limit The soft limit that was crossed.
+ */
+void system_notify_low_memory(lua_State* L, size_t used, size_t soft_limit);
+
 #endif // SYSTEM_BINDINGS_H
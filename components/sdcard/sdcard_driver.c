@@ -10,6 +10,8 @@
 static const char *TAG = "SDCARD";
 static sdcard_config_t g_sdcard_config = {0};
 static bool spi_bus_initialized = false;
+// Bumped whenever the set of files on the card may have changed
+static uint32_t s_generation = 0;
 
 esp_err_t sdcard_init(void)
 {
@@ -106,6 +108,7 @@ esp_err_t sdcard_mount(const char* mount_point, size_t max_files)
     g_sdcard_config.max_files = max_files;
     strncpy(g_sdcard_config.mount_point, mount_point, sizeof(g_sdcard_config.mount_point) - 1);
     g_sdcard_config.mount_point[sizeof(g_sdcard_config.mount_point) - 1] = '\0';
+    s_generation++;
     
     // Print card info
     ESP_LOGI(TAG, "SD card mounted successfully");
@@ -138,6 +141,7 @@ esp_err_t sdcard_unmount(void)
     
     // Clear configuration
     memset(&g_sdcard_config, 0, sizeof(g_sdcard_config));
+    s_generation++;
     
     ESP_LOGI(TAG, "SD card unmounted successfully");
     return ESP_OK;
@@ -185,6 +189,7 @@ esp_err_t sdcard_format(void)
     
     sdmmc_card_t *card;
     ret = esp_vfs_fat_sdspi_mount(g_sdcard_config.mount_point, &host, &slot_config, &mount_config, &card);
+    s_generation++;
     
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to format SD card: %s", esp_err_to_name(ret));
@@ -246,6 +251,7 @@ int sdcard_write_file(const char* filename, const char* data, size_t size)
     
     size_t bytes_written = fwrite(data, 1, size, f);
     fclose(f);
+    s_generation++;
     
     ESP_LOGI(TAG, "Wrote %d bytes to %s", bytes_written, filename);
     return bytes_written;
@@ -266,10 +272,21 @@ esp_err_t sdcard_delete_file(const char* filename)
         return ESP_FAIL;
     }
     
+    s_generation++;
     ESP_LOGI(TAG, "Deleted file %s", filename);
     return ESP_OK;
 }
 
+uint32_t sdcard_get_generation(void)
+{
+    return s_generation;
+}
+
+void sdcard_mark_changed(void)
+{
+    s_generation++;
+}
+
 esp_err_t sdcard_list_files(const char* path, void (*callback)(const char* filename, uint8_t type, size_t size, void* user_data), void* user_data)
 {
     if (!g_sdcard_config.mounted) {
@@ -97,6 +97,22 @@ int sdcard_write_file(const char* filename, const char* data, size_t size);
  */
 esp_err_t sdcard_delete_file(const char* filename);
 
+/**
+ * @brief Get the change counter of the card's contents
+ * @return uint32_t Value that differs from any earlier one once the card was
+ *         mounted, unmounted or formatted, or a file was written or deleted
+ *         through this driver or reported with sdcard_mark_changed()
+ */
+uint32_t sdcard_get_generation(void);
+
+/**
+ * @brief Report a change made to the card without going through this driver
+ *
+ * Call after creating, writing, renaming or deleting files with stdio or
+ * unlink(), so caches keyed on sdcard_get_generation() are refreshed.
+ */
+void sdcard_mark_changed(void);
+
 /**
  * @brief List files in directory
  * @param path Directory path
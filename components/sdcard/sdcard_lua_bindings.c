@@ -1,5 +1,6 @@
 #include "sdcard_lua_bindings.h"
 #include "sdcard_driver.h"
+#include "lrotable.h"
 #include "esp_log.h"
 #include <string.h>
 #include <dirent.h> // Add this for DT_DIR and DT_REG
@@ -164,6 +165,14 @@ static int lua_sdcard_delete_file(lua_State *L)
     return 1;
 }
 
+// sdcard.mark_changed(): after creating or removing files with io or os
+static int lua_sdcard_mark_changed(lua_State *L)
+{
+    (void)L;
+    sdcard_mark_changed();
+    return 0;
+}
+
 // sdcard.list_files([path])
 static int lua_sdcard_list_files(lua_State *L)
 {
@@ -258,27 +267,25 @@ static int lua_sdcard_get_info(lua_State *L)
 }
 
 // SD card function table
-static const luaL_Reg sdcard_funcs[] = {
-    {"init", lua_sdcard_init},
-    {"mount", lua_sdcard_mount},
-    {"unmount", lua_sdcard_unmount},
-    {"is_mounted", lua_sdcard_is_mounted},
-    {"format", lua_sdcard_format},
-    {"read_file", lua_sdcard_read_file},
-    {"write_file", lua_sdcard_write_file},
-    {"delete_file", lua_sdcard_delete_file},
-    {"list_files", lua_sdcard_list_files},
-    {"get_usage", lua_sdcard_get_usage},
-    {"get_info", lua_sdcard_get_info},
-    {NULL, NULL}
+static const luaR_entry sdcard_map[] = {
+    LROT_FUNCENTRY(init, lua_sdcard_init),
+    LROT_FUNCENTRY(mount, lua_sdcard_mount),
+    LROT_FUNCENTRY(unmount, lua_sdcard_unmount),
+    LROT_FUNCENTRY(is_mounted, lua_sdcard_is_mounted),
+    LROT_FUNCENTRY(format, lua_sdcard_format),
+    LROT_FUNCENTRY(read_file, lua_sdcard_read_file),
+    LROT_FUNCENTRY(write_file, lua_sdcard_write_file),
+    LROT_FUNCENTRY(delete_file, lua_sdcard_delete_file),
+    LROT_FUNCENTRY(mark_changed, lua_sdcard_mark_changed),
+    LROT_FUNCENTRY(list_files, lua_sdcard_list_files),
+    LROT_FUNCENTRY(get_usage, lua_sdcard_get_usage),
+    LROT_FUNCENTRY(get_info, lua_sdcard_get_info),
+    LROT_END
 };
 
 // Register SD card module
 int luaopen_sdcard(lua_State *L)
 {
-    // Manually create the library table to bypass the luaL_checkversion call
-    // inside luaL_newlib, which is failing due to a build environment mismatch.
-    lua_createtable(L, 0, sizeof(sdcard_funcs) / sizeof(sdcard_funcs[0]) - 1);
-    luaL_setfuncs(L, sdcard_funcs, 0);
+    lua_pushlibmap(L, sdcard_map);
     return 1;
 }
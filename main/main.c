@@ -17,7 +17,12 @@
 #include "lvgl_helpers.h"
 #include "lvgl_internal_alloc.h"
 #include "lua_engine.h"
-#include "main_simple_lua.h"
+#include "lua_vm_task.h"
+#include "lua_event_loop.h"
+#include "lua_coro_pool.h"
+#include "lua_scheduler.h"
+#include "lua_timer_wheel.h"
+#include "lua_hot_reload.h"
 #include "system_bindings.h"
 #include "sdcard_driver.h" // Add sdcard driver header
 
@@ -96,7 +101,15 @@ void app_main() {
     
     uint32_t stack_size = 32768; // Set to 32KB to handle large initial script stack usage.
     ESP_LOGI(TAG, "Allocating %d bytes for GUI task stack", stack_size);
-    BaseType_t result = xTaskCreate(gui_task, "gui", stack_size, NULL, 5, NULL);
+#if CONFIG_LUA_VM_TASK
+    // Rendering gets the core the Lua task doesn't run on
+    BaseType_t result = xTaskCreatePinnedToCore(gui_task, "gui", stack_size, NULL, 5, NULL,
+                                                1 - CONFIG_LUA_VM_TASK_CORE);
+#else
+    // Pinned, away from WiFi on core 0: the callback budget's watchdog runs
+    // on the core of the task making Lua calls (lua_engine_call.c)
+    BaseType_t result = xTaskCreatePinnedToCore(gui_task, "gui", stack_size, NULL, 5, NULL, 1);
+#endif
     if (result != pdPASS) {
         ESP_LOGE(TAG, "Failed to create GUI task: %d", result);
     }
@@ -115,6 +128,149 @@ static lv_color_t *buf1 = NULL;
 static lv_color_t *buf2 = NULL;
 static lua_State* g_lua_state = NULL;
 
+// Creates the Lua state and runs the app: the state image, the app
+// partition, the SD card app, then the OOBE
+static bool load_lua_app(bool sdcard_mounted) {
+    ESP_LOGI(TAG, "Initializing Lua engine...");
+    g_lua_state = lua_engine_init();
+    if (g_lua_state == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize Lua engine");
+        return false;
+    }
+    
+    log_memory_usage("After Lua engine init");
+
+    bool app_loaded = false;
+    int image_result = -1;
+
+#if CONFIG_LUA_STATE_IMAGE
+    // A state saved with system.save_state() skips running the app's scripts
+    if (sdcard_mounted) {
+        image_result = lua_engine_exec_image(g_lua_state, CONFIG_LUA_STATE_IMAGE_PATH);
+        if (image_result == 0) {
+            ESP_LOGI(TAG, "Successfully restored app state image.");
+            app_loaded = true;
+        } else if (image_result != -1) {
+            // The state was partly restored; load the app the usual way on a clean one
+            ESP_LOGE(TAG, "Error restoring app state image. Error code: %d.", image_result);
+            lua_engine_deinit(g_lua_state);
+            g_lua_state = lua_engine_init();
+            if (g_lua_state == NULL) {
+                ESP_LOGE(TAG, "Failed to initialize Lua engine");
+                return false;
+            }
+            image_result = -1;
+        }
+    }
+#endif
+
+    // An app bundle flashed to the app partition (host/luapack -x) runs in place from flash
+    int partition_result = -1;
+    if (image_result == -1) {
+        partition_result = lua_engine_exec_bundle_partition(g_lua_state, CONFIG_LUA_APP_PARTITION);
+    }
+    if (partition_result == 0) {
+        ESP_LOGI(TAG, "Successfully executed app bundle from flash.");
+        app_loaded = true;
+    } else if (partition_result != -1) {
+        ESP_LOGE(TAG, "Error executing app bundle from flash. Error code: %d.", partition_result);
+    }
+
+    if (sdcard_mounted && image_result == -1 && partition_result == -1) {
+        // --- Preloading is now disabled. Modules will be loaded on-demand by Lua's `require`. ---
+        // const char* modules_to_preload[][2] = {
+        //     {"APP.main.gui_guider", "/sdcard/APP/main/gui_guider.lua"},
+        //     {"APP.main.events_init", "/sdcard/APP/main/events_init.lua"},
+        //     {"APP.main.setup_scr_main", "/sdcard/APP/main/setup_scr_main.lua"},
+        //     {"APP.main.setup_scr_WiFi", "/sdcard/APP/main/setup_scr_WiFi.lua"},
+        //     {"APP.main.setup_scr_wifi_password", "/sdcard/APP/main/setup_scr_wifi_password.lua"},
+        //     {"APP.main.setup_scr_Bluetooth", "/sdcard/APP/main/setup_scr_Bluetooth.lua"},
+        //     {"APP.main.setup_scr_Hotspot", "/sdcard/APP/main/setup_scr_Hotspot.lua"},
+        //     {"APP.main.widgets_init", "/sdcard/APP/main/widgets_init.lua"},
+        //     {NULL, NULL} // End of list
+        // };
+
+        // bool all_preloaded = true;
+        // for (int i = 0; modules_to_preload[i][0] != NULL; i++) {
+        //     if (!preload_module(g_lua_state, modules_to_preload[i][0], modules_to_preload[i][1])) {
+        //         all_preloaded = false;
+        //         break;
+        //     }
+        // }
+
+        // if (all_preloaded) {
+        // A packed app bundle (host/luapack) replaces the per-module files when present
+        const char *bundle_path = "/sdcard/APP/app.luapack";
+        int lua_result = lua_engine_exec_bundle(g_lua_state, bundle_path);
+        if (lua_result == 0) {
+            ESP_LOGI(TAG, "Successfully executed app bundle from SD card.");
+            app_loaded = true;
+        } else if (lua_result != -1) {
+            // The bundle opened but its entry failed; don't run the loose files on top of it
+            ESP_LOGE(TAG, "Error executing app bundle. Error code: %d.", lua_result);
+        } else {
+            const char *app_path = "/sdcard/APP/main/main.lua";
+            ESP_LOGI(TAG, "Executing main script with on-demand loading: %s", app_path);
+            lua_result = lua_engine_exec_file(g_lua_state, app_path);
+            if (lua_result == 0) {
+                ESP_LOGI(TAG, "Successfully executed app from SD card.");
+                app_loaded = true;
+            } else {
+                ESP_LOGE(TAG, "Error executing main Lua script. Error code: %d.", lua_result);
+            }
+        }
+        // } else {
+        //     ESP_LOGE(TAG, "Failed to preload one or more modules. Falling back to OOBE.");
+        // }
+    } else if (!sdcard_mounted) {
+        ESP_LOGW(TAG, "SD card not mounted, skipping app load.");
+    }
+
+    if (!app_loaded) {
+        ESP_LOGI(TAG, "App not loaded from SD card, falling back to OOBE.");
+        // Load and run OOBE Lua script
+        ESP_LOGI(TAG, "Loading OOBE Lua script...");
+        
+        // Try to load from file first
+        int lua_result = lua_engine_exec_file(g_lua_state, "/spiffs/oobe_lua.lua");
+        if (lua_result != 0) {
+            ESP_LOGW(TAG, "Failed to load OOBE from file, trying embedded script");
+            
+            // Load embedded OOBE script, precompiled at build time
+            extern const uint8_t oobe_lua_luac_start[] asm("_binary_oobe_lua_luac_start");
+            extern const uint8_t oobe_lua_luac_end[] asm("_binary_oobe_lua_luac_end");
+            const size_t oobe_lua_size = oobe_lua_luac_end - oobe_lua_luac_start;
+            
+            ESP_LOGI(TAG, "Embedded OOBE bytecode size: %zu bytes", oobe_lua_size);
+            
+            lua_result = lua_engine_exec_bytecode(g_lua_state, oobe_lua_luac_start, oobe_lua_size, "=oobe_lua");
+            if (lua_result != 0) {
+                ESP_LOGE(TAG, "Failed to load embedded OOBE script, falling back to demo");
+                run_lua_demo();
+            } else {
+                ESP_LOGI(TAG, "Embedded OOBE script loaded successfully");
+            }
+        } else {
+            ESP_LOGI(TAG, "OOBE Lua script loaded from file successfully");
+        }
+    }
+    
+    log_memory_usage("After loading Lua script");
+    return true;
+}
+
+#if CONFIG_LUA_VM_TASK
+static bool s_sdcard_mounted = false;
+
+// First thing the Lua task runs
+static void lua_task_main(void *arg) {
+    (void) arg;
+    if (load_lua_app(s_sdcard_mounted)) {
+        lua_vm_task_run(g_lua_state);
+    }
+}
+#endif
+
 static void gui_task(void *pvParameter) {
     (void) pvParameter;
     
@@ -189,96 +345,45 @@ static void gui_task(void *pvParameter) {
     lv_indev_drv_register(&indev_drv);
 #endif
 
-    ESP_LOGI(TAG, "Initializing Lua engine...");
-    g_lua_state = lua_engine_init();
-    if (g_lua_state == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize Lua engine");
+#if CONFIG_LUA_VM_TASK
+    // The app is loaded on the Lua task; this task carries out its LVGL calls
+    s_sdcard_mounted = sdcard_mounted;
+    bool lua_on_own_task = lua_vm_task_start(lua_task_main, NULL);
+#else
+    bool lua_on_own_task = false;
+#endif
+    if (!lua_on_own_task && !load_lua_app(sdcard_mounted)) {
         return;
     }
-    
-    log_memory_usage("After Lua engine init");
-
-    bool app_loaded = false;
-    if (sdcard_mounted) {
-        // --- Preloading is now disabled. Modules will be loaded on-demand by Lua's `require`. ---
-        // const char* modules_to_preload[][2] = {
-        //     {"APP.main.gui_guider", "/sdcard/APP/main/gui_guider.lua"},
-        //     {"APP.main.events_init", "/sdcard/APP/main/events_init.lua"},
-        //     {"APP.main.setup_scr_main", "/sdcard/APP/main/setup_scr_main.lua"},
-        //     {"APP.main.setup_scr_WiFi", "/sdcard/APP/main/setup_scr_WiFi.lua"},
-        //     {"APP.main.setup_scr_wifi_password", "/sdcard/APP/main/setup_scr_wifi_password.lua"},
-        //     {"APP.main.setup_scr_Bluetooth", "/sdcard/APP/main/setup_scr_Bluetooth.lua"},
-        //     {"APP.main.setup_scr_Hotspot", "/sdcard/APP/main/setup_scr_Hotspot.lua"},
-        //     {"APP.main.widgets_init", "/sdcard/APP/main/widgets_init.lua"},
-        //     {NULL, NULL} // End of list
-        // };
-
-        // bool all_preloaded = true;
-        // for (int i = 0; modules_to_preload[i][0] != NULL; i++) {
-        //     if (!preload_module(g_lua_state, modules_to_preload[i][0], modules_to_preload[i][1])) {
-        //         all_preloaded = false;
-        //         break;
-        //     }
-        // }
-
-        // if (all_preloaded) {
-        const char *app_path = "/sdcard/APP/main/main.lua";
-        ESP_LOGI(TAG, "Executing main script with on-demand loading: %s", app_path);
-        int lua_result = lua_engine_exec_file(g_lua_state, app_path);
-        if (lua_result == 0) {
-            ESP_LOGI(TAG, "Successfully executed app from SD card.");
-            app_loaded = true;
-        } else {
-            ESP_LOGE(TAG, "Error executing main Lua script. Error code: %d.", lua_result);
-        }
-        // } else {
-        //     ESP_LOGE(TAG, "Failed to preload one or more modules. Falling back to OOBE.");
-        // }
-    } else {
-        ESP_LOGW(TAG, "SD card not mounted, skipping app load.");
-    }
-
-    if (!app_loaded) {
-        ESP_LOGI(TAG, "App not loaded from SD card, falling back to OOBE.");
-        // Load and run OOBE Lua script
-        ESP_LOGI(TAG, "Loading OOBE Lua script...");
-        
-        // Try to load from file first
-        int lua_result = lua_engine_exec_file(g_lua_state, "/spiffs/oobe_lua.lua");
-        if (lua_result != 0) {
-            ESP_LOGW(TAG, "Failed to load OOBE from file, trying embedded script");
-            
-            // Load embedded OOBE script
-            extern const char oobe_lua_lua_start[] asm("_binary_oobe_lua_lua_start");
-            extern const char oobe_lua_lua_end[] asm("_binary_oobe_lua_lua_end");
-            const size_t oobe_lua_size = oobe_lua_lua_end - oobe_lua_lua_start;
-            
-            ESP_LOGI(TAG, "Embedded OOBE script size: %zu bytes", oobe_lua_size);
-            
-            lua_result = lua_engine_exec_string(g_lua_state, oobe_lua_lua_start);
-            if (lua_result != 0) {
-                ESP_LOGE(TAG, "Failed to load embedded OOBE script, falling back to demo");
-                run_lua_demo();
-            } else {
-                ESP_LOGI(TAG, "Embedded OOBE script loaded successfully");
-            }
-        } else {
-            ESP_LOGI(TAG, "OOBE Lua script loaded from file successfully");
-        }
-    }
-    
-    log_memory_usage("After loading Lua script");
     ESP_LOGI(TAG, "Application initialization completed");
     
     ESP_LOGI(TAG, "Entering main loop");
     uint32_t loop_count = 0;
     uint32_t last_log_time = 0;
+    uint32_t last_overruns = 0;
+    int32_t next_wake_ms = -1;
 
     while (1) {
         uint32_t start_time = esp_timer_get_time() / 1000;
         
-        vTaskDelay(pdMS_TO_TICKS(10));
+        // Shorter when a system.sleep() ends sooner, still a tick for the idle task
+        uint32_t wait_ms = 10;
+        if (next_wake_ms >= 0 && next_wake_ms < 10) {
+            wait_ms = next_wake_ms > 0 ? (uint32_t)next_wake_ms : 1;
+        }
+        lua_vm_task_gui_poll(wait_ms);
+        int64_t frame_start_us = esp_timer_get_time();
         lv_timer_handler();
+        lua_vm_task_note_frame((uint32_t)(esp_timer_get_time() - frame_start_us));
+        if (!lua_on_own_task) {
+            // Timer and WiFi callbacks queued since the last frame
+            lua_event_loop_drain(g_lua_state, CONFIG_LUA_EVENT_BUDGET_US);
+            // ...and system.spawn() tasks whose sleep or wait is over
+            next_wake_ms = lua_scheduler_run(g_lua_state, CONFIG_LUA_EVENT_BUDGET_US);
+            lua_engine_run_suspended(g_lua_state);
+            lua_engine_poll_memory(g_lua_state);
+            lua_hot_reload_poll(g_lua_state);
+        }
         
         loop_count++;
         
@@ -295,6 +400,57 @@ static void gui_task(void *pvParameter) {
                         total_alloc, psram_alloc, internal_alloc);
             }
             
+            lua_vm_task_stats_t vm_stats;
+            lua_vm_task_get_stats(&vm_stats);
+            ESP_LOGI(TAG, "Frames: %u, lv_timer_handler avg %u us, max %u us",
+                    (unsigned)vm_stats.frames, (unsigned)vm_stats.frame_us_avg, (unsigned)vm_stats.frame_us_max);
+            if (lua_on_own_task) {
+                ESP_LOGI(TAG, "Lua task: %u events (latency avg %u us, max %u us), %u dropped, queue high water %u; "
+                        "%u LVGL calls (max %u us)",
+                        (unsigned)vm_stats.jobs, (unsigned)vm_stats.job_latency_us_avg,
+                        (unsigned)vm_stats.job_latency_us_max, (unsigned)vm_stats.jobs_dropped,
+                        (unsigned)vm_stats.job_queue_high_water, (unsigned)vm_stats.ui_calls,
+                        (unsigned)vm_stats.ui_call_us_max);
+            }
+
+            lua_event_loop_stats_t event_stats;
+            lua_event_loop_get_stats(&event_stats);
+            ESP_LOGI(TAG, "Lua events: %u posted, %u run (latency avg %u us, max %u us), %u dropped, "
+                    "queued %u (high water %u), %u drains over budget (max %u us)",
+                    (unsigned)event_stats.posted, (unsigned)event_stats.handled,
+                    (unsigned)event_stats.latency_us_avg, (unsigned)event_stats.latency_us_max,
+                    (unsigned)event_stats.dropped, (unsigned)event_stats.depth,
+                    (unsigned)event_stats.depth_high_water, (unsigned)event_stats.deferred,
+                    (unsigned)event_stats.drain_us_max);
+            lua_coro_pool_stats_t pool_stats;
+            lua_coro_pool_get_stats(&pool_stats);
+            ESP_LOGI(TAG, "Lua callback coroutines: %u taken, %u new, %u reset, %u idle of %u",
+                    (unsigned)pool_stats.taken, (unsigned)pool_stats.created, (unsigned)pool_stats.reset,
+                    (unsigned)pool_stats.idle, (unsigned)pool_stats.size);
+            lua_scheduler_stats_t sched_stats;
+            lua_scheduler_get_stats(&sched_stats);
+            ESP_LOGI(TAG, "Lua tasks: %u spawned, %u blocked (high water %u), %u resumed, late avg %u us, max %u us",
+                    (unsigned)sched_stats.spawned, (unsigned)sched_stats.blocked,
+                    (unsigned)sched_stats.heap_high_water, (unsigned)sched_stats.resumed,
+                    (unsigned)sched_stats.late_us_avg, (unsigned)sched_stats.late_us_max);
+            lua_timer_wheel_stats_t timer_stats;
+            lua_timer_wheel_get_stats(&timer_stats);
+            ESP_LOGI(TAG, "Lua timers: %u running, %u wake-ups for %u expiries (batches up to %u), "
+                    "late avg %u us, max %u us",
+                    (unsigned)timer_stats.timers, (unsigned)timer_stats.wakeups, (unsigned)timer_stats.fired,
+                    (unsigned)timer_stats.batch_max, (unsigned)timer_stats.late_us_avg,
+                    (unsigned)timer_stats.late_us_max);
+
+            lua_engine_budget_stats_t budget_stats;
+            lua_engine_get_budget_stats(&budget_stats);
+            if (budget_stats.overruns != last_overruns) {
+                ESP_LOGW(TAG, "Lua callbacks over budget: %u (%u aborted, %u suspensions, %u suspended now)",
+                        (unsigned)budget_stats.overruns, (unsigned)budget_stats.aborted,
+                        (unsigned)budget_stats.suspended, (unsigned)budget_stats.pending);
+                lua_engine_log_budget_stats();
+                last_overruns = budget_stats.overruns;
+            }
+
             ESP_LOGI(TAG, "Task stack remaining: %d bytes", uxTaskGetStackHighWaterMark(NULL));
             last_log_time = start_time;
         }
@@ -318,7 +474,10 @@ void run_lua_demo(void)
     
             // Load and execute embedded simple demo script
     ESP_LOGI(TAG, "Loading embedded simple demo script...");
-    int result = lua_engine_exec_string(g_lua_state, main_simple_lua_script);
+    extern const uint8_t main_simple_luac_start[] asm("_binary_main_simple_luac_start");
+    extern const uint8_t main_simple_luac_end[] asm("_binary_main_simple_luac_end");
+    int result = lua_engine_exec_bytecode(g_lua_state, main_simple_luac_start,
+                                          main_simple_luac_end - main_simple_luac_start, "=main_simple");
     if (result != 0) {
         ESP_LOGE(TAG, "Failed to execute embedded Lua script");
         lua_engine_deinit(g_lua_state);
@@ -0,0 +1,66 @@
+print('=== ESP32-S3 LuaRTOS Demo ===')
+
+-- Test SD card if available
+if sdcard then
+    print('SD card module available')
+    local init_ok, init_err = sdcard.init()
+    if init_ok then
+        print('SD card initialized')
+        local mount_ok, mount_err = sdcard.mount()
+        if mount_ok then
+            print('SD card mounted successfully')
+            local test_data = 'Hello from ESP32-S3!\n' .. os.date()
+            local write_ok, write_size = sdcard.write_file('test.txt', test_data)
+            if write_ok then
+                print('Created test file: ' .. write_size .. ' bytes')
+            end
+        else
+            print('SD card mount failed: ' .. (mount_err or 'unknown'))
+        end
+    else
+        print('SD card init failed: ' .. (init_err or 'unknown'))
+    end
+else
+    print('SD card module not available')
+end
+
+-- Create simple LVGL interface
+print('Creating LVGL interface...')
+local scr = lvgl.scr_act()
+lvgl.obj_set_style_bg_color(scr, 0x001122, lvgl.PART_MAIN())
+
+-- Main title
+local title = lvgl.label_create(scr)
+lvgl.label_set_text(title, 'ESP32-S3 LuaRTOS')
+lvgl.obj_set_style_text_color(title, lvgl.color_white(), lvgl.PART_MAIN())
+lvgl.obj_align(title, lvgl.ALIGN_TOP_MID(), 0, 10)
+
+-- Status info
+local status = lvgl.label_create(scr)
+local status_text = 'Lua: Ready\nLVGL: Active'
+if sdcard and sdcard.is_mounted() then
+    status_text = status_text .. '\nSD Card: Mounted'
+else
+    status_text = status_text .. '\nSD Card: N/A'
+end
+lvgl.label_set_text(status, status_text)
+lvgl.obj_set_style_text_color(status, 0xaaaaaa, lvgl.PART_MAIN())
+lvgl.obj_align(status, lvgl.ALIGN_CENTER(), 0, -20)
+
+-- Demo button
+local btn = lvgl.btn_create(scr)
+lvgl.obj_set_size(btn, 120, 40)
+lvgl.obj_align(btn, lvgl.ALIGN_CENTER(), 0, 30)
+local btn_label = lvgl.label_create(btn)
+lvgl.label_set_text(btn_label, 'Demo')
+lvgl.obj_center(btn_label)
+
+-- Footer
+local footer = lvgl.label_create(scr)
+lvgl.label_set_text(footer, 'ESP32-S3 • ' .. os.date('%H:%M'))
+lvgl.obj_set_style_text_color(footer, 0x666666, lvgl.PART_MAIN())
+lvgl.obj_align(footer, lvgl.ALIGN_BOTTOM_MID(), 0, -10)
+
+-- Force refresh
+lvgl.obj_invalidate(scr)
+print('Demo ready!')
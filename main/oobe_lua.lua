@@ -196,22 +196,24 @@ local function create_sd_screen()
             -- Simple confirmation dialog
             print("User confirmed SD card format")
             
-            -- Simulate formatting process
-            lvgl.label_set_text(status_label, "SD Card Status: Formatting...")
-            lvgl.refr_now()
-            
-            -- Use FreeRTOS delay to simulate formatting process
-            system.sleep(2000)  -- 2 second delay
-            
-            oobe.sd_formatted = true
-            lvgl.label_set_text(status_label, "SD Card Status: Formatted, Available")
-            
-            -- Re-check and display actual capacity after formatting
-            check_sd_status()
-            
-            -- Delay to let user see the result
-            system.sleep(1000)
-            switch_to_screen(2)
+            -- Simulate formatting process; the sleeps below suspend this
+            -- task only, so the screen keeps refreshing meanwhile
+            system.spawn(function()
+                lvgl.label_set_text(status_label, "SD Card Status: Formatting...")
+                lvgl.refr_now()
+                
+                system.sleep(2000)  -- 2 second delay
+                
+                oobe.sd_formatted = true
+                lvgl.label_set_text(status_label, "SD Card Status: Formatted, Available")
+                
+                -- Re-check and display actual capacity after formatting
+                check_sd_status()
+                
+                -- Delay to let user see the result
+                system.sleep(1000)
+                switch_to_screen(2)
+            end)
         else
             switch_to_screen(2)
         end
@@ -339,37 +341,13 @@ local function create_wifi_screen()
     -- Robust WiFi scanning with retries
     local try_wifi_scan -- Forward declaration
 
-    try_wifi_scan = function(retries_left)
-        if retries_left <= 0 then
-            print("[WIFI_PAGE] Scan failed after multiple retries.")
-            lvgl.obj_clean(wifi_list)
-            lvgl.list_add_text(wifi_list, "Scan failed. Please refresh.")
-            return
-        end
-
-        print("[WIFI_PAGE] Attempting to scan... " .. retries_left .. " retries left.")
-        
-        local networks, err_msg = system.wifi_scan()
-        
-        if not networks then
-            print("[WIFI_PAGE] Scan attempt failed: " .. (err_msg or "Unknown error"))
-            -- Check if the error is a timeout error and retry
-            if err_msg and string.find(err_msg, "ESP_ERR_WIFI_TIMEOUT") then
-                print("[WIFI_PAGE] Timeout detected, retrying in 1 second...")
-                lvgl.obj_clean(wifi_list)
-                lvgl.list_add_text(wifi_list, "Scanning... (retrying)")
-                system.timer_create(1000, false, function()
-                    try_wifi_scan(retries_left - 1)
-                end)
-            else
-                -- For other errors, fail immediately
-                lvgl.obj_clean(wifi_list)
-                lvgl.list_add_text(wifi_list, "Scan failed: " .. (err_msg or "Unknown error"))
-            end
-            return
-        end
+    -- Scan results and retries come in later; by then the OOBE may be done
+    -- and this screen deleted, so they are dropped
+    local function wifi_list_gone()
+        return not lvgl.obj_is_valid(wifi_list)
+    end
 
-        -- Scan succeeded
+    local function show_networks(networks)
         lvgl.obj_clean(wifi_list)
         if #networks > 0 then
             print("[WIFI_PAGE] Scan successful, found " .. #networks .. " networks.")
@@ -388,6 +366,44 @@ local function create_wifi_screen()
         end
     end
 
+    try_wifi_scan = function(retries_left)
+        if wifi_list_gone() then
+            return
+        end
+        if retries_left <= 0 then
+            print("[WIFI_PAGE] Scan failed after multiple retries.")
+            lvgl.obj_clean(wifi_list)
+            lvgl.list_add_text(wifi_list, "Scan failed. Please refresh.")
+            return
+        end
+
+        print("[WIFI_PAGE] Attempting to scan... " .. retries_left .. " retries left.")
+
+        local function retry(err_msg)
+            print("[WIFI_PAGE] Scan attempt failed: " .. (err_msg or "Unknown error") .. ", retrying in 1 second...")
+            lvgl.obj_clean(wifi_list)
+            lvgl.list_add_text(wifi_list, "Scanning... (retrying)")
+            system.timer_create(1000, false, function()
+                try_wifi_scan(retries_left - 1)
+            end)
+        end
+
+        -- Returns right away; the list is filled in when the scan is done,
+        -- so the screen keeps refreshing meanwhile
+        local started, err_msg = system.wifi_scan(function(networks, scan_err)
+            if wifi_list_gone() then
+                print("[WIFI_PAGE] WiFi screen gone, scan result dropped.")
+            elseif networks then
+                show_networks(networks)
+            else
+                retry(scan_err)
+            end
+        end)
+        if not started then
+            retry(err_msg)
+        end
+    end
+
     -- Function to update the WiFi list, initiating the retry sequence
     function update_wifi_list()
         print("[WIFI_PAGE] Starting WiFi scan sequence...")
@@ -673,9 +689,12 @@ local function on_screen_enter(screen_index)
         -- Auto start installation when entering install screen
         local install_ui = oobe.ui.install
         if install_ui and install_ui.simulate_installation then
-            -- Start installation process after 500ms delay
-            system.sleep(500)
-            install_ui.simulate_installation()
+            -- Start installation process after 500ms delay, in a task of
+            -- its own since it sleeps between progress steps
+            system.spawn(function()
+                system.sleep(500)
+                install_ui.simulate_installation()
+            end)
         end
     end
 end